@@ -13,6 +13,7 @@
 #include "nrf_error.h"
 #include "nrf_esb.h"
 #include "nrf_esb_error_codes.h"
+#include "nrf_esb_fifo.h"
 #include "nrf_gpio.h"
 #include <string.h>
 #include <stddef.h>
@@ -34,6 +35,9 @@
 #define     NRF_ESB_INT_TX_SUCCESS_MSK          0x01        /**< Interrupt mask value for TX success. */
 #define     NRF_ESB_INT_TX_FAILED_MSK           0x02        /**< Interrupt mask value for TX failure. */
 #define     NRF_ESB_INT_RX_DATA_RECEIVED_MSK    0x04        /**< Interrupt mask value for RX_DR. */
+#define     NRF_ESB_INT_HOP_MSK                 0x08        /**< Interrupt mask value for a channel hop. */
+#define     NRF_ESB_INT_RX_OVERFLOW_MSK         0x10        /**< Interrupt mask value for an RX FIFO overflow. */
+#define     NRF_ESB_INT_HOP_DEADLINE_MSK        0x20        /**< Interrupt mask value for the deadline of a hop period. */
 
 #define     NRF_ESB_PID_RESET_VALUE             0xFF        /**< Invalid PID value which is guaranteed to not collide with any valid PID value. */
 #define     NRF_ESB_PID_MAX                     3           /**< Maximum value for PID. */
@@ -78,26 +82,6 @@ typedef struct
 } pipe_info_t;
 
 
-/* @brief  First-in, first-out queue of payloads to be transmitted. */
-typedef struct
-{
-    nrf_esb_payload_t * p_payload[NRF_ESB_TX_FIFO_SIZE];  /**< Pointer to the actual queue. */
-    uint32_t            entry_point;                      /**< Current start of queue. */
-    uint32_t            exit_point;                       /**< Current end of queue. */
-    uint32_t            count;                            /**< Current number of elements in the queue. */
-} nrf_esb_payload_tx_fifo_t;
-
-
-/* @brief First-in, first-out queue of received payloads. */
-typedef struct
-{
-    nrf_esb_payload_t * p_payload[NRF_ESB_RX_FIFO_SIZE];  /**< Pointer to the actual queue. */
-    uint32_t            entry_point;                      /**< Current start of queue. */
-    uint32_t            exit_point;                       /**< Current end of queue. */
-    uint32_t            count;                            /**< Current number of elements in the queue. */
-} nrf_esb_payload_rx_fifo_t;
-
-
 /**@brief Enhanced ShockBurst address.
  *
  * Enhanced ShockBurst addresses consist of a base address and a prefix
@@ -129,17 +113,27 @@ static nrf_esb_address_t            m_esb_addr = NRF_ESB_ADDR_DEFAULT;
 // RF parameters
 static nrf_esb_config_t             m_config_local;
 
-// TX FIFO
+// TX FIFO. Produced by the application, consumed by the radio interrupt.
 static nrf_esb_payload_t            m_tx_fifo_payload[NRF_ESB_TX_FIFO_SIZE];
-static nrf_esb_payload_tx_fifo_t    m_tx_fifo;
+static nrf_esb_fifo_t               m_tx_fifo;
 
-// RX FIFO
+// RX FIFO. Produced by the radio interrupt, consumed by the application. With
+// NRF_ESB_RX_OVERFLOW_DROP_OLDEST the radio interrupt also discards from it, so the application
+// releases slots with rx_fifo_release.
 static nrf_esb_payload_t            m_rx_fifo_payload[NRF_ESB_RX_FIFO_SIZE];
-static nrf_esb_payload_rx_fifo_t    m_rx_fifo;
+static nrf_esb_fifo_t               m_rx_fifo;
+static uint32_t                     m_rx_borrow_pos;        /**< Position of the payload returned by nrf_esb_borrow_rx_payload. */
 
-// Payload buffers
-static  uint8_t                     m_tx_payload_buffer[NRF_ESB_MAX_PAYLOAD_LENGTH + 2];
-static  uint8_t                     m_rx_payload_buffer[NRF_ESB_MAX_PAYLOAD_LENGTH + 2];
+STATIC_ASSERT(IS_POWER_OF_TWO(NRF_ESB_TX_FIFO_SIZE));
+STATIC_ASSERT(IS_POWER_OF_TWO(NRF_ESB_RX_FIFO_SIZE));
+
+// Packet buffers. The radio works directly on the FIFO slots; these are only used for an empty
+// acknowledgment and for a reception while the RX FIFO is full.
+static  uint8_t                     m_ack_header[2];
+static  uint8_t                     m_rx_overflow_buffer[NRF_ESB_MAX_PAYLOAD_LENGTH + 2];
+static  uint8_t                   * mp_rx_packet;
+
+STATIC_ASSERT(offsetof(nrf_esb_payload_t, data) == offsetof(nrf_esb_payload_t, rf_header) + 2);
 
 // Run time variables
 static volatile uint32_t            m_interrupt_flags = 0;
@@ -148,6 +142,42 @@ static pipe_info_t                  m_rx_pipe_info[NRF_ESB_PIPE_COUNT];
 static volatile uint32_t            m_retransmits_remaining;
 static volatile uint32_t            m_last_tx_attempts;
 static volatile uint32_t            m_wait_for_ack_timeout_us;
+static uint16_t                     m_rx_end_ticks;
+static bool                         m_rx_end_ticks_valid;
+static volatile uint16_t            m_tx_timestamp;         /**< Address time of the last transmission. */
+static volatile uint16_t            m_rx_timestamp;         /**< Address time of the last received packet. */
+
+// Channel hop sequencer
+static uint8_t                      m_hop_channels[NRF_ESB_HOP_MAX_CHANNELS];
+static uint8_t                      m_hop_count;            /**< Number of channels in the sequence, 0 if the sequencer is stopped. */
+static uint16_t                     m_hop_period_us;
+static volatile uint8_t             m_hop_index;            /**< Index selected by the sequencer. */
+static volatile uint8_t             m_rf_hop_index;         /**< Index of the channel the radio is tuned to. */
+static volatile uint8_t             m_rx_hop_index;         /**< Index of the channel of the last received packet. */
+static volatile bool                m_hop_pending;          /**< A hop is waiting for the end of a packet or transaction. */
+static uint16_t                     m_hop_deadline_us;      /**< Deadline after every hop, 0 if there is none. */
+static volatile bool                m_hop_deadline_armed;   /**< The deadline of the current hop period is still to come. */
+
+// RSSI survey. Runs at the radio interrupt priority, from the hop timer and radio interrupts.
+static uint8_t                      m_survey_channels[NRF_ESB_SURVEY_MAX_CHANNELS];
+static uint16_t                     m_survey_levels[NRF_ESB_SURVEY_MAX_CHANNELS];   /**< Noise level estimates, in 1/16 -dBm. */
+static uint16_t                     m_survey_samples[NRF_ESB_SURVEY_MAX_CHANNELS];
+static uint8_t                      m_survey_count;         /**< Number of channels in the survey table. */
+static volatile bool                m_survey_running;
+static uint8_t                      m_survey_per_hop;
+static uint8_t                      m_survey_pos;           /**< Index of the next channel to sample. */
+static uint8_t                      m_survey_left;          /**< Samples left in the current hop period. */
+static bool                         m_survey_sampling;      /**< The radio is tuned to m_survey_channels[m_survey_pos]. */
+
+// Link statistics. They are only written by RADIO_IRQHandler, which makes m_stats_seq odd while
+// it runs, so that nrf_esb_get_pipe_stats can detect and retry a torn copy.
+static nrf_esb_pipe_stats_t         m_pipe_stats[NRF_ESB_PIPE_COUNT];
+static volatile uint32_t            m_stats_seq;
+
+// RX FIFO overflows. The total is only written by RADIO_IRQHandler, the reported count only by
+// ESB_EVT_IRQHandler.
+static volatile uint32_t            m_rx_overflows;
+static uint32_t                     m_rx_overflows_reported;
 
 // These function pointers are changed dynamically, depending on protocol configuration and state.
 static void (*on_radio_disabled)(void) = 0;
@@ -161,6 +191,7 @@ static void on_radio_disabled_tx(void);
 static void on_radio_disabled_tx_wait_for_ack(void);
 static void on_radio_disabled_rx(void);
 static void on_radio_disabled_rx_ack(void);
+static void on_radio_disabled_rx_retune(void);
 
 
 #define NRF_ESB_ADDR_UPDATE_MASK_BASE0          (1 << 0)    /*< Mask value to signal updating BASE0 radio address. */
@@ -326,55 +357,100 @@ static void update_radio_parameters()
 }
 
 
-static void reset_fifos()
+static void initialize_fifos()
 {
-    m_tx_fifo.entry_point = 0;
-    m_tx_fifo.exit_point  = 0;
-    m_tx_fifo.count       = 0;
-
-    m_rx_fifo.entry_point = 0;
-    m_rx_fifo.exit_point  = 0;
-    m_rx_fifo.count       = 0;
+    nrf_esb_fifo_init(&m_tx_fifo, m_tx_fifo_payload, NRF_ESB_TX_FIFO_SIZE);
+    nrf_esb_fifo_init(&m_rx_fifo, m_rx_fifo_payload, NRF_ESB_RX_FIFO_SIZE);
 }
 
 
-static void initialize_fifos()
+static void tx_fifo_remove_last()
 {
-    reset_fifos();
-
-    for (int i = 0; i < NRF_ESB_TX_FIFO_SIZE; i++)
+    if (nrf_esb_fifo_length(&m_tx_fifo) > 0)
     {
-        m_tx_fifo.p_payload[i] = &m_tx_fifo_payload[i];
+        nrf_esb_fifo_release(&m_tx_fifo, 1);
     }
+}
 
-    for (int i = 0; i < NRF_ESB_RX_FIFO_SIZE; i++)
+/** @brief  Function to point the radio at the buffer for the next received packet.
+ *
+ *  The packet is received directly into the next free slot of the RX FIFO. If the RX FIFO is
+ *  full, the overflow buffer is used instead.
+ */
+static void rx_packet_arm(void)
+{
+    if (!nrf_esb_fifo_is_full(&m_rx_fifo))
+    {
+        mp_rx_packet = nrf_esb_fifo_write_slot(&m_rx_fifo, 0)->rf_header;
+    }
+    else
     {
-        m_rx_fifo.p_payload[i] = &m_rx_fifo_payload[i];
+        mp_rx_packet = m_rx_overflow_buffer;
     }
+
+    NRF_RADIO->PACKETPTR = (uint32_t)mp_rx_packet;
+
+    // The hop sequencer only retunes the receiver while no address has been matched
+    NRF_RADIO->EVENTS_ADDRESS = 0;
 }
 
 
-static void tx_fifo_remove_last()
+/** @brief  Function to tune the radio to the current channel.
+ *
+ *  The radio samples NRF_RADIO->FREQUENCY when ramping up, so the channel takes effect with
+ *  the next TXEN or RXEN.
+ */
+static void update_radio_frequency(void)
 {
-    if (m_tx_fifo.count > 0)
-    {
-        DISABLE_RF_IRQ();
+    NRF_RADIO->FREQUENCY = m_esb_addr.rf_channel;
+    m_rf_hop_index = m_hop_index;
+    m_hop_pending = false;
+}
 
-        m_tx_fifo.count--;
-        if (++m_tx_fifo.exit_point >= NRF_ESB_TX_FIFO_SIZE)
-        {
-            m_tx_fifo.exit_point = 0;
-        }
+/**@brief Function for recording that a received packet found the RX FIFO full. */
+static void rx_fifo_overflow(uint8_t pipe)
+{
+    m_pipe_stats[pipe].rx_fifo_full_drops++;
+    m_rx_overflows++;
+    m_interrupt_flags |= NRF_ESB_INT_RX_OVERFLOW_MSK;
+    NVIC_SetPendingIRQ(ESB_EVT_IRQ);
+}
+
+
+/**@brief Function for releasing RX FIFO slots read by the application from position @p pos.
+ *
+ * @details Only NRF_ESB_RX_OVERFLOW_DROP_OLDEST lets the radio interrupt write the read position,
+ *          so only that policy holds the interrupt off. The other policies release lock-free.
+ *
+ * @return  Number of the slots that the radio interrupt discarded while they were read.
+ */
+static uint32_t rx_fifo_release(uint32_t pos, uint32_t count)
+{
+    uint32_t discarded;
 
-        ENABLE_RF_IRQ();
+    if (m_config_local.rx_overflow != NRF_ESB_RX_OVERFLOW_DROP_OLDEST)
+    {
+        nrf_esb_fifo_release(&m_rx_fifo, count);
+        return 0;
     }
+
+    DISABLE_RF_IRQ();
+
+    discarded = nrf_esb_fifo_release_from(&m_rx_fifo, pos, count);
+
+    ENABLE_RF_IRQ();
+
+    return discarded;
 }
 
-/** @brief  Function to push the content of the rx_buffer to the RX FIFO.
+
+/** @brief  Function to push the received packet to the RX FIFO.
  *
- *  The module will point the register NRF_RADIO->PACKETPTR to a buffer for receiving packets.
- *  After receiving a packet the module will call this function to copy the received data to
- *  the RX FIFO.
+ *  The module points the register NRF_RADIO->PACKETPTR to the next free RX FIFO slot with
+ *  @ref rx_packet_arm. After receiving a packet the module will call this function to commit
+ *  the slot. The packet is only copied if it was received into the overflow buffer, or if the
+ *  FIFO was flushed while the radio was receiving. If the RX FIFO is full, the configured
+ *  overflow policy decides whether the oldest payload makes room for the packet.
  *
  *  @param  pipe Pipe number to set for the packet.
  *  @param  pid  Packet ID.
@@ -384,43 +460,75 @@ static void tx_fifo_remove_last()
  */
 static bool rx_fifo_push_rfbuf(uint8_t pipe, uint8_t pid)
 {
-    if (m_rx_fifo.count < NRF_ESB_RX_FIFO_SIZE)
-    {
-        if (m_config_local.protocol == NRF_ESB_PROTOCOL_ESB_DPL)
-        {
-            if (m_rx_payload_buffer[0] > NRF_ESB_MAX_PAYLOAD_LENGTH)
-            {
-                return false;
-            }
+    nrf_esb_payload_t * p_slot;
+    uint8_t             length;
 
-            m_rx_fifo.p_payload[m_rx_fifo.entry_point]->length = m_rx_payload_buffer[0];
-        }
-        else if (m_config_local.mode == NRF_ESB_MODE_PTX)
-        {
-            // Received packet is an acknowledgment
-            m_rx_fifo.p_payload[m_rx_fifo.entry_point]->length = 0;
-        }
-        else
+    if (m_config_local.protocol == NRF_ESB_PROTOCOL_ESB_DPL)
+    {
+        if (mp_rx_packet[0] > NRF_ESB_MAX_PAYLOAD_LENGTH)
         {
-            m_rx_fifo.p_payload[m_rx_fifo.entry_point]->length = m_config_local.payload_length;
+            return false;
         }
 
-        memcpy(m_rx_fifo.p_payload[m_rx_fifo.entry_point]->data, &m_rx_payload_buffer[2],
-               m_rx_fifo.p_payload[m_rx_fifo.entry_point]->length);
+        length = mp_rx_packet[0];
+    }
+    else if (m_config_local.mode == NRF_ESB_MODE_PTX)
+    {
+        // Received packet is an acknowledgment
+        length = 0;
+    }
+    else
+    {
+        length = m_config_local.payload_length;
+    }
+
+    if (nrf_esb_fifo_is_full(&m_rx_fifo))
+    {
+        rx_fifo_overflow(pipe);
 
-        m_rx_fifo.p_payload[m_rx_fifo.entry_point]->pipe = pipe;
-        m_rx_fifo.p_payload[m_rx_fifo.entry_point]->rssi = NRF_RADIO->RSSISAMPLE;
-        m_rx_fifo.p_payload[m_rx_fifo.entry_point]->pid = pid;
-        if (++m_rx_fifo.entry_point >= NRF_ESB_RX_FIFO_SIZE)
+        if (m_config_local.rx_overflow != NRF_ESB_RX_OVERFLOW_DROP_OLDEST)
         {
-            m_rx_fifo.entry_point = 0;
+            return false;
         }
-        m_rx_fifo.count++;
 
-        return true;
+        // The oldest slot becomes the write slot. The packet is in the overflow buffer.
+        nrf_esb_fifo_discard_oldest(&m_rx_fifo);
+    }
+
+    p_slot = nrf_esb_fifo_write_slot(&m_rx_fifo, 0);
+    p_slot->length = length;
+
+    if (mp_rx_packet != p_slot->rf_header)
+    {
+        memcpy(p_slot->rf_header, mp_rx_packet, p_slot->length + 2);
+    }
+
+    p_slot->pipe = pipe;
+    p_slot->rssi = NRF_RADIO->RSSISAMPLE;
+    p_slot->pid = pid;
+    p_slot->hop_index = m_rf_hop_index;
+    p_slot->timestamp = (uint16_t)NRF_ESB_HOP_TIMER->CC[1];
+    m_rx_hop_index = m_rf_hop_index;
+    m_rx_timestamp = p_slot->timestamp;
+    nrf_esb_fifo_commit(&m_rx_fifo, 1);
+
+    return true;
+}
+
+
+/**@brief Function for adding the RSSI sample of the last packet to the histogram of a pipe. */
+static void pipe_stats_rssi_add(uint8_t pipe)
+{
+    uint32_t bucket = NRF_RADIO->RSSISAMPLE;
+
+    bucket = (bucket > NRF_ESB_RSSI_HIST_FIRST_DBM) ?
+             (bucket - NRF_ESB_RSSI_HIST_FIRST_DBM) / NRF_ESB_RSSI_HIST_STEP_DBM : 0;
+    if (bucket >= NRF_ESB_RSSI_HIST_BUCKETS)
+    {
+        bucket = NRF_ESB_RSSI_HIST_BUCKETS - 1;
     }
 
-    return false;
+    m_pipe_stats[pipe].rssi_histogram[bucket]++;
 }
 
 
@@ -433,6 +541,20 @@ static void sys_timer_init()
 }
 
 
+static void hop_timer_init()
+{
+    // The hop timer runs for as long as the module is initialized, it is the time base of
+    // the packet timestamps. nrf_esb_hop_start() makes it restart at every hop.
+    NRF_ESB_HOP_TIMER->TASKS_STOP = 1;
+    NRF_ESB_HOP_TIMER->MODE      = TIMER_MODE_MODE_Timer;
+    NRF_ESB_HOP_TIMER->PRESCALER = 4;
+    NRF_ESB_HOP_TIMER->BITMODE   = TIMER_BITMODE_BITMODE_16Bit;
+    NRF_ESB_HOP_TIMER->SHORTS    = 0;
+    NRF_ESB_HOP_TIMER->TASKS_CLEAR = 1;
+    NRF_ESB_HOP_TIMER->TASKS_START = 1;
+}
+
+
 static void ppi_init()
 {
     NRF_PPI->CH[NRF_ESB_PPI_TIMER_START].EEP = (uint32_t)&NRF_RADIO->EVENTS_READY;
@@ -446,25 +568,31 @@ static void ppi_init()
 
     NRF_PPI->CH[NRF_ESB_PPI_TX_START].EEP    = (uint32_t)&NRF_ESB_SYS_TIMER->EVENTS_COMPARE[1];
     NRF_PPI->CH[NRF_ESB_PPI_TX_START].TEP    = (uint32_t)&NRF_RADIO->TASKS_TXEN;
+
+    NRF_PPI->CH[NRF_ESB_PPI_RX_TIMESTAMP].EEP = (uint32_t)&NRF_RADIO->EVENTS_END;
+    NRF_PPI->CH[NRF_ESB_PPI_RX_TIMESTAMP].TEP = (uint32_t)&NRF_ESB_SYS_TIMER->TASKS_CAPTURE[2];
+
+    NRF_PPI->CH[NRF_ESB_PPI_ADDRESS_TIMESTAMP].EEP = (uint32_t)&NRF_RADIO->EVENTS_ADDRESS;
+    NRF_PPI->CH[NRF_ESB_PPI_ADDRESS_TIMESTAMP].TEP = (uint32_t)&NRF_ESB_HOP_TIMER->TASKS_CAPTURE[1];
+    NRF_PPI->CHENSET = (1 << NRF_ESB_PPI_ADDRESS_TIMESTAMP);
 }
 
 
-static void start_tx_transaction()
+static void tx_transaction_prepare()
 {
     bool ack;
 
     m_last_tx_attempts = 1;
     // Prepare the payload
-    mp_current_payload = m_tx_fifo.p_payload[m_tx_fifo.exit_point];
+    mp_current_payload = nrf_esb_fifo_read_slot(&m_tx_fifo, 0);
 
 
     switch (m_config_local.protocol)
     {
         case NRF_ESB_PROTOCOL_ESB:
             update_rf_payload_format(mp_current_payload->length);
-            m_tx_payload_buffer[0] = mp_current_payload->pid;
-            m_tx_payload_buffer[1] = 0;
-            memcpy(&m_tx_payload_buffer[2], mp_current_payload->data, mp_current_payload->length);
+            mp_current_payload->rf_header[0] = mp_current_payload->pid;
+            mp_current_payload->rf_header[1] = 0;
 
             NRF_RADIO->SHORTS   = RADIO_SHORTS_COMMON | RADIO_SHORTS_DISABLED_RXEN_Msk;
             NRF_RADIO->INTENSET = RADIO_INTENSET_DISABLED_Msk | RADIO_INTENSET_READY_Msk;
@@ -477,10 +605,9 @@ static void start_tx_transaction()
 
         case NRF_ESB_PROTOCOL_ESB_DPL:
             ack = !mp_current_payload->noack || !m_config_local.selective_auto_ack;
-            m_tx_payload_buffer[0] = mp_current_payload->length;
-            m_tx_payload_buffer[1] = mp_current_payload->pid << 1;
-            m_tx_payload_buffer[1] |= ack ? 0x00 : 0x01;
-            memcpy(&m_tx_payload_buffer[2], mp_current_payload->data, mp_current_payload->length);
+            mp_current_payload->rf_header[0] = mp_current_payload->length;
+            mp_current_payload->rf_header[1] = mp_current_payload->pid << 1;
+            mp_current_payload->rf_header[1] |= ack ? 0x00 : 0x01;
 
             // Handling ack if noack is set to false or if selective auto ack is turned off
             if (ack)
@@ -510,8 +637,8 @@ static void start_tx_transaction()
     NRF_RADIO->TXADDRESS    = mp_current_payload->pipe;
     NRF_RADIO->RXADDRESSES  = 1 << mp_current_payload->pipe;
 
-    NRF_RADIO->FREQUENCY    = m_esb_addr.rf_channel;
-    NRF_RADIO->PACKETPTR    = (uint32_t)m_tx_payload_buffer;
+    update_radio_frequency();
+    NRF_RADIO->PACKETPTR    = (uint32_t)mp_current_payload->rf_header;
 
     NVIC_ClearPendingIRQ(RADIO_IRQn);
     NVIC_EnableIRQ(RADIO_IRQn);
@@ -520,6 +647,19 @@ static void start_tx_transaction()
     NRF_RADIO->EVENTS_PAYLOAD = 0;
     NRF_RADIO->EVENTS_DISABLED = 0;
 
+    // The transmission restarts the system timer, the receive timestamp is no longer valid
+    m_rx_end_ticks_valid = false;
+}
+
+
+static void start_tx_transaction()
+{
+    tx_transaction_prepare();
+
+    // The system timer may still be running freely from the last reception
+    NRF_ESB_SYS_TIMER->TASKS_STOP = 1;
+    NRF_ESB_SYS_TIMER->SHORTS     = TIMER_SHORTS_COMPARE1_CLEAR_Msk | TIMER_SHORTS_COMPARE1_STOP_Msk;
+
     DEBUG_PIN_SET(DEBUGPIN4);
     NRF_RADIO->TASKS_TXEN  = 1;
 }
@@ -527,10 +667,13 @@ static void start_tx_transaction()
 
 static void on_radio_disabled_tx_noack()
 {
+    NRF_PPI->CHENCLR = (1 << NRF_ESB_PPI_TX_START);
     m_interrupt_flags |= NRF_ESB_INT_TX_SUCCESS_MSK;
+    m_pipe_stats[mp_current_payload->pipe].tx_attempts++;
+    m_tx_timestamp = (uint16_t)NRF_ESB_HOP_TIMER->CC[1];
     tx_fifo_remove_last();
 
-    if (m_tx_fifo.count == 0)
+    if (nrf_esb_fifo_length(&m_tx_fifo) == 0)
     {
         m_nrf_esb_mainstate = NRF_ESB_STATE_IDLE;
         NVIC_SetPendingIRQ(ESB_EVT_IRQ);
@@ -545,6 +688,9 @@ static void on_radio_disabled_tx_noack()
 
 static void on_radio_disabled_tx()
 {
+    // The address of the acknowledgment overwrites the capture
+    m_tx_timestamp = (uint16_t)NRF_ESB_HOP_TIMER->CC[1];
+
     // Remove the DISABLED -> RXEN shortcut, to make sure the radio stays
     // disabled after the RX window
     NRF_RADIO->SHORTS           = RADIO_SHORTS_COMMON;
@@ -569,7 +715,7 @@ static void on_radio_disabled_tx()
         update_rf_payload_format(0);
     }
 
-    NRF_RADIO->PACKETPTR        = (uint32_t)m_rx_payload_buffer;
+    rx_packet_arm();
     on_radio_disabled           = on_radio_disabled_tx_wait_for_ack;
     m_nrf_esb_mainstate         = NRF_ESB_STATE_PTX_RX_ACK;
 }
@@ -591,10 +737,13 @@ static void on_radio_disabled_tx_wait_for_ack()
         NRF_PPI->CHENCLR = (1 << NRF_ESB_PPI_TX_START);
         m_interrupt_flags |= NRF_ESB_INT_TX_SUCCESS_MSK;
         m_last_tx_attempts = m_config_local.retransmit_count - m_retransmits_remaining + 1;
+        m_pipe_stats[mp_current_payload->pipe].tx_attempts += m_last_tx_attempts;
+        m_pipe_stats[mp_current_payload->pipe].rx_packets++;
+        pipe_stats_rssi_add(mp_current_payload->pipe);
 
         tx_fifo_remove_last();
 
-        if (m_config_local.protocol != NRF_ESB_PROTOCOL_ESB && m_rx_payload_buffer[0] > 0)
+        if (m_config_local.protocol != NRF_ESB_PROTOCOL_ESB && mp_rx_packet[0] > 0)
         {
             if (rx_fifo_push_rfbuf((uint8_t)NRF_RADIO->TXADDRESS, 0))
             {
@@ -602,7 +751,7 @@ static void on_radio_disabled_tx_wait_for_ack()
             }
         }
 
-        if ((m_tx_fifo.count == 0) || (m_config_local.tx_mode == NRF_ESB_TXMODE_MANUAL))
+        if ((nrf_esb_fifo_length(&m_tx_fifo) == 0) || (m_config_local.tx_mode == NRF_ESB_TXMODE_MANUAL))
         {
             m_nrf_esb_mainstate = NRF_ESB_STATE_IDLE;
             NVIC_SetPendingIRQ(ESB_EVT_IRQ);
@@ -615,6 +764,12 @@ static void on_radio_disabled_tx_wait_for_ack()
     }
     else
     {
+        if (NRF_RADIO->EVENTS_END)
+        {
+            m_pipe_stats[mp_current_payload->pipe].rx_crc_failures++;
+            pipe_stats_rssi_add(mp_current_payload->pipe);
+        }
+
         if (m_retransmits_remaining-- == 0)
         {
             NRF_ESB_SYS_TIMER->TASKS_STOP = 1;
@@ -622,6 +777,8 @@ static void on_radio_disabled_tx_wait_for_ack()
             // All retransmits are expended, and the TX operation is suspended
             m_last_tx_attempts = m_config_local.retransmit_count + 1;
             m_interrupt_flags |= NRF_ESB_INT_TX_FAILED_MSK;
+            m_pipe_stats[mp_current_payload->pipe].tx_attempts += m_last_tx_attempts;
+            m_pipe_stats[mp_current_payload->pipe].tx_failures++;
 
             m_nrf_esb_mainstate = NRF_ESB_STATE_IDLE;
             NVIC_SetPendingIRQ(ESB_EVT_IRQ);
@@ -632,7 +789,7 @@ static void on_radio_disabled_tx_wait_for_ack()
             // entered again as soon as the system timer reaches CC[1].
             NRF_RADIO->SHORTS = RADIO_SHORTS_COMMON | RADIO_SHORTS_DISABLED_RXEN_Msk;
             update_rf_payload_format(mp_current_payload->length);
-            NRF_RADIO->PACKETPTR = (uint32_t)m_tx_payload_buffer;
+            NRF_RADIO->PACKETPTR = (uint32_t)mp_current_payload->rf_header;
             on_radio_disabled = on_radio_disabled_tx;
             m_nrf_esb_mainstate = NRF_ESB_STATE_PTX_TX_ACK;
             NRF_ESB_SYS_TIMER->TASKS_START = 1;
@@ -649,7 +806,7 @@ static void clear_events_restart_rx(void)
 {
     NRF_RADIO->SHORTS = RADIO_SHORTS_COMMON;
     update_rf_payload_format(m_config_local.payload_length);
-    NRF_RADIO->PACKETPTR = (uint32_t)m_rx_payload_buffer;
+    rx_packet_arm();
     NRF_RADIO->EVENTS_DISABLED = 0;
     NRF_RADIO->TASKS_DISABLE = 1;
 
@@ -657,41 +814,261 @@ static void clear_events_restart_rx(void)
 
     NRF_RADIO->EVENTS_DISABLED = 0;
     NRF_RADIO->SHORTS = RADIO_SHORTS_COMMON | RADIO_SHORTS_DISABLED_TXEN_Msk;
+    update_radio_frequency();
     NRF_RADIO->TASKS_RXEN = 1;
 }
 
+
+/**@brief Function for ending the sampling of a survey channel, if any. */
+static void survey_cancel(void)
+{
+    m_survey_sampling = false;
+    m_survey_left = 0;
+    NRF_RADIO->INTENCLR = RADIO_INTENCLR_READY_Msk | RADIO_INTENCLR_RSSIEND_Msk;
+}
+
+
+static void hop_retune_rx(void)
+{
+    survey_cancel();
+
+    // Disable the receiver and let the DISABLED -> RXEN shortcut ramp it up on the new channel
+    NRF_RADIO->SHORTS = RADIO_SHORTS_COMMON | RADIO_SHORTS_DISABLED_RXEN_Msk;
+    on_radio_disabled = on_radio_disabled_rx_retune;
+    update_radio_frequency();
+    NRF_RADIO->TASKS_DISABLE = 1;
+}
+
+
+static void on_radio_disabled_rx_retune(void)
+{
+    NRF_RADIO->SHORTS = RADIO_SHORTS_COMMON | RADIO_SHORTS_DISABLED_TXEN_Msk;
+    rx_packet_arm();
+    on_radio_disabled = on_radio_disabled_rx;
+}
+
+
+/**@brief Function for checking that the receiver listens, with no packet on air. */
+static bool rx_listening(void)
+{
+    uint32_t radio_state = NRF_RADIO->STATE;
+
+    return m_nrf_esb_mainstate == NRF_ESB_STATE_PRX && NRF_RADIO->EVENTS_ADDRESS == 0 &&
+           (radio_state == RADIO_STATE_STATE_RxRu ||
+            radio_state == RADIO_STATE_STATE_RxIdle ||
+            radio_state == RADIO_STATE_STATE_Rx);
+}
+
+
+/**@brief Function for moving the radio to the channel selected by the hop sequencer.
+ *
+ * Runs at the radio interrupt priority, so it never interrupts the radio state handlers.
+ */
+static void hop_apply(void)
+{
+    m_hop_pending = true;
+
+    if ((m_nrf_esb_mainstate == NRF_ESB_STATE_IDLE || m_nrf_esb_mainstate == NRF_ESB_STATE_PRX) &&
+        NRF_RADIO->STATE == RADIO_STATE_STATE_Disabled)
+    {
+        // The next ramp-up uses the new channel
+        update_radio_frequency();
+    }
+    else if (rx_listening())
+    {
+        // Also ends a survey sample
+        hop_retune_rx();
+    }
+
+    // Otherwise a packet is on air. The next transaction or the restart of the receiver
+    // picks up the channel.
+}
+
+
+/**@brief Function for tuning the receiver to the next survey channel, or back to the hop sequence. */
+static void survey_next(void)
+{
+    if (m_survey_left == 0 || !m_survey_running)
+    {
+        hop_retune_rx();
+        return;
+    }
+
+    m_survey_left--;
+    m_survey_sampling = true;
+
+    // Retune like a hop. Until the receiver is back, any packet end or hop retunes it.
+    NRF_RADIO->SHORTS        = RADIO_SHORTS_COMMON | RADIO_SHORTS_DISABLED_RXEN_Msk;
+    on_radio_disabled        = on_radio_disabled_rx_retune;
+    NRF_RADIO->FREQUENCY     = m_survey_channels[m_survey_pos];
+    m_hop_pending            = true;
+    NRF_RADIO->EVENTS_READY  = 0;
+    NRF_RADIO->INTENSET      = RADIO_INTENSET_READY_Msk;
+    NRF_RADIO->TASKS_DISABLE = 1;
+}
+
+
+/**@brief Function for adding a sample to the noise level estimate of a survey channel.
+ *
+ * The estimate moves towards a stronger sample by @ref NRF_ESB_SURVEY_PERCENTILE percent of the
+ * step and towards a weaker one by the rest. It settles where the samples are stronger
+ * (100 - @ref NRF_ESB_SURVEY_PERCENTILE) percent of the time.
+ */
+static void survey_sample_add(uint8_t index, uint8_t rssi)
+{
+    uint16_t sample = (uint16_t)rssi << 4;
+    uint16_t level  = m_survey_levels[index];
+    uint16_t step;
+
+    if (m_survey_samples[index] == 0)
+    {
+        level = sample;
+    }
+    else if (sample < level)
+    {
+        step  = NRF_ESB_SURVEY_STEP * NRF_ESB_SURVEY_PERCENTILE / 100;
+        level = (level - sample > step) ? level - step : sample;
+    }
+    else
+    {
+        step  = NRF_ESB_SURVEY_STEP * (100 - NRF_ESB_SURVEY_PERCENTILE) / 100;
+        level = (sample - level > step) ? level + step : sample;
+    }
+
+    m_survey_levels[index] = level;
+    if (m_survey_samples[index] < UINT16_MAX)
+    {
+        m_survey_samples[index]++;
+    }
+}
+
+
+static void on_radio_rssiend_survey(void)
+{
+    survey_sample_add(m_survey_pos, (uint8_t)NRF_RADIO->RSSISAMPLE);
+    m_survey_sampling = false;
+    NRF_RADIO->INTENCLR = RADIO_INTENCLR_RSSIEND_Msk;
+
+    if (++m_survey_pos >= m_survey_count)
+    {
+        m_survey_pos = 0;
+    }
+
+    // A packet that started meanwhile returns to the hop sequence when it ends
+    if (NRF_RADIO->EVENTS_ADDRESS == 0)
+    {
+        survey_next();
+    }
+    else
+    {
+        m_survey_left = 0;
+    }
+}
+
+
+void NRF_ESB_HOP_TIMER_IRQHandler(void)
+{
+    if (NRF_ESB_HOP_TIMER->EVENTS_COMPARE[2])
+    {
+        NRF_ESB_HOP_TIMER->EVENTS_COMPARE[2] = 0;
+
+        if (m_survey_running && !m_hop_pending && rx_listening())
+        {
+            m_survey_left = m_survey_per_hop;
+            survey_next();
+        }
+    }
+
+    if (NRF_ESB_HOP_TIMER->EVENTS_COMPARE[3])
+    {
+        NRF_ESB_HOP_TIMER->EVENTS_COMPARE[3] = 0;
+
+        // Only the first match after a hop counts, not one after nrf_esb_hop_sync()
+        if (m_hop_deadline_armed)
+        {
+            m_hop_deadline_armed = false;
+            m_interrupt_flags |= NRF_ESB_INT_HOP_DEADLINE_MSK;
+            NVIC_SetPendingIRQ(ESB_EVT_IRQ);
+        }
+    }
+
+    if (NRF_ESB_HOP_TIMER->EVENTS_COMPARE[0] == 0)
+    {
+        return;
+    }
+
+    NRF_ESB_HOP_TIMER->EVENTS_COMPARE[0] = 0;
+
+    // The first compare after nrf_esb_hop_sync() may be shorter than a period
+    NRF_ESB_HOP_TIMER->CC[0] = m_hop_period_us;
+
+    if (m_hop_count == 0)
+    {
+        return;
+    }
+
+    if (++m_hop_index >= m_hop_count)
+    {
+        m_hop_index = 0;
+    }
+    m_esb_addr.rf_channel = m_hop_channels[m_hop_index];
+
+    hop_apply();
+
+    m_hop_deadline_armed = (m_hop_deadline_us != 0);
+
+    m_interrupt_flags |= NRF_ESB_INT_HOP_MSK;
+    NVIC_SetPendingIRQ(ESB_EVT_IRQ);
+}
+
 static void on_radio_disabled_rx(void)
 {
     bool            ack                = false;
     bool            retransmit_payload = false;
     bool            send_rx_event      = true;
     pipe_info_t *   p_pipe_info;
+    uint8_t *       p_ack_packet       = m_ack_header;
+
+    pipe_stats_rssi_add(NRF_RADIO->RXMATCH);
 
     if (NRF_RADIO->CRCSTATUS == 0)
     {
+        m_pipe_stats[NRF_RADIO->RXMATCH].rx_crc_failures++;
         clear_events_restart_rx();
         return;
     }
 
-    if (m_rx_fifo.count >= NRF_ESB_RX_FIFO_SIZE)
+    m_pipe_stats[NRF_RADIO->RXMATCH].rx_packets++;
+
+    // The end of the packet was captured by NRF_ESB_PPI_RX_TIMESTAMP. The end of the
+    // acknowledgment overwrites it, so copy it before anything is sent.
+    m_rx_end_ticks = (uint16_t)NRF_ESB_SYS_TIMER->CC[2];
+    m_rx_end_ticks_valid = true;
+
+    if (nrf_esb_fifo_is_full(&m_rx_fifo) &&
+        m_config_local.rx_overflow == NRF_ESB_RX_OVERFLOW_WITHHOLD_ACK)
     {
+        // Without an acknowledgment the transmitter retries the packet. The other policies
+        // acknowledge it and resolve the overflow in rx_fifo_push_rfbuf.
+        rx_fifo_overflow(NRF_RADIO->RXMATCH);
         clear_events_restart_rx();
         return;
     }
 
     p_pipe_info = &m_rx_pipe_info[NRF_RADIO->RXMATCH];
     if (NRF_RADIO->RXCRC             == p_pipe_info->crc &&
-        (m_rx_payload_buffer[1] >> 1) == p_pipe_info->pid
+        (mp_rx_packet[1] >> 1)       == p_pipe_info->pid
        )
     {
         retransmit_payload = true;
         send_rx_event = false;
+        m_pipe_stats[NRF_RADIO->RXMATCH].rx_duplicates++;
     }
 
-    p_pipe_info->pid = m_rx_payload_buffer[1] >> 1;
+    p_pipe_info->pid = mp_rx_packet[1] >> 1;
     p_pipe_info->crc = NRF_RADIO->RXCRC;
 
-    if (m_config_local.selective_auto_ack == false || ((m_rx_payload_buffer[1] & 0x01) == 0))
+    if (m_config_local.selective_auto_ack == false || ((mp_rx_packet[1] & 0x01) == 0))
     {
         ack = true;
     }
@@ -704,20 +1081,15 @@ static void on_radio_disabled_rx(void)
         {
             case NRF_ESB_PROTOCOL_ESB_DPL:
                 {
-                    if (m_tx_fifo.count > 0 &&
-                        (m_tx_fifo.p_payload[m_tx_fifo.exit_point]->pipe == NRF_RADIO->RXMATCH)
+                    if (nrf_esb_fifo_length(&m_tx_fifo) > 0 &&
+                        (nrf_esb_fifo_read_slot(&m_tx_fifo, 0)->pipe == NRF_RADIO->RXMATCH)
                        )
                     {
                         // Pipe stays in ACK with payload until TX FIFO is empty
                         // Do not report TX success on first ack payload or retransmit
                         if (p_pipe_info->ack_payload == true && !retransmit_payload)
                         {
-                            if (++m_tx_fifo.exit_point >= NRF_ESB_TX_FIFO_SIZE)
-                            {
-                                m_tx_fifo.exit_point = 0;
-                            }
-
-                            m_tx_fifo.count--;
+                            nrf_esb_fifo_release(&m_tx_fifo, 1);
 
                             // ACK payloads also require TX_DS
                             // (page 40 of the 'nRF24LE1_Product_Specification_rev1_6.pdf').
@@ -726,43 +1098,37 @@ static void on_radio_disabled_rx(void)
 
                         p_pipe_info->ack_payload = true;
 
-                        mp_current_payload = m_tx_fifo.p_payload[m_tx_fifo.exit_point];
+                        mp_current_payload = nrf_esb_fifo_read_slot(&m_tx_fifo, 0);
 
                         update_rf_payload_format(mp_current_payload->length);
-                        m_tx_payload_buffer[0] = mp_current_payload->length;
-                        memcpy(&m_tx_payload_buffer[2],
-                               mp_current_payload->data,
-                               mp_current_payload->length);
+                        p_ack_packet = mp_current_payload->rf_header;
+                        p_ack_packet[0] = mp_current_payload->length;
                     }
                     else
                     {
                         p_pipe_info->ack_payload = false;
                         update_rf_payload_format(0);
-                        m_tx_payload_buffer[0] = 0;
+                        p_ack_packet[0] = 0;
                     }
 
-                    m_tx_payload_buffer[1] = m_rx_payload_buffer[1];
+                    p_ack_packet[1] = mp_rx_packet[1];
                 }
                 break;
 
             case NRF_ESB_PROTOCOL_ESB:
                 {
                     update_rf_payload_format(0);
-                    m_tx_payload_buffer[0] = m_rx_payload_buffer[0];
-                    m_tx_payload_buffer[1] = 0;
+                    p_ack_packet[0] = mp_rx_packet[0];
+                    p_ack_packet[1] = 0;
                 }
                 break;
         }
 
         m_nrf_esb_mainstate = NRF_ESB_STATE_PRX_SEND_ACK;
         NRF_RADIO->TXADDRESS = NRF_RADIO->RXMATCH;
-        NRF_RADIO->PACKETPTR = (uint32_t)m_tx_payload_buffer;
+        NRF_RADIO->PACKETPTR = (uint32_t)p_ack_packet;
         on_radio_disabled = on_radio_disabled_rx_ack;
     }
-    else
-    {
-        clear_events_restart_rx();
-    }
 
     if (send_rx_event)
     {
@@ -774,6 +1140,12 @@ static void on_radio_disabled_rx(void)
             NVIC_SetPendingIRQ(ESB_EVT_IRQ);
         }
     }
+
+    if (!ack)
+    {
+        // Restart only after the push, the radio receives into the next free FIFO slot.
+        clear_events_restart_rx();
+    }
 }
 
 
@@ -782,10 +1154,16 @@ static void on_radio_disabled_rx_ack(void)
     NRF_RADIO->SHORTS = RADIO_SHORTS_COMMON | RADIO_SHORTS_DISABLED_TXEN_Msk;
     update_rf_payload_format(m_config_local.payload_length);
 
-    NRF_RADIO->PACKETPTR = (uint32_t)m_rx_payload_buffer;
+    rx_packet_arm();
     on_radio_disabled = on_radio_disabled_rx;
 
     m_nrf_esb_mainstate = NRF_ESB_STATE_PRX;
+
+    // The receiver is already ramping up on the channel of the acknowledged packet
+    if (m_hop_pending)
+    {
+        hop_retune_rx();
+    }
 }
 
 
@@ -815,10 +1193,32 @@ static uint32_t nrf_esb_get_clear_interrupts(uint32_t * p_interrupts)
 
 void RADIO_IRQHandler()
 {
+    m_stats_seq++;
+    __DMB();
+
     if (NRF_RADIO->EVENTS_READY && (NRF_RADIO->INTENSET & RADIO_INTENSET_READY_Msk))
     {
         NRF_RADIO->EVENTS_READY = 0;
         DEBUG_PIN_SET(DEBUGPIN1);
+
+        if (m_survey_sampling)
+        {
+            // The receiver is up on the survey channel
+            NRF_RADIO->INTENCLR = RADIO_INTENCLR_READY_Msk;
+            NRF_RADIO->EVENTS_RSSIEND = 0;
+            NRF_RADIO->INTENSET = RADIO_INTENSET_RSSIEND_Msk;
+            NRF_RADIO->TASKS_RSSISTART = 1;
+        }
+    }
+
+    if (NRF_RADIO->EVENTS_RSSIEND && (NRF_RADIO->INTENSET & RADIO_INTENSET_RSSIEND_Msk))
+    {
+        NRF_RADIO->EVENTS_RSSIEND = 0;
+
+        if (m_survey_sampling)
+        {
+            on_radio_rssiend_survey();
+        }
     }
 
     if (NRF_RADIO->EVENTS_END && (NRF_RADIO->INTENSET & RADIO_INTENSET_END_Msk))
@@ -849,6 +1249,9 @@ void RADIO_IRQHandler()
     DEBUG_PIN_CLR(DEBUGPIN2);
     DEBUG_PIN_CLR(DEBUGPIN3);
     DEBUG_PIN_CLR(DEBUGPIN4);
+
+    __DMB();
+    m_stats_seq++;
 }
 
 
@@ -882,6 +1285,8 @@ uint32_t nrf_esb_init(nrf_esb_config_t const * p_config)
 
     sys_timer_init();
 
+    hop_timer_init();
+
     ppi_init();
 
     NVIC_SetPriority(RADIO_IRQn, m_config_local.radio_irq_priority & 0x03);
@@ -903,7 +1308,13 @@ uint32_t nrf_esb_suspend(void)
     NRF_PPI->CHENCLR = (1 << NRF_ESB_PPI_TIMER_START) |
                        (1 << NRF_ESB_PPI_TIMER_STOP)  |
                        (1 << NRF_ESB_PPI_RX_TIMEOUT)  |
-                       (1 << NRF_ESB_PPI_TX_START);
+                       (1 << NRF_ESB_PPI_TX_START)    |
+                       (1 << NRF_ESB_PPI_RX_TIMESTAMP);
+
+    // The system timer runs freely after a reception, see nrf_esb_start_rx(). Stopping it lets
+    // the 16 MHz clock stop, and drops the reference of nrf_esb_start_tx_at().
+    NRF_ESB_SYS_TIMER->TASKS_STOP = 1;
+    m_rx_end_ticks_valid          = false;
 
     m_nrf_esb_mainstate = NRF_ESB_STATE_IDLE;
 
@@ -911,17 +1322,58 @@ uint32_t nrf_esb_suspend(void)
 }
 
 
+uint32_t nrf_esb_set_mode(nrf_esb_mode_t mode)
+{
+    VERIFY_TRUE(m_esb_initialized, NRF_ERROR_INVALID_STATE);
+    VERIFY_TRUE(m_nrf_esb_mainstate == NRF_ESB_STATE_IDLE, NRF_ERROR_BUSY);
+    VERIFY_TRUE(mode == NRF_ESB_MODE_PTX || mode == NRF_ESB_MODE_PRX, NRF_ERROR_INVALID_PARAM);
+
+    if (m_config_local.mode == mode)
+    {
+        return NRF_SUCCESS;
+    }
+
+    // Leave the radio in the state nrf_esb_init() leaves it in. nrf_esb_start_tx() and
+    // nrf_esb_start_rx() program the shorts, interrupts and handlers of the new role.
+    NRF_PPI->CHENCLR = (1 << NRF_ESB_PPI_TIMER_START) |
+                       (1 << NRF_ESB_PPI_TIMER_STOP)  |
+                       (1 << NRF_ESB_PPI_RX_TIMEOUT)  |
+                       (1 << NRF_ESB_PPI_TX_START)    |
+                       (1 << NRF_ESB_PPI_RX_TIMESTAMP);
+
+    NRF_RADIO->INTENCLR = 0xFFFFFFFF;
+    NRF_RADIO->SHORTS   = RADIO_SHORTS_READY_START_Enabled << RADIO_SHORTS_READY_START_Pos |
+                          RADIO_SHORTS_END_DISABLE_Enabled << RADIO_SHORTS_END_DISABLE_Pos;
+    on_radio_disabled   = NULL;
+
+    m_config_local.mode = mode;
+
+    // A transmission leaves the payload format of its last packet behind.
+    update_rf_payload_format(m_config_local.payload_length);
+
+    return NRF_SUCCESS;
+}
+
+
 uint32_t nrf_esb_disable(void)
 {
     // Clear PPI
     NRF_PPI->CHENCLR = (1 << NRF_ESB_PPI_TIMER_START) |
                        (1 << NRF_ESB_PPI_TIMER_STOP)  |
                        (1 << NRF_ESB_PPI_RX_TIMEOUT)  |
-                       (1 << NRF_ESB_PPI_TX_START);
+                       (1 << NRF_ESB_PPI_TX_START)    |
+                       (1 << NRF_ESB_PPI_RX_TIMESTAMP) |
+                       (1 << NRF_ESB_PPI_ADDRESS_TIMESTAMP);
+
+    NRF_ESB_SYS_TIMER->TASKS_STOP = 1;
+    m_rx_end_ticks_valid = false;
+
+    (void) nrf_esb_hop_stop();
+    NRF_ESB_HOP_TIMER->TASKS_STOP = 1;
 
     m_nrf_esb_mainstate = NRF_ESB_STATE_IDLE;
 
-    reset_fifos();
+    initialize_fifos();
 
     memset(m_rx_pipe_info, 0, sizeof(m_rx_pipe_info));
     memset(m_pids, 0, sizeof(m_pids));
@@ -948,6 +1400,10 @@ void ESB_EVT_IRQHandler(void)
     nrf_esb_evt_t   event;
 
     event.tx_attempts = m_last_tx_attempts;
+    event.hop_index = m_hop_index;
+    event.timestamp = m_tx_timestamp;
+    event.rx_count = 0;
+    event.rx_overflows = 0;
 
     err_code = nrf_esb_get_clear_interrupts(&interrupts);
     if (err_code == NRF_SUCCESS && m_event_handler != 0)
@@ -962,20 +1418,55 @@ void ESB_EVT_IRQHandler(void)
             event.evt_id = NRF_ESB_EVENT_TX_FAILED;
             m_event_handler(&event);
         }
-        if (interrupts & NRF_ESB_INT_RX_DATA_RECEIVED_MSK)
+        if (interrupts & NRF_ESB_INT_RX_OVERFLOW_MSK)
         {
-            event.evt_id = NRF_ESB_EVENT_RX_RECEIVED;
+            uint32_t rx_overflows = m_rx_overflows;
+
+            event.evt_id = NRF_ESB_EVENT_RX_OVERFLOW;
+            event.rx_count = nrf_esb_fifo_length(&m_rx_fifo);
+            event.rx_overflows = rx_overflows - m_rx_overflows_reported;
+            m_rx_overflows_reported = rx_overflows;
+            m_event_handler(&event);
+        }
+        if (interrupts & NRF_ESB_INT_RX_DATA_RECEIVED_MSK)
+        {
+            event.evt_id = NRF_ESB_EVENT_RX_RECEIVED;
+            event.hop_index = m_rx_hop_index;
+            event.timestamp = m_rx_timestamp;
+            event.rx_count = nrf_esb_fifo_length(&m_rx_fifo);
+            m_event_handler(&event);
+        }
+        if (interrupts & NRF_ESB_INT_HOP_MSK)
+        {
+            event.evt_id = NRF_ESB_EVENT_HOP;
+            event.hop_index = m_hop_index;
+            m_event_handler(&event);
+        }
+        if (interrupts & NRF_ESB_INT_HOP_DEADLINE_MSK)
+        {
+            event.evt_id = NRF_ESB_EVENT_HOP_DEADLINE;
+            event.hop_index = m_hop_index;
             m_event_handler(&event);
         }
     }
 }
 
-uint32_t nrf_esb_write_payload(nrf_esb_payload_t const * p_payload)
+/**@brief Function for copying a payload into a free TX FIFO slot and assigning its PID. */
+static void tx_fifo_fill_slot(uint32_t index, nrf_esb_payload_t const * p_payload)
+{
+    nrf_esb_payload_t * p_slot = nrf_esb_fifo_write_slot(&m_tx_fifo, index);
+
+    memcpy(p_slot, p_payload, sizeof(nrf_esb_payload_t));
+
+    m_pids[p_payload->pipe] = (m_pids[p_payload->pipe] + 1) % (NRF_ESB_PID_MAX + 1);
+    p_slot->pid = m_pids[p_payload->pipe];
+}
+
+
+/**@brief Function for checking whether a payload can be queued for transmission. */
+static uint32_t tx_payload_verify(nrf_esb_payload_t const * p_payload)
 {
-    VERIFY_TRUE(m_esb_initialized, NRF_ERROR_INVALID_STATE);
-    VERIFY_PARAM_NOT_NULL(p_payload);
     VERIFY_PAYLOAD_LENGTH(p_payload);
-    VERIFY_FALSE(m_tx_fifo.count >= NRF_ESB_TX_FIFO_SIZE, NRF_ERROR_NO_MEM);
 
     if (m_config_local.mode == NRF_ESB_MODE_PTX &&
         p_payload->noack && !m_config_local.selective_auto_ack )
@@ -983,60 +1474,169 @@ uint32_t nrf_esb_write_payload(nrf_esb_payload_t const * p_payload)
         return NRF_ERROR_NOT_SUPPORTED;
     }
 
-    DISABLE_RF_IRQ();
+    return NRF_SUCCESS;
+}
 
-    memcpy(m_tx_fifo.p_payload[m_tx_fifo.entry_point], p_payload, sizeof(nrf_esb_payload_t));
 
-    m_pids[p_payload->pipe] = (m_pids[p_payload->pipe] + 1) % (NRF_ESB_PID_MAX + 1);
-    m_tx_fifo.p_payload[m_tx_fifo.entry_point]->pid = m_pids[p_payload->pipe];
+/**@brief Function for starting a transaction on queued payloads if the configuration asks for it. */
+static void tx_fifo_auto_start(void)
+{
+    if (m_config_local.mode == NRF_ESB_MODE_PTX &&
+        m_config_local.tx_mode == NRF_ESB_TXMODE_AUTO &&
+        m_nrf_esb_mainstate == NRF_ESB_STATE_IDLE)
+    {
+        start_tx_transaction();
+    }
+}
+
+
+uint32_t nrf_esb_write_payload(nrf_esb_payload_t const * p_payload)
+{
+    uint32_t err_code;
 
-    if (++m_tx_fifo.entry_point >= NRF_ESB_TX_FIFO_SIZE)
+    VERIFY_TRUE(m_esb_initialized, NRF_ERROR_INVALID_STATE);
+    VERIFY_PARAM_NOT_NULL(p_payload);
+    VERIFY_FALSE(nrf_esb_fifo_is_full(&m_tx_fifo), NRF_ERROR_NO_MEM);
+
+    err_code = tx_payload_verify(p_payload);
+    if (err_code != NRF_SUCCESS)
     {
-        m_tx_fifo.entry_point = 0;
+        return err_code;
     }
 
-    m_tx_fifo.count++;
+    // The radio interrupt does not touch the slot until it is committed, so the copy does not
+    // need a critical section.
+    tx_fifo_fill_slot(0, p_payload);
+    nrf_esb_fifo_commit(&m_tx_fifo, 1);
 
-    ENABLE_RF_IRQ();
+    tx_fifo_auto_start();
+
+    return NRF_SUCCESS;
+}
 
 
-    if (m_config_local.mode == NRF_ESB_MODE_PTX &&
-        m_config_local.tx_mode == NRF_ESB_TXMODE_AUTO &&
-        m_nrf_esb_mainstate == NRF_ESB_STATE_IDLE)
+uint32_t nrf_esb_write_payloads(nrf_esb_payload_t const * p_payloads, uint32_t count)
+{
+    uint32_t err_code;
+
+    VERIFY_TRUE(m_esb_initialized, NRF_ERROR_INVALID_STATE);
+    VERIFY_PARAM_NOT_NULL(p_payloads);
+    VERIFY_TRUE(count <= nrf_esb_fifo_space(&m_tx_fifo), NRF_ERROR_NO_MEM);
+
+    for (uint32_t i = 0; i < count; i++)
     {
-        start_tx_transaction();
+        err_code = tx_payload_verify(&p_payloads[i]);
+        if (err_code != NRF_SUCCESS)
+        {
+            return err_code;
+        }
+    }
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        tx_fifo_fill_slot(i, &p_payloads[i]);
+    }
+
+    // One commit hands all payloads to the radio interrupt
+    nrf_esb_fifo_commit(&m_tx_fifo, count);
+
+    if (count > 0)
+    {
+        tx_fifo_auto_start();
     }
 
     return NRF_SUCCESS;
 }
 
 
+/**@brief Function for copying a received payload out of an RX FIFO slot. */
+static void rx_payload_copy(nrf_esb_payload_t * p_payload, nrf_esb_payload_t const * p_slot)
+{
+    p_payload->length    = p_slot->length;
+    p_payload->pipe      = p_slot->pipe;
+    p_payload->rssi      = p_slot->rssi;
+    p_payload->pid       = p_slot->pid;
+    p_payload->hop_index = p_slot->hop_index;
+    p_payload->timestamp = p_slot->timestamp;
+    memcpy(p_payload->data, p_slot->data, p_payload->length);
+}
+
+
 uint32_t nrf_esb_read_rx_payload(nrf_esb_payload_t * p_payload)
 {
+    uint32_t count;
+
+    return nrf_esb_read_rx_payloads(p_payload, 1, &count);
+}
+
+
+uint32_t nrf_esb_read_rx_payloads(nrf_esb_payload_t * p_payloads, uint32_t max_count, uint32_t * p_count)
+{
+    uint32_t pos;
+    uint32_t count;
+    uint32_t discarded;
+
     VERIFY_TRUE(m_esb_initialized, NRF_ERROR_INVALID_STATE);
-    VERIFY_PARAM_NOT_NULL(p_payload);
+    VERIFY_PARAM_NOT_NULL(p_payloads);
+    VERIFY_PARAM_NOT_NULL(p_count);
 
-    if (m_rx_fifo.count == 0)
+    pos   = nrf_esb_fifo_read_pos(&m_rx_fifo);
+    count = MIN(nrf_esb_fifo_length(&m_rx_fifo), max_count);
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        rx_payload_copy(&p_payloads[i], nrf_esb_fifo_slot_at(&m_rx_fifo, pos + i));
+    }
+
+    // One release hands all slots back to the radio interrupt. Payloads it discarded while they
+    // were copied may be torn, so they are dropped from the result.
+    discarded = (count > 0) ? rx_fifo_release(pos, count) : 0;
+
+    if (discarded >= count)
     {
+        *p_count = 0;
         return NRF_ERROR_NOT_FOUND;
     }
 
-    DISABLE_RF_IRQ();
+    if (discarded > 0)
+    {
+        memmove(p_payloads, &p_payloads[discarded], (count - discarded) * sizeof(nrf_esb_payload_t));
+    }
 
-    p_payload->length = m_rx_fifo.p_payload[m_rx_fifo.exit_point]->length;
-    p_payload->pipe   = m_rx_fifo.p_payload[m_rx_fifo.exit_point]->pipe;
-    p_payload->rssi   = m_rx_fifo.p_payload[m_rx_fifo.exit_point]->rssi;
-    p_payload->pid    = m_rx_fifo.p_payload[m_rx_fifo.exit_point]->pid;
-    memcpy(p_payload->data, m_rx_fifo.p_payload[m_rx_fifo.exit_point]->data, p_payload->length);
+    *p_count = count - discarded;
 
-    if (++m_rx_fifo.exit_point >= NRF_ESB_RX_FIFO_SIZE)
+    return NRF_SUCCESS;
+}
+
+
+uint32_t nrf_esb_borrow_rx_payload(nrf_esb_payload_t const ** pp_payload)
+{
+    VERIFY_TRUE(m_esb_initialized, NRF_ERROR_INVALID_STATE);
+    VERIFY_PARAM_NOT_NULL(pp_payload);
+
+    if (nrf_esb_fifo_length(&m_rx_fifo) == 0)
     {
-        m_rx_fifo.exit_point = 0;
+        return NRF_ERROR_NOT_FOUND;
     }
 
-    m_rx_fifo.count--;
+    // The radio only receives into slots that are not committed, so the slot stays intact
+    // unless the overflow policy discards it.
+    m_rx_borrow_pos = nrf_esb_fifo_read_pos(&m_rx_fifo);
+    *pp_payload = nrf_esb_fifo_slot_at(&m_rx_fifo, m_rx_borrow_pos);
 
-    ENABLE_RF_IRQ();
+    return NRF_SUCCESS;
+}
+
+
+uint32_t nrf_esb_release_rx_payload(void)
+{
+    VERIFY_TRUE(m_esb_initialized, NRF_ERROR_INVALID_STATE);
+    VERIFY_TRUE(nrf_esb_fifo_length(&m_rx_fifo) > 0, NRF_ERROR_BUFFER_EMPTY);
+
+    if (rx_fifo_release(m_rx_borrow_pos, 1) != 0)
+    {
+        return NRF_ERROR_INVALID_DATA;
+    }
 
     return NRF_SUCCESS;
 }
@@ -1046,7 +1646,7 @@ uint32_t nrf_esb_start_tx(void)
 {
     VERIFY_TRUE(m_nrf_esb_mainstate == NRF_ESB_STATE_IDLE, NRF_ERROR_BUSY);
 
-    if (m_tx_fifo.count == 0)
+    if (nrf_esb_fifo_length(&m_tx_fifo) == 0)
     {
         return NRF_ERROR_BUFFER_EMPTY;
     }
@@ -1057,6 +1657,151 @@ uint32_t nrf_esb_start_tx(void)
 }
 
 
+uint32_t nrf_esb_start_tx_at(uint16_t ticks)
+{
+    uint16_t elapsed;
+
+    VERIFY_TRUE(m_esb_initialized, NRF_ERROR_INVALID_STATE);
+    VERIFY_TRUE(m_config_local.mode == NRF_ESB_MODE_PTX, NRF_ERROR_INVALID_STATE);
+    VERIFY_TRUE(m_nrf_esb_mainstate == NRF_ESB_STATE_IDLE, NRF_ERROR_BUSY);
+    VERIFY_TRUE(m_rx_end_ticks_valid, NRF_ERROR_INVALID_STATE);
+
+    if (nrf_esb_fifo_length(&m_tx_fifo) == 0)
+    {
+        return NRF_ERROR_BUFFER_EMPTY;
+    }
+
+    tx_transaction_prepare();
+
+    // The timer is still running from the reception. CC[1] starts the radio through
+    // NRF_ESB_PPI_TX_START and hands the timer over to the retransmit logic, just like a retransmit.
+    NRF_ESB_SYS_TIMER->CC[1]             = (uint16_t)(m_rx_end_ticks + ticks);
+    NRF_ESB_SYS_TIMER->EVENTS_COMPARE[1] = 0;
+    NRF_ESB_SYS_TIMER->SHORTS            = TIMER_SHORTS_COMPARE1_CLEAR_Msk | TIMER_SHORTS_COMPARE1_STOP_Msk;
+    NRF_PPI->CHENSET                     = (1 << NRF_ESB_PPI_TX_START);
+
+    NRF_ESB_SYS_TIMER->TASKS_CAPTURE[0]  = 1;
+    elapsed = (uint16_t)(NRF_ESB_SYS_TIMER->CC[0] - m_rx_end_ticks);
+
+    if (NRF_ESB_SYS_TIMER->EVENTS_COMPARE[1])
+    {
+        // The compare may have fired before the PPI channel was enabled
+        DEBUG_PIN_SET(DEBUGPIN4);
+        NRF_RADIO->TASKS_TXEN = 1;
+    }
+    else if (elapsed >= ticks)
+    {
+        // Too late, the compare only matches again when the timer wraps
+        NRF_PPI->CHENCLR          = (1 << NRF_ESB_PPI_TX_START);
+        NRF_ESB_SYS_TIMER->SHORTS = 0;
+        NRF_RADIO->INTENCLR       = 0xFFFFFFFF;
+        on_radio_disabled         = NULL;
+        m_nrf_esb_mainstate       = NRF_ESB_STATE_IDLE;
+        m_rx_end_ticks_valid      = true;
+
+        return NRF_ERROR_TIMEOUT;
+    }
+
+    return NRF_SUCCESS;
+}
+
+
+/**@brief Function for reading @ref NRF_ESB_HOP_TIMER. Call it with the hop timer interrupt disabled.
+ *
+ * CC[3] holds the deadline. It is only borrowed to read the hop timer, and put back before
+ * the timer can reach it again.
+ */
+static uint16_t hop_timer_elapsed(void)
+{
+    uint16_t elapsed;
+
+    NRF_ESB_HOP_TIMER->TASKS_CAPTURE[3] = 1;
+    elapsed = (uint16_t)NRF_ESB_HOP_TIMER->CC[3];
+    NRF_ESB_HOP_TIMER->CC[3] = m_hop_deadline_us;
+
+    return elapsed;
+}
+
+
+/**@brief Function for starting the queued transmission when @ref NRF_ESB_HOP_TIMER reaches @p ticks.
+ *
+ * The system timer starts over at the remaining time, and CC[1] starts the radio as in
+ * nrf_esb_start_tx_at().
+ */
+static uint32_t tx_start_at_hop_ticks(uint16_t ticks)
+{
+    uint16_t elapsed;
+
+    NVIC_DisableIRQ(NRF_ESB_HOP_TIMER_IRQn);
+    elapsed = hop_timer_elapsed();
+    NVIC_EnableIRQ(NRF_ESB_HOP_TIMER_IRQn);
+
+    if (elapsed >= ticks)
+    {
+        return NRF_ERROR_TIMEOUT;
+    }
+
+    tx_transaction_prepare();
+
+    NRF_ESB_SYS_TIMER->TASKS_STOP        = 1;
+    NRF_ESB_SYS_TIMER->TASKS_CLEAR       = 1;
+    NRF_ESB_SYS_TIMER->EVENTS_COMPARE[1] = 0;
+    NRF_ESB_SYS_TIMER->SHORTS            = TIMER_SHORTS_COMPARE1_CLEAR_Msk | TIMER_SHORTS_COMPARE1_STOP_Msk;
+    NRF_PPI->CHENSET                     = (1 << NRF_ESB_PPI_TX_START);
+
+    // Read the hop timer again right before the start, so that the time the preparation took
+    // does not delay it
+    NVIC_DisableIRQ(NRF_ESB_HOP_TIMER_IRQn);
+    elapsed = hop_timer_elapsed();
+    NRF_ESB_SYS_TIMER->CC[1]       = elapsed < ticks ? ticks - elapsed : 1;
+    NRF_ESB_SYS_TIMER->TASKS_START = 1;
+    NVIC_EnableIRQ(NRF_ESB_HOP_TIMER_IRQn);
+
+    return NRF_SUCCESS;
+}
+
+
+uint32_t nrf_esb_start_tx_at_hop(uint16_t ticks)
+{
+    VERIFY_TRUE(m_esb_initialized, NRF_ERROR_INVALID_STATE);
+    VERIFY_TRUE(m_config_local.mode == NRF_ESB_MODE_PTX, NRF_ERROR_INVALID_STATE);
+    VERIFY_TRUE(m_nrf_esb_mainstate == NRF_ESB_STATE_IDLE, NRF_ERROR_BUSY);
+    VERIFY_TRUE(m_hop_count > 0, NRF_ERROR_INVALID_STATE);
+
+    if (nrf_esb_fifo_length(&m_tx_fifo) == 0)
+    {
+        return NRF_ERROR_BUFFER_EMPTY;
+    }
+
+    return tx_start_at_hop_ticks(ticks);
+}
+
+
+uint32_t nrf_esb_start_tx_before_hop(uint16_t ticks)
+{
+    uint16_t next;
+
+    VERIFY_TRUE(m_esb_initialized, NRF_ERROR_INVALID_STATE);
+    VERIFY_TRUE(m_config_local.mode == NRF_ESB_MODE_PTX, NRF_ERROR_INVALID_STATE);
+    VERIFY_TRUE(m_nrf_esb_mainstate == NRF_ESB_STATE_IDLE, NRF_ERROR_BUSY);
+    VERIFY_TRUE(m_hop_count > 0, NRF_ERROR_INVALID_STATE);
+
+    if (nrf_esb_fifo_length(&m_tx_fifo) == 0)
+    {
+        return NRF_ERROR_BUFFER_EMPTY;
+    }
+
+    // The next hop is moved by nrf_esb_hop_paused(), the timer count is not
+    next = (uint16_t)NRF_ESB_HOP_TIMER->CC[0];
+    if (next <= ticks)
+    {
+        return NRF_ERROR_TIMEOUT;
+    }
+
+    return tx_start_at_hop_ticks(next - ticks);
+}
+
+
 uint32_t nrf_esb_start_rx(void)
 {
     VERIFY_TRUE(m_nrf_esb_mainstate == NRF_ESB_STATE_IDLE, NRF_ERROR_BUSY);
@@ -1070,8 +1815,17 @@ uint32_t nrf_esb_start_rx(void)
     m_nrf_esb_mainstate    = NRF_ESB_STATE_PRX;
 
     NRF_RADIO->RXADDRESSES  = m_esb_addr.rx_pipes_enabled;
-    NRF_RADIO->FREQUENCY    = m_esb_addr.rf_channel;
-    NRF_RADIO->PACKETPTR    = (uint32_t)m_rx_payload_buffer;
+    update_radio_frequency();
+    rx_packet_arm();
+
+    // Let the system timer run freely, so that the end of every received packet can be
+    // captured as a reference for nrf_esb_start_tx_at()
+    NRF_ESB_SYS_TIMER->TASKS_STOP  = 1;
+    NRF_ESB_SYS_TIMER->SHORTS      = 0;
+    NRF_ESB_SYS_TIMER->TASKS_CLEAR = 1;
+    NRF_ESB_SYS_TIMER->TASKS_START = 1;
+    m_rx_end_ticks_valid           = false;
+    NRF_PPI->CHENSET               = (1 << NRF_ESB_PPI_RX_TIMESTAMP);
 
     NVIC_ClearPendingIRQ(RADIO_IRQn);
     NVIC_EnableIRQ(RADIO_IRQn);
@@ -1088,14 +1842,18 @@ uint32_t nrf_esb_start_rx(void)
 
 uint32_t nrf_esb_stop_rx(void)
 {
-    if (m_nrf_esb_mainstate == NRF_ESB_STATE_PRX)
+    if (m_nrf_esb_mainstate == NRF_ESB_STATE_PRX || m_nrf_esb_mainstate == NRF_ESB_STATE_PRX_SEND_ACK)
     {
         NRF_RADIO->SHORTS = 0;
         NRF_RADIO->INTENCLR = 0xFFFFFFFF;
+        NRF_PPI->CHENCLR = (1 << NRF_ESB_PPI_RX_TIMESTAMP);
         on_radio_disabled = NULL;
+        survey_cancel();
         NRF_RADIO->EVENTS_DISABLED = 0;
         NRF_RADIO->TASKS_DISABLE = 1;
         while (NRF_RADIO->EVENTS_DISABLED == 0);
+        // Do not leave the event set, the next INTENSET of DISABLED would raise a stale interrupt
+        NRF_RADIO->EVENTS_DISABLED = 0;
         m_nrf_esb_mainstate = NRF_ESB_STATE_IDLE;
 
         return NRF_SUCCESS;
@@ -1109,11 +1867,10 @@ uint32_t nrf_esb_flush_tx(void)
 {
     VERIFY_TRUE(m_esb_initialized, NRF_ERROR_INVALID_STATE);
 
+    // The radio interrupt consumes the TX FIFO, keep it out while the read position is moved
     DISABLE_RF_IRQ();
 
-    m_tx_fifo.count = 0;
-    m_tx_fifo.entry_point = 0;
-    m_tx_fifo.exit_point = 0;
+    nrf_esb_fifo_release_all(&m_tx_fifo);
 
     ENABLE_RF_IRQ();
 
@@ -1124,15 +1881,11 @@ uint32_t nrf_esb_flush_tx(void)
 uint32_t nrf_esb_pop_tx(void)
 {
     VERIFY_TRUE(m_esb_initialized, NRF_ERROR_INVALID_STATE);
-    VERIFY_TRUE(m_tx_fifo.count > 0, NRF_ERROR_BUFFER_EMPTY);
+    VERIFY_TRUE(nrf_esb_fifo_length(&m_tx_fifo) > 0, NRF_ERROR_BUFFER_EMPTY);
 
     DISABLE_RF_IRQ();
 
-    if (++m_tx_fifo.entry_point >= NRF_ESB_TX_FIFO_SIZE)
-    {
-        m_tx_fifo.entry_point = 0;
-    }
-    m_tx_fifo.count--;
+    nrf_esb_fifo_release(&m_tx_fifo, 1);
 
     ENABLE_RF_IRQ();
 
@@ -1146,10 +1899,7 @@ uint32_t nrf_esb_flush_rx(void)
 
     DISABLE_RF_IRQ();
 
-    m_rx_fifo.count = 0;
-    m_rx_fifo.entry_point = 0;
-    m_rx_fifo.exit_point = 0;
-
+    nrf_esb_fifo_release_all(&m_rx_fifo);
     memset(m_rx_pipe_info, 0, sizeof(m_rx_pipe_info));
 
     ENABLE_RF_IRQ();
@@ -1257,6 +2007,279 @@ uint32_t nrf_esb_get_rf_channel(uint32_t * p_channel)
 }
 
 
+uint32_t nrf_esb_hop_start(uint8_t const * p_channels, uint8_t count, uint16_t period_us)
+{
+    VERIFY_TRUE(m_esb_initialized, NRF_ERROR_INVALID_STATE);
+    VERIFY_PARAM_NOT_NULL(p_channels);
+    VERIFY_TRUE(count > 0 && count <= NRF_ESB_HOP_MAX_CHANNELS, NRF_ERROR_INVALID_PARAM);
+    VERIFY_TRUE(period_us > 0, NRF_ERROR_INVALID_PARAM);
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        VERIFY_TRUE(p_channels[i] <= 125, NRF_ERROR_INVALID_PARAM);
+    }
+
+    NVIC_DisableIRQ(NRF_ESB_HOP_TIMER_IRQn);
+    NRF_ESB_HOP_TIMER->TASKS_STOP = 1;
+    m_interrupt_flags &= ~NRF_ESB_INT_HOP_MSK;
+
+    memcpy(m_hop_channels, p_channels, count);
+    m_hop_count     = count;
+    m_hop_period_us = period_us;
+
+    // The first hop selects the first channel
+    m_hop_index     = count - 1;
+    m_rf_hop_index  = m_hop_index;
+    m_hop_pending   = false;
+
+    m_hop_deadline_us    = 0;
+    m_hop_deadline_armed = false;
+    NRF_ESB_HOP_TIMER->INTENCLR = TIMER_INTENCLR_COMPARE3_Msk;
+    m_interrupt_flags &= ~NRF_ESB_INT_HOP_DEADLINE_MSK;
+
+    NRF_ESB_HOP_TIMER->SHORTS    = TIMER_SHORTS_COMPARE0_CLEAR_Msk;
+    NRF_ESB_HOP_TIMER->CC[0]     = period_us;
+    NRF_ESB_HOP_TIMER->INTENSET  = TIMER_INTENSET_COMPARE0_Msk;
+    NRF_ESB_HOP_TIMER->EVENTS_COMPARE[0] = 0;
+    NRF_ESB_HOP_TIMER->TASKS_CLEAR = 1;
+    NRF_ESB_HOP_TIMER->TASKS_START = 1;
+
+    NVIC_SetPriority(NRF_ESB_HOP_TIMER_IRQn, m_config_local.radio_irq_priority & 0x03);
+    NVIC_ClearPendingIRQ(NRF_ESB_HOP_TIMER_IRQn);
+    NVIC_EnableIRQ(NRF_ESB_HOP_TIMER_IRQn);
+
+    return NRF_SUCCESS;
+}
+
+
+uint32_t nrf_esb_hop_sync(uint8_t index, uint16_t ticks)
+{
+    uint16_t elapsed = 0;
+
+    VERIFY_TRUE(m_hop_count > 0, NRF_ERROR_INVALID_STATE);
+    VERIFY_TRUE(index < m_hop_count, NRF_ERROR_INVALID_PARAM);
+
+    NVIC_DisableIRQ(NRF_ESB_HOP_TIMER_IRQn);
+    DISABLE_RF_IRQ();
+
+    NRF_ESB_HOP_TIMER->TASKS_STOP  = 1;
+    NRF_ESB_HOP_TIMER->TASKS_CLEAR = 1;
+    NRF_ESB_HOP_TIMER->EVENTS_COMPARE[0] = 0;
+
+    // The time from the packet is read right before the start, so that the hop timer counts from it
+    if (m_rx_end_ticks_valid)
+    {
+        NRF_ESB_SYS_TIMER->TASKS_CAPTURE[3] = 1;
+        elapsed = (uint16_t)(NRF_ESB_SYS_TIMER->CC[3] - m_rx_end_ticks);
+    }
+
+    NRF_ESB_HOP_TIMER->CC[0]       = elapsed < ticks ? ticks - elapsed : 1;
+    NRF_ESB_HOP_TIMER->TASKS_START = 1;
+
+    // The timer restarted, the deadline applies again after the next hop
+    m_hop_deadline_armed = false;
+
+    if (index != m_hop_index)
+    {
+        m_hop_index = index;
+        m_esb_addr.rf_channel = m_hop_channels[index];
+        hop_apply();
+    }
+
+    NVIC_ClearPendingIRQ(NRF_ESB_HOP_TIMER_IRQn);
+    ENABLE_RF_IRQ();
+    NVIC_EnableIRQ(NRF_ESB_HOP_TIMER_IRQn);
+
+    return NRF_SUCCESS;
+}
+
+
+uint32_t nrf_esb_hop_channel_set(uint8_t index, uint8_t channel)
+{
+    VERIFY_TRUE(m_hop_count > 0, NRF_ERROR_INVALID_STATE);
+    VERIFY_TRUE(index < m_hop_count, NRF_ERROR_INVALID_PARAM);
+    VERIFY_TRUE(channel <= 125, NRF_ERROR_INVALID_PARAM);
+
+    // A single byte store; the hop interrupt reads either the old or the new channel
+    m_hop_channels[index] = channel;
+
+    return NRF_SUCCESS;
+}
+
+
+uint32_t nrf_esb_hop_stop(void)
+{
+    NVIC_DisableIRQ(NRF_ESB_HOP_TIMER_IRQn);
+    NRF_ESB_HOP_TIMER->SHORTS     = 0;
+    NRF_ESB_HOP_TIMER->INTENCLR   = TIMER_INTENCLR_COMPARE0_Msk;
+    NRF_ESB_HOP_TIMER->EVENTS_COMPARE[0] = 0;
+    NVIC_ClearPendingIRQ(NRF_ESB_HOP_TIMER_IRQn);
+    m_interrupt_flags &= ~NRF_ESB_INT_HOP_MSK;
+
+    m_hop_count   = 0;
+    m_hop_index   = 0;
+    m_rf_hop_index = 0;
+    m_hop_pending = false;
+    m_hop_deadline_us = 0;
+    m_hop_deadline_armed = false;
+    NRF_ESB_HOP_TIMER->INTENCLR = TIMER_INTENCLR_COMPARE3_Msk;
+    m_interrupt_flags &= ~NRF_ESB_INT_HOP_DEADLINE_MSK;
+
+    return nrf_esb_survey_stop();
+}
+
+
+uint32_t nrf_esb_hop_deadline_set(uint16_t ticks)
+{
+    VERIFY_TRUE(m_hop_count > 0, NRF_ERROR_INVALID_STATE);
+    VERIFY_TRUE(ticks < m_hop_period_us, NRF_ERROR_INVALID_PARAM);
+
+    NVIC_DisableIRQ(NRF_ESB_HOP_TIMER_IRQn);
+    NRF_ESB_HOP_TIMER->CC[3]             = ticks;
+    NRF_ESB_HOP_TIMER->EVENTS_COMPARE[3] = 0;
+    if (ticks != 0)
+    {
+        NRF_ESB_HOP_TIMER->INTENSET = TIMER_INTENSET_COMPARE3_Msk;
+    }
+    else
+    {
+        NRF_ESB_HOP_TIMER->INTENCLR = TIMER_INTENCLR_COMPARE3_Msk;
+    }
+    m_hop_deadline_us    = ticks;
+    m_hop_deadline_armed = false;
+    m_interrupt_flags &= ~NRF_ESB_INT_HOP_DEADLINE_MSK;
+    NVIC_EnableIRQ(NRF_ESB_HOP_TIMER_IRQn);
+
+    return NRF_SUCCESS;
+}
+
+
+uint32_t nrf_esb_hop_time_left(uint16_t * p_ticks)
+{
+    uint16_t elapsed;
+    uint16_t next;
+
+    VERIFY_PARAM_NOT_NULL(p_ticks);
+    VERIFY_TRUE(m_hop_count > 0, NRF_ERROR_INVALID_STATE);
+    VERIFY_FALSE(m_hop_deadline_armed, NRF_ERROR_BUSY);
+
+    NVIC_DisableIRQ(NRF_ESB_HOP_TIMER_IRQn);
+    elapsed = hop_timer_elapsed();
+    next    = (uint16_t)NRF_ESB_HOP_TIMER->CC[0];
+    NVIC_EnableIRQ(NRF_ESB_HOP_TIMER_IRQn);
+
+    *p_ticks = next > elapsed ? next - elapsed : 0;
+
+    return NRF_SUCCESS;
+}
+
+
+uint32_t nrf_esb_hop_paused(uint16_t ticks)
+{
+    uint16_t elapsed;
+    uint16_t next;
+
+    VERIFY_TRUE(m_hop_count > 0, NRF_ERROR_INVALID_STATE);
+
+    NVIC_DisableIRQ(NRF_ESB_HOP_TIMER_IRQn);
+    elapsed = hop_timer_elapsed();
+    next    = (uint16_t)NRF_ESB_HOP_TIMER->CC[0];
+    if (next > elapsed + ticks)
+    {
+        NRF_ESB_HOP_TIMER->CC[0] = next - ticks;
+    }
+    else
+    {
+        // The time is up. A compare at the count would only match after the timer wraps.
+        NRF_ESB_HOP_TIMER->CC[0] = elapsed + 1;
+    }
+    NVIC_EnableIRQ(NRF_ESB_HOP_TIMER_IRQn);
+
+    return next > elapsed + ticks ? NRF_SUCCESS : NRF_ERROR_INVALID_PARAM;
+}
+
+
+uint32_t nrf_esb_survey_start(uint8_t const * p_channels, uint8_t count, uint16_t offset_us, uint8_t samples_per_hop)
+{
+    VERIFY_TRUE(m_hop_count > 0, NRF_ERROR_INVALID_STATE);
+    VERIFY_PARAM_NOT_NULL(p_channels);
+    VERIFY_TRUE(count > 0 && count <= NRF_ESB_SURVEY_MAX_CHANNELS, NRF_ERROR_INVALID_PARAM);
+    VERIFY_TRUE(offset_us < m_hop_period_us, NRF_ERROR_INVALID_PARAM);
+    VERIFY_TRUE(samples_per_hop > 0, NRF_ERROR_INVALID_PARAM);
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        VERIFY_TRUE(p_channels[i] <= 125, NRF_ERROR_INVALID_PARAM);
+    }
+
+    NVIC_DisableIRQ(NRF_ESB_HOP_TIMER_IRQn);
+    DISABLE_RF_IRQ();
+
+    if (count != m_survey_count || memcmp(m_survey_channels, p_channels, count) != 0)
+    {
+        memcpy(m_survey_channels, p_channels, count);
+        memset(m_survey_samples, 0, sizeof(m_survey_samples));
+        m_survey_pos = 0;
+    }
+    m_survey_count    = count;
+    m_survey_per_hop  = samples_per_hop;
+    m_survey_running  = true;
+
+    NRF_ESB_HOP_TIMER->CC[2]     = offset_us;
+    NRF_ESB_HOP_TIMER->EVENTS_COMPARE[2] = 0;
+    NRF_ESB_HOP_TIMER->INTENSET  = TIMER_INTENSET_COMPARE2_Msk;
+
+    ENABLE_RF_IRQ();
+    NVIC_EnableIRQ(NRF_ESB_HOP_TIMER_IRQn);
+
+    return NRF_SUCCESS;
+}
+
+
+uint32_t nrf_esb_survey_stop(void)
+{
+    NRF_ESB_HOP_TIMER->INTENCLR  = TIMER_INTENCLR_COMPARE2_Msk;
+    NRF_ESB_HOP_TIMER->EVENTS_COMPARE[2] = 0;
+
+    // A sample in progress still completes, the receiver then returns to the hop sequence
+    m_survey_running  = false;
+
+    return NRF_SUCCESS;
+}
+
+
+uint32_t nrf_esb_survey_get(uint8_t index, nrf_esb_survey_result_t * p_result)
+{
+    VERIFY_PARAM_NOT_NULL(p_result);
+    VERIFY_TRUE(index < m_survey_count, NRF_ERROR_INVALID_PARAM);
+
+    p_result->channel     = m_survey_channels[index];
+    p_result->noise_level = (uint8_t)((m_survey_levels[index] + 8) >> 4);
+    p_result->samples     = m_survey_samples[index];
+
+    return NRF_SUCCESS;
+}
+
+
+uint32_t nrf_esb_get_pipe_stats(uint8_t pipe, nrf_esb_pipe_stats_t * p_stats)
+{
+    uint32_t seq;
+
+    VERIFY_PARAM_NOT_NULL(p_stats);
+    VERIFY_TRUE(pipe < NRF_ESB_PIPE_COUNT, NRF_ERROR_INVALID_PARAM);
+
+    do
+    {
+        seq = m_stats_seq;
+        __DMB();
+        memcpy(p_stats, &m_pipe_stats[pipe], sizeof(nrf_esb_pipe_stats_t));
+        __DMB();
+    } while ((seq & 1) || (seq != m_stats_seq));
+
+    return NRF_SUCCESS;
+}
+
+
 uint32_t nrf_esb_set_tx_power(nrf_esb_tx_power_t tx_output_power)
 {
     VERIFY_TRUE(m_nrf_esb_mainstate == NRF_ESB_STATE_IDLE, NRF_ERROR_BUSY);
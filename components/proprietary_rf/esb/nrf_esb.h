@@ -54,16 +54,30 @@ extern "C" {
 #define     NRF_ESB_TX_FIFO_SIZE                8                   /**< The size of the transmission first-in, first-out buffer. */
 #define     NRF_ESB_RX_FIFO_SIZE                8                   /**< The size of the reception first-in, first-out buffer. */
 
+#define     NRF_ESB_RSSI_HIST_BUCKETS           8                   /**< Number of buckets in the RSSI histogram of each pipe. */
+#define     NRF_ESB_RSSI_HIST_FIRST_DBM         40                  /**< Upper edge of the second RSSI histogram bucket, in -dBm. */
+#define     NRF_ESB_RSSI_HIST_STEP_DBM          8                   /**< Width of an RSSI histogram bucket, in dBm. */
+
 // 252 is the largest possible payload size according to the nRF5 architecture.
 STATIC_ASSERT(NRF_ESB_MAX_PAYLOAD_LENGTH <= 252);
 
 #define     NRF_ESB_SYS_TIMER                   NRF_TIMER2          /**< The timer that is used by the module. */
 #define     NRF_ESB_SYS_TIMER_IRQ_Handler       TIMER2_IRQHandler   /**< The handler that is used by @ref NRF_ESB_SYS_TIMER. */
 
+#define     NRF_ESB_HOP_TIMER                   NRF_TIMER1          /**< The timer that is used by the channel hop sequencer and for packet timestamps. */
+#define     NRF_ESB_HOP_TIMER_IRQn              TIMER1_IRQn         /**< The interrupt of @ref NRF_ESB_HOP_TIMER. */
+#define     NRF_ESB_HOP_TIMER_IRQHandler        TIMER1_IRQHandler   /**< The handler that is used by @ref NRF_ESB_HOP_TIMER. */
+#define     NRF_ESB_HOP_MAX_CHANNELS            16                  /**< The maximum number of channels in a hop sequence. */
+#define     NRF_ESB_SURVEY_MAX_CHANNELS         64                  /**< The maximum number of channels in the RSSI survey. */
+#define     NRF_ESB_SURVEY_PERCENTILE           90                  /**< Percentile of the signal strength on a channel that is tracked as its noise level. */
+#define     NRF_ESB_SURVEY_STEP                 32                  /**< Largest correction of a noise level per sample, in 1/16 dB. */
+
 #define     NRF_ESB_PPI_TIMER_START             10                  /**< The PPI channel used for timer start. */
 #define     NRF_ESB_PPI_TIMER_STOP              11                  /**< The PPI channel used for timer stop. */
 #define     NRF_ESB_PPI_RX_TIMEOUT              12                  /**< The PPI channel used for RX time-out. */
 #define     NRF_ESB_PPI_TX_START                13                  /**< The PPI channel used for starting TX. */
+#define     NRF_ESB_PPI_RX_TIMESTAMP            14                  /**< The PPI channel used for capturing the end of a received packet. */
+#define     NRF_ESB_PPI_ADDRESS_TIMESTAMP       15                  /**< The PPI channel used for capturing the address of every packet. */
 
 // Interrupt flags
 #define     NRF_ESB_INT_TX_SUCCESS_MSK          0x01                /**< The flag used to indicate a success since the last event. */
@@ -103,7 +117,8 @@ STATIC_ASSERT(NRF_ESB_MAX_PAYLOAD_LENGTH <= 252);
                                 .radio_irq_priority     = 1,                                \
                                 .event_irq_priority     = 2,                                \
                                 .payload_length         = 32,                               \
-                                .selective_auto_ack     = false                             \
+                                .selective_auto_ack     = false,                            \
+                                .rx_overflow            = NRF_ESB_RX_OVERFLOW_WITHHOLD_ACK  \
 }
 
 
@@ -120,7 +135,8 @@ STATIC_ASSERT(NRF_ESB_MAX_PAYLOAD_LENGTH <= 252);
                                 .radio_irq_priority     = 1,                                \
                                 .event_irq_priority     = 2,                                \
                                 .payload_length         = 32,                               \
-                                .selective_auto_ack     = false                             \
+                                .selective_auto_ack     = false,                            \
+                                .rx_overflow            = NRF_ESB_RX_OVERFLOW_WITHHOLD_ACK  \
 }
 
 
@@ -192,12 +208,23 @@ typedef enum {
 } nrf_esb_tx_mode_t;
 
 
+/**@brief Enhanced ShockBurst handling of a received packet that finds the RX FIFO full. */
+typedef enum {
+    NRF_ESB_RX_OVERFLOW_DROP_NEWEST,    /**< Acknowledge the new packet and discard it. */
+    NRF_ESB_RX_OVERFLOW_DROP_OLDEST,    /**< Discard the oldest payload in the RX FIFO and queue the new packet in its place. */
+    NRF_ESB_RX_OVERFLOW_WITHHOLD_ACK    /**< Do not acknowledge the new packet, so that the transmitter retries it. In PTX mode, a payload in an acknowledgment is discarded. */
+} nrf_esb_rx_overflow_t;
+
+
 /**@brief Enhanced ShockBurst event IDs used to indicate the type of the event. */
 typedef enum
 {
     NRF_ESB_EVENT_TX_SUCCESS,   /**< Event triggered on TX success.     */
     NRF_ESB_EVENT_TX_FAILED,    /**< Event triggered on TX failure.     */
-    NRF_ESB_EVENT_RX_RECEIVED   /**< Event triggered on RX received.    */
+    NRF_ESB_EVENT_RX_RECEIVED,  /**< Event triggered on RX received. @c rx_count gives the number of payloads ready in the RX FIFO. */
+    NRF_ESB_EVENT_HOP,          /**< Event triggered when the hop sequencer selects the next channel. */
+    NRF_ESB_EVENT_RX_OVERFLOW,  /**< Event triggered when received packets found the RX FIFO full. @c rx_overflows gives their number. */
+    NRF_ESB_EVENT_HOP_DEADLINE  /**< Event triggered at the deadline set by @ref nrf_esb_hop_deadline_set, once per hop period. */
 } nrf_esb_evt_id_t;
 
 
@@ -205,6 +232,10 @@ typedef enum
  *
  * @details The payload is used both for transmissions and for acknowledging a
  *          received packet with a payload.
+ *
+ *          The FIFO slots of the module are payload structures, and the radio transmits from
+ *          and receives into them directly: @c rf_header holds the on-air length (or S0) and
+ *          S1 fields and is immediately followed by @c data.
 */
 typedef struct
 {
@@ -213,18 +244,65 @@ typedef struct
     int8_t  rssi;                                   /**< RSSI for the received packet. */
     uint8_t noack;                                  /**< Flag indicating that this packet will not be acknowledged. */
     uint8_t pid;                                    /**< PID assigned during communication. */
+    uint8_t hop_index;                              /**< Hop sequence index of the channel the packet was received on. */
+    uint16_t timestamp;                             /**< Time of the address of the received packet, see @ref nrf_esb_evt_t. */
+    uint8_t rf_header[2];                           /**< On-air packet header. Owned by the module. */
     uint8_t data[NRF_ESB_MAX_PAYLOAD_LENGTH];       /**< The payload data. */
 } nrf_esb_payload_t;
 
 
-/**@brief Enhanced ShockBurst event. */
+/**@brief Enhanced ShockBurst event.
+ *
+ * @details Timestamps are the value of @ref NRF_ESB_HOP_TIMER, in microseconds, captured by
+ *          PPI when the radio sent or received the packet address. While the hop sequencer
+ *          runs, the timer restarts at every hop, so a timestamp is the offset of the packet
+ *          into the hop period given by @c hop_index. Otherwise, the timer runs freely and
+ *          wraps around every 65.536 ms.
+ */
 typedef struct
 {
     nrf_esb_evt_id_t    evt_id;                     /**< Enhanced ShockBurst event ID. */
     uint32_t            tx_attempts;                /**< Number of TX retransmission attempts. */
+    uint8_t             hop_index;                  /**< Hop sequence index: of the last received packet for @ref NRF_ESB_EVENT_RX_RECEIVED, of the current channel otherwise. */
+    uint16_t            timestamp;                  /**< Time of the address of the last transmission for @ref NRF_ESB_EVENT_TX_SUCCESS and @ref NRF_ESB_EVENT_TX_FAILED, of the last received packet for @ref NRF_ESB_EVENT_RX_RECEIVED. */
+    uint32_t            rx_count;                   /**< Number of payloads in the RX FIFO when the event was dispatched. */
+    uint32_t            rx_overflows;               /**< Number of RX FIFO overflows since the previous @ref NRF_ESB_EVENT_RX_OVERFLOW. */
 } nrf_esb_evt_t;
 
 
+/**@brief Enhanced ShockBurst link statistics of one pipe.
+ *
+ * @details The counters start at zero at reset and wrap around; they are not cleared by
+ *          @ref nrf_esb_init. Take the difference of two snapshots to get rates.
+ *
+ *          Bucket 0 of @c rssi_histogram counts samples stronger than
+ *          -(@ref NRF_ESB_RSSI_HIST_FIRST_DBM + @ref NRF_ESB_RSSI_HIST_STEP_DBM) dBm, bucket i
+ *          counts samples down to -(@ref NRF_ESB_RSSI_HIST_FIRST_DBM + (i + 1) *
+ *          @ref NRF_ESB_RSSI_HIST_STEP_DBM) dBm, and the last bucket also counts all weaker
+ *          samples. Every packet with a matching address is sampled, including packets with a
+ *          CRC error and acknowledgments received in PTX mode.
+ */
+typedef struct
+{
+    uint32_t rx_packets;                                        /**< Packets received with a valid CRC, including duplicates and drops. */
+    uint32_t rx_crc_failures;                                   /**< Packets received with a CRC error. */
+    uint32_t rx_duplicates;                                     /**< Retransmitted packets that were acknowledged but not queued again. */
+    uint32_t rx_fifo_full_drops;                                /**< Packets that found the RX FIFO full, see @ref nrf_esb_rx_overflow_t. */
+    uint32_t tx_attempts;                                       /**< Transmissions, including retransmissions. */
+    uint32_t tx_failures;                                       /**< Payloads that were not acknowledged after all retransmissions. */
+    uint32_t rssi_histogram[NRF_ESB_RSSI_HIST_BUCKETS];         /**< Histogram of the received signal strength. */
+} nrf_esb_pipe_stats_t;
+
+
+/**@brief Noise level of one channel of the RSSI survey. */
+typedef struct
+{
+    uint8_t  channel;                                           /**< Channel number. */
+    uint8_t  noise_level;                                       /**< Signal strength that @ref NRF_ESB_SURVEY_PERCENTILE percent of the samples stay below, in -dBm. A higher value is a quieter channel. */
+    uint16_t samples;                                           /**< Number of samples taken, 0 if the noise level is not known yet. Saturates. */
+} nrf_esb_survey_result_t;
+
+
 /**@brief Definition of the event handler for the module. */
 typedef void (* nrf_esb_event_handler_t)(nrf_esb_evt_t const * p_event);
 
@@ -253,6 +331,7 @@ typedef struct
     uint8_t                 payload_length;         /**< Length of the payload (maximum length depends on the platforms that are used on each side). */
 
     bool                    selective_auto_ack;     /**< Enable or disable selective auto acknowledgment. */
+    nrf_esb_rx_overflow_t   rx_overflow;            /**< Handling of received packets while the RX FIFO is full. */
 } nrf_esb_config_t;
 
 
@@ -271,12 +350,33 @@ uint32_t nrf_esb_init(nrf_esb_config_t const * p_config);
  *
  * Calling this function stops ongoing communications without changing the queues.
  *
+ * It also stops @ref NRF_ESB_SYS_TIMER, which runs freely from @ref nrf_esb_start_rx on as the
+ * reference of @ref nrf_esb_start_tx_at, so that the 16 MHz clock can stop. The next reception
+ * or transmission starts it again.
+ *
  * @retval  NRF_SUCCESS             If Enhanced ShockBurst was suspended.
  * @retval  NRF_ERROR_BUSY          If the function failed because the radio is busy.
  */
 uint32_t nrf_esb_suspend(void);
 
 
+/**@brief Function for switching between PTX and PRX mode.
+ *
+ * Unlike a new call to @ref nrf_esb_init, this function keeps the radio configuration, the
+ * addresses, the PID state and the queued payloads. Only the role is changed; the next call to
+ * @ref nrf_esb_start_tx, @ref nrf_esb_write_payload or @ref nrf_esb_start_rx programs the
+ * radio for it.
+ *
+ * @param[in]   mode                Mode to switch to.
+ *
+ * @retval  NRF_SUCCESS             If the mode was set.
+ * @retval  NRF_INVALID_STATE       If the module is not initialized.
+ * @retval  NRF_ERROR_BUSY          If the module is not idle.
+ * @retval  NRF_ERROR_INVALID_PARAM If the mode is invalid.
+ */
+uint32_t nrf_esb_set_mode(nrf_esb_mode_t mode);
+
+
 /**@brief Function for disabling the Enhanced ShockBurst module.
  *
  * Calling this function disables the Enhanced ShockBurst module immediately.
@@ -315,6 +415,24 @@ bool nrf_esb_is_idle(void);
 uint32_t nrf_esb_write_payload(nrf_esb_payload_t const * p_payload);
 
 
+/**@brief Function for writing several payloads at once.
+ *
+ * The payloads are queued as by @ref nrf_esb_write_payload, but all of them become visible to
+ * the radio together. Either all payloads are queued or none is.
+ *
+ * @param[in]   p_payloads    Array of payloads to queue.
+ * @param[in]   count         Number of payloads in @p p_payloads.
+ *
+ * @retval  NRF_SUCCESS                     If all payloads were queued.
+ * @retval  NRF_ERROR_NULL                  If the required parameter was NULL.
+ * @retval  NRF_INVALID_STATE               If the module is not initialized.
+ * @retval  NRF_ERROR_NOT_SUPPORTED         If a payload has noack set, but selective acknowledgment is not enabled.
+ * @retval  NRF_ERROR_NO_MEM                If the TX FIFO does not have room for @p count payloads.
+ * @retval  NRF_ERROR_INVALID_LENGTH        If a payload length was invalid (zero or larger than the allowed maximum).
+ */
+uint32_t nrf_esb_write_payloads(nrf_esb_payload_t const * p_payloads, uint32_t count);
+
+
 /**@brief Function for reading an RX payload.
  *
  * @param[in,out]   p_payload   Pointer to the structure that contains information and state of the payload.
@@ -326,6 +444,54 @@ uint32_t nrf_esb_write_payload(nrf_esb_payload_t const * p_payload);
 uint32_t nrf_esb_read_rx_payload(nrf_esb_payload_t * p_payload);
 
 
+/**@brief Function for reading all ready RX payloads at once.
+ *
+ * Up to @p max_count payloads are copied, oldest first, and removed from the RX FIFO together.
+ * Giving an array of @ref NRF_ESB_RX_FIFO_SIZE payloads empties the FIFO. Payloads that
+ * @ref NRF_ESB_RX_OVERFLOW_DROP_OLDEST discards during the copy are left out.
+ *
+ * @param[out]  p_payloads    Array that receives the payloads.
+ * @param[in]   max_count     Number of payloads @p p_payloads can hold.
+ * @param[out]  p_count       Number of payloads read.
+ *
+ * @retval  NRF_SUCCESS                     If at least one payload was read.
+ * @retval  NRF_ERROR_NULL                  If a required parameter was NULL.
+ * @retval  NRF_INVALID_STATE               If the module is not initialized.
+ * @retval  NRF_ERROR_NOT_FOUND             If the RX FIFO is empty.
+ */
+uint32_t nrf_esb_read_rx_payloads(nrf_esb_payload_t * p_payloads, uint32_t max_count, uint32_t * p_count);
+
+
+/**@brief Function for accessing the oldest RX payload in place.
+ *
+ * The payload stays in the RX FIFO, and the radio does not reuse its slot, until
+ * @ref nrf_esb_release_rx_payload is called. Calling this function again before the
+ * release returns the same payload.
+ *
+ * @note @ref nrf_esb_flush_rx and @ref nrf_esb_disable discard a borrowed payload. With
+ *       @ref NRF_ESB_RX_OVERFLOW_DROP_OLDEST, a packet that finds the RX FIFO full also
+ *       discards it, and may overwrite it before the release.
+ *
+ * @param[out]  pp_payload  Pointer to the payload in the RX FIFO.
+ *
+ * @retval  NRF_SUCCESS                     If a payload was available.
+ * @retval  NRF_ERROR_NULL                  If the required parameter was NULL.
+ * @retval  NRF_INVALID_STATE               If the module is not initialized.
+ * @retval  NRF_ERROR_NOT_FOUND             If the RX FIFO is empty.
+ */
+uint32_t nrf_esb_borrow_rx_payload(nrf_esb_payload_t const ** pp_payload);
+
+
+/**@brief Function for removing the payload returned by @ref nrf_esb_borrow_rx_payload from the RX FIFO.
+ *
+ * @retval  NRF_SUCCESS                     If the payload was removed.
+ * @retval  NRF_INVALID_STATE               If the module is not initialized.
+ * @retval  NRF_ERROR_BUFFER_EMPTY          If the RX FIFO is empty.
+ * @retval  NRF_ERROR_INVALID_DATA          If the overflow policy discarded the payload while it was borrowed.
+ */
+uint32_t nrf_esb_release_rx_payload(void);
+
+
 /**@brief Function for starting transmission.
  *
  * @retval  NRF_SUCCESS                     If the TX started successfully.
@@ -335,6 +501,71 @@ uint32_t nrf_esb_read_rx_payload(nrf_esb_payload_t * p_payload);
 uint32_t nrf_esb_start_tx(void);
 
 
+/**@brief Function for starting transmission at a fixed time after the last received packet.
+ *
+ * While receiving, @ref NRF_ESB_SYS_TIMER runs freely and the end of every packet is captured
+ * by hardware. This function arms a timer compare that starts the radio on @p ticks after the
+ * end of the last packet that was received with a valid CRC, so the start of the transmission
+ * does not depend on interrupt latency. The reference is kept across @ref nrf_esb_stop_rx and
+ * @ref nrf_esb_set_mode, and is consumed by the next transmission.
+ *
+ * The timer runs at 1 MHz with 16 bits, so @p ticks is in microseconds and the function must
+ * be called less than 65 ms after the reference packet.
+ *
+ * @param[in]   ticks               Time from the end of the last received packet to the start
+ *                                  of the radio ramp-up, in microseconds.
+ *
+ * @retval  NRF_SUCCESS                     If the transmission was scheduled.
+ * @retval  NRF_ERROR_INVALID_STATE         If the module is not initialized, not in PTX mode or
+ *                                          no packet was received since the last transmission.
+ * @retval  NRF_ERROR_BUSY                  If the function failed because the radio is busy.
+ * @retval  NRF_ERROR_BUFFER_EMPTY          If the TX does not start because the FIFO buffer is empty.
+ * @retval  NRF_ERROR_TIMEOUT               If the requested time has already passed. The payload
+ *                                          stays in the TX FIFO.
+ */
+uint32_t nrf_esb_start_tx_at(uint16_t ticks);
+
+
+/**@brief Function for starting transmission at a fixed time after the last hop.
+ *
+ * Like @ref nrf_esb_start_tx_at, but timed from the last hop of the sequencer instead of a
+ * received packet. A device that missed a packet from its peer can still send when the peer
+ * expects it, as long as the sequencer follows the peer.
+ *
+ * @param[in]   ticks               Time from the last hop to the start of the radio ramp-up, in
+ *                                  microseconds.
+ *
+ * @retval  NRF_SUCCESS                     If the transmission was scheduled.
+ * @retval  NRF_ERROR_INVALID_STATE         If the module is not initialized, not in PTX mode or
+ *                                          the hop sequencer is not running.
+ * @retval  NRF_ERROR_BUSY                  If the function failed because the radio is busy.
+ * @retval  NRF_ERROR_BUFFER_EMPTY          If the TX does not start because the FIFO buffer is empty.
+ * @retval  NRF_ERROR_TIMEOUT               If the requested time has already passed. The payload
+ *                                          stays in the TX FIFO.
+ */
+uint32_t nrf_esb_start_tx_at_hop(uint16_t ticks);
+
+
+/**@brief Function for starting transmission at a fixed time before the next hop.
+ *
+ * Like @ref nrf_esb_start_tx_at_hop, but timed from the next hop. The next hop stays on time
+ * through a stop of @ref NRF_ESB_HOP_TIMER, see @ref nrf_esb_hop_paused, so a device can
+ * still send at a time it derived from a packet after the 16 MHz clock was off.
+ *
+ * @param[in]   ticks               Time from the start of the radio ramp-up to the next hop, in
+ *                                  microseconds.
+ *
+ * @retval  NRF_SUCCESS                     If the transmission was scheduled.
+ * @retval  NRF_ERROR_INVALID_STATE         If the module is not initialized, not in PTX mode or
+ *                                          the hop sequencer is not running.
+ * @retval  NRF_ERROR_BUSY                  If the function failed because the radio is busy.
+ * @retval  NRF_ERROR_BUFFER_EMPTY          If the TX does not start because the FIFO buffer is empty.
+ * @retval  NRF_ERROR_TIMEOUT               If the requested time has already passed. The payload
+ *                                          stays in the TX FIFO.
+ */
+uint32_t nrf_esb_start_tx_before_hop(uint16_t ticks);
+
+
 /**@brief Function for starting to transmit data from the FIFO buffer.
  *
  * @retval  NRF_SUCCESS                     If the transmission was started successfully.
@@ -480,6 +711,187 @@ uint32_t nrf_esb_set_rf_channel(uint32_t channel);
 uint32_t nrf_esb_rf_channel_get(uint32_t * p_channel);
 
 
+/**@brief Function for starting the channel hop sequencer.
+ *
+ * The sequencer changes the channel every @p period_us on @ref NRF_ESB_HOP_TIMER, from the
+ * timer interrupt and without stopping the module. A receiver that is listening is retuned
+ * right away. A hop that falls into a packet or a PTX transaction takes effect when the
+ * packet or transaction ends, so no packet is cut. Every hop is reported with
+ * @ref NRF_ESB_EVENT_HOP.
+ *
+ * The current channel is kept until the first hop, which selects @p p_channels[0]. The
+ * sequencer overrides the channel set by @ref nrf_esb_set_rf_channel. Calling this function
+ * while the sequencer runs restarts it with the new table and period.
+ *
+ * @param[in]   p_channels          Channel table. It is copied.
+ * @param[in]   count               Number of channels in the table.
+ * @param[in]   period_us           Time between two hops, in microseconds.
+ *
+ * @retval  NRF_SUCCESS                     If the sequencer was started.
+ * @retval  NRF_ERROR_INVALID_STATE         If the module is not initialized.
+ * @retval  NRF_ERROR_NULL                  If the required parameter was NULL.
+ * @retval  NRF_ERROR_INVALID_PARAM         If @p count or @p period_us is out of range.
+ */
+uint32_t nrf_esb_hop_start(uint8_t const * p_channels, uint8_t count, uint16_t period_us);
+
+
+/**@brief Function for aligning the hop sequencer with a peer.
+ *
+ * Selects the channel at @p index right away and moves the next hop to @p ticks after the end
+ * of the last packet received with a valid CRC, or after the call if no packet was received
+ * since the last transmission. Later hops follow every hop period.
+ *
+ * @param[in]   index               Hop sequence index to select.
+ * @param[in]   ticks               Time from the end of the last received packet to the next
+ *                                  hop, in microseconds.
+ *
+ * @retval  NRF_SUCCESS                     If the sequencer was aligned.
+ * @retval  NRF_ERROR_INVALID_STATE         If the sequencer is not running.
+ * @retval  NRF_ERROR_INVALID_PARAM         If @p index is outside of the channel table.
+ */
+uint32_t nrf_esb_hop_sync(uint8_t index, uint16_t ticks);
+
+
+/**@brief Function for replacing one channel of the running hop sequence.
+ *
+ * The timing of the sequencer is not affected. The new channel is used from the next hop that
+ * selects @p index on; the channel the module is tuned to now is kept.
+ *
+ * @param[in]   index               Hop sequence index of the channel to replace.
+ * @param[in]   channel             New channel.
+ *
+ * @retval  NRF_SUCCESS                     If the channel was replaced.
+ * @retval  NRF_ERROR_INVALID_STATE         If the sequencer is not running.
+ * @retval  NRF_ERROR_INVALID_PARAM         If @p index is outside of the channel table, or
+ *                                          @p channel is out of range.
+ */
+uint32_t nrf_esb_hop_channel_set(uint8_t index, uint8_t channel);
+
+
+/**@brief Function for stopping the channel hop sequencer.
+ *
+ * The module stays on the current channel. The RSSI survey stops as well.
+ *
+ * @retval  NRF_SUCCESS                     If the sequencer was stopped.
+ */
+uint32_t nrf_esb_hop_stop(void);
+
+
+/**@brief Function for setting a deadline in every hop period.
+ *
+ * @ref NRF_ESB_EVENT_HOP_DEADLINE is reported @p ticks after every hop, so that the application
+ * can tell in time that a packet it expected early in the period did not come. The period in
+ * which @ref nrf_esb_hop_sync is called has no deadline. @ref nrf_esb_hop_start and
+ * @ref nrf_esb_hop_stop remove the deadline.
+ *
+ * @param[in]   ticks               Time from the hop to the deadline, in microseconds. 0
+ *                                  removes the deadline.
+ *
+ * @retval  NRF_SUCCESS                     If the deadline was set.
+ * @retval  NRF_ERROR_INVALID_STATE         If the sequencer is not running.
+ * @retval  NRF_ERROR_INVALID_PARAM         If @p ticks is not shorter than the hop period.
+ */
+uint32_t nrf_esb_hop_deadline_set(uint16_t ticks);
+
+
+/**@brief Function for getting the time until the next hop.
+ *
+ * @param[out]  p_ticks             Time until the next hop, in microseconds.
+ *
+ * @retval  NRF_SUCCESS                     If the time was written to @p p_ticks.
+ * @retval  NRF_ERROR_NULL                  If the required parameter was NULL.
+ * @retval  NRF_ERROR_INVALID_STATE         If the sequencer is not running.
+ * @retval  NRF_ERROR_BUSY                  If the deadline of the current hop period is still
+ *                                          to come.
+ */
+uint32_t nrf_esb_hop_time_left(uint16_t * p_ticks);
+
+
+/**@brief Function for keeping the next hop on time after @ref NRF_ESB_HOP_TIMER was stopped.
+ *
+ * The application may stop the hop timer through PPI while the 16 MHz clock is off, and start
+ * it again a known time later. This function moves the next hop earlier by that time, so that
+ * it comes when it would have without the stop. Call it while the timer is stopped, before
+ * the next hop and with no deadline to come, see @ref nrf_esb_hop_time_left.
+ *
+ * @param[in]   ticks               Time the timer stands still, in microseconds.
+ *
+ * @retval  NRF_SUCCESS                     If the next hop was moved.
+ * @retval  NRF_ERROR_INVALID_STATE         If the sequencer is not running.
+ * @retval  NRF_ERROR_INVALID_PARAM         If @p ticks is not shorter than the time left until
+ *                                          the next hop. The hop comes right after the timer
+ *                                          starts again.
+ */
+uint32_t nrf_esb_hop_paused(uint16_t ticks);
+
+
+/**@brief Function for starting the RSSI survey.
+ *
+ * The survey measures the noise on channels other than the one in use, in the idle part of
+ * every hop period. At @p offset_us after each hop, a receiver that is listening in PRX mode
+ * with no packet on air is tuned to the next @p samples_per_hop channels of the table in turn.
+ * Each is sampled once, and the receiver returns to the channel of the hop sequencer. The
+ * survey is driven by the radio and hop timer interrupts; no function call blocks on it. A hop
+ * period in which the receiver is busy is skipped.
+ *
+ * Every channel keeps a running estimate of the level that @ref NRF_ESB_SURVEY_PERCENTILE
+ * percent of its samples stay below, so that a channel with bursty interference does not look
+ * as quiet as its average. The estimate moves by at most @ref NRF_ESB_SURVEY_STEP per sample.
+ *
+ * Starting the survey again with the same table keeps the estimates. The survey stops with the
+ * hop sequencer.
+ *
+ * @param[in]   p_channels          Channel table. It is copied. A channel may appear more than once.
+ * @param[in]   count               Number of channels in the table.
+ * @param[in]   offset_us           Start of the idle part of the hop period, in microseconds.
+ * @param[in]   samples_per_hop     Number of channels sampled per hop period. Every sample takes
+ *                                  a receiver ramp-up, and one more ramp-up returns to the hop
+ *                                  sequence.
+ *
+ * @retval  NRF_SUCCESS                     If the survey was started.
+ * @retval  NRF_ERROR_INVALID_STATE         If the hop sequencer is not running.
+ * @retval  NRF_ERROR_NULL                  If the required parameter was NULL.
+ * @retval  NRF_ERROR_INVALID_PARAM         If @p count, a channel, @p offset_us or
+ *                                          @p samples_per_hop is out of range.
+ */
+uint32_t nrf_esb_survey_start(uint8_t const * p_channels, uint8_t count, uint16_t offset_us, uint8_t samples_per_hop);
+
+
+/**@brief Function for stopping the RSSI survey. The estimates are kept.
+ *
+ * @retval  NRF_SUCCESS                     If the survey was stopped.
+ */
+uint32_t nrf_esb_survey_stop(void);
+
+
+/**@brief Function for reading the noise level of a channel of the RSSI survey.
+ *
+ * @param[in]   index       Index of the channel in the survey table.
+ * @param[out]  p_result    Pointer to the structure that receives the noise level.
+ *
+ * @retval  NRF_SUCCESS                     If the noise level was read.
+ * @retval  NRF_ERROR_NULL                  If the required parameter was NULL.
+ * @retval  NRF_ERROR_INVALID_PARAM         If @p index is outside of the survey table.
+ */
+uint32_t nrf_esb_survey_get(uint8_t index, nrf_esb_survey_result_t * p_result);
+
+
+/**@brief Function for reading the link statistics of a pipe.
+ *
+ * The statistics are updated by the radio interrupt. The snapshot is consistent without
+ * disabling interrupts: the copy is repeated if a radio interrupt ran while it was taken.
+ * Do not call this function from an interrupt with a higher priority than the radio interrupt.
+ *
+ * @param[in]   pipe        Pipe number.
+ * @param[out]  p_stats     Pointer to the structure that receives the snapshot.
+ *
+ * @retval  NRF_SUCCESS                     If the snapshot was taken.
+ * @retval  NRF_ERROR_NULL                  If the required parameter was NULL.
+ * @retval  NRF_ERROR_INVALID_PARAM         If @p pipe is not a valid pipe number.
+ */
+uint32_t nrf_esb_get_pipe_stats(uint8_t pipe, nrf_esb_pipe_stats_t * p_stats);
+
+
 /**@brief Function for setting the radio output power.
  *
  * @param[in]   tx_output_power    Output power.
@@ -0,0 +1,187 @@
+/* Copyright (c) 2016 Nordic Semiconductor. All Rights Reserved.
+ *
+ * The information contained herein is property of Nordic Semiconductor ASA.
+ * Terms and conditions of usage are described in detail in NORDIC
+ * SEMICONDUCTOR STANDARD SOFTWARE LICENSE AGREEMENT.
+ *
+ * Licensees are granted free, non-transferable use of the information. NO
+ * WARRANTY of ANY KIND is provided. This heading must NOT be removed from
+ * the file.
+ *
+ */
+
+#ifndef NRF_ESB_FIFO_H__
+#define NRF_ESB_FIFO_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "nrf.h"
+#include "nrf_esb.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @defgroup nrf_esb_fifo ESB payload FIFO
+ * @{
+ * @ingroup nrf_esb
+ *
+ * @brief Single-producer, single-consumer queue of payload slots.
+ *
+ * @details The producer only writes @c write_pos and the consumer only writes @c read_pos.
+ *          Both positions run freely and are masked on use, as in @ref app_fifo, so no
+ *          critical section is needed as long as each side stays in one context. The
+ *          producer fills the slots returned by @ref nrf_esb_fifo_write_slot in place and
+ *          publishes them with @ref nrf_esb_fifo_commit; the consumer uses the slots returned by
+ *          @ref nrf_esb_fifo_read_slot in place and frees them with @ref nrf_esb_fifo_release.
+ *          Several slots can be passed with one position update.
+ */
+
+/**@brief Payload FIFO. */
+typedef struct
+{
+    nrf_esb_payload_t * p_slots;        /**< Payload slots. */
+    uint32_t            size_mask;      /**< Number of slots minus one. The number of slots must be a power of two. */
+    volatile uint32_t   write_pos;      /**< Number of payloads committed. Only written by the producer. */
+    volatile uint32_t   read_pos;       /**< Number of payloads released. Only written by the consumer. */
+} nrf_esb_fifo_t;
+
+
+/**@brief Function for initializing an empty FIFO. */
+static __INLINE void nrf_esb_fifo_init(nrf_esb_fifo_t * p_fifo, nrf_esb_payload_t * p_slots, uint32_t size)
+{
+    p_fifo->p_slots   = p_slots;
+    p_fifo->size_mask = size - 1;
+    p_fifo->write_pos = 0;
+    p_fifo->read_pos  = 0;
+}
+
+
+/**@brief Function for getting the number of committed payloads. Safe from either side. */
+static __INLINE uint32_t nrf_esb_fifo_length(nrf_esb_fifo_t const * p_fifo)
+{
+    return p_fifo->write_pos - p_fifo->read_pos;
+}
+
+
+/**@brief Function for getting the number of free slots. */
+static __INLINE uint32_t nrf_esb_fifo_space(nrf_esb_fifo_t const * p_fifo)
+{
+    return p_fifo->size_mask + 1 - nrf_esb_fifo_length(p_fifo);
+}
+
+
+/**@brief Function for checking whether the producer has a free slot. */
+static __INLINE bool nrf_esb_fifo_is_full(nrf_esb_fifo_t const * p_fifo)
+{
+    return nrf_esb_fifo_length(p_fifo) > p_fifo->size_mask;
+}
+
+
+/**@brief Function for getting the free slot @p index positions after the next one to fill.
+ *
+ * Only valid if @p index is smaller than @ref nrf_esb_fifo_space.
+ */
+static __INLINE nrf_esb_payload_t * nrf_esb_fifo_write_slot(nrf_esb_fifo_t const * p_fifo, uint32_t index)
+{
+    return &p_fifo->p_slots[(p_fifo->write_pos + index) & p_fifo->size_mask];
+}
+
+
+/**@brief Function for publishing @p count slots returned by @ref nrf_esb_fifo_write_slot to the consumer. */
+static __INLINE void nrf_esb_fifo_commit(nrf_esb_fifo_t * p_fifo, uint32_t count)
+{
+    // The slot contents must be visible before the new position
+    __DMB();
+    p_fifo->write_pos = p_fifo->write_pos + count;
+}
+
+
+/**@brief Function for getting the committed slot @p index positions after the oldest one.
+ *
+ * Only valid if @p index is smaller than @ref nrf_esb_fifo_length.
+ */
+static __INLINE nrf_esb_payload_t * nrf_esb_fifo_read_slot(nrf_esb_fifo_t const * p_fifo, uint32_t index)
+{
+    // The slot contents must not be read before the position that published them
+    __DMB();
+    return &p_fifo->p_slots[(p_fifo->read_pos + index) & p_fifo->size_mask];
+}
+
+
+/**@brief Function for handing the @p count oldest slots back to the producer. */
+static __INLINE void nrf_esb_fifo_release(nrf_esb_fifo_t * p_fifo, uint32_t count)
+{
+    // The slots must be read completely before the producer may reuse them
+    __DMB();
+    p_fifo->read_pos = p_fifo->read_pos + count;
+}
+
+
+/**@brief Function for discarding the oldest committed slot from the producer side.
+ *
+ * @details This is the only producer operation that writes @c read_pos. A FIFO that uses it must
+ *          be released with @ref nrf_esb_fifo_release_from, in a critical section against the
+ *          producer, instead of with @ref nrf_esb_fifo_release.
+ */
+static __INLINE void nrf_esb_fifo_discard_oldest(nrf_esb_fifo_t * p_fifo)
+{
+    p_fifo->read_pos = p_fifo->read_pos + 1;
+}
+
+
+/**@brief Function for getting the position of the oldest committed slot. */
+static __INLINE uint32_t nrf_esb_fifo_read_pos(nrf_esb_fifo_t const * p_fifo)
+{
+    return p_fifo->read_pos;
+}
+
+
+/**@brief Function for getting the slot at a position returned by @ref nrf_esb_fifo_read_pos. */
+static __INLINE nrf_esb_payload_t * nrf_esb_fifo_slot_at(nrf_esb_fifo_t const * p_fifo, uint32_t pos)
+{
+    __DMB();
+    return &p_fifo->p_slots[pos & p_fifo->size_mask];
+}
+
+
+/**@brief Function for releasing @p count slots read from position @p pos.
+ *
+ * @details Slots the producer discarded with @ref nrf_esb_fifo_discard_oldest in the meantime
+ *          are not released twice.
+ *
+ * @return  Number of the slots from @p pos that the producer discarded. Their contents may have
+ *          been overwritten while the consumer read them.
+ */
+static __INLINE uint32_t nrf_esb_fifo_release_from(nrf_esb_fifo_t * p_fifo, uint32_t pos, uint32_t count)
+{
+    uint32_t discarded;
+
+    __DMB();
+    discarded = p_fifo->read_pos - pos;
+
+    if (discarded < count)
+    {
+        p_fifo->read_pos = pos + count;
+    }
+
+    return discarded;
+}
+
+
+/**@brief Function for releasing all committed slots. Must be called by the consumer. */
+static __INLINE void nrf_esb_fifo_release_all(nrf_esb_fifo_t * p_fifo)
+{
+    __DMB();
+    p_fifo->read_pos = p_fifo->write_pos;
+}
+
+/** @} */
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NRF_ESB_FIFO_H__ */
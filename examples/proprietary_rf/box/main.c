@@ -27,74 +27,117 @@
 #include "app_util_platform.h"
 #include "nrf_nvmc.h"
 #include "app_common.h"
+#include "app_tdma.h"
+#include "app_timesync.h"
+#include "app_store.h"
+#include "app_scheduler.h"
 
 #define NRF_LOG_MODULE_NAME "APP"
 #include "nrf_log.h"
 #include "nrf_log_ctrl.h"
 
 #define MODE_NORMAL					0
-#define MODE_CHANNEL_PICKING		1
 #define MODE_PAIRING				2
 
 #define MAXIMUM_PAIRING_TIMEOUT_MS				30000	//0.5 min
-
-#define M_ESB_STOP_RX_WAIT_IDLE()				do{\
-												if(!nrf_esb_is_idle()){\
-												  if(nrf_esb_stop_rx() != NRF_SUCCESS){\
-													  esb_init(false);\
-												  }\
-												}\
-												}while(0)
+#define PAIRING_QUIET_MS						100		//with every slot granted, pairing ends once no device asked for this long.
 
 
 typedef struct {
 	
 	uint32_t signature;
+	link_params_t link;
 	uint8_t chlist[MAXIMUM_CHANNEL_LIST_SIZE];
-	uint8_t display_slot_idx;
-	uint8_t controller_slot_idx;
+	uint8_t chip_ids[MAXIMUM_DEV][CHIP_ID_LENGTH];	//slot table. Device N has the chip ID at N - 1, all 0xff if the slot is free.
 	
 } ds_data_t;
 
 /* function prototype */
-void interval_timer_init(void);
-void interval_timer_start(void);
-void interval_timer_stop(void);
 uint32_t esb_init( bool is_ptx );
 void enter_setup_mode(void);
 void enter_normal_mode(void);
-void interval_timer_event_handler(void);
 
 const uint8_t gca_pairing_chlist[MAXIMUM_CHANNEL_LIST_SIZE] = DEFAULT_PAIRING_CHANNEL_LIST;
-#if USE_SCHEME_2
-const uint8_t gca_available_chlist[MAXIMUM_CHANNEL_LIST_SIZE][MAXIMUM_CHANNELS_PER_REGION] = {
-									REGION1_CHANNEL_LIST,
-									REGION3_CHANNEL_LIST,
-									REGION5_CHANNEL_LIST};
-#else
 const uint8_t gca_available_chlist[MAXIMUM_CHANNEL_LIST_SIZE][MAXIMUM_CHANNELS_PER_REGION] = {
 									REGION1_CHANNEL_LIST,
 									REGION2_CHANNEL_LIST,				
 									REGION3_CHANNEL_LIST,
 									REGION4_CHANNEL_LIST,
 									REGION5_CHANNEL_LIST};
-#endif
+static const link_params_t gc_pairing_link = PAIRING_LINK_PARAMS;
 									
 uint8_t ga_chlist[MAXIMUM_CHANNEL_LIST_SIZE] = {0};				
 uint8_t g_mode = MODE_NORMAL;
 bool g_esb_init = false;
 uint32_t g_pairing_timeout = 0;						
+bool g_chlist_picked = false;						//the channel list was given to a device in this setup.
 uint8_t g_cur_ch_idx = 0;
-static nrf_esb_payload_t  g_beacon = NRF_ESB_CREATE_PAYLOAD(0, BEACON_BYTE1, BEACON_BYTE2, 0xee, 0xdd, 0xee, 0xdd, 0xee, 0xdd, 0xee, 0xdd);
-nrf_esb_payload_t rx_payload;
+uint8_t g_cur_subframe = 0;
+uint32_t g_frame_period_ms;
+static nrf_esb_payload_t  g_beacon = NRF_ESB_CREATE_PAYLOAD(0, BEACON_BYTE1, BEACON_BYTE2, 0xee, 0xdd, 0xee, 0xdd, 0xee, 0xdd, 0xee, 0xdd, 0xee,
+																			0xdd, 0xee, 0xdd, 0xee, 0xdd, 0xee, 0xdd, 0xee, 0xdd, 0xee, 0xdd);
+static nrf_esb_payload_t g_rx_payloads[NRF_ESB_RX_FIFO_SIZE];
 uint8_t g_base_addr_1[4];
 ds_data_t g_ds;
-uint8_t g_cur_pairing_dev_type;
+pair_info_t g_pair_info;								//queued as the ack payload of the next pairing request.
+uint32_t g_pair_quiet_ms = 0;							//left until pairing may end, restarted by every pairing packet.
+uint32_t g_join_timeout_ms = 0;							//left until joining ends. 0 while the box takes no device.
+uint8_t g_join_dev_idx = 0;								//device that joined in this window.
+bool g_join_heard = false;								//the device that joined answered in its slot.
+bool g_button_3_down = false;
+uint32_t ga_dev_heard[MAXIMUM_DEV];						//beacon count at the last response of each device.
+
+uint32_t g_devs_paired_mask = 0;						//bit DEV_MASK(N) for device N.
+uint32_t g_devs_data_recv_mask = 0;
+uint32_t g_cycle_ask_mask = 0;							//devices due to report new data in the current cycle.
+uint32_t g_report_cycle = 0;
+uint32_t g_beacon_counter = 0;							//beacons sent.
+uint32_t g_beacon_stamp = 0;							//box time of the address of the last beacon sent.
+uint32_t g_sync_pulse_time;
+bool g_first_try_pending = false;
+
+#if ADAPTIVE_SCHEME_SWITCHING
+uint8_t ga_adapt_history[(ADAPT_WINDOW_CYCLES + 7) / 8];	//1 for every cycle with a first try loss.
+uint8_t g_adapt_idx;
+uint8_t g_adapt_samples;
+uint8_t g_adapt_losses;
+#endif
+
+#if ADAPTIVE_FREQUENCY_HOPPING
+typedef struct {
+	
+	uint16_t expected;	//responses asked for on this channel since the last evaluation.
+	uint16_t lost;
+	uint16_t received;
+	uint32_t rssi_sum;	//of the received responses, in -dBm.
+	
+} afh_stats_t;
 
-#ifdef USE_SCHEME_2
-uint8_t g_devs_paired_mask = 0;
-uint8_t g_devs_data_recv_mask = 0;
+//Responses of one frame, handed from the radio interrupt to the main loop.
+typedef struct {
+	
+	uint32_t ask_mask;	//devices asked to respond.
+	uint32_t recv_mask;
+	uint32_t rssi_sum;	//of the received responses, in -dBm.
+	uint16_t received;
+	uint8_t idx;		//hop index of the frame.
+	
+} afh_frame_t;
+
+afh_stats_t ga_afh_stats[MAXIMUM_CHANNEL_LIST_SIZE];		//only used from the main loop.
+uint16_t ga_afh_blacklist[MAXIMUM_CHANNEL_LIST_SIZE];	//per region. Bit k stands for gca_available_chlist[region][k].
+afh_frame_t g_afh_frame;								//responses of the current frame.
+uint8_t g_afh_idx = BEACON_NO_MAP_ENTRY;				//hop index of the announced channel change.
+uint8_t g_afh_ch;
+uint8_t g_afh_countdown;
+uint8_t g_afh_refresh_idx = 0;							//map entry repeated in the beacons while no change is announced.
+uint8_t g_afh_silent_frames = 0;						//frames in a row in which no device answered.
+
+#define SCHED_MAX_EVENT_DATA_SIZE	MAX(sizeof(afh_frame_t), sizeof(nrf_esb_payload_t))
+#else
+#define SCHED_MAX_EVENT_DATA_SIZE	sizeof(nrf_esb_payload_t)	//a pairing request, answered in the main loop.
 #endif
+#define SCHED_QUEUE_SIZE			8
 
 void nrf_esb_error_handler(uint32_t err_code, uint32_t line)
 {
@@ -118,34 +161,347 @@ void nrf_esb_error_handler(uint32_t err_code, uint32_t line)
 /*lint -save -esym(40, BUTTON_1) -esym(40, BUTTON_2) -esym(40, BUTTON_3) -esym(40, BUTTON_4) -esym(40, LED_1) -esym(40, LED_2) -esym(40, LED_3) -esym(40, LED_4) */
 
 
-static void hop_channel(){
+//Load the frame schedule of a set of link parameters. It takes effect with the next app_tdma_master_start().
+static void schedule_load(link_params_t const * p_link){
+	
+	app_tdma_schedule_t schedule = APP_TDMA_SCHEDULE(*p_link);
+	
+	APP_ERROR_CHECK(app_tdma_init(&schedule));
+	g_frame_period_ms = p_link->frame_period_us / 1000;
+}
+
+//Survey the channels of all regions in the idle end of every frame, after the last response slot.
+static void survey_start(link_params_t const * p_link){
+	
+	app_tdma_schedule_t schedule = APP_TDMA_SCHEDULE(*p_link);
+	
+	APP_ERROR_CHECK(nrf_esb_survey_start(&gca_available_chlist[0][0], MAXIMUM_CHANNEL_LIST_SIZE * MAXIMUM_CHANNELS_PER_REGION,
+										 (uint16_t)app_tdma_frame_busy_us(&schedule), SURVEY_SAMPLES_PER_FRAME));
+}
+
+#if ADAPTIVE_SCHEME_SWITCHING
+static void adapt_reset(){
+	
+	memset(ga_adapt_history, 0, sizeof(ga_adapt_history));
+	g_adapt_idx = 0;
+	g_adapt_samples = 0;
+	g_adapt_losses = 0;
+}
+
+//Record one cycle in the sliding window. The oldest cycle drops out once the window is full.
+static void adapt_sample(bool is_lossy){
+	
+	uint8_t *p_byte = &ga_adapt_history[g_adapt_idx / 8];
+	uint8_t bit = (uint8_t)(0x01 << (g_adapt_idx % 8));
+	
+	if(g_adapt_samples == ADAPT_WINDOW_CYCLES){
+		if(*p_byte & bit) g_adapt_losses--;
+	}
+	else{
+		g_adapt_samples++;
+	}
+	
+	if(is_lossy){
+		*p_byte |= bit;
+		g_adapt_losses++;
+	}
+	else{
+		*p_byte &= (uint8_t)~bit;
+	}
+	
+	g_adapt_idx++;
+	if(g_adapt_idx >= ADAPT_WINDOW_CYCLES){
+		g_adapt_idx = 0;
+	}
+}
+
+//Move all devices to the other scheme when the loss over a full window crosses its threshold.
+//Only the retry frames change. The frame timing stays the same, so the devices keep their sync.
+static void adapt_update(){
+	
+	uint8_t scheme;
+	
+	if(g_adapt_samples < ADAPT_WINDOW_CYCLES) return;
+	
+	if(g_ds.link.scheme == APP_SCHEME_1 && g_adapt_losses * 100 > ADAPT_LOSS_HIGH_PERCENT * ADAPT_WINDOW_CYCLES){
+		scheme = APP_SCHEME_2;
+	}
+	else if(g_ds.link.scheme == APP_SCHEME_2 && g_adapt_losses * 100 < ADAPT_LOSS_LOW_PERCENT * ADAPT_WINDOW_CYCLES){
+		scheme = APP_SCHEME_1;
+	}
+	else{
+		return;
+	}
+	
+	//Not written to flash. The box starts with the scheme picked in setup mode after a reset.
+	link_params_switch(&g_ds.link, scheme);
+	APP_ERROR_CHECK(app_tdma_subframes_set(g_ds.link.retry_count + 1));
+	adapt_reset();
+	
+	NRF_LOG_INFO("Switched to scheme %d\r\n", scheme);
+}
+#endif
+
+//Region of the channel at a hop index. A shorter channel list is spread over the whole band.
+static uint8_t chlist_region(uint8_t idx){
+	
+	return (g_ds.link.chlist_size > 1) ? idx * (MAXIMUM_CHANNEL_LIST_SIZE - 1) / (g_ds.link.chlist_size - 1) : 0;
+}
+
+//Noise level of a channel of a region, in -dBm. Higher is quieter. A channel not surveyed yet counts as the loudest.
+static uint8_t survey_level(uint8_t region, uint8_t k){
+	
+	nrf_esb_survey_result_t result;
+	
+	if(nrf_esb_survey_get(region * MAXIMUM_CHANNELS_PER_REGION + k, &result) != NRF_SUCCESS || result.samples == 0){
+		return 0;
+	}
+	return result.noise_level;
+}
+
+//Pick the quietest channel of every region from the survey so far. The list is fixed once a device got it.
+static void chlist_pick(){
+	
+	uint8_t i, j, k, region, best;
+	
+	if(g_chlist_picked) return;
+	
+	for(i = 0; i < g_ds.link.chlist_size; i++){
+		
+		region = chlist_region(i);
+		best = 0xff;
+		
+		for(k = 0; k < MAXIMUM_CHANNELS_PER_REGION; k++){
+			
+			//regions may share a channel. Never use one twice.
+			for(j = 0; j < i && g_ds.chlist[j] != gca_available_chlist[region][k]; j++);
+			if(j < i) continue;
+			
+			if(best == 0xff || survey_level(region, k) > survey_level(region, best)){
+				best = k;
+			}
+		}
+		
+		g_ds.chlist[i] = gca_available_chlist[region][best];
+		NRF_LOG_INFO("Channel %d picked, %d dBm.\r\n", g_ds.chlist[i], -(int32_t)survey_level(region, best));
+	}
+	
+	g_chlist_picked = true;
+}
+
+#if ADAPTIVE_FREQUENCY_HOPPING
+//Blacklist the channel at a hop index and announce the quietest other channel of its region in its place, as surveyed.
+static void afh_replace(uint8_t idx){
+	
+	uint8_t region = chlist_region(idx);
+	uint16_t current = 0;
+	uint8_t i, k, best;
+	
+	for(k = 0; k < MAXIMUM_CHANNELS_PER_REGION; k++){
+		if(gca_available_chlist[region][k] == ga_chlist[idx]){
+			current = (uint16_t)(0x01 << k);
+		}
+	}
+	ga_afh_blacklist[region] |= current;
+	
+	for(;;){
+		
+		best = 0xff;
+		for(k = 0; k < MAXIMUM_CHANNELS_PER_REGION; k++){
+			
+			if(ga_afh_blacklist[region] & (0x01 << k)) continue;
+			
+			//regions may share a channel. Never use one twice.
+			for(i = 0; i < g_ds.link.chlist_size && ga_chlist[i] != gca_available_chlist[region][k]; i++);
+			if(i < g_ds.link.chlist_size) continue;
+			
+			if(best == 0xff || survey_level(region, k) > survey_level(region, best)){
+				best = k;
+			}
+		}
+		
+		if(best != 0xff || ga_afh_blacklist[region] == current) break;
+		
+		//Every other channel of the region was blacklisted before. Give them another chance.
+		ga_afh_blacklist[region] = current;
+	}
+	
+	if(best == 0xff) return;
+	
+	//the radio interrupt announces the change from the next beacon on.
+	CRITICAL_REGION_ENTER();
+	g_afh_idx = idx;
+	g_afh_ch = gca_available_chlist[region][best];
+	g_afh_countdown = AFH_ANNOUNCE_LISTS * g_ds.link.chlist_size;
+	CRITICAL_REGION_EXIT();
+	
+	NRF_LOG_INFO("Channel %d blacklisted, %d dBm. Channel %d follows.\r\n", ga_chlist[idx],
+				 ga_afh_stats[idx].received ? -(int32_t)(ga_afh_stats[idx].rssi_sum / ga_afh_stats[idx].received) : 0, g_afh_ch);
+}
+
+//Account for the responses of a frame that ended. Runs in the main loop.
+static void afh_frame_end(void * p_event_data, uint16_t event_size){
+	
+	afh_frame_t const *p_frame = (afh_frame_t const *)p_event_data;
+	afh_stats_t *p_stats = &ga_afh_stats[p_frame->idx];
+	
+	if(p_frame->recv_mask){
+		g_afh_silent_frames = 0;
+	}
+	else if(p_frame->ask_mask && g_afh_silent_frames < 0xff){
+		g_afh_silent_frames++;
+	}
+	if(g_afh_silent_frames >= g_ds.link.chlist_size){
+		//Nobody answered on any channel for a whole pass: the whole band is jammed, or the devices lost sync.
+		//That tells nothing about single channels. Drop what this pass added, or the devices come back to a map
+		//they no longer know.
+		memset(ga_afh_stats, 0, sizeof(ga_afh_stats));
+		return;
+	}
+	
+	p_stats->expected += bit_count(p_frame->ask_mask);
+	p_stats->lost += bit_count(p_frame->ask_mask & ~p_frame->recv_mask);
+	p_stats->received += p_frame->received;
+	p_stats->rssi_sum += p_frame->rssi_sum;
+	
+	if(p_stats->expected < AFH_WINDOW_RESPONSES) return;
+	
+	if(g_afh_idx == BEACON_NO_MAP_ENTRY && p_stats->lost * 100 > AFH_LOSS_PERCENT * p_stats->expected){
+		afh_replace(p_frame->idx);
+	}
+	memset(p_stats, 0, sizeof(afh_stats_t));
+}
+
+//Hand the responses of the frame that just ended, on the channel at hop index idx, to the main loop. A frame the
+//queue has no room for is left out of the statistics.
+static void afh_frame_close(uint8_t idx){
+	
+	g_afh_frame.idx = idx;
+	(void) app_sched_event_put(&g_afh_frame, sizeof(afh_frame_t), afh_frame_end);
+	memset(&g_afh_frame, 0, sizeof(afh_frame_t));
+}
 
-	g_cur_ch_idx++;
-	if(g_cur_ch_idx >= MAXIMUM_CHANNEL_LIST_SIZE){
-		g_cur_ch_idx = 0;
+//The statistics of a channel start over once it is replaced. Runs in the main loop.
+static void afh_stats_reset(void * p_event_data, uint16_t event_size){
+	
+	memset(&ga_afh_stats[*(uint8_t const *)p_event_data], 0, sizeof(afh_stats_t));
+}
+
+//Put the announced channel in use once its countdown ran out. Called on every hop before the beacon.
+static void afh_on_hop(){
+	
+	if(g_afh_idx == BEACON_NO_MAP_ENTRY || g_afh_countdown) return;
+	
+	//The hop sequencer already selected the channel of this frame. The change applies from the next pass on,
+	//as on the devices. Not written to flash: after a reset the box starts with the map picked in setup mode.
+	APP_ERROR_CHECK(nrf_esb_hop_channel_set(g_afh_idx, g_afh_ch));
+	ga_chlist[g_afh_idx] = g_afh_ch;
+	(void) app_sched_event_put(&g_afh_idx, sizeof(uint8_t), afh_stats_reset);
+	g_afh_idx = BEACON_NO_MAP_ENTRY;
+}
+
+static void afh_beacon_fill(){
+	
+	if(g_afh_idx != BEACON_NO_MAP_ENTRY){
+		g_beacon.data[BEACON_MAP_INDEX] = g_afh_idx;
+		g_beacon.data[BEACON_MAP_INDEX + 1] = g_afh_ch;
+		g_beacon.data[BEACON_MAP_INDEX + 2] = g_afh_countdown--;
+	}
+	else{
+		//Repeat the map, so that devices which missed a change pick it up.
+		g_beacon.data[BEACON_MAP_INDEX] = g_afh_refresh_idx;
+		g_beacon.data[BEACON_MAP_INDEX + 1] = ga_chlist[g_afh_refresh_idx];
+		g_beacon.data[BEACON_MAP_INDEX + 2] = 0;
+		
+		g_afh_refresh_idx++;
+		if(g_afh_refresh_idx >= g_ds.link.chlist_size){
+			g_afh_refresh_idx = 0;
+		}
+	}
+}
+#endif
+
+//Paired devices due to report new data in a cycle, by their reporting divisors.
+static uint32_t report_ask_mask(uint32_t cycle){
+	
+	uint32_t mask = 0;
+	uint8_t idx;
+	
+	for(idx = 1; idx <= MAXIMUM_DEV; idx++){
+		if((g_devs_paired_mask & DEV_MASK(idx)) && cycle % DEV_REPORT_DIVISOR(idx) == DEV_REPORT_PHASE(idx)){
+			mask |= DEV_MASK(idx);
+		}
 	}
-	M_ESB_STOP_RX_WAIT_IDLE();
-	APP_ERROR_CHECK(nrf_esb_set_rf_channel(ga_chlist[g_cur_ch_idx]));
+	return mask;
+}
+
+//Toggle the sync pulse pin, and schedule the next toggle one period later in box time.
+static void sync_pulse_toggle(){
+	
+	nrf_gpio_pin_toggle(SYNC_PULSE_PIN);
+	g_sync_pulse_time += SYNC_PULSE_PERIOD_US;
+	(void) app_timesync_action_at(g_sync_pulse_time, sync_pulse_toggle);
+}
+
+static void sync_pulse_start(){
+	
+	uint32_t now;
+	
+	APP_ERROR_CHECK(app_timesync_now_in_box_time(&now));
+	g_sync_pulse_time = (now / SYNC_PULSE_PERIOD_US + 1) * SYNC_PULSE_PERIOD_US;
+	APP_ERROR_CHECK(app_timesync_action_at(g_sync_pulse_time, sync_pulse_toggle));
 }
 
 static void send_beacon(){
 	
-#if USE_SCHEME_2
-	//finish 1 frame cycle and not received data from all paired device. Toggle LED_3.
-	if(g_cur_ch_idx == 0 && (g_devs_data_recv_mask != g_devs_paired_mask)){
-		nrf_gpio_pin_toggle(LED_3);
+	if(g_first_try_pending){
+		//The responses to the last new-data beacon are in. Did every device asked get through on the first try?
+		g_first_try_pending = false;
+#if ADAPTIVE_SCHEME_SWITCHING
+		adapt_sample((g_cycle_ask_mask & ~g_devs_data_recv_mask) != 0);
+#endif
 	}
+	
+	if(g_cur_subframe == 0){
+		//finish 1 frame cycle and not received data from all devices asked. Toggle LED_3.
+		if(g_cycle_ask_mask & ~g_devs_data_recv_mask){
+			nrf_gpio_pin_toggle(LED_3);
+		}
+		
+#if ADAPTIVE_SCHEME_SWITCHING
+		//The new cycle may run on the other scheme. Its beacons announce it to the devices.
+		adapt_update();
+#endif
 		
-	if(g_cur_ch_idx == 0){
-		//New frame cycle. Send beacon to get new data from all paired devices.
+		//New frame cycle. Send beacon to get new data from the devices due in this cycle.
+		g_cycle_ask_mask = report_ask_mask(g_report_cycle++);
 		g_devs_data_recv_mask = 0;
-		g_beacon.data[2] = BEACON_BYTE3_NEW_DATA;
+		g_first_try_pending = true;
+		g_beacon.data[BEACON_REQUEST_INDEX] = BEACON_BYTE3_NEW_DATA;
+		(void) uint32_encode(g_cycle_ask_mask, &g_beacon.data[BEACON_ASK_MASK_INDEX]);
 	}
 	else{
 		//Send re-transmit beacon. Indicate those devices that have not yet receive their data packet.
-		g_beacon.data[2] = BEACON_BYTE3_RESEND;
-		g_beacon.data[3] = ~g_devs_data_recv_mask & g_devs_paired_mask;
+		//They take the first slots, so the retries come early in the frame.
+		g_beacon.data[BEACON_REQUEST_INDEX] = BEACON_BYTE3_RESEND;
+		(void) uint32_encode(g_cycle_ask_mask & ~g_devs_data_recv_mask, &g_beacon.data[BEACON_ASK_MASK_INDEX]);
 	}
+	g_beacon.data[BEACON_SCHEME_INDEX] = g_ds.link.scheme;
+	
+	//the devices predict the new-data frames of the next cycles from the phase, and the next hops from the index.
+	g_beacon.data[BEACON_PHASE_INDEX] = (g_report_cycle - 1) % DEV_REPORT_PERIOD;
+	g_beacon.data[BEACON_HOP_INDEX] = g_cur_ch_idx;
+	g_beacon.data[BEACON_JOIN_INDEX] = (g_join_timeout_ms != 0);
+	
+	//The devices that got the last beacon too learn the box time of its address.
+	(void) uint32_encode(++g_beacon_counter, &g_beacon.data[BEACON_COUNTER_INDEX]);
+	(void) uint32_encode(g_beacon_stamp, &g_beacon.data[BEACON_STAMP_INDEX]);
+	
+#if ADAPTIVE_FREQUENCY_HOPPING
+	g_afh_frame.ask_mask = uint32_decode(&g_beacon.data[BEACON_ASK_MASK_INDEX]);
+	afh_beacon_fill();
+#else
+	g_beacon.data[BEACON_MAP_INDEX] = BEACON_NO_MAP_ENTRY;
 #endif
 	
 	g_beacon.noack = true;
@@ -153,32 +509,332 @@ static void send_beacon(){
 	nrf_gpio_pin_clear(LED_2);
 }
 
+//Slot of a chip ID in the slot table, 0 if it has none.
+static uint8_t slot_find(uint8_t const *p_chip_id){
+	
+	uint8_t idx;
+	
+	for(idx = 1; idx <= MAXIMUM_DEV; idx++){
+		if((g_devs_paired_mask & DEV_MASK(idx)) && memcmp(g_ds.chip_ids[idx - 1], p_chip_id, CHIP_ID_LENGTH) == 0){
+			return idx;
+		}
+	}
+	return 0;
+}
+
+//A device that was not heard for SLOT_RELEASE_MS is gone. Joining may give its slot to another device.
+static bool slot_released(uint8_t idx){
+	
+	return g_mode == MODE_NORMAL &&
+		   g_beacon_counter - ga_dev_heard[idx - 1] >= SLOT_RELEASE_MS * 1000UL / g_ds.link.frame_period_us;
+}
+
+//Give a chip ID the first free slot of its type, or else one that was released. Returns 0 if there is none.
+static uint8_t slot_take(uint8_t const *p_chip_id, uint8_t dev_type){
+	
+	uint8_t first, last, idx;
+	
+	if(dev_type == DEV_TYPE_DISPLAY){
+		first = 1;
+		last = MAXIMUM_DISPLAY_DEV;
+	}
+	else if(dev_type == DEV_TYPE_CONTROLLER){
+		first = MAXIMUM_DISPLAY_DEV + 1;
+		last = MAXIMUM_DEV;
+	}
+	else{
+		return 0;
+	}
+	
+	for(idx = first; idx <= last && (g_devs_paired_mask & DEV_MASK(idx)); idx++);
+	if(idx > last){
+		for(idx = first; idx <= last && !slot_released(idx); idx++);
+		if(idx > last) return 0;
+		
+		NRF_LOG_INFO("Slot %d released.\r\n", idx);
+	}
+	
+	memcpy(g_ds.chip_ids[idx - 1], p_chip_id, CHIP_ID_LENGTH);
+	g_devs_paired_mask |= DEV_MASK(idx);
+	ga_dev_heard[idx - 1] = g_beacon_counter;
+	
+	return idx;
+}
+
+//Set the pair info of a device. The offer of a joining box, dev_idx 0, tells the link and the channels but no slot.
+static void pair_info_set(uint8_t const *p_chip_id, uint8_t dev_idx){
+	
+	memcpy(g_pair_info.system_address_32, g_base_addr_1, 4);
+	g_pair_info.link = g_ds.link;
+	memcpy(g_pair_info.chlist, (g_mode == MODE_NORMAL) ? ga_chlist : g_ds.chlist, MAXIMUM_CHANNEL_LIST_SIZE);
+	g_pair_info.dev_idx = dev_idx;
+	g_pair_info.report_divisor = dev_idx ? DEV_REPORT_DIVISOR(dev_idx) : 0;
+	
+	if(dev_idx){
+		memcpy(g_pair_info.chip_id, p_chip_id, CHIP_ID_LENGTH);
+	}
+	else{
+		memset(g_pair_info.chip_id, 0xff, CHIP_ID_LENGTH);
+	}
+}
+
+//Set the pair info as the ack payload of the next pairing request, whoever sends it.
+static void pair_info_queue(){
+	
+	nrf_esb_payload_t pair_info;
+	
+	memcpy(pair_info.data, (uint8_t *)&g_pair_info, sizeof(pair_info_t));
+	pair_info.length = sizeof(pair_info_t);
+	pair_info.pipe = 0;
+	
+	//ESB keeps the ack payload at the head of the queue until the next packet shows that it arrived, then sends the
+	//one behind it. Queue the info twice so that the next packet gets it either way.
+	nrf_esb_flush_tx();
+	nrf_esb_write_payload(&pair_info);
+	nrf_esb_write_payload(&pair_info);
+}
+
+//The join slot must be over before the box hops. The RSSI survey pauses meanwhile.
+static bool join_slot_fits(){
+	
+	uint32_t end = APP_TDMA_RAMP_UP_US + app_tdma_airtime_us(BEACON_LENGTH) + app_tdma_slot_offset_us(JOIN_SLOT) +
+				   APP_TDMA_RAMP_UP_US + app_tdma_airtime_us(PAIR_REQ_LENGTH) +
+				   APP_TDMA_RAMP_UP_US + app_tdma_airtime_us(sizeof(pair_info_t));
+	
+	return end <= g_ds.link.frame_period_us;
+}
+
+//Take one device in the join slot, a new one or one that lost its pairing info. Runs in the main loop. Only the
+//main loop opens joining, so it is still closed after the check.
+static void join_open(void * p_event_data, uint16_t event_size){
+	
+	if(g_mode != MODE_NORMAL || g_join_timeout_ms || !join_slot_fits()) return;
+	
+	//the radio interrupt offers the join slot from the next beacon on.
+	CRITICAL_REGION_ENTER();
+	(void) nrf_esb_survey_stop();
+	pair_info_set(NULL, 0);
+	g_join_dev_idx = 0;
+	g_join_heard = false;
+	g_join_timeout_ms = JOIN_TIMEOUT_MS;
+	CRITICAL_REGION_EXIT();
+	
+	nrf_gpio_pin_clear(LED_1);
+	NRF_LOG_INFO("Joining open.\r\n");
+}
+
+//Runs in the main loop. The store is not reentrant, and its writes go on from there.
+static void ds_save(void * p_event_data, uint16_t event_size){
+	
+	app_store_write(&g_ds, sizeof(ds_data_t));
+}
+
+//Only the slot table changed. The scheme and the channels the box moved to stay out of flash. Runs in the main loop.
+static void slot_table_save(void * p_event_data, uint16_t event_size){
+	
+	ds_data_t ds;
+	
+	if(app_store_read(&ds, sizeof(ds_data_t)) == NRF_SUCCESS){
+		memcpy(ds.chip_ids, g_ds.chip_ids, sizeof(ds.chip_ids));
+		app_store_write(&ds, sizeof(ds_data_t));
+	}
+}
+
+//The beacons stopped offering the join slot. Runs in the main loop.
+static void join_close(void * p_event_data, uint16_t event_size){
+	
+	if(g_join_dev_idx){
+		slot_table_save(NULL, 0);
+	}
+	
+	CRITICAL_REGION_ENTER();
+	survey_start(&g_ds.link);
+	CRITICAL_REGION_EXIT();
+	
+	nrf_gpio_pin_set(LED_1);
+	NRF_LOG_INFO("Joining closed, device %d joined.\r\n", g_join_dev_idx);
+}
+
+static void hop_event_handler(uint8_t hop_index){
+	
+	//the hop sequencer has moved to the next channel of the list. It paces the frames.
+#if ADAPTIVE_FREQUENCY_HOPPING
+	if(g_mode == MODE_NORMAL){
+		afh_frame_close(g_cur_ch_idx);
+		afh_on_hop();
+	}
+#endif
+	g_cur_ch_idx = hop_index;
+	
+	if(g_pairing_timeout){
+		g_pairing_timeout = (g_pairing_timeout > g_frame_period_ms) ? g_pairing_timeout - g_frame_period_ms : 0;
+		g_pair_quiet_ms = (g_pair_quiet_ms > g_frame_period_ms) ? g_pair_quiet_ms - g_frame_period_ms : 0;
+		
+		//Leave when the pairing window closes, keeping the devices paired so far, or once every slot is granted and
+		//the devices stopped asking: the last one has its info.
+		if(g_pairing_timeout == 0 || (bit_count(g_devs_paired_mask) == MAXIMUM_DEV && g_pair_quiet_ms == 0)){
+			chlist_pick();
+			APP_ERROR_CHECK(app_sched_event_put(NULL, 0, ds_save));
+			enter_normal_mode();
+			return;
+		}
+	}
+	
+	//If new frame, toggle LED_4.
+	g_cur_subframe = app_tdma_master_on_hop();
+	if(g_cur_subframe == 0){
+		nrf_gpio_pin_toggle(LED_4);
+	}
+	
+	if(g_mode == MODE_NORMAL){
+		
+		//BUTTON_3 opens joining. It closes once the device that joined answered, or after JOIN_TIMEOUT_MS. The main
+		//loop does the rest of both.
+		if(nrf_gpio_pin_read(BUTTON_3) == 0 && !g_button_3_down){
+			APP_ERROR_CHECK(app_sched_event_put(NULL, 0, join_open));
+		}
+		g_button_3_down = (nrf_gpio_pin_read(BUTTON_3) == 0);
+		
+		if(g_join_timeout_ms){
+			g_join_timeout_ms = (g_join_timeout_ms > g_frame_period_ms && !g_join_heard) ? g_join_timeout_ms - g_frame_period_ms : 0;
+			if(g_join_timeout_ms == 0){
+				APP_ERROR_CHECK(app_sched_event_put(NULL, 0, join_close));
+			}
+		}
+	
+		//send beacon. Skip it if the last beacon is still on air.
+		(void) nrf_esb_stop_rx();
+		(void) nrf_esb_flush_tx();
+		if(nrf_esb_set_mode(NRF_ESB_MODE_PTX) == NRF_SUCCESS){
+			send_beacon();
+		}
+	}
+}
+
+//Device a response comes from, 0 if the payload is no response.
+static uint8_t response_dev_idx(nrf_esb_payload_t const * p_payload){
+	
+	uint8_t dev_idx;
+	
+	if(p_payload->pipe == 0 || p_payload->length != RESPONSE_LENGTH) return 0;
+	
+#if SHARED_PIPE_ADDRESSING
+	//every device sends on pipe 1. The device ID in the payload tells them apart.
+	dev_idx = p_payload->data[RESPONSE_DEV_ID_INDEX];
+#else
+	dev_idx = p_payload->pipe;
+#endif
+	
+	return (dev_idx <= MAXIMUM_DEV) ? dev_idx : 0;
+}
+
+//Answer a pairing or join request: find the slot of the device, or give it one, and queue its info. Runs in the main
+//loop, with the radio interrupt held off. It reads the slot table for the beacons, and queues the info for the join
+//slot.
+static void pair_req_handle(void * p_event_data, uint16_t event_size){
+	
+	nrf_esb_payload_t const *p_payload = (nrf_esb_payload_t const *)p_event_data;
+	uint8_t const *p_chip_id = &p_payload->data[PAIR_CHIP_ID_INDEX];
+	uint8_t dev_idx;
+	
+	CRITICAL_REGION_ENTER();
+	if(g_mode == MODE_PAIRING || g_join_timeout_ms){
+		
+		switch(p_payload->data[0]){
+			
+			case ID_PAIR_REQ:
+			case ID_PAIR_INFO_GET:
+				
+				if(g_mode == MODE_PAIRING){
+					g_pair_quiet_ms = PAIRING_QUIET_MS;
+					chlist_pick();
+				}
+				
+				//Find the slot of the chip ID, or give it one, and queue its info. INFO_GET has no device type, so
+				//only finds a slot. Joining gives a slot to one device.
+				dev_idx = slot_find(p_chip_id);
+				if(dev_idx == 0 && p_payload->data[0] == ID_PAIR_REQ && (g_mode == MODE_PAIRING || g_join_dev_idx == 0)){
+					dev_idx = slot_take(p_chip_id, p_payload->data[1]);
+				}
+				if(g_mode == MODE_NORMAL && g_join_dev_idx == 0){
+					g_join_dev_idx = dev_idx;
+				}
+				
+				if(dev_idx != 0){
+					pair_info_set(p_chip_id, dev_idx);
+					pair_info_queue();
+				}
+				break;
+			
+		}
+	}
+	CRITICAL_REGION_EXIT();
+}
+
+//Handle one received payload.
+static void rx_payload_handle(nrf_esb_payload_t const * p_payload)
+{
+	if((g_mode == MODE_PAIRING || g_join_timeout_ms) && p_payload->length == PAIR_REQ_LENGTH){
+		
+		//A request the queue has no room for goes unanswered. The device asks again.
+		(void) app_sched_event_put((void *)p_payload, sizeof(nrf_esb_payload_t), pair_req_handle);
+	}
+	else if(g_mode == MODE_NORMAL){
+		
+		uint8_t dev_idx = response_dev_idx(p_payload);
+		
+		if(dev_idx != 0){
+			g_devs_data_recv_mask |= DEV_MASK(dev_idx);
+			ga_dev_heard[dev_idx - 1] = g_beacon_counter;
+			if(dev_idx == g_join_dev_idx){
+				g_join_heard = true;
+			}
+#if ADAPTIVE_FREQUENCY_HOPPING
+			g_afh_frame.recv_mask |= DEV_MASK(dev_idx);
+			g_afh_frame.received++;
+			g_afh_frame.rssi_sum += p_payload->rssi;
+#endif
+		}
+	}
+}
+
 void nrf_esb_event_handler(nrf_esb_evt_t const * p_event)
 {
+	uint32_t rx_count, i;
+	
 	switch(p_event->evt_id){
 		
 		case NRF_ESB_EVENT_TX_SUCCESS:
 
 			nrf_gpio_pin_set(LED_2);
 		
-			(void) nrf_esb_flush_rx();
-			(void) nrf_esb_flush_tx();		
-		
+			//In pairing mode this is an ack payload that got through. The packet that told is still to be read.
 			if(g_mode == MODE_NORMAL){
+				(void) nrf_esb_flush_rx();
+				(void) nrf_esb_flush_tx();
+				
+				//the beacon is out. Its address was the last one on air.
+				g_beacon_stamp = app_timesync_address_time();
+				
 				//switch to PRX mode.
-				esb_init(false);
+				nrf_esb_set_mode(NRF_ESB_MODE_PRX);
 				nrf_esb_start_rx();
+				
+				//A device asking in the join slot gets the offer, or the info of the device heard last.
+				if(g_join_timeout_ms){
+					pair_info_queue();
+				}
 			}
 			break;
 		
 		case NRF_ESB_EVENT_TX_FAILED:
 
-			(void) nrf_esb_flush_rx();
-			(void) nrf_esb_flush_tx();		
-		
 			if(g_mode == MODE_NORMAL){
+				(void) nrf_esb_flush_rx();
+				(void) nrf_esb_flush_tx();
+				
 				//switch to PRX mode.
-				esb_init(false);
+				nrf_esb_set_mode(NRF_ESB_MODE_PRX);
 				nrf_esb_start_rx();
 			}
 			
@@ -186,124 +842,32 @@ void nrf_esb_event_handler(nrf_esb_evt_t const * p_event)
 		
 		case NRF_ESB_EVENT_RX_RECEIVED:
 			
-			if (nrf_esb_read_rx_payload(&rx_payload) == NRF_SUCCESS)
-            {
-				nrf_esb_flush_rx();
-				
-				if(g_mode == MODE_PAIRING && rx_payload.length == 2){
-					
-					switch(rx_payload.data[0]){
-						
-						case ID_PAIR_REQ:
-							{
-								//Got a pairing request. Retrieve the device type and prepare pairing info.
-								nrf_esb_payload_t pair_info;
-								pair_info_t info;
-								
-								g_cur_pairing_dev_type = 0;
-								
-								memcpy(info.system_address_32, g_base_addr_1, 4);
-								memcpy(info.chlist, g_ds.chlist, MAXIMUM_CHANNEL_LIST_SIZE);
-								info.dev_idx = 0xff;
-								
-								if(rx_payload.data[1] == DEV_TYPE_DISPLAY){
-									if(g_ds.display_slot_idx < MAXIMUM_DISPLAY_DEV){
-										g_cur_pairing_dev_type = DEV_TYPE_DISPLAY;
-										info.dev_idx = g_ds.display_slot_idx + 1;
-									}
-								}
-								else if(rx_payload.data[1] == DEV_TYPE_CONTROLLER){
-									if(g_ds.controller_slot_idx < MAXIMUM_CONTROLLER_DEV){
-										g_cur_pairing_dev_type = DEV_TYPE_CONTROLLER;
-										info.dev_idx = MAXIMUM_DISPLAY_DEV + g_ds.controller_slot_idx + 1;
-									}
-								}
-								
-								if(info.dev_idx != 0xff){
-									
-									//device slot is available. Set the pairing info as ack payload.
-									memcpy(pair_info.data, (uint8_t *)&info, sizeof(pair_info_t));
-									pair_info.length = sizeof(pair_info_t);
-									pair_info.pipe = 0;
-
-									nrf_esb_flush_tx();
-									nrf_esb_write_payload(&pair_info);
-								}
-								
-							}
-							break;
-						
-						case ID_PAIR_INFO_GET:
-						
-							//Got the INFO_GET request. Pairing info is sent over to the device.
-							//Increament the device type slot.
-						
-							nrf_esb_flush_tx();
-						
-							if(g_cur_pairing_dev_type == DEV_TYPE_DISPLAY && g_ds.display_slot_idx < MAXIMUM_DISPLAY_DEV){
-								g_ds.display_slot_idx++;
-#if USE_SCHEME_2								
-								g_devs_paired_mask |= (uint8_t)(0x01 << (6 - g_ds.display_slot_idx));
-#endif								
-							}
-							else if(g_cur_pairing_dev_type == DEV_TYPE_CONTROLLER && g_ds.controller_slot_idx < MAXIMUM_CONTROLLER_DEV){
-								g_ds.controller_slot_idx++;
-#if USE_SCHEME_2								
-								g_devs_paired_mask |= (uint8_t)(0x01 << (2 - g_ds.controller_slot_idx));
-#endif								
-							}
-							g_cur_pairing_dev_type = 0;
-							
-							if(g_ds.controller_slot_idx == MAXIMUM_CONTROLLER_DEV && g_ds.display_slot_idx == MAXIMUM_DISPLAY_DEV){
-								
-								ds_update((uint32_t *)&g_ds, sizeof(ds_data_t));
-								enter_normal_mode();	
-								return;								
-							}
-							break;
-						
-					}
-				}
-				else if(g_mode == MODE_NORMAL){
-					
-					if(rx_payload.pipe != 0 && rx_payload.length == 32){
-#if USE_SCHEME_2						
-						g_devs_data_recv_mask |= (uint8_t)(0x01 << (6 - rx_payload.pipe));
-#endif						
-					}
+			//Drain everything that arrived since the last event in one go.
+			if (nrf_esb_read_rx_payloads(g_rx_payloads, NRF_ESB_RX_FIFO_SIZE, &rx_count) == NRF_SUCCESS)
+			{
+				for(i = 0; i < rx_count; i++){
+					rx_payload_handle(&g_rx_payloads[i]);
 				}
-				
-            }
+			}
 			
 			break;
-	}
-	
-}
-
-void interval_timer_event_handler(){
-	
-	hop_channel();
-	
-	//If new frame, toggle LED_4.
-	
-#if USE_SCHEME_2
-	if(g_cur_ch_idx == 0){
-		nrf_gpio_pin_toggle(LED_4);
-	}
-#else
-	nrf_gpio_pin_toggle(LED_4);
-#endif	
-	
-	if(g_mode == MODE_NORMAL){
-	
-		//send beacon
-		esb_init(true);
-		send_beacon();
-	}		
-	else if(g_mode == MODE_PAIRING){
 		
-		nrf_esb_start_rx();
+		case NRF_ESB_EVENT_HOP:
+			
+			hop_event_handler(p_event->hop_index);
+			break;
+		
+		case NRF_ESB_EVENT_RX_OVERFLOW:
+			
+			//The RX FIFO is not drained fast enough. The oldest samples were overwritten.
+			NRF_LOG_WARNING("RX FIFO overflow: %d packets\r\n", p_event->rx_overflows);
+			break;
+		
+		case NRF_ESB_EVENT_HOP_DEADLINE:
+			//Only the devices set a deadline.
+			break;
 	}
+	
 }
 
 static void host_chip_id_read(uint8_t *dst)
@@ -319,74 +883,42 @@ static void host_chip_id_read(uint8_t *dst)
   
  
 
-#define MAXIMUM_RSSI_SAMPLES		256
-
-void do_channel_list_generation(){
-	
-	uint32_t packet;
-	uint16_t samples, highest_rssi, rssi[MAXIMUM_CHANNELS_PER_REGION];
-	uint8_t i, k, selected_ch;
-	
-	NRF_RADIO->PACKETPTR = (uint32_t)&packet;
-	
-	for(i = 0; i < MAXIMUM_CHANNEL_LIST_SIZE; i++){
-		
-		for(k = 0; k < MAXIMUM_CHANNELS_PER_REGION; k++){
-			rssi[k] = 0;
-		}
-		
-		highest_rssi = 0;
-		
-		for(samples = 0; samples < MAXIMUM_RSSI_SAMPLES; samples++){
-		
-			for(k = 0; k < MAXIMUM_CHANNELS_PER_REGION; k++){
-				
-				NRF_RADIO->FREQUENCY = gca_available_chlist[i][k];
-				NRF_RADIO->EVENTS_READY = 0U;
-				NRF_RADIO->TASKS_RXEN = 1U;
-				while(NRF_RADIO->EVENTS_READY == 0U);
-				NRF_RADIO->EVENTS_END = 0U;
-
-				NRF_RADIO->TASKS_START = 1U;
-
-				NRF_RADIO->EVENTS_RSSIEND = 0U;
-				NRF_RADIO->TASKS_RSSISTART = 1U;
-				while(NRF_RADIO->EVENTS_RSSIEND == 0U);
-
-				rssi[k] += NRF_RADIO->RSSISAMPLE;
-
-				NRF_RADIO->EVENTS_DISABLED = 0U;    
-				NRF_RADIO->TASKS_DISABLE   = 1U;  // Disable the radio.
-
-				while(NRF_RADIO->EVENTS_DISABLED == 0U)
-				{
-						// Do nothing.
-				}
-				
-				if(highest_rssi < rssi[k]){
-					highest_rssi = rssi[k];
-					selected_ch = gca_available_chlist[i][k];
-				}
-			}
-		}
-
-		g_ds.chlist[i] = selected_ch;
-	}
-}
-
 void enter_normal_mode(){
 	
+	uint8_t i;
+	
 	//enter normal mode
 	g_pairing_timeout = 0;
 
-	interval_timer_stop();
-	
-	//change to system channel list.
+	//change to system channel list and schedule. The first hop selects its first channel and sends the first beacon.
 	memcpy(ga_chlist, g_ds.chlist, MAXIMUM_CHANNEL_LIST_SIZE);
+	schedule_load(&g_ds.link);
 	g_mode = MODE_NORMAL;
-	g_cur_ch_idx = MAXIMUM_CHANNEL_LIST_SIZE;
+	g_first_try_pending = false;
+#if ADAPTIVE_SCHEME_SWITCHING
+	adapt_reset();
+#endif
+#if ADAPTIVE_FREQUENCY_HOPPING
+	memset(ga_afh_stats, 0, sizeof(ga_afh_stats));
+	memset(ga_afh_blacklist, 0, sizeof(ga_afh_blacklist));
+	memset(&g_afh_frame, 0, sizeof(afh_frame_t));
+	g_afh_idx = BEACON_NO_MAP_ENTRY;
+	g_afh_refresh_idx = 0;
+	g_afh_silent_frames = 0;
+#endif
+	
+	//Every device gets SLOT_RELEASE_MS to answer before joining may take its slot.
+	for(i = 0; i < MAXIMUM_DEV; i++){
+		ga_dev_heard[i] = g_beacon_counter;
+	}
+	g_join_timeout_ms = 0;
 	
-	interval_timer_start();
+	if(app_tdma_master_start(ga_chlist, g_ds.link.chlist_size) != NRF_SUCCESS){
+		//ESB is not initialized yet on power up.
+		APP_ERROR_CHECK(esb_init(false));
+		APP_ERROR_CHECK(app_tdma_master_start(ga_chlist, g_ds.link.chlist_size));
+	}
+	survey_start(&g_ds.link);
 	
 	nrf_gpio_pin_set(LED_1);
 	
@@ -396,35 +928,34 @@ void enter_setup_mode(){
 	uint32_t err_code;
 	
 	//enter setup mode.
-	//1) channel picking
-	//2) pairing.
+	//1) scheme selection. Hold BUTTON 2 for scheme 1.
+	//2) pairing. The channels are surveyed meanwhile, and picked when the first device asks for the pairing info.
 	
-	g_mode = MODE_CHANNEL_PICKING;
-
-	do_channel_list_generation();
+	link_params_get(&g_ds.link, nrf_gpio_pin_read(BUTTON_2) == 0 ? APP_SCHEME_1 : APP_DEFAULT_SCHEME);
+	g_chlist_picked = false;
 	
     err_code = esb_init(false);
     APP_ERROR_CHECK(err_code);
 	
 	memcpy(ga_chlist, gca_pairing_chlist, MAXIMUM_CHANNEL_LIST_SIZE);
-	g_cur_ch_idx = 0;
 	
-	APP_ERROR_CHECK(nrf_esb_set_rf_channel(ga_chlist[g_cur_ch_idx]));
+	//hop through the pairing channel list, starting with the first channel.
+	schedule_load(&gc_pairing_link);
+	APP_ERROR_CHECK(app_tdma_master_start(ga_chlist, gc_pairing_link.chlist_size));
+	APP_ERROR_CHECK(nrf_esb_hop_sync(0, gc_pairing_link.frame_period_us));
+	survey_start(&gc_pairing_link);
 	
-#ifdef USE_SCHEME_2	
+	//every device pairs again.
 	g_devs_paired_mask = 0;
-#endif	
+	memset(g_ds.chip_ids, 0xff, sizeof(g_ds.chip_ids));
+	g_pair_quiet_ms = 0;
 	g_pairing_timeout = MAXIMUM_PAIRING_TIMEOUT_MS;
+	g_join_timeout_ms = 0;
 	g_mode = MODE_PAIRING;
 
-	g_ds.controller_slot_idx = 0;
-	g_ds.display_slot_idx = 0;
-
     err_code = nrf_esb_start_rx();
     APP_ERROR_CHECK(err_code);
 
-	interval_timer_start();
-
 	nrf_gpio_pin_clear(LED_1);
 	
 }
@@ -459,6 +990,16 @@ void gpio_init( void )
 	
 	//Press and hold BUTTON 1 to activate pairing.
 	nrf_gpio_cfg_input(BUTTON_1, NRF_GPIO_PIN_PULLUP);
+	
+	//Press and hold BUTTON 2 together with BUTTON 1 to set up scheme 1 (no retry frames) instead of scheme 2.
+	nrf_gpio_cfg_input(BUTTON_2, NRF_GPIO_PIN_PULLUP);
+	
+	//Press BUTTON 3 in normal mode to add a device, or to replace one. LED_1 is low while the box takes the device.
+	nrf_gpio_cfg_input(BUTTON_3, NRF_GPIO_PIN_PULLUP);
+	
+	//Toggles at every multiple of SYNC_PULSE_PERIOD_US in box time, on the box and on the devices.
+	nrf_gpio_cfg_output(SYNC_PULSE_PIN);
+	nrf_gpio_pin_clear(SYNC_PULSE_PIN);
 }
 
 
@@ -473,6 +1014,7 @@ uint32_t esb_init( bool is_ptx )
     nrf_esb_config.mode                     = (is_ptx == true ? NRF_ESB_MODE_PTX : NRF_ESB_MODE_PRX);
     nrf_esb_config.event_handler            = nrf_esb_event_handler;
     nrf_esb_config.selective_auto_ack       = true;//is_ptx;
+	nrf_esb_config.rx_overflow				= NRF_ESB_RX_OVERFLOW_DROP_OLDEST;	//keep the freshest samples under burst load
 
 	nrf_esb_disable();
 	
@@ -482,33 +1024,9 @@ uint32_t esb_init( bool is_ptx )
     return err_code;
 }
 
-void interval_timer_init(){
-
-	//configure to interval 
-	NRF_TIMER0->TASKS_CLEAR = 1;
-	
-    NRF_TIMER0->MODE        = TIMER_MODE_MODE_Timer;       // Set the timer in Timer Mode.
-    NRF_TIMER0->PRESCALER   = 4;                           // Prescaler 4 produces 1000000 Hz timer frequency.
-    NRF_TIMER0->BITMODE     = TIMER_BITMODE_BITMODE_24Bit; // 16 bit mode.
-    NRF_TIMER0->CC[0]       = INTERVAL_TIMER_INTERVAL_10MS * 100UL;
-	
-	NRF_TIMER0->SHORTS		= TIMER_SHORTS_COMPARE0_CLEAR_Msk;
-	NRF_TIMER0->INTENSET    = (TIMER_INTENSET_COMPARE0_Enabled << TIMER_INTENSET_COMPARE0_Pos);
-	
-    NVIC_EnableIRQ(TIMER0_IRQn);
-	
-}
-
-void interval_timer_start(){
+void TIMER0_IRQHandler(void){
 	
-	NRF_TIMER0->TASKS_CLEAR = 1;
-	NRF_TIMER0->EVENTS_COMPARE[0] = 0;
-	NRF_TIMER0->TASKS_START = 1;
-}
-
-void interval_timer_stop(){
-	
-	NRF_TIMER0->TASKS_STOP = 1;
+	app_timesync_timer_handler();
 }
 
 int main(void)
@@ -524,35 +1042,38 @@ int main(void)
     APP_ERROR_CHECK(err_code);
 
     clocks_start();
-	interval_timer_init();
+	
+	//The interrupts only do what the radio timing needs. The rest waits for the main loop.
+	APP_SCHED_INIT(SCHED_MAX_EVENT_DATA_SIZE, SCHED_QUEUE_SIZE);
+	
+	//The local clock of the box is the box time. It keeps running through pairing, so that the stamps stay valid.
+	app_timesync_start(true);
+	sync_pulse_start();
 
 	host_chip_id_read(g_base_addr_1);
-	ds_get((uint32_t *)&g_ds, sizeof(ds_data_t));
+	app_store_init();
 	
-	if(g_ds.signature != DS_SIGNATURE){
+	if(app_store_read(&g_ds, sizeof(ds_data_t)) != NRF_SUCCESS || g_ds.signature != DS_SIGNATURE || !link_params_valid(&g_ds.link)){
 		
 		g_ds.signature = DS_SIGNATURE;
 		force_setup = true;
 	}
 	else{
 		
-		if(g_ds.controller_slot_idx == 0 && g_ds.display_slot_idx == 0){
-			force_setup = true;
-		}
-#ifdef USE_SCHEME_2		
-		else
-		{
-			uint8_t i;
-			g_devs_paired_mask = 0;
-			
-			for(i=0; i<g_ds.display_slot_idx; i++){
-				g_devs_paired_mask |= (uint8_t)(0x01 << (5 - i));
-			}
-			for(i=0; i<g_ds.controller_slot_idx; i++){
-				g_devs_paired_mask |= (uint8_t)(0x01 << (1 - i));
+		uint8_t i, j;
+		g_devs_paired_mask = 0;
+		
+		//a slot with a chip ID has a device.
+		for(i=0; i<MAXIMUM_DEV; i++){
+			for(j=0; j<CHIP_ID_LENGTH && g_ds.chip_ids[i][j] == 0xff; j++);
+			if(j < CHIP_ID_LENGTH){
+				g_devs_paired_mask |= DEV_MASK(i + 1);
 			}
 		}
-#endif		
+		
+		if(g_devs_paired_mask == 0){
+			force_setup = true;
+		}
 	}
 	
     err_code = nrf_esb_set_base_address_0(base_addr_0);
@@ -575,6 +1096,14 @@ int main(void)
 	
     while (true)
     {
+		app_sched_execute();
+		
+		//flash writes go one word at a time, between the radio events.
+		app_store_process();
+		
+		if(!NRF_LOG_PROCESS()){
+			__WFE();
+		}
     }
 }
 
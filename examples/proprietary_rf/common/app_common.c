@@ -1,83 +1,62 @@
 #include "string.h"
 #include "nrf_esb.h"
+#include "nrf_error.h"
 #include "app_common.h"
+#include "app_tdma.h"
 
-#define DATA_STORE_PAGE			127
-
-void ds_get(uint32_t *p, uint16_t length){
-
-	uint16_t i;
-	if(length % 4) return;
+//Fill in the link parameters of a scheme.
+void link_params_get(link_params_t *p_link, uint8_t scheme){
 	
-	uint32_t page_size = NRF_FICR->CODEPAGESIZE;
-	uint32_t *addr = (uint32_t *)(page_size * DATA_STORE_PAGE);
+	static const link_params_t scheme_1 = SCHEME_1_LINK_PARAMS;
+	static const link_params_t scheme_2 = SCHEME_2_LINK_PARAMS;
 	
-	for(i=0; i<length; i+=sizeof(uint32_t)){
-		
-		*(p++) = *(addr++);
-	}
+	*p_link = (scheme == APP_SCHEME_1) ? scheme_1 : scheme_2;
 }
 
-void ds_update(uint32_t *p, uint16_t length){
+//Move to another scheme on the same channel list and frame period.
+void link_params_switch(link_params_t *p_link, uint8_t scheme){
+	
+	link_params_t link;
+	
+	link_params_get(&link, scheme);
+	p_link->scheme = link.scheme;
+	p_link->retry_count = link.retry_count;
+}
 
-	uint16_t i;
-	if(length % 4) return;
+//Check link parameters read from flash or received in the pairing info.
+bool link_params_valid(link_params_t const *p_link){
 	
-	__disable_irq();
+	app_tdma_schedule_t schedule = APP_TDMA_SCHEDULE(*p_link);
 	
-	uint32_t page_size = NRF_FICR->CODEPAGESIZE;
-	uint32_t *addr = (uint32_t *)(page_size * DATA_STORE_PAGE);
+	if(p_link->scheme != APP_SCHEME_1 && p_link->scheme != APP_SCHEME_2) return false;
+	if(p_link->scheme == APP_SCHEME_1 && p_link->retry_count != 0) return false;
+	if(p_link->chlist_size == 0 || p_link->chlist_size > MAXIMUM_CHANNEL_LIST_SIZE) return false;
 	
-    // Turn on flash erase enable and wait until the NVMC is ready:
-    NRF_NVMC->CONFIG = (NVMC_CONFIG_WEN_Een << NVMC_CONFIG_WEN_Pos);
-
-    while (NRF_NVMC->READY == NVMC_READY_READY_Busy)
-    {
-        // Do nothing.
-    }
-
-    // Erase page:
-    NRF_NVMC->ERASEPAGE = (uint32_t)addr;
-
-    while (NRF_NVMC->READY == NVMC_READY_READY_Busy)
-    {
-        // Do nothing.
-    }
-
-    // Turn on flash write enable and wait until the NVMC is ready:
-    NRF_NVMC->CONFIG = (NVMC_CONFIG_WEN_Wen << NVMC_CONFIG_WEN_Pos);
-
-    while (NRF_NVMC->READY == NVMC_READY_READY_Busy)
-    {
-        // Do nothing.
-    }
+	return app_tdma_schedule_check(&schedule) == NRF_SUCCESS;
+}
 
+//CHIP_ID_LENGTH bytes of NRF_FICR->DEVICEID, little endian.
+void chip_id_get(uint8_t *p_chip_id){
 	
-	for(i=0; i<length; i+=sizeof(uint32_t)){
-		
-		*addr = *p;
-		
-		while (NRF_NVMC->READY == NVMC_READY_READY_Busy)
-		{
-			// Do nothing.
-		}
-		
-		addr++;
-		p++;
+	uint8_t i;
+	
+	for(i = 0; i < CHIP_ID_LENGTH; i++){
+		p_chip_id[i] = (NRF_FICR->DEVICEID[i / 4] >> ((i % 4) * 8)) & 0xff;
 	}
-		
-    while (NRF_NVMC->READY == NVMC_READY_READY_Busy)
-    {
-        // Do nothing.
-    }
+}
 
-    // Turn off flash erase enable and wait until the NVMC is ready:
-    NRF_NVMC->CONFIG = (NVMC_CONFIG_WEN_Ren << NVMC_CONFIG_WEN_Pos);
+uint8_t bit_count(uint32_t mask){
+	
+	uint8_t count = 0;
+	
+	for(; mask; mask &= mask - 1){
+		count++;
+	}
+	return count;
+}
 
-    while (NRF_NVMC->READY == NVMC_READY_READY_Busy)
-    {
-        // Do nothing.
-    }
+//Slot of a device asked by a beacon. The devices asked take the first slots, in the order of their IDs.
+uint8_t response_slot(uint32_t ask_mask, uint8_t dev_idx){
 	
-	__enable_irq();
+	return bit_count(ask_mask & (DEV_MASK(dev_idx) - 1));
 }
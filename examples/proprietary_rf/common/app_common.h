@@ -1,9 +1,17 @@
 #ifndef APP_COMMON_H
 #define APP_COMMON_H
 
+#include <stdbool.h>
 #include "nrf_esb.h"
+#include "app_config.h"
 
-void ds_get(uint32_t *p, uint16_t length);
-void ds_update(uint32_t *p, uint16_t length);
+void link_params_get(link_params_t *p_link, uint8_t scheme);
+void link_params_switch(link_params_t *p_link, uint8_t scheme);
+bool link_params_valid(link_params_t const *p_link);
+
+void chip_id_get(uint8_t *p_chip_id);
+
+uint8_t bit_count(uint32_t mask);
+uint8_t response_slot(uint32_t ask_mask, uint8_t dev_idx);
 
 #endif
@@ -2,23 +2,22 @@
 #define _APP_CONFIG_H_
 
 #include "nrf_esb.h"
+#include "app_tdma.h"
 
-#define USE_SCHEME_2							1
+//Scheme 1 asks every device for new data in every frame. Scheme 2 follows every new-data frame
+//with retry frames, in which the devices the box did not hear from send their data again.
+#define APP_SCHEME_1							1
+#define APP_SCHEME_2							2
 
-#define MAXIMUM_CHANNELS_PER_REGION				10
+#ifndef APP_DEFAULT_SCHEME
+#define APP_DEFAULT_SCHEME						APP_SCHEME_2
+#endif
 
-#if USE_SCHEME_2
-#define DS_SIGNATURE							0x12345678
-#define MAXIMUM_CHANNEL_LIST_SIZE				3
-#define DEFAULT_PAIRING_CHANNEL_LIST			{2, 48, 76}
-#define INTERVAL_TIMER_INTERVAL_10MS			40UL
-#define MAXIMUM_RETRY_COUNT						2
-#else
-#define DS_SIGNATURE							0x87654321
-#define MAXIMUM_CHANNEL_LIST_SIZE				5
+#define DS_SIGNATURE							0x1234567a
+
+#define MAXIMUM_CHANNELS_PER_REGION				10
+#define MAXIMUM_CHANNEL_LIST_SIZE				5		//one channel per region.
 #define DEFAULT_PAIRING_CHANNEL_LIST			{2, 21, 48, 53, 76}
-#define INTERVAL_TIMER_INTERVAL_10MS			40UL
-#endif
 
 #define REGION1_CHANNEL_LIST					{1, 3, 4, 5, 6, 7, 8, 9, 10, 12}
 #define REGION2_CHANNEL_LIST					{14, 16, 17, 18, 20, 23, 24, 25, 27, 29}
@@ -33,28 +32,206 @@
 #define ID_PAIR_REQ								0x1A
 #define ID_PAIR_INFO_GET						0x1B
 
+//Pairing packets: ID, device type (0 in INFO_GET), and the chip ID of the device, NRF_FICR->DEVICEID in little endian.
+//Several devices may pair at once. The box grants a slot per chip ID, the same one again for every retry. Its pair
+//info goes out as the ack payload of the next pairing packet, whichever device sends it, so the info names the chip
+//ID it is for. A device that got someone else's info backs off for a random time and asks again.
+#define CHIP_ID_LENGTH							8
+#define PAIR_CHIP_ID_INDEX						2
+#define PAIR_REQ_LENGTH							(PAIR_CHIP_ID_INDEX + CHIP_ID_LENGTH)
+
+//Joining. BUTTON_3 makes a box in normal mode take one new device for JOIN_TIMEOUT_MS, while the others keep streaming.
+//It gives the device a free slot of its type, or the slot of a device of that type not heard for SLOT_RELEASE_MS. The
+//beacons tell that the box takes a pairing request in the join slot, after the response slots. The ack carries the
+//pair info of the device the box heard last, or the offer of the box: its link and channels without a slot. A device
+//finds such a box on hop index 0, which is always in region 1.
+#define JOIN_SLOT								APP_SLOTS_PER_FRAME
+#define JOIN_TIMEOUT_MS							30000
+#define SLOT_RELEASE_MS							2000
+
 #define DEV_TYPE_DISPLAY						1
 #define DEV_TYPE_CONTROLLER						2
 
+#ifndef MAXIMUM_DISPLAY_DEV
 #define MAXIMUM_DISPLAY_DEV						4
+#endif
+#ifndef MAXIMUM_CONTROLLER_DEV
 #define MAXIMUM_CONTROLLER_DEV					2
+#endif
+#define MAXIMUM_DEV								(MAXIMUM_DISPLAY_DEV + MAXIMUM_CONTROLLER_DEV)	//device N has index N, 1..MAXIMUM_DEV.
+#define MAXIMUM_PIPE_DEV						6		//pipes 1..6 of the box, one per device.
+
+#if MAXIMUM_DEV > 32
+#error "The device masks of the box hold 32 devices."
+#endif
+
+//Shared-pipe addressing. All devices send on pipe 1 with the same address, and the box tells them apart by the
+//device ID in the first payload byte. Needed for more devices than the box has pipes.
+#ifndef SHARED_PIPE_ADDRESSING
+#define SHARED_PIPE_ADDRESSING					(MAXIMUM_DEV > MAXIMUM_PIPE_DEV)
+#endif
+
+#if SHARED_PIPE_ADDRESSING
+#define DEV_PIPE_PREFIX(_idx)					1
+#else
+#define DEV_PIPE_PREFIX(_idx)					(_idx)
+#endif
+
+#define DEV_MASK(_idx)							(1UL << ((_idx) - 1))	//bit of device _idx in the masks of the box.
+
+//Reporting divisors. A device reports new data in every DIVISOR-th cycle. Devices of a type take turns, so that
+//every cycle asks about the same number of them, and the frame has slots only for the devices asked in one cycle.
+//The box passes the divisor on in the pairing info, and asks the devices due in a cycle by the beacon mask.
+#ifndef DISPLAY_REPORT_DIVISOR
+#define DISPLAY_REPORT_DIVISOR					1
+#endif
+#ifndef CONTROLLER_REPORT_DIVISOR
+#define CONTROLLER_REPORT_DIVISOR				1
+#endif
+
+#define DEV_REPORT_DIVISOR(_idx)				((_idx) <= MAXIMUM_DISPLAY_DEV ? DISPLAY_REPORT_DIVISOR : CONTROLLER_REPORT_DIVISOR)
+#define DEV_REPORT_PHASE(_idx)					(((_idx) <= MAXIMUM_DISPLAY_DEV ? (_idx) - 1 : (_idx) - 1 - MAXIMUM_DISPLAY_DEV) \
+												 % DEV_REPORT_DIVISOR(_idx))
+
+//Cycles after which the devices asked repeat. The beacons carry the cycle count modulo DEV_REPORT_PERIOD.
+#define DEV_REPORT_PERIOD						(DISPLAY_REPORT_DIVISOR * CONTROLLER_REPORT_DIVISOR)
+#if DEV_REPORT_PERIOD > 32
+#error "The devices keep one bit per report phase."
+#endif
+
+#define APP_SLOTS_PER_FRAME						((MAXIMUM_DISPLAY_DEV + DISPLAY_REPORT_DIVISOR - 1) / DISPLAY_REPORT_DIVISOR + \
+												 (MAXIMUM_CONTROLLER_DEV + CONTROLLER_REPORT_DIVISOR - 1) / CONTROLLER_REPORT_DIVISOR)
+
+//Response payload: device ID, followed by the data of the device.
+#define RESPONSE_DEV_ID_INDEX					0
+#define RESPONSE_LENGTH							32
 
 #define BEACON_BYTE1							0xee
 #define BEACON_BYTE2							0xdd
 
-#if USE_SCHEME_2
+//Beacon payload: BEACON_BYTE1, BEACON_BYTE2, request, scheme of the cycle, a channel map entry: hop index, channel,
+//frames until the channel is used at that index (0: already in use), the 32-bit mask of the devices asked to
+//send new data or to resend, the count of beacons sent, the box time of the address of the beacon before,
+//in microseconds, the report phase of the cycle, the hop index of the frame, and 1 while the box takes a device in the
+//join slot. The numbers are little endian.
+#define BEACON_LENGTH							22
+#define BEACON_REQUEST_INDEX					2
+#define BEACON_SCHEME_INDEX						3
+#define BEACON_MAP_INDEX						4
+#define BEACON_ASK_MASK_INDEX					7
+#define BEACON_COUNTER_INDEX					11
+#define BEACON_STAMP_INDEX						15
+#define BEACON_PHASE_INDEX						19
+#define BEACON_HOP_INDEX						20
+#define BEACON_JOIN_INDEX						21
 #define BEACON_BYTE3_NEW_DATA					0x01
-#define BEACON_BYTE3_RESEND						0x02
-#endif
+#define BEACON_BYTE3_RESEND						0x02	//scheme 2 only
+#define BEACON_NO_MAP_ENTRY						0xff
+
+//Adaptive scheme switching. The box measures the share of cycles in which not every paired device got
+//its new data through on the first try, over the last ADAPT_WINDOW_CYCLES cycles. Above
+//ADAPT_LOSS_HIGH_PERCENT it moves to scheme 2, below ADAPT_LOSS_LOW_PERCENT back to scheme 1.
+#define ADAPTIVE_SCHEME_SWITCHING				1
+#define ADAPT_WINDOW_CYCLES						100
+#define ADAPT_LOSS_HIGH_PERCENT					10
+#define ADAPT_LOSS_LOW_PERCENT					2
+
+//Adaptive frequency hopping. The box counts the responses it misses on each channel of the list. A channel that
+//misses more than AFH_LOSS_PERCENT of AFH_WINDOW_RESPONSES responses is blacklisted and replaced by the quietest
+//other channel of its region. The beacons announce the change for AFH_ANNOUNCE_LISTS passes through the list.
+#define ADAPTIVE_FREQUENCY_HOPPING				1
+#define AFH_WINDOW_RESPONSES					120
+#define AFH_LOSS_PERCENT						25
+#define AFH_ANNOUNCE_LISTS						3
+
+//RSSI survey. The box samples SURVEY_SAMPLES_PER_FRAME channels of the regions in the idle end of every frame, and
+//picks its channel list and the AFH replacements by their noise level.
+#define SURVEY_SAMPLES_PER_FRAME				2
+
+//Beacon flywheel. A device that misses up to FLYWHEEL_FRAMES beacons in a row still answers a new-data frame in
+//the slot it predicts from the beacons of the earlier cycles, see app_tdma.h.
+#define FLYWHEEL_FRAMES							2
+
+//Sync acquisition. A device that lost sync keeps following the hop sequence of the box for COAST_MS, listening
+//through every frame, so the first beacon after a fade brings it back. Only then does it scan channel by channel.
+#define COAST_MS								1000
+
+//Time synchronization, see app_timesync.h. Box and devices toggle SYNC_PULSE_PIN at every multiple of
+//SYNC_PULSE_PERIOD_US in box time, so that the sync error can be measured on the pins.
+#define SYNC_PULSE_PIN							12
+#define SYNC_PULSE_PERIOD_US					100000
+
+//Frame period of the schemes. Up to MAXIMUM_PIPE_DEV slots fit 4 ms. More slots take one slot period
+//each, on top of the beacon, the last slot and the beacon guard time, rounded up to whole milliseconds.
+#define APP_SLOT_PERIOD_US						490
+#define APP_FRAME_OVERHEAD_US					1500
+#define APP_FRAME_PERIOD_US						(APP_SLOTS_PER_FRAME <= MAXIMUM_PIPE_DEV ? 4000 :	\
+												 ((APP_SLOTS_PER_FRAME - 1) * APP_SLOT_PERIOD_US + APP_FRAME_OVERHEAD_US + 999) / 1000 * 1000)
+
+//Link parameters of the schemes. The box stores the ones it runs and passes them on in the pairing info.
+#define SCHEME_1_LINK_PARAMS											\
+{																		\
+	.frame_period_us		= APP_FRAME_PERIOD_US,						\
+	.scheme					= APP_SCHEME_1,								\
+	.chlist_size			= 5,										\
+	.retry_count			= 0,										\
+}
+
+#define SCHEME_2_LINK_PARAMS											\
+{																		\
+	.frame_period_us		= APP_FRAME_PERIOD_US,						\
+	.scheme					= APP_SCHEME_2,								\
+	.chlist_size			= 3,										\
+	.retry_count			= 2,										\
+}
+
+//The box hops through the pairing channel list without retry frames.
+#define PAIRING_LINK_PARAMS						SCHEME_1_LINK_PARAMS
+
+//Frame schedule of the box and the devices for a set of link parameters, see app_tdma.h.
+//The devices asked by a beacon answer in the order of their IDs, in the first slots. A scanning device holds each channel for a whole pass through the list,
+//or as long as the 16-bit hop timer allows with long frames.
+#define APP_TDMA_SCHEDULE(_link)										\
+{																		\
+	.frame_period_us		= (_link).frame_period_us,					\
+	.subframes				= (_link).retry_count + 1,					\
+	.slot_count				= APP_SLOTS_PER_FRAME,						\
+	.slot_offset_us			= 60,										\
+	.slot_period_us			= APP_SLOT_PERIOD_US,						\
+	.beacon_guard_us		= 500,										\
+	.beacon_length			= BEACON_LENGTH,							\
+	.response_length		= RESPONSE_LENGTH,							\
+	.sync_timeout_frames	= (_link).chlist_size + 1,					\
+	.flywheel_frames		= FLYWHEEL_FRAMES,							\
+	.coast_frames			= COAST_MS * 1000UL / (_link).frame_period_us,	\
+	.scan_frames			= APP_SCAN_FRAMES(_link),					\
+}
+
+#define APP_SCAN_FRAMES(_link)											\
+	((_link).chlist_size + 1 <= UINT16_MAX / (_link).frame_period_us ?	\
+	 (_link).chlist_size + 1 : UINT16_MAX / (_link).frame_period_us)
 
 #define APP_CREATE_PAYLOAD(_pipe, ...)        {.pipe = _pipe, .length = NUM_VA_ARGS(__VA_ARGS__), .data = {__VA_ARGS__}}       
 
 
+typedef struct {
+	
+	uint16_t frame_period_us;	//time from one beacon to the next.
+	uint8_t  scheme;			//APP_SCHEME_1 or APP_SCHEME_2.
+	uint8_t  chlist_size;		//number of channels in the hopping list.
+	uint8_t  retry_count;		//retry frames after each new-data frame. 0 under scheme 1.
+	uint8_t  reserved;
+	
+} link_params_t;
+
 typedef struct {
 	
 	uint8_t system_address_32[4];
+	link_params_t link;
 	uint8_t  chlist[MAXIMUM_CHANNEL_LIST_SIZE];
-	uint8_t  dev_idx;
+	uint8_t  dev_idx;			//0 in the offer of a joining box.
+	uint8_t  report_divisor;	//cycles from one request for new data to the next.
+	uint8_t  chip_id[CHIP_ID_LENGTH];	//of the device the info is for.
 	
 } pair_info_t;
 
@@ -0,0 +1,183 @@
+/* Copyright (c) 2016 Nordic Semiconductor. All Rights Reserved.
+ *
+ * The information contained herein is property of Nordic Semiconductor ASA.
+ * Terms and conditions of usage are described in detail in NORDIC
+ * SEMICONDUCTOR STANDARD SOFTWARE LICENSE AGREEMENT.
+ *
+ * Licensees are granted free, non-transferable use of the information. NO
+ * WARRANTY of ANY KIND is provided. This heading must NOT be removed from
+ * the file.
+ *
+ */
+
+#include <stddef.h>
+#include "nrf.h"
+#include "nrf_error.h"
+#include "sdk_macros.h"
+#include "app_sleep.h"
+
+#define RTC_FREQUENCY           32768UL
+#define RTC_COUNTER_MASK        0xFFFFFFUL
+#define STOP_DELAY_TICKS        2                   /**< A compare at COUNTER + 1 may be missed. */
+
+// Compares of the RTC
+#define CC_STOP                 0                   /**< Stops the timers, then the crystal. */
+#define CC_HFCLK                1                   /**< Starts the crystal. */
+#define CC_WAKE                 2                   /**< Starts the timers. */
+#define TIMER_CC_COUNT          3                   /**< Compare of @ref APP_SLEEP_COUNT_TIMER its count is captured in. */
+
+#define US_TO_TICKS(us)         ((uint32_t)(((uint64_t)(us) * RTC_FREQUENCY) / 1000000UL))
+#define HFXO_STARTUP_TICKS      (US_TO_TICKS(APP_SLEEP_HFXO_STARTUP_US) + 1)
+#define MIN_OFF_TICKS           (US_TO_TICKS(APP_SLEEP_MIN_OFF_US) + 1)
+
+static app_sleep_pause_handler_t    m_pause_handler;
+static app_sleep_wake_handler_t     m_wake_handler;     /**< Of the sleep in progress. */
+static uint32_t                     m_ppi_channels;     /**< Channels that stop and start the timers. */
+static uint32_t                     m_stop_tick;        /**< RTC count at which the timers stop. */
+static uint32_t                     m_pause_ticks;      /**< Time from the stop to the start of the timers. */
+static uint32_t                     m_wake_tick;        /**< RTC count at which the timers last started. */
+static uint32_t                     m_wake_count;       /**< Count of @ref APP_SLEEP_COUNT_TIMER when they did. */
+static bool                         m_wake_valid;
+static uint32_t                     m_pause_remainder;  /**< Fraction of a microsecond carried to the next pause, in 1/32768 us. */
+static volatile bool                m_active;
+
+
+void app_sleep_init(NRF_TIMER_Type * const * pp_timers, uint8_t count, app_sleep_pause_handler_t pause_handler)
+{
+    uint8_t channel = APP_SLEEP_PPI_FIRST_CHANNEL;
+
+    APP_SLEEP_RTC->TASKS_STOP  = 1;
+    APP_SLEEP_RTC->TASKS_CLEAR = 1;
+    APP_SLEEP_RTC->PRESCALER   = 0;
+    APP_SLEEP_RTC->INTENCLR    = 0xFFFFFFFF;
+    APP_SLEEP_RTC->EVTENCLR    = 0xFFFFFFFF;
+
+    NRF_PPI->CHENCLR = m_ppi_channels;
+    m_ppi_channels   = 0;
+    for (uint8_t i = 0; i < count && i < APP_SLEEP_MAX_TIMERS; i++)
+    {
+        NRF_PPI->CH[channel].EEP = (uint32_t)&APP_SLEEP_RTC->EVENTS_COMPARE[CC_STOP];
+        NRF_PPI->CH[channel].TEP = (uint32_t)&pp_timers[i]->TASKS_STOP;
+        m_ppi_channels |= 1UL << channel++;
+        NRF_PPI->CH[channel].EEP = (uint32_t)&APP_SLEEP_RTC->EVENTS_COMPARE[CC_WAKE];
+        NRF_PPI->CH[channel].TEP = (uint32_t)&pp_timers[i]->TASKS_START;
+        m_ppi_channels |= 1UL << channel++;
+    }
+
+    m_pause_handler   = pause_handler;
+    m_pause_remainder = 0;
+    m_wake_valid      = false;
+    m_active          = false;
+
+    NVIC_SetPriority(APP_SLEEP_RTC_IRQn, APP_SLEEP_IRQ_PRIORITY);
+    NVIC_ClearPendingIRQ(APP_SLEEP_RTC_IRQn);
+    NVIC_EnableIRQ(APP_SLEEP_RTC_IRQn);
+
+    APP_SLEEP_RTC->TASKS_START = 1;
+}
+
+
+bool app_sleep_is_long_enough(uint32_t time_us)
+{
+    // The stop comes up to STOP_DELAY_TICKS from now, and one more tick keeps the start early
+    return US_TO_TICKS(time_us) >= STOP_DELAY_TICKS + 1 + HFXO_STARTUP_TICKS + MIN_OFF_TICKS;
+}
+
+
+uint32_t app_sleep_start(uint32_t time_us, app_sleep_wake_handler_t wake_handler)
+{
+    uint32_t ticks = US_TO_TICKS(time_us);
+    uint32_t stop;
+
+    VERIFY_TRUE(m_pause_handler != NULL, NRF_ERROR_INVALID_STATE);
+    VERIFY_FALSE(m_active, NRF_ERROR_BUSY);
+    VERIFY_TRUE(app_sleep_is_long_enough(time_us), NRF_ERROR_INVALID_PARAM);
+
+    m_pause_ticks  = ticks - STOP_DELAY_TICKS - 1;
+    m_wake_handler = wake_handler;
+
+    __disable_irq();
+    stop        = APP_SLEEP_RTC->COUNTER + STOP_DELAY_TICKS;
+    m_stop_tick = stop & RTC_COUNTER_MASK;
+    APP_SLEEP_RTC->CC[CC_STOP]  = stop & RTC_COUNTER_MASK;
+    APP_SLEEP_RTC->CC[CC_HFCLK] = (stop + m_pause_ticks - HFXO_STARTUP_TICKS) & RTC_COUNTER_MASK;
+    APP_SLEEP_RTC->CC[CC_WAKE]  = (stop + m_pause_ticks) & RTC_COUNTER_MASK;
+    APP_SLEEP_RTC->EVENTS_COMPARE[CC_STOP]  = 0;
+    APP_SLEEP_RTC->EVENTS_COMPARE[CC_HFCLK] = 0;
+    APP_SLEEP_RTC->EVENTS_COMPARE[CC_WAKE]  = 0;
+    APP_SLEEP_RTC->EVTENSET = RTC_EVTENSET_COMPARE0_Msk | RTC_EVTENSET_COMPARE2_Msk;
+    APP_SLEEP_RTC->INTENSET = RTC_INTENSET_COMPARE0_Msk | RTC_INTENSET_COMPARE1_Msk | RTC_INTENSET_COMPARE2_Msk;
+    NRF_PPI->CHENSET        = m_ppi_channels;
+    m_active = true;
+    __enable_irq();
+
+    return NRF_SUCCESS;
+}
+
+
+bool app_sleep_is_active(void)
+{
+    return m_active;
+}
+
+
+void app_sleep_rtc_handler(void)
+{
+    if (APP_SLEEP_RTC->EVENTS_COMPARE[CC_STOP])
+    {
+        uint32_t cc      = APP_SLEEP_COUNT_TIMER->CC[TIMER_CC_COUNT];
+        int64_t  dropped = RTC_FREQUENCY / 2;
+        int64_t  measured;
+        uint32_t count;
+        int64_t  pause;
+
+        APP_SLEEP_RTC->EVENTS_COMPARE[CC_STOP] = 0;
+        NRF_CLOCK->TASKS_HFCLKSTOP = 1;
+
+        APP_SLEEP_COUNT_TIMER->TASKS_CAPTURE[TIMER_CC_COUNT] = 1;
+        count = APP_SLEEP_COUNT_TIMER->CC[TIMER_CC_COUNT];
+        APP_SLEEP_COUNT_TIMER->CC[TIMER_CC_COUNT] = cc;
+
+        // A timer drops the part of a microsecond it had counted when it stops, and the 16 MHz
+        // clock decides where a tick of the RTC falls between two of its counts. The time awake
+        // since the last wake is a whole number of RTC ticks, so comparing it with the count
+        // gives the difference exactly. Before the first wake, or if the timer was cleared since,
+        // it is half a microsecond on average.
+        if (m_wake_valid)
+        {
+            measured = (int64_t)((m_stop_tick - m_wake_tick) & RTC_COUNTER_MASK) * 1000000
+                     - (int64_t)(count - m_wake_count) * RTC_FREQUENCY;
+            if (measured > -(int64_t)RTC_FREQUENCY && measured < (int64_t)RTC_FREQUENCY)
+            {
+                dropped = measured;
+            }
+        }
+        m_wake_count      = count;
+        pause             = (int64_t)m_pause_ticks * 1000000 + dropped + m_pause_remainder;
+        m_pause_remainder = (uint32_t)(pause % RTC_FREQUENCY);
+        m_pause_handler((uint32_t)(pause / RTC_FREQUENCY));
+    }
+
+    if (APP_SLEEP_RTC->EVENTS_COMPARE[CC_HFCLK])
+    {
+        APP_SLEEP_RTC->EVENTS_COMPARE[CC_HFCLK] = 0;
+        NRF_CLOCK->EVENTS_HFCLKSTARTED = 0;
+        NRF_CLOCK->TASKS_HFCLKSTART    = 1;
+    }
+
+    if (APP_SLEEP_RTC->EVENTS_COMPARE[CC_WAKE])
+    {
+        APP_SLEEP_RTC->EVENTS_COMPARE[CC_WAKE] = 0;
+        m_wake_tick             = (m_stop_tick + m_pause_ticks) & RTC_COUNTER_MASK;
+        m_wake_valid            = true;
+        NRF_PPI->CHENCLR        = m_ppi_channels;
+        APP_SLEEP_RTC->INTENCLR = RTC_INTENCLR_COMPARE0_Msk | RTC_INTENCLR_COMPARE1_Msk | RTC_INTENCLR_COMPARE2_Msk;
+        APP_SLEEP_RTC->EVTENCLR = RTC_EVTENCLR_COMPARE0_Msk | RTC_EVTENCLR_COMPARE2_Msk;
+        m_active = false;
+
+        if (m_wake_handler != NULL)
+        {
+            m_wake_handler();
+        }
+    }
+}
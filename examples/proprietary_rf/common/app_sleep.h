@@ -0,0 +1,111 @@
+/* Copyright (c) 2016 Nordic Semiconductor. All Rights Reserved.
+ *
+ * The information contained herein is property of Nordic Semiconductor ASA.
+ * Terms and conditions of usage are described in detail in NORDIC
+ * SEMICONDUCTOR STANDARD SOFTWARE LICENSE AGREEMENT.
+ *
+ * Licensees are granted free, non-transferable use of the information. NO
+ * WARRANTY of ANY KIND is provided. This heading must NOT be removed from
+ * the file.
+ *
+ */
+
+#ifndef APP_SLEEP_H__
+#define APP_SLEEP_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "nrf.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @defgroup app_sleep Sleep between frames
+ * @{
+ * @ingroup app_common
+ *
+ * @brief Stops the 16 MHz clock of a device while its radio has nothing to do.
+ *
+ * @details The frame timing and the local clock count on TIMERs, which keep the 16 MHz clock
+ *          running. For a sleep, PPI stops the timers on one tick of @ref APP_SLEEP_RTC, which
+ *          runs on the 32.768 kHz clock, and starts them again on a later tick. In between, the
+ *          16 MHz crystal is stopped, and started again @ref APP_SLEEP_HFXO_STARTUP_US before the
+ *          timers, so that they count on the crystal from their first tick on. The CPU waits in
+ *          WFE as before.
+ *
+ *          As the stop and the start come from the RTC, the time the timers stood still is a
+ *          whole number of ticks. The pause handler gets it when the timers stop, and moves the
+ *          counts and compares built on them.
+ */
+
+#define APP_SLEEP_RTC                   NRF_RTC1
+#define APP_SLEEP_RTC_IRQn              RTC1_IRQn
+#define APP_SLEEP_IRQ_PRIORITY          1                   /**< Same as the radio, so that neither preempts the other. */
+#define APP_SLEEP_PPI_FIRST_CHANNEL     1                   /**< First of two PPI channels per timer, one to stop and one to start it. */
+#define APP_SLEEP_MAX_TIMERS            2
+#define APP_SLEEP_COUNT_TIMER           NRF_TIMER0          /**< Timer among them that counts microseconds in 32 bits. Its CC[3] is borrowed at each stop. */
+#define APP_SLEEP_HFXO_STARTUP_US       1000                /**< 16 MHz crystal start-up time, with margin over the typical 800 us. */
+#define APP_SLEEP_MIN_OFF_US            200                 /**< Shortest time worth stopping the crystal for. */
+
+
+/**@brief Handler of the time the timers stand still. Runs in the RTC interrupt, while they do.
+ *
+ * @param[in]   pause_us            Time from the stop of the timers to their start, in microseconds.
+ */
+typedef void (*app_sleep_pause_handler_t)(uint32_t pause_us);
+
+
+/**@brief Handler of the end of a sleep. Runs in the RTC interrupt, once the timers run again. */
+typedef void (*app_sleep_wake_handler_t)(void);
+
+
+/**@brief Function for setting up the RTC and the PPI channels of the timers.
+ *
+ * The 32.768 kHz clock must be running. The caller must forward the interrupt of
+ * @ref APP_SLEEP_RTC to @ref app_sleep_rtc_handler.
+ *
+ * @param[in]   pp_timers           Timers to stop during a sleep, up to @ref APP_SLEEP_MAX_TIMERS,
+ *                                  among them @ref APP_SLEEP_COUNT_TIMER.
+ * @param[in]   count               Number of timers.
+ * @param[in]   pause_handler       Handler of the time the timers stand still.
+ */
+void app_sleep_init(NRF_TIMER_Type * const * pp_timers, uint8_t count, app_sleep_pause_handler_t pause_handler);
+
+
+/**@brief Function for sleeping until shortly before the timers are needed again.
+ *
+ * The timers stop within two RTC ticks and start again up to one tick before @p time_us.
+ * Nothing may use the radio or the 16 MHz crystal meanwhile.
+ *
+ * @param[in]   time_us             Time from now until the timers are needed, in microseconds.
+ * @param[in]   wake_handler        Handler of the end of the sleep, or NULL.
+ *
+ * @retval  NRF_SUCCESS                     If the sleep was set up.
+ * @retval  NRF_ERROR_INVALID_STATE         If the module is not initialized.
+ * @retval  NRF_ERROR_BUSY                  If a sleep is in progress.
+ * @retval  NRF_ERROR_INVALID_PARAM         If @p time_us is too short to stop the crystal.
+ */
+uint32_t app_sleep_start(uint32_t time_us, app_sleep_wake_handler_t wake_handler);
+
+
+/**@brief Function for checking whether a time is long enough for @ref app_sleep_start to stop the crystal. */
+bool app_sleep_is_long_enough(uint32_t time_us);
+
+
+/**@brief Function for checking whether a sleep is in progress. */
+bool app_sleep_is_active(void);
+
+
+/**@brief Function for handling the interrupt of @ref APP_SLEEP_RTC. */
+void app_sleep_rtc_handler(void);
+
+/** @} */
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* APP_SLEEP_H__ */
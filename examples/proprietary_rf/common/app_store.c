@@ -0,0 +1,378 @@
+/* Copyright (c) 2016 Nordic Semiconductor. All Rights Reserved.
+ *
+ * The information contained herein is property of Nordic Semiconductor ASA.
+ * Terms and conditions of usage are described in detail in NORDIC
+ * SEMICONDUCTOR STANDARD SOFTWARE LICENSE AGREEMENT.
+ *
+ * Licensees are granted free, non-transferable use of the information. NO
+ * WARRANTY of ANY KIND is provided. This heading must NOT be removed from
+ * the file.
+ *
+ */
+
+#include <stddef.h>
+#include <string.h>
+#include "nrf.h"
+#include "nrf_error.h"
+#include "sdk_macros.h"
+#include "app_util.h"
+#include "app_store.h"
+
+#define STORE_PAGE_TAG            0x53544F52UL        /**< First word of a page in use. */
+#define STORE_RECORD_TAG          0xA55A0000UL        /**< Upper half of a record header. The lower half is the length in words. */
+#define STORE_RECORD_TAG_MASK     0xFFFF0000UL
+#define STORE_PAGE_HEADER_WORDS   2                   /**< Magic word and sequence number. */
+#define STORE_RECORD_EXTRA_WORDS  2                   /**< Record header and check word. */
+#define STORE_MAX_WORDS           (APP_STORE_MAX_LENGTH / sizeof(uint32_t))
+#define STORE_ERASED_WORD         0xFFFFFFFFUL
+#define STORE_NO_PAGE             0xFF
+
+STATIC_ASSERT(APP_STORE_PAGES >= 3);
+STATIC_ASSERT(APP_STORE_MAX_LENGTH % sizeof(uint32_t) == 0);
+
+/**@brief Step of a write in progress. */
+typedef enum
+{
+    STORE_STATE_IDLE,
+    STORE_STATE_ERASE,          /**< Erasing the next page. It was not left erased at boot. */
+    STORE_STATE_PAGE_SEQUENCE,  /**< Writing the sequence number of the next page. */
+    STORE_STATE_PAGE_MAGIC,     /**< Writing the magic word, which makes the next page the one in use. */
+    STORE_STATE_RECORD,         /**< Appending the record to the page in use. */
+} store_state_t;
+
+static uint32_t                 m_page_words;
+static uint8_t                  m_page;                 /**< Page in use, where records are appended. */
+static uint32_t                 m_page_sequence;        /**< Sequence number of the page in use. */
+static uint32_t                 m_write_pos;            /**< First free word of the page in use. */
+static uint8_t                  m_next_page;            /**< Page being opened. */
+static uint8_t                  m_erased_mask;          /**< Pages known to be erased. */
+static uint32_t const *         mp_latest;              /**< Header of the latest valid record in flash. */
+
+static uint32_t                 m_data[STORE_MAX_WORDS];        /**< Data of the last write since boot. */
+static uint16_t                 m_data_words;                   /**< 0 before the first write. */
+static volatile bool            m_pending;                      /**< m_data has yet to be written. */
+
+static store_state_t            m_state;
+static uint32_t                 m_record[STORE_MAX_WORDS + STORE_RECORD_EXTRA_WORDS];   /**< Record being written. */
+static uint16_t                 m_record_words;
+static uint16_t                 m_record_pos;           /**< Next word of the record to write. */
+
+
+static uint32_t * page_address(uint8_t page)
+{
+    return (uint32_t *)(NRF_FICR->CODEPAGESIZE * (APP_STORE_FIRST_PAGE + page));
+}
+
+
+static bool page_is_valid(uint8_t page)
+{
+    uint32_t const * p_page = page_address(page);
+
+    // The sequence number is written first, so a page torn while it was opened has no magic word.
+    return p_page[0] == STORE_PAGE_TAG && p_page[1] != STORE_ERASED_WORD;
+}
+
+
+static bool page_is_erased(uint8_t page)
+{
+    uint32_t const * p_page = page_address(page);
+
+    for (uint32_t i = 0; i < m_page_words; i++)
+    {
+        if (p_page[i] != STORE_ERASED_WORD)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/**@brief Function for erasing a page, waiting until the NVMC is done. Only used by @ref app_store_init. */
+static void page_erase(uint8_t page)
+{
+    NRF_NVMC->CONFIG = (NVMC_CONFIG_WEN_Een << NVMC_CONFIG_WEN_Pos);
+    NRF_NVMC->ERASEPAGE = (uint32_t)page_address(page);
+
+    while (NRF_NVMC->READY == NVMC_READY_READY_Busy)
+    {
+        // Do nothing.
+    }
+
+    NRF_NVMC->CONFIG = (NVMC_CONFIG_WEN_Ren << NVMC_CONFIG_WEN_Pos);
+}
+
+
+/**@brief Function for computing the check word of a record, FNV-1a over the header and the data. */
+static uint32_t record_check(uint32_t const * p_record, uint16_t data_words)
+{
+    uint8_t const * p_byte = (uint8_t const *)p_record;
+    uint32_t        check  = 2166136261UL;
+
+    for (uint32_t i = 0; i < (data_words + 1) * sizeof(uint32_t); i++)
+    {
+        check ^= p_byte[i];
+        check *= 16777619UL;
+    }
+    return check;
+}
+
+
+/**@brief Function for walking the records of a valid page.
+ *
+ * @param[in]   page                Page to walk.
+ * @param[out]  pp_latest           Header of the last record of the page that checks out. Left
+ *                                  alone if there is none.
+ *
+ * @return  First free word of the page, or the page size if nothing more can be appended.
+ */
+static uint32_t page_scan(uint8_t page, uint32_t const ** pp_latest)
+{
+    uint32_t const * p_page = page_address(page);
+    uint32_t         pos    = STORE_PAGE_HEADER_WORDS;
+
+    while (pos < m_page_words && p_page[pos] != STORE_ERASED_WORD)
+    {
+        uint32_t header = p_page[pos];
+        uint32_t words  = header & ~STORE_RECORD_TAG_MASK;
+
+        if ((header & STORE_RECORD_TAG_MASK) != STORE_RECORD_TAG || words > STORE_MAX_WORDS ||
+            pos + words + STORE_RECORD_EXTRA_WORDS > m_page_words)
+        {
+            // Not a record header, so the rest of the page cannot be trusted to be erased.
+            return m_page_words;
+        }
+
+        // A record torn by a reset fails the check, and only takes up its space.
+        if (p_page[pos + 1 + words] == record_check(&p_page[pos], words))
+        {
+            *pp_latest = &p_page[pos];
+        }
+        pos += words + STORE_RECORD_EXTRA_WORDS;
+    }
+    return pos;
+}
+
+
+static bool page_has_latest(uint8_t page)
+{
+    uint32_t const * p_page = page_address(page);
+
+    return mp_latest >= p_page && mp_latest < p_page + m_page_words;
+}
+
+
+static void word_write(uint32_t * p_word, uint32_t value)
+{
+    NRF_NVMC->CONFIG = (NVMC_CONFIG_WEN_Wen << NVMC_CONFIG_WEN_Pos);
+    *p_word = value;
+}
+
+
+/**@brief Function for taking the newest data as the record to write, and picking where it goes. */
+static void record_start(void)
+{
+    // The data can be replaced from an interrupt.
+    __disable_irq();
+    m_record_words = m_data_words + STORE_RECORD_EXTRA_WORDS;
+    m_record[0]    = STORE_RECORD_TAG | m_data_words;
+    memcpy(&m_record[1], m_data, m_data_words * sizeof(uint32_t));
+    m_pending      = false;
+    __enable_irq();
+
+    m_record[m_record_words - 1] = record_check(m_record, m_record_words - STORE_RECORD_EXTRA_WORDS);
+    m_record_pos = 0;
+
+    if (m_write_pos + m_record_words <= m_page_words)
+    {
+        m_state = STORE_STATE_RECORD;
+        return;
+    }
+
+    // Pages are used in turn, skipping the one with the latest record, which must survive an erase.
+    m_next_page = (m_page == STORE_NO_PAGE) ? 0 : (m_page + 1) % APP_STORE_PAGES;
+    if (page_has_latest(m_next_page))
+    {
+        m_next_page = (m_next_page + 1) % APP_STORE_PAGES;
+    }
+    m_state = (m_erased_mask & (1 << m_next_page)) ? STORE_STATE_PAGE_SEQUENCE : STORE_STATE_ERASE;
+}
+
+
+void app_store_init(void)
+{
+    uint8_t  latest_page     = STORE_NO_PAGE;
+    uint32_t latest_sequence = 0;
+
+    m_page_words    = NRF_FICR->CODEPAGESIZE / sizeof(uint32_t);
+    m_page          = STORE_NO_PAGE;
+    m_page_sequence = 0;
+    m_write_pos     = m_page_words;
+    m_erased_mask   = 0;
+    mp_latest       = NULL;
+    m_data_words    = 0;
+    m_pending       = false;
+    m_state         = STORE_STATE_IDLE;
+
+    // The page in use has the highest sequence number. The latest record is the last one that
+    // checks out in the page with the highest sequence number that has one.
+    for (uint8_t page = 0; page < APP_STORE_PAGES; page++)
+    {
+        uint32_t const * p_latest = NULL;
+        uint32_t         sequence;
+        uint32_t         pos;
+
+        if (!page_is_valid(page))
+        {
+            continue;
+        }
+
+        sequence = page_address(page)[1];
+        pos      = page_scan(page, &p_latest);
+
+        if (m_page == STORE_NO_PAGE || (int32_t)(sequence - m_page_sequence) > 0)
+        {
+            m_page          = page;
+            m_page_sequence = sequence;
+            m_write_pos     = pos;
+        }
+        if (p_latest != NULL && (latest_page == STORE_NO_PAGE || (int32_t)(sequence - latest_sequence) > 0))
+        {
+            mp_latest       = p_latest;
+            latest_page     = page;
+            latest_sequence = sequence;
+        }
+    }
+
+    for (uint8_t page = 0; page < APP_STORE_PAGES; page++)
+    {
+        if (page == m_page || page == latest_page)
+        {
+            continue;
+        }
+        if (!page_is_erased(page))
+        {
+            page_erase(page);
+        }
+        m_erased_mask |= (1 << page);
+    }
+}
+
+
+uint32_t app_store_read(void * p_data, uint16_t length)
+{
+    uint32_t const * p_words;
+    uint32_t         words;
+
+    VERIFY_PARAM_NOT_NULL(p_data);
+
+    if (m_data_words != 0)
+    {
+        p_words = m_data;
+        words   = m_data_words;
+    }
+    else if (mp_latest != NULL)
+    {
+        p_words = mp_latest + 1;
+        words   = *mp_latest & ~STORE_RECORD_TAG_MASK;
+    }
+    else
+    {
+        return NRF_ERROR_NOT_FOUND;
+    }
+
+    if (length != words * sizeof(uint32_t))
+    {
+        return NRF_ERROR_INVALID_LENGTH;
+    }
+
+    memcpy(p_data, p_words, length);
+    return NRF_SUCCESS;
+}
+
+
+uint32_t app_store_write(void const * p_data, uint16_t length)
+{
+    VERIFY_PARAM_NOT_NULL(p_data);
+
+    if (length == 0 || length % sizeof(uint32_t) != 0 || length > APP_STORE_MAX_LENGTH)
+    {
+        return NRF_ERROR_INVALID_LENGTH;
+    }
+
+    memcpy(m_data, p_data, length);
+    m_data_words = length / sizeof(uint32_t);
+    m_pending    = true;
+
+    return NRF_SUCCESS;
+}
+
+
+void app_store_process(void)
+{
+    uint32_t * p_page;
+
+    if (NRF_NVMC->READY == NVMC_READY_READY_Busy)
+    {
+        return;
+    }
+
+    if (m_state == STORE_STATE_IDLE)
+    {
+        if (!m_pending)
+        {
+            if ((NRF_NVMC->CONFIG & NVMC_CONFIG_WEN_Msk) != (NVMC_CONFIG_WEN_Ren << NVMC_CONFIG_WEN_Pos))
+            {
+                NRF_NVMC->CONFIG = (NVMC_CONFIG_WEN_Ren << NVMC_CONFIG_WEN_Pos);
+            }
+            return;
+        }
+        record_start();
+    }
+
+    switch (m_state)
+    {
+        case STORE_STATE_ERASE:
+            // Only when more records were written since boot than the erased pages hold.
+            NRF_NVMC->CONFIG = (NVMC_CONFIG_WEN_Een << NVMC_CONFIG_WEN_Pos);
+            NRF_NVMC->ERASEPAGE = (uint32_t)page_address(m_next_page);
+            m_erased_mask |= (1 << m_next_page);
+            m_state = STORE_STATE_PAGE_SEQUENCE;
+            break;
+
+        case STORE_STATE_PAGE_SEQUENCE:
+            word_write(&page_address(m_next_page)[1], m_page_sequence + 1);
+            m_state = STORE_STATE_PAGE_MAGIC;
+            break;
+
+        case STORE_STATE_PAGE_MAGIC:
+            word_write(&page_address(m_next_page)[0], STORE_PAGE_TAG);
+            m_erased_mask  &= ~(1 << m_next_page);
+            m_page          = m_next_page;
+            m_page_sequence = m_page_sequence + 1;
+            m_write_pos     = STORE_PAGE_HEADER_WORDS;
+            m_state         = STORE_STATE_RECORD;
+            break;
+
+        case STORE_STATE_RECORD:
+            p_page = page_address(m_page);
+            word_write(&p_page[m_write_pos + m_record_pos], m_record[m_record_pos]);
+            if (++m_record_pos == m_record_words)
+            {
+                // The check word is the last one written, so the record is valid from now on.
+                mp_latest    = &p_page[m_write_pos];
+                m_write_pos += m_record_words;
+                m_state      = STORE_STATE_IDLE;
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+bool app_store_is_busy(void)
+{
+    return m_pending || m_state != STORE_STATE_IDLE;
+}
@@ -0,0 +1,110 @@
+/* Copyright (c) 2016 Nordic Semiconductor. All Rights Reserved.
+ *
+ * The information contained herein is property of Nordic Semiconductor ASA.
+ * Terms and conditions of usage are described in detail in NORDIC
+ * SEMICONDUCTOR STANDARD SOFTWARE LICENSE AGREEMENT.
+ *
+ * Licensees are granted free, non-transferable use of the information. NO
+ * WARRANTY of ANY KIND is provided. This heading must NOT be removed from
+ * the file.
+ *
+ */
+
+#ifndef APP_STORE_H__
+#define APP_STORE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @defgroup app_store Configuration store
+ * @{
+ * @ingroup app_common
+ *
+ * @brief Log-structured flash store of the configuration of the box or of a device.
+ *
+ * @details The store spans @ref APP_STORE_PAGES flash pages. Each page starts with a page
+ *          header: a magic word and a sequence number, which grows by one for every page
+ *          opened. Records are appended after it: a header word with the record magic and the
+ *          length in words, the data, and a check word over both. Only the last record that
+ *          checks out is valid, so a record torn by a reset is skipped, and the one before it
+ *          stays in use. When a record does not fit, the next page is opened.
+ *
+ *          @ref app_store_write only takes a copy of the data. @ref app_store_process, called
+ *          from the main loop, writes one word per call whenever the NVMC is ready, so that the
+ *          radio interrupts are held off for at most one word write. A write that comes while
+ *          another is in progress is kept, and only the newest one is written afterwards.
+ *
+ *          Erasing a page stops the CPU for about 22 ms on the nRF51, so @ref app_store_init
+ *          erases every page but the one in use and the one with the latest record, before the
+ *          radio starts. That leaves room for at least
+ *          (@ref APP_STORE_PAGES - 1) * (page size / record size) records per power cycle.
+ *          Only a write beyond that erases the oldest page at run time.
+ */
+
+#define APP_STORE_FIRST_PAGE        124                 /**< First flash page of the store. */
+#define APP_STORE_PAGES             4                   /**< Flash pages of the store, used in turn. */
+#define APP_STORE_MAX_LENGTH        320                 /**< Largest record, in bytes. */
+
+
+/**@brief Function for finding the latest record and preparing the pages.
+ *
+ * Erases the pages that are not needed any more, so it blocks for up to
+ * (@ref APP_STORE_PAGES - 1) page erases. Call it before the radio starts.
+ */
+void app_store_init(void);
+
+
+/**@brief Function for reading the latest record.
+ *
+ * The latest record is the data of the last @ref app_store_write, whether or not it has reached
+ * the flash yet.
+ *
+ * @param[out]  p_data              Record data.
+ * @param[in]   length              Length of the record, in bytes.
+ *
+ * @retval  NRF_SUCCESS                     If the record was copied to @p p_data.
+ * @retval  NRF_ERROR_NULL                  If the required parameter was NULL.
+ * @retval  NRF_ERROR_NOT_FOUND             If there is no record.
+ * @retval  NRF_ERROR_INVALID_LENGTH        If the latest record has another length.
+ */
+uint32_t app_store_read(void * p_data, uint16_t length);
+
+
+/**@brief Function for writing a new record.
+ *
+ * Returns right away. The record reaches the flash through @ref app_store_process.
+ *
+ * @param[in]   p_data              Record data.
+ * @param[in]   length              Length of the record, in bytes. A multiple of 4, up to
+ *                                  @ref APP_STORE_MAX_LENGTH.
+ *
+ * @retval  NRF_SUCCESS                     If the record was taken.
+ * @retval  NRF_ERROR_NULL                  If the required parameter was NULL.
+ * @retval  NRF_ERROR_INVALID_LENGTH        If the length is not supported.
+ */
+uint32_t app_store_write(void const * p_data, uint16_t length);
+
+
+/**@brief Function for running the next step of a pending write.
+ *
+ * Call it from the main loop. It writes at most one word, and does nothing while the NVMC is busy.
+ */
+void app_store_process(void);
+
+
+/**@brief Function for checking whether a written record has yet to reach the flash. */
+bool app_store_is_busy(void);
+
+/** @} */
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* APP_STORE_H__ */
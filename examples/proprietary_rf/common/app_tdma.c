@@ -0,0 +1,308 @@
+/* Copyright (c) 2016 Nordic Semiconductor. All Rights Reserved.
+ *
+ * The information contained herein is property of Nordic Semiconductor ASA.
+ * Terms and conditions of usage are described in detail in NORDIC
+ * SEMICONDUCTOR STANDARD SOFTWARE LICENSE AGREEMENT.
+ *
+ * Licensees are granted free, non-transferable use of the information. NO
+ * WARRANTY of ANY KIND is provided. This heading must NOT be removed from
+ * the file.
+ *
+ */
+
+#include <string.h>
+#include "nrf_error.h"
+#include "nrf_esb.h"
+#include "sdk_macros.h"
+#include "app_tdma.h"
+
+static app_tdma_schedule_t  m_schedule;
+static uint8_t const      * mp_channels;            /**< Channel list of a device, kept for scanning again. */
+static uint8_t              m_channel_count;
+static uint8_t              m_sync_timeout;         /**< Frames left until a device loses sync. 0 while it is not synced. */
+static uint16_t             m_coast_left;           /**< Frames left until a device that lost sync scans again. */
+static uint8_t              m_subframe;             /**< Position of the current frame of the box in its cycle. */
+
+
+uint32_t app_tdma_airtime_us(uint8_t payload_length)
+{
+    uint32_t bits = 8 * (1 + APP_TDMA_ADDRESS_LENGTH + payload_length + APP_TDMA_CRC_LENGTH) +
+                    APP_TDMA_PCF_BITS;
+
+    // 2 bits per microsecond, rounded up
+    return (bits + 1) / 2;
+}
+
+
+uint32_t app_tdma_slot_airtime_us(app_tdma_schedule_t const * p_schedule)
+{
+    return app_tdma_airtime_us(p_schedule->response_length) + APP_TDMA_RAMP_UP_US +
+           app_tdma_airtime_us(0) + APP_TDMA_RAMP_UP_US;
+}
+
+
+uint32_t app_tdma_frame_busy_us(app_tdma_schedule_t const * p_schedule)
+{
+    return APP_TDMA_RAMP_UP_US + app_tdma_airtime_us(p_schedule->beacon_length) +
+           p_schedule->slot_offset_us +
+           (uint32_t)(p_schedule->slot_count - 1) * p_schedule->slot_period_us +
+           APP_TDMA_RAMP_UP_US + app_tdma_slot_airtime_us(p_schedule);
+}
+
+
+uint32_t app_tdma_schedule_check(app_tdma_schedule_t const * p_schedule)
+{
+    VERIFY_PARAM_NOT_NULL(p_schedule);
+
+    if (p_schedule->subframes == 0 || p_schedule->slot_count == 0 ||
+        p_schedule->sync_timeout_frames == 0 || p_schedule->scan_frames == 0)
+    {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+
+    // The device must still be synced in the last frame it answers without a beacon
+    if (p_schedule->flywheel_frames >= p_schedule->sync_timeout_frames)
+    {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+
+    // The hop sequencer takes a 16-bit period, also while scanning
+    if (p_schedule->frame_period_us * p_schedule->scan_frames > UINT16_MAX)
+    {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+
+    if (p_schedule->slot_period_us < app_tdma_slot_airtime_us(p_schedule))
+    {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+
+    // The last device must be done before the others retune for the next beacon
+    if (app_tdma_frame_busy_us(p_schedule) + p_schedule->beacon_guard_us > p_schedule->frame_period_us)
+    {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+
+    return NRF_SUCCESS;
+}
+
+
+uint32_t app_tdma_init(app_tdma_schedule_t const * p_schedule)
+{
+    uint32_t err_code = app_tdma_schedule_check(p_schedule);
+
+    if (err_code != NRF_SUCCESS)
+    {
+        return err_code;
+    }
+
+    memcpy(&m_schedule, p_schedule, sizeof(m_schedule));
+    m_sync_timeout = 0;
+    m_coast_left   = 0;
+
+    return NRF_SUCCESS;
+}
+
+
+uint32_t app_tdma_slot_offset_us(uint8_t slot)
+{
+    return m_schedule.slot_offset_us + (uint32_t)slot * m_schedule.slot_period_us;
+}
+
+
+uint32_t app_tdma_subframes_set(uint8_t subframes)
+{
+    VERIFY_TRUE(subframes > 0, NRF_ERROR_INVALID_PARAM);
+
+    m_schedule.subframes = subframes;
+    m_subframe           = 0;
+
+    return NRF_SUCCESS;
+}
+
+
+uint32_t app_tdma_master_start(uint8_t const * p_channels, uint8_t count)
+{
+    m_subframe = m_schedule.subframes - 1;
+
+    return nrf_esb_hop_start(p_channels, count, (uint16_t)m_schedule.frame_period_us);
+}
+
+
+uint8_t app_tdma_master_on_hop(void)
+{
+    m_subframe++;
+    if (m_subframe >= m_schedule.subframes)
+    {
+        m_subframe = 0;
+    }
+
+    return m_subframe;
+}
+
+
+/**@brief Function for hopping through the channel list of a device at the scan period. */
+static uint32_t scan_hop_start(void)
+{
+    m_sync_timeout = 0;
+    m_coast_left   = 0;
+
+    return nrf_esb_hop_start(mp_channels, m_channel_count,
+                             (uint16_t)(m_schedule.frame_period_us * m_schedule.scan_frames));
+}
+
+
+uint32_t app_tdma_scan_start(uint8_t const * p_channels, uint8_t count)
+{
+    uint32_t err_code;
+
+    mp_channels = p_channels;
+    m_channel_count = count;
+
+    err_code = scan_hop_start();
+    if (err_code != NRF_SUCCESS)
+    {
+        return err_code;
+    }
+
+    return nrf_esb_hop_sync(0, (uint16_t)(m_schedule.frame_period_us * m_schedule.scan_frames));
+}
+
+
+uint32_t app_tdma_beacon_received(uint8_t hop_index)
+{
+    uint32_t err_code;
+
+    if (m_sync_timeout == 0)
+    {
+        // Also from coasting: the hop timer starts over from this beacon
+        m_coast_left = 0;
+        err_code = nrf_esb_hop_start(mp_channels, m_channel_count, (uint16_t)m_schedule.frame_period_us);
+        if (err_code != NRF_SUCCESS)
+        {
+            return err_code;
+        }
+
+        // The beacon ends the guard time after the hop
+        err_code = nrf_esb_hop_deadline_set((uint16_t)(m_schedule.beacon_guard_us + APP_TDMA_BEACON_WINDOW_US));
+        if (err_code != NRF_SUCCESS)
+        {
+            return err_code;
+        }
+    }
+
+    m_sync_timeout = m_schedule.sync_timeout_frames;
+
+    return nrf_esb_hop_sync(hop_index, (uint16_t)(m_schedule.frame_period_us - m_schedule.beacon_guard_us));
+}
+
+
+uint32_t app_tdma_respond(uint8_t slot)
+{
+    // No late start: past its slot, the response would run into the next one
+    return nrf_esb_start_tx_at((uint16_t)app_tdma_slot_offset_us(slot));
+}
+
+
+/**@brief Function for getting the time from the radio ramp-up of a slot to the next hop. */
+static uint16_t slot_to_hop_us(uint8_t slot)
+{
+    return (uint16_t)(m_schedule.frame_period_us - m_schedule.beacon_guard_us - app_tdma_slot_offset_us(slot));
+}
+
+
+uint32_t app_tdma_slot_time_left(uint8_t slot, uint32_t * p_time_us)
+{
+    uint16_t hop_us;
+    uint32_t err_code;
+
+    VERIFY_PARAM_NOT_NULL(p_time_us);
+
+    err_code = nrf_esb_hop_time_left(&hop_us);
+    if (err_code != NRF_SUCCESS)
+    {
+        return err_code;
+    }
+
+    *p_time_us = hop_us > slot_to_hop_us(slot) ? hop_us - slot_to_hop_us(slot) : 0;
+
+    return NRF_SUCCESS;
+}
+
+
+uint32_t app_tdma_respond_before_hop(uint8_t slot)
+{
+    // No late start either
+    return nrf_esb_start_tx_before_hop(slot_to_hop_us(slot));
+}
+
+
+uint32_t app_tdma_respond_predicted(uint8_t slot)
+{
+    uint8_t missed = app_tdma_beacons_missed();
+
+    if (missed == 0 || missed > m_schedule.flywheel_frames)
+    {
+        return NRF_ERROR_INVALID_STATE;
+    }
+
+    // No late start: past its slot, the response would run into the next one
+    return nrf_esb_start_tx_at_hop((uint16_t)(m_schedule.beacon_guard_us + app_tdma_slot_offset_us(slot)));
+}
+
+
+uint8_t app_tdma_beacons_missed(void)
+{
+    if (m_sync_timeout == 0)
+    {
+        return 0;
+    }
+
+    return m_schedule.sync_timeout_frames - m_sync_timeout;
+}
+
+
+bool app_tdma_on_hop(void)
+{
+    if (m_sync_timeout == 0)
+    {
+        // The box may have restarted its frames. Hold each channel long enough to find it again.
+        if (m_coast_left > 0 && --m_coast_left == 0)
+        {
+            (void)scan_hop_start();
+        }
+        return false;
+    }
+
+    m_sync_timeout--;
+    if (m_sync_timeout > 0)
+    {
+        return false;
+    }
+
+    // Sync lost. The box still hops where the device expects it, so follow it and listen
+    // through the whole frame. Without coasting, scan right away.
+    if (m_schedule.coast_frames > 0)
+    {
+        m_coast_left = m_schedule.coast_frames;
+        (void)nrf_esb_hop_deadline_set(0);
+    }
+    else
+    {
+        (void)scan_hop_start();
+    }
+
+    return true;
+}
+
+
+bool app_tdma_is_synced(void)
+{
+    return m_sync_timeout > 0;
+}
+
+
+bool app_tdma_is_coasting(void)
+{
+    return m_coast_left > 0;
+}
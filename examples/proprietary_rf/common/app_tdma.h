@@ -0,0 +1,253 @@
+/* Copyright (c) 2016 Nordic Semiconductor. All Rights Reserved.
+ *
+ * The information contained herein is property of Nordic Semiconductor ASA.
+ * Terms and conditions of usage are described in detail in NORDIC
+ * SEMICONDUCTOR STANDARD SOFTWARE LICENSE AGREEMENT.
+ *
+ * Licensees are granted free, non-transferable use of the information. NO
+ * WARRANTY of ANY KIND is provided. This heading must NOT be removed from
+ * the file.
+ *
+ */
+
+#ifndef APP_TDMA_H__
+#define APP_TDMA_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @defgroup app_tdma TDMA slot scheduler
+ * @{
+ * @ingroup app_common
+ *
+ * @brief Frame schedule of the box and its devices, run on the ESB hop sequencer.
+ *
+ * @details Every frame is one hop of the channel list. The box sends a beacon when the frame
+ *          starts, and every device answers in its own response slot, timed by
+ *          @ref nrf_esb_start_tx_at from the end of the beacon. Devices follow the box with
+ *          @ref nrf_esb_hop_sync and retune shortly before the next beacon is due. A cycle of
+ *          @c subframes frames asks for new data in its first frame; the other frames of the
+ *          cycle give the devices the box did not hear from another try. The box can change
+ *          the number of subframes between cycles without affecting the frame timing.
+ *
+ *          A synced device listens for the beacon from the hop on. When the beacon has not come
+ *          by @ref APP_TDMA_BEACON_WINDOW_US after it was due, @ref NRF_ESB_EVENT_HOP_DEADLINE
+ *          tells the device so. It can stop listening until the next frame, or, for up to
+ *          @c flywheel_frames missed beacons in a row, still answer in its slot with
+ *          @ref app_tdma_respond_predicted, timed from the hop.
+ *
+ *          After @c sync_timeout_frames without a beacon, the device has lost sync. It still knows
+ *          when and where the box hops, so it coasts: it keeps the hop sequence for
+ *          @c coast_frames and listens through every frame, and the first beacon after a fade
+ *          brings it back. Only then does it scan channel by channel, in case the box restarted.
+ *
+ *          Both the frame timing and the device slots come from one @ref app_tdma_schedule_t,
+ *          which @ref app_tdma_init checks against the on-air time of the packets. The check
+ *          assumes the radio configuration of the box and the devices: ESB with dynamic payload
+ *          length at 2 Mbps, a 5-byte address and a 16-bit CRC.
+ */
+
+#define APP_TDMA_RAMP_UP_US         140     /**< Radio ramp-up time, TX or RX, including the turnaround to the acknowledgment. */
+#define APP_TDMA_ADDRESS_LENGTH     5       /**< On-air address length, in bytes. */
+#define APP_TDMA_CRC_LENGTH         2       /**< On-air CRC length, in bytes. */
+#define APP_TDMA_PCF_BITS           9       /**< Length of the packet control field of ESB with dynamic payload length. */
+#define APP_TDMA_BEACON_WINDOW_US   20      /**< A beacon that has not ended this long after it was due is taken as missed. */
+
+
+/**@brief TDMA frame schedule. All times are in microseconds. */
+typedef struct
+{
+    uint32_t frame_period_us;       /**< Time from one beacon to the next. */
+    uint8_t  subframes;             /**< Frames per cycle: one new-data frame, followed by retry frames. */
+    uint8_t  slot_count;            /**< Number of response slots. */
+    uint16_t slot_offset_us;        /**< From the end of the beacon to the start of the first response slot. */
+    uint16_t slot_period_us;        /**< From the start of one response slot to the start of the next. */
+    uint16_t beacon_guard_us;       /**< Devices tune to the channel of the next frame this long before its beacon. */
+    uint8_t  beacon_length;         /**< Beacon payload length, in bytes. */
+    uint8_t  response_length;       /**< Response payload length, in bytes. */
+    uint8_t  sync_timeout_frames;   /**< Frames without a beacon after which a device has lost sync. */
+    uint8_t  flywheel_frames;       /**< Frames without a beacon in which a device still answers in its predicted slot. */
+    uint16_t coast_frames;          /**< Frames a device that lost sync follows the hop sequence before it scans. */
+    uint8_t  scan_frames;           /**< Frames a scanning device listens on each channel. */
+} app_tdma_schedule_t;
+
+
+/**@brief Function for getting the on-air time of a packet.
+ *
+ * @param[in]   payload_length      Payload length, in bytes. An empty acknowledgment has 0.
+ *
+ * @return  Time from the start of the preamble to the end of the CRC, in microseconds.
+ */
+uint32_t app_tdma_airtime_us(uint8_t payload_length);
+
+
+/**@brief Function for getting the time a response slot needs on air.
+ *
+ * The slot covers the response, the ramp-up of the box to send the acknowledgment, the
+ * acknowledgment, and the ramp-up of the box back to RX for the next response. The ramp-up of
+ * the device at the start of the slot overlaps with the end of the previous slot.
+ */
+uint32_t app_tdma_slot_airtime_us(app_tdma_schedule_t const * p_schedule);
+
+
+/**@brief Function for getting the time from the start of a frame to the end of its last slot. */
+uint32_t app_tdma_frame_busy_us(app_tdma_schedule_t const * p_schedule);
+
+
+/**@brief Function for checking a schedule.
+ *
+ * @retval  NRF_SUCCESS                     If the slots fit the frame and the frame fits the hop timer.
+ * @retval  NRF_ERROR_NULL                  If the required parameter was NULL.
+ * @retval  NRF_ERROR_INVALID_PARAM         If a count is zero, a slot is shorter than its packets,
+ *                                          the slots overrun the guard time before the next beacon,
+ *                                          or the scan period does not fit the hop timer.
+ */
+uint32_t app_tdma_schedule_check(app_tdma_schedule_t const * p_schedule);
+
+
+/**@brief Function for initializing the scheduler with a schedule. The schedule is copied.
+ *
+ * @return  The result of @ref app_tdma_schedule_check.
+ */
+uint32_t app_tdma_init(app_tdma_schedule_t const * p_schedule);
+
+
+/**@brief Function for getting the time from the end of the beacon to the start of a slot. */
+uint32_t app_tdma_slot_offset_us(uint8_t slot);
+
+
+/**@brief Function for changing the number of frames per cycle.
+ *
+ * The frame timing is not affected. The current frame becomes the first frame of a cycle.
+ *
+ * @retval  NRF_SUCCESS                     If the number of subframes was changed.
+ * @retval  NRF_ERROR_INVALID_PARAM         If @p subframes is zero.
+ */
+uint32_t app_tdma_subframes_set(uint8_t subframes);
+
+
+/**@brief Function for starting the frames of the box.
+ *
+ * The first frame starts one frame period after the call, on @p p_channels[0], and opens a
+ * cycle. Every frame is reported with @ref NRF_ESB_EVENT_HOP.
+ *
+ * @return  The result of @ref nrf_esb_hop_start.
+ */
+uint32_t app_tdma_master_start(uint8_t const * p_channels, uint8_t count);
+
+
+/**@brief Function for advancing the box to the next frame on @ref NRF_ESB_EVENT_HOP.
+ *
+ * @return  Position of the frame in its cycle. 0 is the new-data frame.
+ */
+uint8_t app_tdma_master_on_hop(void);
+
+
+/**@brief Function for making a device scan for the beacons of the box.
+ *
+ * The device listens on every channel for @c scan_frames frames, starting with @p p_channels[0]
+ * right away. The channel list is used again after coasting, so it must stay valid.
+ *
+ * @return  The result of @ref nrf_esb_hop_start or @ref nrf_esb_hop_sync.
+ */
+uint32_t app_tdma_scan_start(uint8_t const * p_channels, uint8_t count);
+
+
+/**@brief Function for following the box after a device received its beacon.
+ *
+ * Switches a scanning device to the frame period, and aligns the next hop with the guard time
+ * before the next beacon.
+ *
+ * @param[in]   hop_index           Hop sequence index the beacon was received on.
+ */
+uint32_t app_tdma_beacon_received(uint8_t hop_index);
+
+
+/**@brief Function for starting the queued response in a slot of the current frame.
+ *
+ * The module must be in PTX mode, and the beacon of the frame must be the last received packet.
+ *
+ * @retval  NRF_SUCCESS                     If the response was scheduled.
+ * @retval  NRF_ERROR_TIMEOUT               If the slot has already started. The response stays
+ *                                          in the TX FIFO.
+ * @return  Otherwise, the result of @ref nrf_esb_start_tx_at.
+ */
+uint32_t app_tdma_respond(uint8_t slot);
+
+
+/**@brief Function for getting the time left until a slot of the current frame.
+ *
+ * The beacon of the frame aligned the next hop, so the slot is timed from the hop. Call it in
+ * the frame of the last beacon the device received.
+ *
+ * @param[in]   slot                Slot of the current frame.
+ * @param[out]  p_time_us           Time until the radio ramp-up of the slot, 0 if it has started.
+ *
+ * @retval  NRF_SUCCESS                     If the time was written to @p p_time_us.
+ * @retval  NRF_ERROR_NULL                  If the required parameter was NULL.
+ * @return  Otherwise, the result of @ref nrf_esb_hop_time_left.
+ */
+uint32_t app_tdma_slot_time_left(uint8_t slot, uint32_t * p_time_us);
+
+
+/**@brief Function for starting the queued response in a slot of the current frame, timed from
+ *        the next hop.
+ *
+ * Unlike @ref app_tdma_respond, it does not need the beacon to be the last received packet, so
+ * the timers may have stood still for a sleep since the beacon. The module must be in PTX mode.
+ *
+ * @retval  NRF_SUCCESS                     If the response was scheduled.
+ * @retval  NRF_ERROR_TIMEOUT               If the slot has already started. The response stays
+ *                                          in the TX FIFO.
+ * @return  Otherwise, the result of @ref nrf_esb_start_tx_before_hop.
+ */
+uint32_t app_tdma_respond_before_hop(uint8_t slot);
+
+
+/**@brief Function for starting the queued response in a slot of a frame whose beacon was missed.
+ *
+ * The slot is timed from the hop, where the device expected the beacon. Call it on
+ * @ref NRF_ESB_EVENT_HOP_DEADLINE, in PTX mode.
+ *
+ * @retval  NRF_SUCCESS                     If the response was scheduled.
+ * @retval  NRF_ERROR_INVALID_STATE         If the beacon of the frame was received, or more than
+ *                                          @c flywheel_frames beacons were missed in a row.
+ * @retval  NRF_ERROR_TIMEOUT               If the slot has already started. The response stays
+ *                                          in the TX FIFO.
+ * @return  Otherwise, the result of @ref nrf_esb_start_tx_at_hop.
+ */
+uint32_t app_tdma_respond_predicted(uint8_t slot);
+
+
+/**@brief Function for getting the number of beacons a synced device missed in a row, up to the current frame. */
+uint8_t app_tdma_beacons_missed(void);
+
+
+/**@brief Function for updating the sync state of a device on @ref NRF_ESB_EVENT_HOP.
+ *
+ * @retval  true    If no beacon was received for @c sync_timeout_frames and the device lost sync.
+ * @retval  false   Otherwise.
+ */
+bool app_tdma_on_hop(void);
+
+
+/**@brief Function for checking whether a device follows the beacons of the box. */
+bool app_tdma_is_synced(void);
+
+
+/**@brief Function for checking whether a device that lost sync still follows the hop sequence of the box. */
+bool app_tdma_is_coasting(void);
+
+/** @} */
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* APP_TDMA_H__ */
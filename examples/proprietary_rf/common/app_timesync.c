@@ -0,0 +1,330 @@
+/* Copyright (c) 2016 Nordic Semiconductor. All Rights Reserved.
+ *
+ * The information contained herein is property of Nordic Semiconductor ASA.
+ * Terms and conditions of usage are described in detail in NORDIC
+ * SEMICONDUCTOR STANDARD SOFTWARE LICENSE AGREEMENT.
+ *
+ * Licensees are granted free, non-transferable use of the information. NO
+ * WARRANTY of ANY KIND is provided. This heading must NOT be removed from
+ * the file.
+ *
+ */
+
+#include <stddef.h>
+#include "nrf.h"
+#include "nrf_error.h"
+#include "sdk_macros.h"
+#include "app_timesync.h"
+
+/**@brief Pair of local time and box time of one beacon address. */
+typedef struct
+{
+    uint32_t local_us;
+    uint32_t box_us;
+} timesync_sample_t;
+
+static bool                     m_is_master;
+static bool                     m_synced;               /**< A device has a sample. */
+static uint32_t                 m_anchor_local;         /**< Last sample, the reference of the conversions. */
+static uint32_t                 m_anchor_box;
+static int32_t                  m_drift;                /**< See @ref app_timesync_drift. */
+static timesync_sample_t        m_samples[APP_TIMESYNC_SAMPLES];
+static uint8_t                  m_sample_count;
+static uint8_t                  m_sample_pos;           /**< Where the next sample of the drift estimate goes. */
+static app_timesync_action_t    m_action;
+static uint32_t                 m_action_box_time;
+static volatile bool            m_action_late;          /**< The action time had passed when it was armed. */
+static uint32_t                 m_paused_us;            /**< Time the local clock timer stood still, added to its count. */
+
+
+uint32_t app_timesync_local_now(void)
+{
+    APP_TIMESYNC_TIMER->TASKS_CAPTURE[2] = 1;
+
+    return APP_TIMESYNC_TIMER->CC[2] + m_paused_us;
+}
+
+
+uint32_t app_timesync_address_time(void)
+{
+    return APP_TIMESYNC_TIMER->CC[0] + m_paused_us;
+}
+
+
+static uint32_t local_to_box(uint32_t local_us)
+{
+    int32_t delta = (int32_t)(local_us - m_anchor_local);
+
+    if (m_is_master)
+    {
+        return local_us;
+    }
+
+    return m_anchor_box + delta + (int32_t)(((int64_t)delta * m_drift) / (1L << APP_TIMESYNC_DRIFT_SHIFT));
+}
+
+
+static uint32_t box_to_local(uint32_t box_us)
+{
+    int32_t delta = (int32_t)(box_us - m_anchor_box);
+
+    if (m_is_master)
+    {
+        return box_us;
+    }
+
+    // First order is enough: the drift squared is far below one part per million
+    return m_anchor_local + delta - (int32_t)(((int64_t)delta * m_drift) / (1L << APP_TIMESYNC_DRIFT_SHIFT));
+}
+
+
+/**@brief Function for arming the compare of the pending action with the current estimate. */
+static void action_arm(void)
+{
+    uint32_t local_us = box_to_local(m_action_box_time);
+
+    APP_TIMESYNC_TIMER->CC[1]             = local_us - m_paused_us;
+    APP_TIMESYNC_TIMER->EVENTS_COMPARE[1] = 0;
+    APP_TIMESYNC_TIMER->INTENSET          = TIMER_INTENSET_COMPARE1_Msk;
+
+    // A compare in the past would only match after the counter wraps
+    if ((int32_t)(local_us - app_timesync_local_now()) <= 0)
+    {
+        m_action_late = true;
+        NVIC_SetPendingIRQ(APP_TIMESYNC_TIMER_IRQn);
+    }
+}
+
+
+static void action_drop(void)
+{
+    APP_TIMESYNC_TIMER->INTENCLR = TIMER_INTENCLR_COMPARE1_Msk;
+    m_action      = NULL;
+    m_action_late = false;
+}
+
+
+/**@brief Function for fitting the drift to the offsets of the samples by least squares. */
+static void drift_update(void)
+{
+    timesync_sample_t const * p_ref = &m_samples[(m_sample_pos + APP_TIMESYNC_SAMPLES - m_sample_count) %
+                                                 APP_TIMESYNC_SAMPLES];
+    int64_t                   n     = m_sample_count;
+    int64_t                   sx    = 0;
+    int64_t                   sy    = 0;
+    int64_t                   sxx   = 0;
+    int64_t                   sxy   = 0;
+    int64_t                   den;
+
+    for (uint8_t i = 0; i < m_sample_count; i++)
+    {
+        timesync_sample_t const * p_sample = &m_samples[(p_ref - m_samples + i) % APP_TIMESYNC_SAMPLES];
+
+        // Offset of the box time, relative to the oldest sample
+        int64_t x = (int32_t)(p_sample->local_us - p_ref->local_us);
+        int64_t y = (int32_t)((p_sample->box_us - p_sample->local_us) - (p_ref->box_us - p_ref->local_us));
+
+        sx  += x;
+        sy  += y;
+        sxx += x * x;
+        sxy += x * y;
+    }
+
+    den = n * sxx - sx * sx;
+    if (den > 0)
+    {
+        m_drift = (int32_t)((n * sxy - sx * sy) * (1L << APP_TIMESYNC_DRIFT_SHIFT) / den);
+    }
+}
+
+
+static void samples_reset(void)
+{
+    m_sample_count = 0;
+    m_sample_pos   = 0;
+}
+
+
+void app_timesync_start(bool is_master)
+{
+    APP_TIMESYNC_TIMER->TASKS_STOP  = 1;
+    APP_TIMESYNC_TIMER->TASKS_CLEAR = 1;
+    APP_TIMESYNC_TIMER->MODE        = TIMER_MODE_MODE_Timer;
+    APP_TIMESYNC_TIMER->PRESCALER   = 4;                               // 1 MHz
+    APP_TIMESYNC_TIMER->BITMODE     = TIMER_BITMODE_BITMODE_32Bit;
+    APP_TIMESYNC_TIMER->SHORTS      = 0;
+    APP_TIMESYNC_TIMER->INTENCLR    = 0xFFFFFFFF;
+    APP_TIMESYNC_TIMER->EVENTS_COMPARE[1] = 0;
+
+    NRF_PPI->CH[APP_TIMESYNC_PPI_CHANNEL].EEP = (uint32_t)&NRF_RADIO->EVENTS_ADDRESS;
+    NRF_PPI->CH[APP_TIMESYNC_PPI_CHANNEL].TEP = (uint32_t)&APP_TIMESYNC_TIMER->TASKS_CAPTURE[0];
+    NRF_PPI->CHENSET = 1UL << APP_TIMESYNC_PPI_CHANNEL;
+
+    m_is_master    = is_master;
+    m_synced       = is_master;
+    m_anchor_local = 0;
+    m_anchor_box   = 0;
+    m_drift        = 0;
+    m_paused_us    = 0;
+    samples_reset();
+    action_drop();
+
+    NVIC_SetPriority(APP_TIMESYNC_TIMER_IRQn, 1);
+    NVIC_ClearPendingIRQ(APP_TIMESYNC_TIMER_IRQn);
+    NVIC_EnableIRQ(APP_TIMESYNC_TIMER_IRQn);
+
+    APP_TIMESYNC_TIMER->TASKS_START = 1;
+}
+
+
+void app_timesync_stop(void)
+{
+    APP_TIMESYNC_TIMER->TASKS_STOP = 1;
+    NRF_PPI->CHENCLR = 1UL << APP_TIMESYNC_PPI_CHANNEL;
+    action_drop();
+    m_synced = false;
+}
+
+
+void app_timesync_sample_add(uint32_t local_us, uint32_t box_us)
+{
+    timesync_sample_t const * p_last;
+    int32_t                   step;
+
+    if (m_is_master)
+    {
+        return;
+    }
+
+    step = (int32_t)(box_us - local_to_box(local_us));
+    if (!m_synced || step > APP_TIMESYNC_MAX_STEP_US || step < -APP_TIMESYNC_MAX_STEP_US)
+    {
+        // First sample, or the box restarted its clock. Actions at the old box time are void.
+        if (m_synced)
+        {
+            action_drop();
+        }
+        m_drift  = 0;
+        m_synced = true;
+        samples_reset();
+    }
+
+    m_anchor_local = local_us;
+    m_anchor_box   = box_us;
+
+    p_last = &m_samples[(m_sample_pos + APP_TIMESYNC_SAMPLES - 1) % APP_TIMESYNC_SAMPLES];
+    if (m_sample_count > 0 && local_us - p_last->local_us > 4 * APP_TIMESYNC_SAMPLE_INTERVAL_US)
+    {
+        // After a long gap the old samples span too much time for the fit. The drift is kept.
+        samples_reset();
+    }
+
+    if (m_sample_count == 0 || local_us - p_last->local_us >= APP_TIMESYNC_SAMPLE_INTERVAL_US)
+    {
+        m_samples[m_sample_pos].local_us = local_us;
+        m_samples[m_sample_pos].box_us   = box_us;
+        m_sample_pos = (m_sample_pos + 1) % APP_TIMESYNC_SAMPLES;
+        if (m_sample_count < APP_TIMESYNC_SAMPLES)
+        {
+            m_sample_count++;
+        }
+
+        if (m_sample_count >= 2)
+        {
+            drift_update();
+        }
+    }
+
+    if (m_action != NULL)
+    {
+        action_arm();
+    }
+}
+
+
+bool app_timesync_is_synced(void)
+{
+    return m_synced;
+}
+
+
+uint32_t app_timesync_now_in_box_time(uint32_t * p_box_time_us)
+{
+    VERIFY_PARAM_NOT_NULL(p_box_time_us);
+    VERIFY_TRUE(m_synced, NRF_ERROR_INVALID_STATE);
+
+    *p_box_time_us = local_to_box(app_timesync_local_now());
+
+    return NRF_SUCCESS;
+}
+
+
+int32_t app_timesync_drift(void)
+{
+    return m_drift;
+}
+
+
+uint32_t app_timesync_action_at(uint32_t box_time_us, app_timesync_action_t action)
+{
+    VERIFY_PARAM_NOT_NULL(action);
+    VERIFY_TRUE(m_synced, NRF_ERROR_INVALID_STATE);
+
+    m_action          = action;
+    m_action_box_time = box_time_us;
+    m_action_late     = false;
+    action_arm();
+
+    return NRF_SUCCESS;
+}
+
+
+bool app_timesync_action_pending(void)
+{
+    return m_action != NULL;
+}
+
+
+uint32_t app_timesync_action_time_left(uint32_t * p_time_us)
+{
+    int32_t left;
+
+    VERIFY_PARAM_NOT_NULL(p_time_us);
+    VERIFY_TRUE(m_action != NULL, NRF_ERROR_NOT_FOUND);
+
+    left       = (int32_t)(box_to_local(m_action_box_time) - app_timesync_local_now());
+    *p_time_us = left > 0 ? (uint32_t)left : 0;
+
+    return NRF_SUCCESS;
+}
+
+
+void app_timesync_paused(uint32_t pause_us)
+{
+    m_paused_us += pause_us;
+
+    // The compare of the action counts on the timer, which is now behind
+    if (m_action != NULL && !m_action_late)
+    {
+        action_arm();
+    }
+}
+
+
+void app_timesync_timer_handler(void)
+{
+    app_timesync_action_t action = m_action;
+
+    if (APP_TIMESYNC_TIMER->EVENTS_COMPARE[1] == 0 && !m_action_late)
+    {
+        return;
+    }
+
+    APP_TIMESYNC_TIMER->EVENTS_COMPARE[1] = 0;
+    action_drop();
+
+    if (action != NULL)
+    {
+        action();
+    }
+}
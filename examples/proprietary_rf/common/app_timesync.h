@@ -0,0 +1,157 @@
+/* Copyright (c) 2016 Nordic Semiconductor. All Rights Reserved.
+ *
+ * The information contained herein is property of Nordic Semiconductor ASA.
+ * Terms and conditions of usage are described in detail in NORDIC
+ * SEMICONDUCTOR STANDARD SOFTWARE LICENSE AGREEMENT.
+ *
+ * Licensees are granted free, non-transferable use of the information. NO
+ * WARRANTY of ANY KIND is provided. This heading must NOT be removed from
+ * the file.
+ *
+ */
+
+#ifndef APP_TIMESYNC_H__
+#define APP_TIMESYNC_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "nrf.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @defgroup app_timesync Beacon time synchronization
+ * @{
+ * @ingroup app_common
+ *
+ * @brief Common time base of the box and its devices, carried by the beacons.
+ *
+ * @details Every node runs a free-running 1 MHz local clock, and captures the local time of
+ *          the address of every packet through PPI. The local clock of the box is the box time.
+ *          Each beacon carries a frame counter, and the box time of the address of the beacon
+ *          before it, which the box learns once that beacon is sent. A device that received
+ *          both beacons adds the pair of box time and local time as a sample.
+ *
+ *          The last sample anchors the box time of a device. A least-squares fit of the offset
+ *          over samples taken at least @ref APP_TIMESYNC_SAMPLE_INTERVAL_US apart gives the drift
+ *          of the local clock, so that the box time stays accurate while beacons are missed.
+ *          Actions can be scheduled at a box time; they run in the interrupt of the local clock.
+ */
+
+#define APP_TIMESYNC_TIMER                  NRF_TIMER0          /**< Local clock. The only nRF51 timer with 32 bits. */
+#define APP_TIMESYNC_TIMER_IRQn             TIMER0_IRQn
+#define APP_TIMESYNC_PPI_CHANNEL            0                   /**< Captures the local time of every packet address. */
+#define APP_TIMESYNC_SAMPLES                8                   /**< Samples in the drift estimate. */
+#define APP_TIMESYNC_SAMPLE_INTERVAL_US     100000              /**< Shortest time between samples of the drift estimate. */
+#define APP_TIMESYNC_MAX_STEP_US            1000                /**< A larger jump of the box time starts the estimate over. */
+#define APP_TIMESYNC_DRIFT_SHIFT            24                  /**< The drift is kept in units of 2^-24. */
+
+
+/**@brief Action run at a box time. */
+typedef void (*app_timesync_action_t)(void);
+
+
+/**@brief Function for starting the local clock and the address capture.
+ *
+ * The estimate starts over. The caller must forward the interrupt of @ref APP_TIMESYNC_TIMER
+ * to @ref app_timesync_timer_handler.
+ *
+ * @param[in]   is_master           True on the box, whose local clock is the box time.
+ */
+void app_timesync_start(bool is_master);
+
+
+/**@brief Function for stopping the local clock and the address capture, and dropping a pending action. */
+void app_timesync_stop(void);
+
+
+/**@brief Function for getting the local time. */
+uint32_t app_timesync_local_now(void);
+
+
+/**@brief Function for getting the local time of the address of the last packet sent or received.
+ *
+ * Read it in the event of the packet, before the radio moves on to the next one.
+ */
+uint32_t app_timesync_address_time(void);
+
+
+/**@brief Function for adding a sample on a device.
+ *
+ * @param[in]   local_us            Local time of the address of a beacon.
+ * @param[in]   box_us              Box time of the same address.
+ */
+void app_timesync_sample_add(uint32_t local_us, uint32_t box_us);
+
+
+/**@brief Function for checking whether the box time is known. Always true on the box. */
+bool app_timesync_is_synced(void);
+
+
+/**@brief Function for getting the current box time.
+ *
+ * @retval  NRF_SUCCESS                     If the box time was written to @p p_box_time_us.
+ * @retval  NRF_ERROR_NULL                  If the required parameter was NULL.
+ * @retval  NRF_ERROR_INVALID_STATE         If the device has no sample yet.
+ */
+uint32_t app_timesync_now_in_box_time(uint32_t * p_box_time_us);
+
+
+/**@brief Function for getting the drift estimate of the local clock against the box time.
+ *
+ * @return  Box microseconds per local microsecond, minus 1, in units of 2^-@ref APP_TIMESYNC_DRIFT_SHIFT.
+ */
+int32_t app_timesync_drift(void);
+
+
+/**@brief Function for running an action at a box time.
+ *
+ * The action replaces a pending one. It follows later samples, and runs right away if its
+ * time has passed. A jump of the box time drops it.
+ *
+ * @retval  NRF_SUCCESS                     If the action was scheduled.
+ * @retval  NRF_ERROR_NULL                  If the required parameter was NULL.
+ * @retval  NRF_ERROR_INVALID_STATE         If the device has no sample yet.
+ */
+uint32_t app_timesync_action_at(uint32_t box_time_us, app_timesync_action_t action);
+
+
+/**@brief Function for checking whether an action is pending. */
+bool app_timesync_action_pending(void);
+
+
+/**@brief Function for getting the local time until the pending action runs.
+ *
+ * @retval  NRF_SUCCESS                     If the time was written to @p p_time_us. It is 0 if the
+ *                                          action is due.
+ * @retval  NRF_ERROR_NULL                  If the required parameter was NULL.
+ * @retval  NRF_ERROR_NOT_FOUND             If no action is pending.
+ */
+uint32_t app_timesync_action_time_left(uint32_t * p_time_us);
+
+
+/**@brief Function for keeping the local clock on time after @ref APP_TIMESYNC_TIMER was stopped.
+ *
+ * The application may stop the timer through PPI while the 16 MHz clock is off, and start it
+ * again a known time later. The time is added to the local clock, and the pending action is
+ * moved so that it still runs at its box time. Call it while the timer is stopped, before the
+ * time of the action.
+ *
+ * @param[in]   pause_us            Time the timer stands still, in microseconds.
+ */
+void app_timesync_paused(uint32_t pause_us);
+
+
+/**@brief Function for handling the interrupt of @ref APP_TIMESYNC_TIMER. */
+void app_timesync_timer_handler(void);
+
+/** @} */
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* APP_TIMESYNC_H__ */
@@ -23,33 +23,54 @@
 #include "boards.h"
 #include "nrf_delay.h"
 #include "app_util.h"
+#include "app_util_platform.h"
 #define NRF_LOG_MODULE_NAME "APP"
 #include "nrf_log.h"
 #include "nrf_log_ctrl.h"
 
 #include "app_config.h"
 #include "app_common.h"
+#include "app_tdma.h"
+#include "app_timesync.h"
+#include "app_store.h"
+#include "app_sleep.h"
+#include "app_scheduler.h"
 #include "nrf_drv_timer.h"
 
 #define MODE_NORMAL					0
 #define MODE_PAIRING				1
+#define MODE_JOINING				2
 
 #define PAIR_STATE_NONE				0
 #define PAIR_STATE_SEND_REQ			1
 #define PAIR_STATE_WAIT_FOR_INFO	2
+#define PAIR_STATE_BACKOFF			3
+#define PAIR_STATE_INFO_DELAY		4
+#define PAIR_STATE_NEXT_CHANNEL		5				//the next request waits for the radio to go idle.
 
 #define MAXIMUM_PAIRING_TIMEOUT_MS				60000UL	//1 min
-#define BEACON_SCAN_SHORT_TIMEOUT_MS			(INTERVAL_TIMER_INTERVAL_10MS/10)
-#define BEACON_SCAN_LONG_TIMEOUT_MS 			(INTERVAL_TIMER_INTERVAL_10MS/10 * (MAXIMUM_CHANNEL_LIST_SIZE + 1))
+#define PAIR_BACKOFF_MAX_MS						10		//a failed pairing round starts again after 1 to this many ms.
+#define PAIR_INFO_DELAY_MS						2		//ticks of 1 ms from the ack of a request to asking for the info, so 1 to 2 ms.
+#define PAIR_SETUP_MS							200		//without an ack for this long, look for a box that takes joining devices.
+#define JOIN_BACKOFF_BEACONS					4		//a failed join request is sent again after up to this many join beacons.
+#define SLOT_WAKE_US							150		//a sleep before the slot ends this long before it, to queue the response.
 
-#define APP_PACKET_DELAY_US						350
+//Timing of a response.
+#define RESPONSE_FROM_BEACON		0				//the beacon of the frame was the last packet received.
+#define RESPONSE_FROM_HOP			1				//the beacon was missed. The slot is predicted from the hop.
+#define RESPONSE_TO_HOP				2				//the timers stood still since the beacon. The next hop is still on time.
+
+#define SCHED_MAX_EVENT_DATA_SIZE				sizeof(nrf_esb_payload_t)	//an ack of the box, in pairing and joining.
+#define SCHED_QUEUE_SIZE						8
 
 typedef struct {
 	
 	uint32_t signature;
+	link_params_t link;
 	uint8_t chlist[MAXIMUM_CHANNEL_LIST_SIZE];
 	uint8_t sys_address_32[4];
 	uint8_t dev_idx;
+	uint8_t report_divisor;		//the box asks for new data every report_divisor cycles.
 	
 } ds_data_t;
 
@@ -59,6 +80,9 @@ void interval_timer_stop(void);
 uint32_t esb_init(bool is_ptx);
 void do_pairing(void);
 void enter_normal_mode(void);
+static void pair_setup_start(void);
+static void join_scan_start(void);
+static void sleep_until_hop(void);
 
 // 2 payload buffer system.
 static nrf_esb_payload_t        tx_data_payload[] = {
@@ -75,6 +99,7 @@ static nrf_esb_payload_t        tx_data_payload[] = {
 static nrf_esb_payload_t	rx_payload;
 																		
 const uint8_t gca_pairing_chlist[MAXIMUM_CHANNEL_LIST_SIZE] = DEFAULT_PAIRING_CHANNEL_LIST;
+const uint8_t gca_join_scan_chlist[MAXIMUM_CHANNELS_PER_REGION] = REGION1_CHANNEL_LIST;
 uint8_t ga_chlist[MAXIMUM_CHANNEL_LIST_SIZE] = {0};			
 uint8_t g_mode = MODE_NORMAL;
 uint32_t g_pairing_timeout = 0;						
@@ -83,10 +108,100 @@ uint8_t g_base_addr_1[4];
 ds_data_t g_ds = {.dev_idx = 0xff};
 uint8_t g_dev_type = DEV_TYPE_DISPLAY;
 uint8_t g_pair_state;
-uint32_t g_scan_timeout = 0;
+uint8_t g_pair_wait_ms = 0;							//left until the next pairing packet, in PAIR_STATE_BACKOFF and PAIR_STATE_INFO_DELAY.
+uint8_t g_pair_sweep_left;							//pairing channels left to try in this round.
+uint8_t g_pair_setup_ms;							//left until the device looks for a joining box instead.
+uint8_t g_join_hops_left;							//scan hops left without a join beacon before pairing again.
+uint8_t g_join_skip = 0;							//join beacons to let pass after a failed request.
+bool g_join_narrowed;								//the scan follows the channels of the box that offered to take the device.
+uint8_t ga_chip_id[CHIP_ID_LENGTH];
+uint32_t g_rand_state;								//of the backoff, seeded with the chip ID.
 uint8_t g_cur_payload_idx = 0;
-bool g_force_hop_channel = false;
-uint32_t g_sync_timeout = 0;
+bool g_beacon_valid = false;							//a beacon was received since the time sync started.
+uint32_t g_beacon_counter;
+uint32_t g_beacon_local;								//local time of the address of the last beacon received.
+uint32_t g_sync_pulse_time;
+uint32_t ga_report_ask_mask[DEV_REPORT_PERIOD];		//ask mask of the last new-data beacon of each report phase.
+uint32_t g_report_known = 0;						//report phases with a mask in ga_report_ask_mask.
+uint32_t g_new_data_counter;						//counter of the last new-data beacon received.
+uint8_t g_new_data_phase;
+uint8_t g_sleep_slot;								//slot of the response queued when the sleep before it ends.
+bool g_sleep_resend;
+#if ADAPTIVE_FREQUENCY_HOPPING
+uint8_t g_map_idx = BEACON_NO_MAP_ENTRY;			//channel change announced by the box, not yet in use.
+uint8_t g_map_ch;
+uint8_t g_map_countdown;
+#endif
+
+#if ADAPTIVE_FREQUENCY_HOPPING
+static void map_entry_apply(uint8_t idx, uint8_t ch){
+	
+	//the hop sequencer keeps its own copy. The scan after a loss of sync starts from ga_chlist.
+	ga_chlist[idx] = ch;
+	(void) nrf_esb_hop_channel_set(idx, ch);
+}
+
+//Take the channel map entry of a beacon. An entry already in use at the box is applied right away.
+static void map_entry_received(uint8_t const * p_entry){
+	
+	if(p_entry[0] >= g_ds.link.chlist_size || p_entry[1] > 125) return;
+	
+	if(p_entry[2] == 0){
+		if(ga_chlist[p_entry[0]] != p_entry[1]){
+			map_entry_apply(p_entry[0], p_entry[1]);
+		}
+	}
+	else{
+		g_map_idx = p_entry[0];
+		g_map_ch = p_entry[1];
+		g_map_countdown = p_entry[2];
+	}
+}
+#endif
+
+//Hop index of the frame of a beacon. A channel the box moved while the device was away is taken over.
+static uint8_t beacon_hop_index(nrf_esb_payload_t const * p_beacon){
+	
+	uint8_t idx = p_beacon->data[BEACON_HOP_INDEX];
+	
+	if(idx >= g_ds.link.chlist_size) return p_beacon->hop_index;
+	
+#if ADAPTIVE_FREQUENCY_HOPPING
+	if(idx != p_beacon->hop_index){
+		map_entry_apply(idx, ga_chlist[p_beacon->hop_index]);
+	}
+#endif
+	return idx;
+}
+
+//Toggle the sync pulse pin, and schedule the next toggle one period later in box time.
+static void sync_pulse_toggle(){
+	
+	nrf_gpio_pin_toggle(SYNC_PULSE_PIN);
+	g_sync_pulse_time += SYNC_PULSE_PERIOD_US;
+	(void) app_timesync_action_at(g_sync_pulse_time, sync_pulse_toggle);
+}
+
+//Take the counter and the stamp of a beacon. The stamp is the box time of the beacon before, so it makes a sample
+//only if that beacon was received too.
+static void beacon_time_received(uint8_t const * p_data, uint32_t local_us){
+	
+	uint32_t counter = uint32_decode(&p_data[BEACON_COUNTER_INDEX]);
+	uint32_t now;
+	
+	if(g_beacon_valid && counter == g_beacon_counter + 1){
+		app_timesync_sample_add(g_beacon_local, uint32_decode(&p_data[BEACON_STAMP_INDEX]));
+	}
+	g_beacon_valid = true;
+	g_beacon_counter = counter;
+	g_beacon_local = local_us;
+	
+	//(Re)start the sync pulse once the box time is known. A jump of the box time drops the pending toggle.
+	if(!app_timesync_action_pending() && app_timesync_now_in_box_time(&now) == NRF_SUCCESS){
+		g_sync_pulse_time = (now / SYNC_PULSE_PERIOD_US + 1) * SYNC_PULSE_PERIOD_US;
+		(void) app_timesync_action_at(g_sync_pulse_time, sync_pulse_toggle);
+	}
+}
 
 void nrf_esb_error_handler(uint32_t err_code, uint32_t line)
 {
@@ -107,13 +222,13 @@ void nrf_esb_error_handler(uint32_t err_code, uint32_t line)
 
 #define APP_ERROR_CHECK(err_code) if (err_code) nrf_esb_error_handler(err_code, __LINE__);
 
+//The radio must be idle.
 static void hop_channel(){
 
 	g_cur_ch_idx++;
 	if(g_cur_ch_idx >= MAXIMUM_CHANNEL_LIST_SIZE){
 		g_cur_ch_idx = 0;
 	}
-	while(!nrf_esb_is_idle());
 	APP_ERROR_CHECK(nrf_esb_set_rf_channel(ga_chlist[g_cur_ch_idx]));
 	
 }
@@ -121,7 +236,7 @@ static void hop_channel(){
 static bool is_beacon_packet(nrf_esb_payload_t *p_pkt){
 	
 	if(p_pkt->pipe != 0) return false;
-	if(p_pkt->length != 10) return false;
+	if(p_pkt->length != BEACON_LENGTH) return false;
 
 	if(p_pkt->data[0] != BEACON_BYTE1) return false;
 	if(p_pkt->data[1] != BEACON_BYTE2) return false;
@@ -137,7 +252,8 @@ static void send_pairing_req(){
 
 	tx_pl.data[0] = ID_PAIR_REQ;
 	tx_pl.data[1] = g_dev_type;
-	tx_pl.length = 2;
+	memcpy(&tx_pl.data[PAIR_CHIP_ID_INDEX], ga_chip_id, CHIP_ID_LENGTH);
+	tx_pl.length = PAIR_REQ_LENGTH;
 	tx_pl.pipe = 0;
 	tx_pl.noack = false;
 	
@@ -153,7 +269,8 @@ static void send_get_info_req(){
 
 	tx_pl.data[0] = ID_PAIR_INFO_GET;
 	tx_pl.data[1] = 0;
-	tx_pl.length = 2;
+	memcpy(&tx_pl.data[PAIR_CHIP_ID_INDEX], ga_chip_id, CHIP_ID_LENGTH);
+	tx_pl.length = PAIR_REQ_LENGTH;
 	tx_pl.pipe = 0;
 	tx_pl.noack = false;
 	
@@ -161,9 +278,209 @@ static void send_get_info_req(){
 	
 }
 
-static void send_device_data(bool is_retransmit){
+//xorshift32. The devices pairing together need not agree on anything, so the chip ID is seed enough.
+static uint32_t rand_next(){
+	
+	g_rand_state ^= g_rand_state << 13;
+	g_rand_state ^= g_rand_state >> 17;
+	g_rand_state ^= g_rand_state << 5;
+	return g_rand_state;
+}
+
+//Start a pairing round: the request goes out on each pairing channel in turn until the box acks it.
+static void pair_round_start(){
+	
+	g_pair_state = PAIR_STATE_SEND_REQ;
+	g_pair_sweep_left = MAXIMUM_CHANNEL_LIST_SIZE;
+	send_pairing_req();
+}
+
+//Start the next round after a random time, so that devices whose requests collided, or that keep getting each
+//other's pair info, drift apart.
+static void pair_backoff(){
+	
+	g_pair_state = PAIR_STATE_BACKOFF;
+	g_pair_wait_ms = 1 + rand_next() % PAIR_BACKOFF_MAX_MS;
+}
+
+//Runs in the main loop. The store is not reentrant, and its writes go on from there.
+static void ds_save(void * p_event_data, uint16_t event_size){
+	
+	app_store_write(&g_ds, sizeof(ds_data_t));
+}
+
+//Scan the channels of a joining box from its offer, or from the info of another device. They have a beacon in every
+//frame, where region 1 has one every channel list cycle.
+static void join_channels_take(pair_info_t const *p_info){
+	
+	app_tdma_schedule_t schedule = APP_TDMA_SCHEDULE(p_info->link);
+	
+	if(g_join_narrowed || p_info->link.chlist_size == 0 || p_info->link.chlist_size > MAXIMUM_CHANNEL_LIST_SIZE) return;
+	if(app_tdma_init(&schedule) != NRF_SUCCESS) return;
+	
+	g_join_narrowed = true;
+	memcpy(ga_chlist, p_info->chlist, MAXIMUM_CHANNEL_LIST_SIZE);
+	(void) app_tdma_scan_start(ga_chlist, p_info->link.chlist_size);
+}
+
+//Take the pair info an ack of the box carried, if it is for this device. It also carries the link parameters the
+//box runs. The info of other devices is dropped.
+static void pair_info_take(nrf_esb_payload_t const *p_payload){
+	
+	pair_info_t pair_info;
+	
+	if(p_payload->length != sizeof(pair_info_t)) return;
+	
+	memcpy(&pair_info, p_payload->data, sizeof(pair_info_t));
+	if(!link_params_valid(&pair_info.link)) return;
+	
+	if(memcmp(pair_info.chip_id, ga_chip_id, CHIP_ID_LENGTH) != 0){
+		if(g_mode == MODE_JOINING){
+			join_channels_take(&pair_info);
+		}
+		return;
+	}
+	if(pair_info.dev_idx == 0 || pair_info.dev_idx > MAXIMUM_DEV || pair_info.report_divisor == 0) return;
+	
+	g_ds.link = pair_info.link;
+	memcpy(g_ds.chlist, pair_info.chlist, MAXIMUM_CHANNEL_LIST_SIZE);
+	memcpy(g_ds.sys_address_32, pair_info.system_address_32, 4);
+	g_ds.dev_idx = pair_info.dev_idx;
+	g_ds.report_divisor = pair_info.report_divisor;
+	NRF_LOG_INFO("Paired as device %d, new data every %d cycles.\r\n", g_ds.dev_idx, g_ds.report_divisor);
+	
+	APP_ERROR_CHECK(app_sched_event_put(NULL, 0, ds_save));
+	
+	enter_normal_mode();
+}
+
+//Ask again on the next channel of the round. The channel only changes while the radio is idle. Until then, the 1 ms
+//tick tries again.
+static void pair_sweep_next(){
+	
+	if(!nrf_esb_is_idle()){
+		g_pair_state = PAIR_STATE_NEXT_CHANNEL;
+		return;
+	}
+	
+	hop_channel();
+	if(--g_pair_sweep_left){
+		g_pair_state = PAIR_STATE_SEND_REQ;
+		send_pairing_req();
+	}
+	else{
+		pair_backoff();
+	}
+}
+
+//Pairing and joining run in the main loop. The interrupts only queue the radio events and the 1 ms ticks, the radio
+//events with the mode they came in. The handlers hold the interrupts off while they change the mode or reconfigure
+//ESB, which the join beacons and the hops use too.
+
+//The box acked a request.
+static void pair_tx_succeeded(void * p_event_data, uint16_t event_size){
+	
+	if(*(uint8_t const *)p_event_data != g_mode) return;
+	
+	CRITICAL_REGION_ENTER();
+	if(g_mode == MODE_PAIRING){
+		
+		g_pair_setup_ms = PAIR_SETUP_MS;
+		
+		switch(g_pair_state){
+			
+			case PAIR_STATE_SEND_REQ:
+				//Get ACK from box. Give it time to queue the pair info, then send get info packet from the 1 ms tick.
+				g_pair_state = PAIR_STATE_INFO_DELAY;
+				g_pair_wait_ms = PAIR_INFO_DELAY_MS;
+				break;
+			
+			case PAIR_STATE_WAIT_FOR_INFO:
+				//another device asked in between, and got its info queued instead.
+				pair_backoff();
+				break;
+			
+		}
+	}
+	else if(g_mode == MODE_JOINING){
+		
+		//the box took the request. Its info comes with the ack of a later request.
+		nrf_esb_set_mode(NRF_ESB_MODE_PRX);
+		nrf_esb_start_rx();
+	}
+	CRITICAL_REGION_EXIT();
+}
+
+static void pair_tx_failed(void * p_event_data, uint16_t event_size){
+	
+	if(*(uint8_t const *)p_event_data != g_mode) return;
+	
+	CRITICAL_REGION_ENTER();
+	if(g_mode == MODE_PAIRING){
+		
+		//no box on this channel, or another device sent at the same time. Ask again on the next channel.
+		pair_sweep_next();
+	}
+	else if(g_mode == MODE_JOINING){
+		
+		//another device asked in the join slot too. Let a random number of join beacons pass.
+		g_join_skip = rand_next() % JOIN_BACKOFF_BEACONS;
+		nrf_esb_set_mode(NRF_ESB_MODE_PRX);
+		nrf_esb_start_rx();
+	}
+	CRITICAL_REGION_EXIT();
+}
+
+//An ack payload. It may carry the pair info, for this device or for the one the box heard last.
+static void pair_ack_received(void * p_event_data, uint16_t event_size){
+	
+	if(g_mode == MODE_NORMAL) return;
+	
+	CRITICAL_REGION_ENTER();
+	pair_info_take((nrf_esb_payload_t const *)p_event_data);
+	CRITICAL_REGION_EXIT();
+}
+
+//No box took joining devices for a whole scan. Look for one in setup mode again, unless a join beacon came meanwhile.
+static void join_scan_ended(void * p_event_data, uint16_t event_size){
+	
+	CRITICAL_REGION_ENTER();
+	if(g_mode == MODE_JOINING && g_join_hops_left == 0){
+		pair_setup_start();
+	}
+	CRITICAL_REGION_EXIT();
+}
+
+static void pair_tick(void * p_event_data, uint16_t event_size){
+	
+	if(g_mode == MODE_NORMAL) return;
+	
+	CRITICAL_REGION_ENTER();
+	if(g_pairing_timeout && --g_pairing_timeout == 0){
+		//no pairing response. Start over.
+		do_pairing();
+	}
+	else if(g_mode == MODE_PAIRING && --g_pair_setup_ms == 0){
+		join_scan_start();
+	}
+	else if(g_pair_state == PAIR_STATE_BACKOFF && --g_pair_wait_ms == 0){
+		pair_round_start();
+	}
+	else if(g_pair_state == PAIR_STATE_INFO_DELAY && --g_pair_wait_ms == 0){
+		g_pair_state = PAIR_STATE_WAIT_FOR_INFO;
+		send_get_info_req();
+	}
+	else if(g_pair_state == PAIR_STATE_NEXT_CHANNEL){
+		pair_sweep_next();
+	}
+	CRITICAL_REGION_EXIT();
+}
+
+//Send the data in a slot of the current frame, with one of the RESPONSE_ timings.
+static uint32_t send_device_data(bool is_retransmit, uint8_t slot, uint8_t timing){
 
 	uint8_t idx = g_cur_payload_idx;
+	uint32_t err_code;
 	
 	nrf_esb_flush_tx();
 	
@@ -174,47 +491,144 @@ static void send_device_data(bool is_retransmit){
 	tx_data_payload[idx].noack = false;
 	nrf_esb_write_payload(&tx_data_payload[idx]);
 	
+	//the payload is queued in PRX mode, so it is not sent until the slot of this device starts.
+	nrf_esb_set_mode(NRF_ESB_MODE_PTX);
+	if(timing == RESPONSE_FROM_HOP){
+		err_code = app_tdma_respond_predicted(slot);
+	}
+	else if(timing == RESPONSE_TO_HOP){
+		err_code = app_tdma_respond_before_hop(slot);
+	}
+	else{
+		err_code = app_tdma_respond(slot);
+	}
+	
+	if(err_code != NRF_SUCCESS){
+		//the slot is gone. Keep the data for the next frame.
+		nrf_esb_flush_tx();
+		nrf_esb_set_mode(NRF_ESB_MODE_PRX);
+		return err_code;
+	}
+	
 	if(!is_retransmit){
 		if(g_cur_payload_idx == 0) g_cur_payload_idx = 1;
 		else g_cur_payload_idx = 0;
 	}
 	
 	nrf_gpio_pin_clear(LED_2);
+	return NRF_SUCCESS;
+}
+
+//Keep the ask mask of a new-data beacon. The box asks the same devices again DEV_REPORT_PERIOD cycles later.
+static void report_phase_received(uint8_t const * p_data){
+	
+	uint8_t phase = p_data[BEACON_PHASE_INDEX];
+	
+	if(phase >= DEV_REPORT_PERIOD) return;
+	
+	ga_report_ask_mask[phase] = uint32_decode(&p_data[BEACON_ASK_MASK_INDEX]);
+	g_report_known |= 1UL << phase;
+	g_new_data_counter = g_beacon_counter;
+	g_new_data_phase = phase;
+}
+
+//The beacon of this frame was missed. If the frame is a new-data frame and the slot of this device is known from
+//an earlier cycle, send new data in it anyway.
+static bool flywheel_respond(){
+	
+	uint8_t subframes = g_ds.link.retry_count + 1;
+	uint32_t frames = g_beacon_counter + app_tdma_beacons_missed() - g_new_data_counter;
+	uint8_t phase = (g_new_data_phase + frames / subframes) % DEV_REPORT_PERIOD;
+	uint32_t ask_mask = ga_report_ask_mask[phase];
+	
+	//who gets asked in a retry frame depends on the responses the box got, so only new-data frames are predicted.
+	if(!g_beacon_valid || frames % subframes != 0) return false;
+	if((g_report_known & (1UL << phase)) == 0 || (ask_mask & DEV_MASK(g_ds.dev_idx)) == 0) return false;
+	
+	return send_device_data(false, response_slot(ask_mask, g_ds.dev_idx), RESPONSE_FROM_HOP) == NRF_SUCCESS;
+}
+
+//LED_4 goes low for 20us after a response that got no ack.
+static void tx_failed_pulse(void * p_event_data, uint16_t event_size){
+	
+	nrf_gpio_pin_clear(LED_4);
+	nrf_delay_us(20);
+	nrf_gpio_pin_set(LED_4);
+}
+
+//Nothing more for the radio in this frame. Stop the 16 MHz clock until shortly before the next hop, or before the
+//next sync pulse if that comes first.
+static void sleep_until_hop(){
+	
+	uint16_t hop_us;
+	uint32_t action_us;
+	uint32_t sleep_us;
+	
+	if(g_mode != MODE_NORMAL || nrf_esb_hop_time_left(&hop_us) != NRF_SUCCESS) return;
+	
+	sleep_us = hop_us;
+	if(app_timesync_action_time_left(&action_us) == NRF_SUCCESS && action_us < sleep_us){
+		sleep_us = action_us;
+	}
+	
+	//the timer of ESB only times the responses, and starts again with the receiver at the hop.
+	if(nrf_esb_suspend() == NRF_SUCCESS){
+		(void) app_sleep_start(sleep_us, NULL);
+	}
+}
+
+//The timers run again shortly before the slot. Queue the response, timed to the next hop.
+static void slot_woken(){
+	
+	if(send_device_data(g_sleep_resend, g_sleep_slot, RESPONSE_TO_HOP) != NRF_SUCCESS){
+		sleep_until_hop();
+	}
+}
+
+//Stop the 16 MHz clock from the beacon until shortly before the slot of this device, if the wait is long enough.
+//Returns false if the response is still to be sent, timed from the beacon.
+static bool sleep_until_slot(bool is_resend, uint8_t slot){
+	
+	uint32_t slot_us;
+	uint32_t action_us;
+	
+	if(app_tdma_slot_time_left(slot, &slot_us) != NRF_SUCCESS || slot_us <= SLOT_WAKE_US) return false;
+	if(!app_sleep_is_long_enough(slot_us - SLOT_WAKE_US) || app_sleep_is_active()) return false;
+	
+	//the sync pulse is timed by the local clock, which stands still in a sleep.
+	if(app_timesync_action_time_left(&action_us) == NRF_SUCCESS && action_us < slot_us) return false;
+	
+	//suspending drops the beacon as the reference of the slot. From here on it is timed to the next hop.
+	if(nrf_esb_suspend() != NRF_SUCCESS) return false;
+	
+	g_sleep_slot = slot;
+	g_sleep_resend = is_resend;
+	if(app_sleep_start(slot_us - SLOT_WAKE_US, slot_woken) != NRF_SUCCESS){
+		slot_woken();
+	}
+	return true;
 }
 
 void nrf_esb_event_handler(nrf_esb_evt_t const * p_event)
 {
+	//local time of the address of the packet of this event. Read it before the next packet can come in.
+	uint32_t address_time = app_timesync_address_time();
+	
     switch (p_event->evt_id)
     {
         case NRF_ESB_EVENT_TX_SUCCESS:
 
-			if(g_mode == MODE_PAIRING){
+			if(g_mode == MODE_NORMAL){
 				
-				switch(g_pair_state){
-					
-					case PAIR_STATE_SEND_REQ:
-						//Get ACK from box. Delay a while and send get info packet to receive pair info.
-						{
-							g_pair_state = PAIR_STATE_WAIT_FOR_INFO;
-							
-							nrf_delay_us(800);
-							send_get_info_req();
-							
-						}					
-						break;
-					
-				}
-			}
-			else if(g_mode == MODE_NORMAL){
-				
-				//data packet sent successfully. 
+				//data packet sent successfully. The receiver starts again at the hop, shortly before the next beacon.
 				nrf_gpio_pin_set(LED_2);
 				
-				g_scan_timeout = BEACON_SCAN_SHORT_TIMEOUT_MS;
-				hop_channel();
-				esb_init(false);
-				nrf_esb_start_rx();
-				interval_timer_start();
+				nrf_esb_set_mode(NRF_ESB_MODE_PRX);
+				sleep_until_hop();
+			}
+			else{
+				//A pairing or join request got through. The main loop goes on from there.
+				(void) app_sched_event_put(&g_mode, sizeof(uint8_t), pair_tx_succeeded);
 			}
             break;
 		
@@ -222,70 +636,69 @@ void nrf_esb_event_handler(nrf_esb_evt_t const * p_event)
             
             (void) nrf_esb_flush_tx();
             
-			if(g_mode == MODE_PAIRING){
-			
-				hop_channel();	
+			if(g_mode == MODE_NORMAL){
 				
-				if(g_pair_state == PAIR_STATE_WAIT_FOR_INFO){
-					send_get_info_req();
-				}else{
-					send_pairing_req();
-				}
-			}
-			else if(g_mode == MODE_NORMAL){
-				
-				//data packet sent failed. pulse LED_4 for 20us.
+				//data packet sent failed. pulse LED_4 for 20us, from the main loop.
 				nrf_gpio_pin_set(LED_2);
 
-				g_scan_timeout = BEACON_SCAN_SHORT_TIMEOUT_MS;
-				hop_channel();
-				esb_init(false);
-				nrf_esb_start_rx();
-				interval_timer_start();
-
-				nrf_gpio_pin_clear(LED_4);
-				nrf_delay_us(20);
-				nrf_gpio_pin_set(LED_4);
+				nrf_esb_set_mode(NRF_ESB_MODE_PRX);
+				(void) app_sched_event_put(NULL, 0, tx_failed_pulse);
 				
+				sleep_until_hop();
+			}
+			else{
+				(void) app_sched_event_put(&g_mode, sizeof(uint8_t), pair_tx_failed);
 			}
             break;
         
 		case NRF_ESB_EVENT_RX_RECEIVED:
             
-			nrf_esb_read_rx_payload(&rx_payload);
+			//In pairing and joining, the acks of the requests come in here too, after their TX_SUCCESS.
+			if(nrf_esb_read_rx_payload(&rx_payload) != NRF_SUCCESS) break;
 		
-			if(g_mode == MODE_PAIRING && g_pair_state == PAIR_STATE_WAIT_FOR_INFO){
-
-				//Pair info received.
-				if(rx_payload.length == sizeof(pair_info_t)){
-					pair_info_t *p_pairInfo = (pair_info_t *)rx_payload.data;
-					memcpy(g_ds.chlist, p_pairInfo->chlist, MAXIMUM_CHANNEL_LIST_SIZE);
-					memcpy(g_ds.sys_address_32, p_pairInfo->system_address_32, 4);
-					g_ds.dev_idx = p_pairInfo->dev_idx;
-					
-					ds_update((uint32_t*)&g_ds, sizeof(ds_data_t));
-					
-					enter_normal_mode();
-				}
-				
-			}
-			else if(g_mode == MODE_NORMAL){
+			if(g_mode == MODE_NORMAL){
 				
 				if(is_beacon_packet(&rx_payload)){
 				
-					//beacon received.
-					g_sync_timeout = BEACON_SCAN_LONG_TIMEOUT_MS;
+					//beacon received. Stay on this channel until shortly before the next beacon is due. The box tells
+					//where in its list the frame is, so the next hops are right even if this list has moved on.
+					app_tdma_beacon_received(beacon_hop_index(&rx_payload));
+					
+					//Follow the scheme the box announces. Only the retry frames change, not the frame timing.
+					uint8_t scheme = rx_payload.data[BEACON_SCHEME_INDEX];
+					
+					if(scheme != g_ds.link.scheme && (scheme == APP_SCHEME_1 || scheme == APP_SCHEME_2)){
+						link_params_switch(&g_ds.link, scheme);
+						app_tdma_subframes_set(g_ds.link.retry_count + 1);
+						
+						//the cycles had another length. Predict the slots again once new-data beacons come in.
+						g_report_known = 0;
+					}
+					
+#if ADAPTIVE_FREQUENCY_HOPPING
+					map_entry_received(&rx_payload.data[BEACON_MAP_INDEX]);
+#endif
 					
-#if USE_SCHEME_2
+					beacon_time_received(rx_payload.data, address_time);
+					
+					if(rx_payload.data[BEACON_REQUEST_INDEX] == BEACON_BYTE3_NEW_DATA){
+						report_phase_received(rx_payload.data);
+					}
+					
+					uint32_t ask_mask = uint32_decode(&rx_payload.data[BEACON_ASK_MASK_INDEX]);
 					bool send_pkt = false;
 					bool is_resend = false;
 					
-					if(rx_payload.data[2] == BEACON_BYTE3_NEW_DATA){
+					if((ask_mask & DEV_MASK(g_ds.dev_idx)) == 0){
+						
+						//Not due in this cycle, or the box already has the data.
+					}
+					else if(rx_payload.data[BEACON_REQUEST_INDEX] == BEACON_BYTE3_NEW_DATA){
 						
 						//Got beacon to send new packet.
 						send_pkt = true;
 					}						
-					else if((rx_payload.data[2] == BEACON_BYTE3_RESEND) && ((rx_payload.data[3] & (1 << (6 - g_ds.dev_idx))) == (1 << (6 - g_ds.dev_idx)))){
+					else if(rx_payload.data[BEACON_REQUEST_INDEX] == BEACON_BYTE3_RESEND){
 						
 						//Got beacon to re-send previous packet. Toggle LED_3.
 						send_pkt = true;
@@ -293,74 +706,108 @@ void nrf_esb_event_handler(nrf_esb_evt_t const * p_event)
 						nrf_gpio_pin_toggle(LED_3);
 					}
 					
-					if(send_pkt){
-						interval_timer_stop();
-						nrf_esb_stop_rx();
-						esb_init(true);
-						
-						//delay for specific time before sending packet based on the device index.
-						nrf_delay_us((APP_PACKET_DELAY_US) * (g_ds.dev_idx-1));
-						send_device_data(is_resend);
+					//Nothing more to hear in this frame. The receiver starts again at the hop.
+					nrf_esb_stop_rx();
+					
+					//send packet in the slot of this device among those asked. A later slot leaves time to stop the
+					//crystal until shortly before it. Otherwise it is timed from the beacon.
+					if(!send_pkt){
+						sleep_until_hop();
+					}
+					else if(!sleep_until_slot(is_resend, response_slot(ask_mask, g_ds.dev_idx)) &&
+							send_device_data(is_resend, response_slot(ask_mask, g_ds.dev_idx), RESPONSE_FROM_BEACON) != NRF_SUCCESS){
+						sleep_until_hop();
+					}
+				}
+			}
+			else if(g_mode == MODE_JOINING && is_beacon_packet(&rx_payload)){
+				
+				if(rx_payload.data[BEACON_JOIN_INDEX]){
+					
+					g_join_hops_left = MAXIMUM_CHANNELS_PER_REGION;
+					
+					if(g_join_skip){
+						g_join_skip--;
 					}
 					else{
-						//No need to resend packet. We will hop to next channel and scan next beacon.
-						interval_timer_stop();
+						//ask in the join slot of this frame, timed from the beacon.
 						nrf_esb_stop_rx();
-						esb_init(false);
-						
-						g_scan_timeout = BEACON_SCAN_SHORT_TIMEOUT_MS;
-						g_force_hop_channel = true;
-						
-						interval_timer_start();
-					}						
-#else				
-							
-					interval_timer_stop();
-					nrf_esb_stop_rx();
-					esb_init(true);
-					
-					//delay for specific time before sending packet based on the device index.
-					nrf_delay_us((350) * (g_ds.dev_idx-1));
-					send_device_data(false);
-#endif					
+						send_pairing_req();
+						nrf_esb_set_mode(NRF_ESB_MODE_PTX);
+						if(app_tdma_respond(JOIN_SLOT) != NRF_SUCCESS){
+							//the join slot is gone. Ask on a later join beacon.
+							nrf_esb_flush_tx();
+							nrf_esb_set_mode(NRF_ESB_MODE_PRX);
+							nrf_esb_start_rx();
+						}
+					}
 				}
 			}
+			else{
+				//an ack payload. The pair info in it is taken in the main loop.
+				(void) app_sched_event_put(&rx_payload, sizeof(nrf_esb_payload_t), pair_ack_received);
+			}
 				
             break;
 		
-    }
-}
-
-void interval_timer_event_handler(){
-	
-	if(g_scan_timeout || g_sync_timeout || g_force_hop_channel){
-		
-		if(g_scan_timeout){
-			g_scan_timeout--;
-		}
+		case NRF_ESB_EVENT_HOP:
+			
+			if(g_mode == MODE_NORMAL){
+				//If we lost sync, the hops follow the box for a while. Then each channel is held for more than 1 channel
+				//list cycle to find the box again.
+				app_tdma_on_hop();
+#if ADAPTIVE_FREQUENCY_HOPPING
+				if(!app_tdma_is_synced() && !app_tdma_is_coasting()){
+					//scanning does not count the frames of the box. It repeats its map in the beacons.
+					g_map_idx = BEACON_NO_MAP_ENTRY;
+				}
+				else if(g_map_idx != BEACON_NO_MAP_ENTRY && --g_map_countdown == 0){
+					//the box uses the new channel from this frame on, the next time the list comes to it.
+					map_entry_apply(g_map_idx, g_map_ch);
+					g_map_idx = BEACON_NO_MAP_ENTRY;
+				}
+#endif
+				//Listen for the beacon of the new frame, or keep scanning.
+				if(nrf_esb_is_idle()){
+					nrf_esb_start_rx();
+				}
+			}
+			else if(g_mode == MODE_JOINING){
+				
+				//No box took joining devices for a whole scan. Look for one in setup mode again, from the main loop. Asked
+				//on every hop until it does.
+				if(g_join_hops_left == 0 || --g_join_hops_left == 0){
+					(void) app_sched_event_put(NULL, 0, join_scan_ended);
+				}
+				else if(nrf_esb_is_idle()){
+					nrf_esb_start_rx();
+				}
+			}
+			break;
 		
-		if(g_sync_timeout){
-			g_sync_timeout--;
-		}
-
-		if(g_scan_timeout == 0 || g_force_hop_channel){
+		case NRF_ESB_EVENT_HOP_DEADLINE:
 			
-			g_force_hop_channel = false;
-
-			g_scan_timeout = BEACON_SCAN_SHORT_TIMEOUT_MS;
-			if(g_sync_timeout == 0){
-				//We lost sync. Switch to long scan interval.
-				g_scan_timeout = BEACON_SCAN_LONG_TIMEOUT_MS;
+			if(g_mode == MODE_NORMAL){
+				//The beacon of this frame did not come. Stop listening until the next frame, unless the slot of
+				//this device can be predicted.
+				(void) nrf_esb_stop_rx();
+				if(!flywheel_respond()){
+					sleep_until_hop();
+				}
 			}
-			nrf_esb_stop_rx();
-			hop_channel();
-			nrf_esb_start_rx();
-		}
-	}		
+			break;
+		
+		case NRF_ESB_EVENT_RX_OVERFLOW:
+			//Every payload is read as it arrives. Nothing to do.
+			break;
+		
+    }
 }
 
 void enter_normal_mode(){
 
+	app_tdma_schedule_t schedule = APP_TDMA_SCHEDULE(g_ds.link);
+	
 	//enter normal mode.
 	nrf_gpio_pin_set(LED_1);
 	
@@ -370,27 +817,34 @@ void enter_normal_mode(){
 	
 	interval_timer_stop();
 	
+	//TIMER0 becomes the local clock of the time sync.
+	app_timesync_start(false);
+	g_beacon_valid = false;
+	g_report_known = 0;
+	
 	esb_init(false);
 	nrf_esb_set_base_address_1(g_ds.sys_address_32);
-	nrf_esb_update_prefix(1, g_ds.dev_idx);
+	nrf_esb_update_prefix(1, DEV_PIPE_PREFIX(g_ds.dev_idx));
 	
-	//change to system channel list.
-	memcpy(ga_chlist, g_ds.chlist, MAXIMUM_CHANNEL_LIST_SIZE);
-	g_cur_ch_idx = MAXIMUM_CHANNEL_LIST_SIZE;
+	//the device ID heads every response, so that the box can tell devices on a shared pipe apart.
+	tx_data_payload[0].data[RESPONSE_DEV_ID_INDEX] = g_ds.dev_idx;
+	tx_data_payload[1].data[RESPONSE_DEV_ID_INDEX] = g_ds.dev_idx;
 	
-	//Set to long scan interval (hold channel for more than 1 channel list cycle) to try and sync with the box.
-	g_scan_timeout = BEACON_SCAN_LONG_TIMEOUT_MS;
-	g_sync_timeout = 0;
+	//change to system channel list and the schedule of the box.
+	memcpy(ga_chlist, g_ds.chlist, MAXIMUM_CHANNEL_LIST_SIZE);
+	APP_ERROR_CHECK(app_tdma_init(&schedule));
+#if ADAPTIVE_FREQUENCY_HOPPING
+	g_map_idx = BEACON_NO_MAP_ENTRY;
+#endif
 	
-	g_force_hop_channel = true;
-	interval_timer_start();
+	//Hold each channel for more than 1 channel list cycle to try and sync with the box.
+	app_tdma_scan_start(ga_chlist, g_ds.link.chlist_size);
+	nrf_esb_start_rx();
 	
 }
 
-void do_pairing(){
-	
-	//enter pairing mode
-	nrf_gpio_pin_clear(LED_1);
+//Ask a box in setup mode on the pairing channels.
+static void pair_setup_start(){
 	
 	esb_init(true);
 	
@@ -400,12 +854,44 @@ void do_pairing(){
 	
 	APP_ERROR_CHECK(nrf_esb_set_rf_channel(ga_chlist[g_cur_ch_idx]));
 	
-	g_pairing_timeout = MAXIMUM_PAIRING_TIMEOUT_MS;
+	g_pair_setup_ms = PAIR_SETUP_MS;
 	g_mode = MODE_PAIRING;
-	g_pair_state = PAIR_STATE_SEND_REQ;
 			
 	//start sending pairing request.
-	send_pairing_req();
+	pair_round_start();
+}
+
+//Look for a box in normal mode that takes joining devices. Its hop index 0 is always in region 1, so the scan holds
+//each channel of region 1 for a channel list cycle of the box.
+static void join_scan_start(){
+	
+	link_params_t link = SCHEME_1_LINK_PARAMS;
+	app_tdma_schedule_t schedule = APP_TDMA_SCHEDULE(link);
+	
+	esb_init(false);
+	APP_ERROR_CHECK(app_tdma_init(&schedule));
+	
+	g_mode = MODE_JOINING;
+	g_pair_state = PAIR_STATE_NONE;
+	g_join_hops_left = MAXIMUM_CHANNELS_PER_REGION;
+	g_join_narrowed = false;
+	
+	APP_ERROR_CHECK(app_tdma_scan_start(gca_join_scan_chlist, MAXIMUM_CHANNELS_PER_REGION));
+	nrf_esb_start_rx();
+}
+
+void do_pairing(){
+	
+	//enter pairing mode
+	nrf_gpio_pin_clear(LED_1);
+	
+	//TIMER0 goes back to the pairing interval.
+	app_timesync_stop();
+	interval_timer_init();
+	
+	g_pairing_timeout = MAXIMUM_PAIRING_TIMEOUT_MS;
+	pair_setup_start();
+	interval_timer_start();
 }
 
 void clocks_start( void )
@@ -414,6 +900,13 @@ void clocks_start( void )
     NRF_CLOCK->TASKS_HFCLKSTART = 1;
 
     while (NRF_CLOCK->EVENTS_HFCLKSTARTED == 0);
+
+    //The RTC that times the sleep between frames runs on the 32 kHz crystal.
+    NRF_CLOCK->LFCLKSRC = (CLOCK_LFCLKSRC_SRC_Xtal << CLOCK_LFCLKSRC_SRC_Pos);
+    NRF_CLOCK->EVENTS_LFCLKSTARTED = 0;
+    NRF_CLOCK->TASKS_LFCLKSTART = 1;
+
+    while (NRF_CLOCK->EVENTS_LFCLKSTARTED == 0);
 }
 
 
@@ -442,6 +935,10 @@ void gpio_init( void )
 	//**You need to press this together with BUTTON 1 so that the device type can be correctly registered to the box.
 	nrf_gpio_cfg_input(BUTTON_2, NRF_GPIO_PIN_PULLUP);
 	
+	//Toggles at every multiple of SYNC_PULSE_PERIOD_US in box time, on the box and on the devices.
+	nrf_gpio_cfg_output(SYNC_PULSE_PIN);
+	nrf_gpio_pin_clear(SYNC_PULSE_PIN);
+	
 }
 
 
@@ -478,6 +975,8 @@ void interval_timer_init(){
 	NRF_TIMER0->SHORTS		= TIMER_SHORTS_COMPARE0_CLEAR_Msk;
 	NRF_TIMER0->INTENSET    = (TIMER_INTENSET_COMPARE0_Enabled << TIMER_INTENSET_COMPARE0_Pos);
 	
+	//The handler only queues the tick for the main loop. It runs at the radio interrupt priority, as in normal mode.
+	NVIC_SetPriority(TIMER0_IRQn, 1);
     NVIC_EnableIRQ(TIMER0_IRQn);
 	
 }
@@ -494,6 +993,31 @@ void interval_timer_stop(){
 	NRF_TIMER0->TASKS_STOP = 1;
 }
 
+void TIMER0_IRQHandler(void){
+	
+	if(g_mode == MODE_NORMAL){
+		app_timesync_timer_handler();
+		return;
+	}
+	
+	NRF_TIMER0->EVENTS_COMPARE[0] = 0;
+	
+	//A tick the queue has no room for only makes the pairing waits 1 ms longer.
+	(void) app_sched_event_put(NULL, 0, pair_tick);
+}
+
+//The local clock and the hop timer stood still for pause_us while the 16 MHz clock was off.
+static void sleep_paused(uint32_t pause_us){
+	
+	app_timesync_paused(pause_us);
+	(void) nrf_esb_hop_paused((uint16_t)pause_us);
+}
+
+void RTC1_IRQHandler(void){
+	
+	app_sleep_rtc_handler();
+}
+
 int main(void)
 {
     ret_code_t err_code;
@@ -508,12 +1032,26 @@ int main(void)
     clocks_start();
 	interval_timer_init();
 	
+	//The interrupts only do what the radio timing needs. The rest waits for the main loop.
+	APP_SCHED_INIT(SCHED_MAX_EVENT_DATA_SIZE, SCHED_QUEUE_SIZE);
+	
+	//TIMER0 only stops for a sleep in normal mode, where it is the local clock of the time sync.
+	NRF_TIMER_Type * const sleep_timers[] = {NRF_TIMER0, NRF_ESB_HOP_TIMER};
+	app_sleep_init(sleep_timers, ARRAY_SIZE(sleep_timers), sleep_paused);
+	
+	//The chip ID names this device in pairing, and seeds its backoff.
+	chip_id_get(ga_chip_id);
+	g_rand_state = uint32_decode(&ga_chip_id[0]) ^ uint32_decode(&ga_chip_id[4]);
+	if(g_rand_state == 0) g_rand_state = 1;
+	
 	//Retrieve pairing info from flash if any.
-	ds_get((uint32_t*)&g_ds, sizeof(ds_data_t));
+	app_store_init();
 	
-	if(g_ds.signature != DS_SIGNATURE){
+	if(app_store_read(&g_ds, sizeof(ds_data_t)) != NRF_SUCCESS || g_ds.signature != DS_SIGNATURE || !link_params_valid(&g_ds.link) || g_ds.report_divisor == 0){
 		
+		//nothing usable in flash. Pair again.
 		g_ds.signature = DS_SIGNATURE;
+		g_ds.dev_idx = 0xff;
 	}
 	
 	if(nrf_gpio_pin_read(BUTTON_2) == 0){
@@ -528,7 +1066,7 @@ int main(void)
 	VERIFY_SUCCESS(err_code);
 	
 	if(g_ds.signature == DS_SIGNATURE && g_ds.dev_idx != 0xff){
-		addr_prefix[1] = g_ds.dev_idx;
+		addr_prefix[1] = DEV_PIPE_PREFIX(g_ds.dev_idx);
 	}
 	
     err_code = nrf_esb_set_prefixes(addr_prefix, g_ds.dev_idx == 0xff ? 1 : 2);
@@ -541,10 +1079,17 @@ int main(void)
 		enter_normal_mode();
 	}
 	__enable_irq();
-	interval_timer_start();
 	
     while (true)
     {
+		app_sched_execute();
+		
+		//flash writes go one word at a time, between the radio events.
+		app_store_process();
+		
+		if(!NRF_LOG_PROCESS()){
+			__WFE();
+		}
     }
 }
 
@@ -0,0 +1,1512 @@
+/* Copyright (c) 2016 Nordic Semiconductor. All Rights Reserved.
+ *
+ * The information contained herein is property of Nordic Semiconductor ASA.
+ * Terms and conditions of usage are described in detail in NORDIC
+ * SEMICONDUCTOR STANDARD SOFTWARE LICENSE AGREEMENT.
+ *
+ * Licensees are granted free, non-transferable use of the information. NO
+ * WARRANTY of ANY KIND is provided. This heading must NOT be removed from
+ * the file.
+ *
+ */
+
+/** @file
+ *
+ * @brief Discrete-event simulation of one box and up to six devices on a shared medium.
+ *
+ * @details The kernel starts every node as a separate process running the unmodified box or
+ *          device firmware against simulated peripherals, and schedules them conservatively:
+ *          the node with the earliest pending activity runs, but never further than the
+ *          earliest moment another node could make a transmission reach it.
+ *
+ *          The kernel observes the box beacons and the packets the box receives and reports,
+ *          per device, the share of frames whose data reached the box, the latency from the
+ *          beacon that opened the frame to the reception, and the time from entering normal
+ *          mode until the first delivery. The edges of the sync pulse pin give the error of the
+ *          box time on each device, against the edges of the box. The nodes report when their
+ *          16 MHz clock turns on and off, which gives the share of the time each device keeps it
+ *          on from the first beacon it hears.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "sim_proto.h"
+
+#define PIPE_DEVICES                6       /**< Devices of the default build, one ESB pipe each. */
+#define MAX_DEVICES                 32      /**< Devices of the shared-pipe build, see the Makefile. */
+#define BOX_NODE                    0
+
+#define DEFAULT_DURATION_S          60
+#define DEFAULT_BOOT_DELAY_MS       1500    /**< Devices boot once the box has picked its channels. */
+#define DEFAULT_STAGGER_MS          300
+#define DEFAULT_RX_DBM              (-50)
+#define DEFAULT_NOISE_FLOOR_DBM     (-95)
+
+#define PIPE_FIRST_CONTROLLER       5       /**< Devices from this index hold BUTTON_2 at boot. */
+#define SHARED_FIRST_CONTROLLER     25
+#define PIN_LED_1                   21
+#define PIN_BUTTON_2                18
+#define PIN_BUTTON_3                19      /**< Opens joining on the box in normal mode. */
+#define REPLACE_PRESS_MS            200
+#define PIN_SYNC_PULSE              12      /**< Toggled at every multiple of 100 ms in box time. */
+
+#define BEACON_LENGTH               22
+#define BEACON_BYTE1                0xee
+#define BEACON_BYTE2                0xdd
+#define BEACON_BYTE3_RESEND         0x02
+#define BEACON_SCHEME_INDEX         3       /**< Payload byte carrying the scheme of the cycle. */
+#define BEACON_MAP_INDEX            4       /**< Payload bytes carrying a channel map entry: hop index, channel, frames until use. */
+#define BEACON_NO_MAP_ENTRY         0xff
+#define BEACON_ASK_MASK_INDEX       7       /**< Payload bytes carrying the 32-bit mask of the devices asked, little endian. */
+#define RESPONSE_DEV_ID_INDEX       0       /**< Payload byte carrying the device ID. */
+#define DATA_LENGTH                 32
+#define DPL_HEADER_LENGTH           2       /**< LENGTH and S1 bytes in the PDU. */
+
+typedef struct
+{
+    sim_msg_tx_t * p_items;
+    uint32_t       count;
+    uint32_t       capacity;
+} notice_queue_t;
+
+typedef struct
+{
+    pid_t          pid;
+    int            fd;
+    sim_time_t     now;
+    sim_time_t     wake;
+    uint32_t       gpio_out;
+    uint32_t       resets;
+    notice_queue_t notices;
+    sim_msg_config_t config;
+} node_t;
+
+/**@brief Growable list of samples in microseconds. */
+typedef struct
+{
+    uint32_t       count;
+    uint32_t       capacity;
+    uint32_t     * p_items;
+} sample_list_t;
+
+/**@brief Results of one device. */
+typedef struct
+{
+    sim_time_t     normal_since;            /**< Start of normal mode (LED_1 released). */
+    sim_time_t     last_beacon;             /**< Last beacon heard in normal mode, SIM_TIME_NEVER before the first. */
+    sim_time_t     first_delivery;
+    uint32_t       frames;                  /**< Frames counted after the first delivery. */
+    uint32_t       delivered;
+    sample_list_t  latency_us;
+    bool           in_frame;                /**< Delivered in the current frame. */
+    uint8_t        dev_idx;                 /**< Device ID from the responses, 0 before the first one. */
+    uint32_t       edge_count;
+    uint32_t       edge_capacity;
+    sim_time_t   * p_edges;                 /**< Times of the sync pulse edges. */
+    sim_time_t     hf_from;                 /**< First beacon heard, where the 16 MHz clock time is counted from. */
+    sim_time_t     hf_since;                /**< The 16 MHz clock is on from here, SIM_TIME_NEVER while off. */
+    sim_time_t     hf_on;                   /**< Time the 16 MHz clock was on from hf_from. */
+} device_stats_t;
+
+/**@brief Results of one simulation run. */
+typedef struct
+{
+    uint32_t       scheme;
+    uint32_t       beacons;
+    uint32_t       frames;
+    uint32_t       frames_all_synced;
+    uint32_t       frames_complete;
+    uint8_t        beacon_scheme;           /**< Scheme announced by the last beacon. */
+    uint32_t       scheme_switches;
+    uint32_t       channel_changes;         /**< Channel map changes announced by the box. */
+    uint8_t        map_idx;                 /**< Last announced change, to count each once. */
+    uint8_t        map_ch;
+    sim_time_t     frame_start;
+    bool           frame_open;
+    uint32_t       frame_ask_mask;          /**< Devices the new-data beacon of the frame asked. */
+    uint32_t       box_resets;
+    sim_time_t     first_beacon;
+    sample_list_t  acquire_us;              /**< From normal mode, or the first beacon, to the first beacon heard. */
+    sample_list_t  resync_us;               /**< From the end of a noise band to the next beacon heard. */
+    uint8_t        replaced_dev_idx;        /**< Device ID of the device --replace removed, 0 if it never answered. */
+    device_stats_t devices[MAX_DEVICES + 1];    /**< Entry 0 keeps the sync pulse edges of the box. */
+} run_stats_t;
+
+typedef struct
+{
+    uint32_t         devices;
+    uint32_t         duration_s;
+    uint64_t         seed;
+    uint32_t         boot_delay_ms;
+    uint32_t         stagger_ms;
+    int8_t           rx_dbm;
+    int8_t           noise_floor_dbm;
+    uint8_t          base_loss_percent;
+    uint8_t          noise_band_count;
+    sim_noise_band_t noise_bands[SIM_MAX_NOISE_BANDS];
+    char const     * p_flash_dir;
+    char const     * p_bin_dir;
+    char const     * p_csv;
+    bool             compare;
+    uint32_t         scheme;
+    uint32_t         clock_ppm;
+    uint32_t         max_sync_error_us;     /**< 0 for no limit. */
+    uint32_t         max_pair_ms;           /**< 0 for no limit. */
+    uint32_t         max_hf_duty;           /**< Percent, for each device, 0 for no limit. */
+    uint32_t         replace_dev;           /**< Device --replace removes, 0 for none. */
+    uint32_t         replace_remove_s;
+    uint32_t         replace_join_s;        /**< The new device boots and the box takes it from here. */
+    bool             verbose;
+} options_t;
+
+static options_t    m_opt;
+static node_t       m_nodes[SIM_MAX_NODES];
+static uint32_t     m_node_count;
+static run_stats_t  m_stats;
+static FILE       * mp_csv;
+static bool         m_failed;
+
+
+static void fatal(char const * p_what)
+{
+    fprintf(stderr, "esb_sim: %s: %s\n", p_what, strerror(errno));
+    exit(EXIT_FAILURE);
+}
+
+
+static double us(sim_time_t t)
+{
+    return (double)t / SIM_TICKS_PER_US;
+}
+
+
+/**@brief Node link. */
+
+static void node_died(node_t * p_node)
+{
+    int status = 0;
+
+    (void)waitpid(p_node->pid, &status, 0);
+    if (WIFSIGNALED(status))
+    {
+        fprintf(stderr, "esb_sim: node %u killed by signal %d\n", (unsigned)(p_node - m_nodes), WTERMSIG(status));
+    }
+    else
+    {
+        fprintf(stderr, "esb_sim: node %u exited with status %d\n", (unsigned)(p_node - m_nodes), WEXITSTATUS(status));
+    }
+    exit(EXIT_FAILURE);
+}
+
+
+static void node_write(node_t * p_node, sim_msg_type_t type, void const * p_body, uint32_t length)
+{
+    uint8_t         buf[sizeof(sim_msg_hdr_t) + sizeof(sim_msg_tx_t)];
+    sim_msg_hdr_t   hdr   = {.type = type, .length = length};
+    size_t          total = sizeof(hdr) + length;
+    uint8_t const * p     = buf;
+
+    memcpy(buf, &hdr, sizeof(hdr));
+    if (length > 0)
+    {
+        memcpy(buf + sizeof(hdr), p_body, length);
+    }
+
+    while (total > 0)
+    {
+        ssize_t n = send(p_node->fd, p, total, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            node_died(p_node);
+        }
+        p     += n;
+        total -= n;
+    }
+}
+
+
+static void node_read(node_t * p_node, void * p_buf, size_t length)
+{
+    uint8_t * p = p_buf;
+
+    while (length > 0)
+    {
+        ssize_t n = read(p_node->fd, p, length);
+        if (n <= 0)
+        {
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            node_died(p_node);
+        }
+        p      += n;
+        length -= n;
+    }
+}
+
+
+static void notice_push(notice_queue_t * p_queue, sim_msg_tx_t const * p_tx)
+{
+    if (p_queue->count == p_queue->capacity)
+    {
+        p_queue->capacity = p_queue->capacity ? 2 * p_queue->capacity : 16;
+        p_queue->p_items  = realloc(p_queue->p_items, p_queue->capacity * sizeof(sim_msg_tx_t));
+        if (p_queue->p_items == NULL)
+        {
+            fatal("realloc");
+        }
+    }
+    p_queue->p_items[p_queue->count++] = *p_tx;
+}
+
+
+/**@brief Hand the node the transmissions it has not seen yet, dropping those already over. */
+static void notices_flush(node_t * p_node)
+{
+    for (uint32_t i = 0; i < p_node->notices.count; i++)
+    {
+        sim_msg_tx_t const * p_tx = &p_node->notices.p_items[i];
+
+        if (p_tx->t_end > p_node->now)
+        {
+            node_write(p_node, SIM_MSG_TX, p_tx, sizeof(*p_tx));
+        }
+    }
+    p_node->notices.count = 0;
+}
+
+
+static void node_spawn(uint32_t id, char const * p_binary, char const * p_flash)
+{
+    node_t * p_node = &m_nodes[id];
+    int      sv[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+    {
+        fatal("socketpair");
+    }
+
+    p_node->pid = fork();
+    if (p_node->pid < 0)
+    {
+        fatal("fork");
+    }
+
+    if (p_node->pid == 0)
+    {
+        // Drop the kernel ends first: one of them may occupy the descriptor the node expects.
+        for (uint32_t i = 0; i < m_node_count; i++)
+        {
+            if (i != id && m_nodes[i].pid > 0)
+            {
+                close(m_nodes[i].fd);
+            }
+        }
+        close(sv[0]);
+        if (sv[1] != SIM_NODE_FD)
+        {
+            if (dup2(sv[1], SIM_NODE_FD) < 0)
+            {
+                fatal("dup2");
+            }
+            close(sv[1]);
+        }
+        execl(p_binary, p_binary, "--flash", p_flash, (char *)NULL);
+        fatal(p_binary);
+    }
+
+    close(sv[1]);
+    p_node->fd = sv[0];
+}
+
+
+/**@brief Statistics. */
+
+static void sample_add(sample_list_t * p_list, uint32_t value)
+{
+    if (p_list->count == p_list->capacity)
+    {
+        p_list->capacity = p_list->capacity ? 2 * p_list->capacity : 256;
+        p_list->p_items  = realloc(p_list->p_items, p_list->capacity * sizeof(uint32_t));
+        if (p_list->p_items == NULL)
+        {
+            fatal("realloc");
+        }
+    }
+    p_list->p_items[p_list->count++] = value;
+}
+
+
+static void edge_add(device_stats_t * p_dev, sim_time_t t)
+{
+    if (p_dev->edge_count == p_dev->edge_capacity)
+    {
+        p_dev->edge_capacity = p_dev->edge_capacity ? 2 * p_dev->edge_capacity : 64;
+        p_dev->p_edges       = realloc(p_dev->p_edges, p_dev->edge_capacity * sizeof(sim_time_t));
+        if (p_dev->p_edges == NULL)
+        {
+            fatal("realloc");
+        }
+    }
+    p_dev->p_edges[p_dev->edge_count++] = t;
+}
+
+
+/**@brief Function for checking whether the box asked a device for new data in the current frame.
+ *
+ * Devices with a reporting divisor are asked only in some frames.
+ */
+static bool device_asked(device_stats_t const * p_dev)
+{
+    return p_dev->dev_idx == 0 || p_dev->dev_idx > 32 ||
+           (m_stats.frame_ask_mask & (1UL << (p_dev->dev_idx - 1))) != 0;
+}
+
+
+static void frame_close(void)
+{
+    bool all_synced = true;
+    bool complete   = true;
+
+    if (!m_stats.frame_open)
+    {
+        return;
+    }
+
+    if (mp_csv != NULL)
+    {
+        fprintf(mp_csv, "%u,%u,%.1f", m_stats.scheme, m_stats.frames, us(m_stats.frame_start));
+    }
+
+    for (uint32_t d = 1; d <= m_opt.devices; d++)
+    {
+        device_stats_t * p_dev = &m_stats.devices[d];
+
+        if (p_dev->first_delivery == SIM_TIME_NEVER)
+        {
+            all_synced = false;
+            complete   = false;
+        }
+        else if ((p_dev->first_delivery < m_stats.frame_start && device_asked(p_dev)) || p_dev->in_frame)
+        {
+            // Counted from the frame of the first delivery on, in the frames that ask for the device.
+            p_dev->frames++;
+            if (p_dev->in_frame)
+            {
+                p_dev->delivered++;
+            }
+            else
+            {
+                complete = false;
+            }
+        }
+
+        if (mp_csv != NULL)
+        {
+            fprintf(mp_csv, ",%d", p_dev->in_frame ? 1 : 0);
+        }
+        p_dev->in_frame = false;
+    }
+
+    if (mp_csv != NULL)
+    {
+        fputc('\n', mp_csv);
+    }
+
+    if (all_synced)
+    {
+        m_stats.frames_all_synced++;
+        if (complete)
+        {
+            m_stats.frames_complete++;
+        }
+    }
+    m_stats.frames++;
+    m_stats.frame_open = false;
+}
+
+
+static void on_box_tx(sim_msg_tx_t const * p_tx)
+{
+    uint8_t const * p_payload = &p_tx->pdu[DPL_HEADER_LENGTH];
+
+    if (p_tx->payload_length != BEACON_LENGTH || p_payload[0] != BEACON_BYTE1 || p_payload[1] != BEACON_BYTE2)
+    {
+        return;
+    }
+
+    if (m_stats.beacons++ == 0)
+    {
+        m_stats.first_beacon = p_tx->t_start;
+    }
+
+    // The box may move to the other scheme at the start of a cycle
+    if (m_stats.beacons > 1 && p_payload[BEACON_SCHEME_INDEX] != m_stats.beacon_scheme)
+    {
+        m_stats.scheme_switches++;
+        if (m_opt.verbose)
+        {
+            fprintf(stderr, "esb_sim: %10.3f ms box switches to scheme %u\n",
+                    us(p_tx->t_start) / 1000, p_payload[BEACON_SCHEME_INDEX]);
+        }
+    }
+    m_stats.beacon_scheme = p_payload[BEACON_SCHEME_INDEX];
+
+    // A change is announced in several beacons before it is used
+    if (p_payload[BEACON_MAP_INDEX] != BEACON_NO_MAP_ENTRY && p_payload[BEACON_MAP_INDEX + 2] > 0 &&
+        (p_payload[BEACON_MAP_INDEX] != m_stats.map_idx || p_payload[BEACON_MAP_INDEX + 1] != m_stats.map_ch))
+    {
+        m_stats.channel_changes++;
+        m_stats.map_idx = p_payload[BEACON_MAP_INDEX];
+        m_stats.map_ch  = p_payload[BEACON_MAP_INDEX + 1];
+        if (m_opt.verbose)
+        {
+            fprintf(stderr, "esb_sim: %10.3f ms box moves hop index %u to channel %u in %u frames\n",
+                    us(p_tx->t_start) / 1000, p_payload[BEACON_MAP_INDEX], p_payload[BEACON_MAP_INDEX + 1],
+                    p_payload[BEACON_MAP_INDEX + 2]);
+        }
+    }
+
+    // Scheme 2 opens a frame with NEW_DATA and repeats it with RESEND beacons on the other
+    // channels; under scheme 1 every beacon opens a frame.
+    if (p_payload[2] == BEACON_BYTE3_RESEND)
+    {
+        return;
+    }
+
+    frame_close();
+    m_stats.frame_open     = true;
+    m_stats.frame_start    = p_tx->t_start;
+    m_stats.frame_ask_mask = (uint32_t)p_payload[BEACON_ASK_MASK_INDEX] |
+                             (uint32_t)p_payload[BEACON_ASK_MASK_INDEX + 1] << 8 |
+                             (uint32_t)p_payload[BEACON_ASK_MASK_INDEX + 2] << 16 |
+                             (uint32_t)p_payload[BEACON_ASK_MASK_INDEX + 3] << 24;
+}
+
+
+static void on_box_rx(sim_msg_rx_t const * p_rx)
+{
+    device_stats_t * p_dev;
+
+    if (p_rx->src_node == BOX_NODE || p_rx->src_node > m_opt.devices || p_rx->payload_length != DATA_LENGTH)
+    {
+        return;
+    }
+
+    p_dev = &m_stats.devices[p_rx->src_node];
+    p_dev->dev_idx = p_rx->payload[RESPONSE_DEV_ID_INDEX];
+    if (p_dev->first_delivery == SIM_TIME_NEVER)
+    {
+        p_dev->first_delivery = p_rx->t_end;
+    }
+
+    if (m_stats.frame_open && !p_dev->in_frame && p_rx->t_end > m_stats.frame_start)
+    {
+        p_dev->in_frame = true;
+        sample_add(&p_dev->latency_us, (uint32_t)((p_rx->t_end - m_stats.frame_start) / SIM_TICKS_PER_US));
+    }
+}
+
+
+/**@brief Function for timing how long a device in normal mode goes without beacons it can hear. */
+static void on_device_rx(uint32_t id, sim_msg_rx_t const * p_rx)
+{
+    device_stats_t * p_dev = &m_stats.devices[id];
+    sim_time_t       since;
+
+    if (p_rx->src_node != BOX_NODE || p_dev->normal_since == 0 || p_rx->payload_length != BEACON_LENGTH ||
+        p_rx->payload[0] != BEACON_BYTE1 || p_rx->payload[1] != BEACON_BYTE2)
+    {
+        return;
+    }
+
+    if (p_dev->hf_from == SIM_TIME_NEVER)
+    {
+        p_dev->hf_from = p_rx->t_end;
+    }
+    if (p_dev->last_beacon == SIM_TIME_NEVER)
+    {
+        since = p_dev->normal_since > m_stats.first_beacon ? p_dev->normal_since : m_stats.first_beacon;
+        sample_add(&m_stats.acquire_us, (uint32_t)((p_rx->t_end - since) / SIM_TICKS_PER_US));
+    }
+    else
+    {
+        for (uint32_t i = 0; i < m_opt.noise_band_count; i++)
+        {
+            sim_time_t end = m_opt.noise_bands[i].end;
+
+            if (end != SIM_TIME_NEVER && end > p_dev->last_beacon && end <= p_rx->t_end)
+            {
+                sample_add(&m_stats.resync_us, (uint32_t)((p_rx->t_end - end) / SIM_TICKS_PER_US));
+            }
+        }
+    }
+    p_dev->last_beacon = p_rx->t_end;
+}
+
+
+static void on_gpio(uint32_t id, sim_msg_gpio_t const * p_gpio)
+{
+    node_t  * p_node = &m_nodes[id];
+    uint32_t  rising = p_gpio->out & ~p_node->gpio_out;
+
+    if (id != BOX_NODE && (rising & (1UL << PIN_LED_1)))
+    {
+        m_stats.devices[id].normal_since = p_gpio->time;
+        m_stats.devices[id].last_beacon  = SIM_TIME_NEVER;
+    }
+    if ((p_gpio->out ^ p_node->gpio_out) & (1UL << PIN_SYNC_PULSE))
+    {
+        edge_add(&m_stats.devices[id], p_gpio->time);
+    }
+    p_node->gpio_out = p_gpio->out;
+}
+
+
+/**@brief Function for adding the time the 16 MHz clock of a device was on after its first beacon, up to @p t. */
+static void hf_close(device_stats_t * p_dev, sim_time_t t)
+{
+    sim_time_t start = p_dev->hf_since > p_dev->hf_from ? p_dev->hf_since : p_dev->hf_from;
+
+    if (p_dev->hf_since != SIM_TIME_NEVER && p_dev->hf_from != SIM_TIME_NEVER && t > start)
+    {
+        p_dev->hf_on += t - start;
+    }
+    p_dev->hf_since = SIM_TIME_NEVER;
+}
+
+
+static void on_clock(uint32_t id, sim_msg_clock_t const * p_clock)
+{
+    device_stats_t * p_dev = &m_stats.devices[id];
+
+    if (p_clock->hfclk_on)
+    {
+        if (p_dev->hf_since == SIM_TIME_NEVER)
+        {
+            p_dev->hf_since = p_clock->time;
+        }
+    }
+    else
+    {
+        hf_close(p_dev, p_clock->time);
+    }
+}
+
+
+/**@brief Scheduling. */
+
+static void node_configure(uint32_t id, sim_time_t boot_time)
+{
+    node_t * p_node = &m_nodes[id];
+
+    p_node->config.boot_time = boot_time;
+    p_node->now              = boot_time;
+    p_node->wake             = boot_time;
+    p_node->gpio_out         = 0;
+    p_node->notices.count    = 0;
+
+    node_write(p_node, SIM_MSG_CONFIG, &p_node->config, sizeof(p_node->config));
+}
+
+
+static void node_run(uint32_t id, sim_time_t horizon)
+{
+    node_t      * p_node = &m_nodes[id];
+    sim_msg_run_t run    = {.horizon = horizon};
+
+    notices_flush(p_node);
+    node_write(p_node, SIM_MSG_RUN, &run, sizeof(run));
+
+    for (;;)
+    {
+        sim_msg_hdr_t hdr;
+        union
+        {
+            sim_msg_tx_t    tx;
+            sim_msg_rx_t    rx;
+            sim_msg_yield_t yield;
+            sim_msg_gpio_t  gpio;
+            sim_msg_reset_t reset;
+            sim_msg_clock_t clock;
+        } body;
+
+        node_read(p_node, &hdr, sizeof(hdr));
+        if (hdr.length > sizeof(body))
+        {
+            fprintf(stderr, "esb_sim: bad message length %u from node %u\n", hdr.length, id);
+            exit(EXIT_FAILURE);
+        }
+        node_read(p_node, &body, hdr.length);
+
+        switch (hdr.type)
+        {
+            case SIM_MSG_TX:
+                if (m_opt.verbose)
+                {
+                    fprintf(stderr, "esb_sim: %10.3f ms node %u tx ch %u len %u\n",
+                            us(body.tx.t_start) / 1000, id, body.tx.channel, body.tx.payload_length);
+                }
+                if (id == BOX_NODE)
+                {
+                    on_box_tx(&body.tx);
+                }
+                for (uint32_t i = 0; i < m_node_count; i++)
+                {
+                    if (i != id && m_nodes[i].fd >= 0)
+                    {
+                        notice_push(&m_nodes[i].notices, &body.tx);
+                        if (body.tx.t_address < m_nodes[i].wake)
+                        {
+                            m_nodes[i].wake = body.tx.t_address;
+                        }
+                    }
+                }
+                break;
+
+            case SIM_MSG_RX:
+                if (id == BOX_NODE)
+                {
+                    on_box_rx(&body.rx);
+                }
+                else
+                {
+                    on_device_rx(id, &body.rx);
+                }
+                break;
+
+            case SIM_MSG_GPIO:
+                if (m_opt.verbose)
+                {
+                    fprintf(stderr, "esb_sim: %10.3f ms node %u gpio %08x\n",
+                            us(body.gpio.time) / 1000, id, body.gpio.out);
+                }
+                on_gpio(id, &body.gpio);
+                break;
+
+            case SIM_MSG_CLOCK:
+                on_clock(id, &body.clock);
+                break;
+
+            case SIM_MSG_RESET:
+                p_node->resets++;
+                if (m_opt.verbose)
+                {
+                    fprintf(stderr, "esb_sim: node %u reset at %.3f ms\n", id, us(body.reset.time) / 1000);
+                }
+                // The node re-executes its image and waits for its configuration.
+                node_configure(id, body.reset.time);
+                return;
+
+            case SIM_MSG_YIELD:
+                p_node->now  = body.yield.now;
+                p_node->wake = body.yield.wake;
+                return;
+
+            default:
+                fprintf(stderr, "esb_sim: unexpected message %u from node %u\n", hdr.type, id);
+                exit(EXIT_FAILURE);
+        }
+    }
+}
+
+
+static void simulate(sim_time_t end)
+{
+    for (;;)
+    {
+        uint32_t   next    = 0;
+        sim_time_t horizon = end;
+
+        for (uint32_t i = 1; i < m_node_count; i++)
+        {
+            if (m_nodes[i].wake < m_nodes[next].wake)
+            {
+                next = i;
+            }
+        }
+        if (m_nodes[next].wake >= end)
+        {
+            return;
+        }
+
+        // Another node may start transmitting at its wake time; the address of that packet
+        // cannot reach this node before the lookahead has passed.
+        for (uint32_t i = 0; i < m_node_count; i++)
+        {
+            if (i != next && m_nodes[i].wake != SIM_TIME_NEVER &&
+                m_nodes[i].wake + SIM_LOOKAHEAD - 1 < horizon)
+            {
+                horizon = m_nodes[i].wake + SIM_LOOKAHEAD - 1;
+            }
+        }
+
+        node_run(next, horizon);
+    }
+}
+
+
+/**@brief Power a device off for good. It stops answering, so the box may give its slot away. */
+static void node_remove(uint32_t id)
+{
+    node_t * p_node = &m_nodes[id];
+
+    node_write(p_node, SIM_MSG_END, NULL, 0);
+    close(p_node->fd);
+    waitpid(p_node->pid, NULL, 0);
+
+    p_node->fd            = -1;
+    p_node->wake          = SIM_TIME_NEVER;
+    p_node->gpio_out      = 0;
+    p_node->notices.count = 0;
+}
+
+
+/**@brief Reporting. */
+
+static int compare_u32(void const * p_a, void const * p_b)
+{
+    uint32_t a = *(uint32_t const *)p_a;
+    uint32_t b = *(uint32_t const *)p_b;
+
+    return a < b ? -1 : a > b;
+}
+
+
+/**@brief Function for checking whether the run needs the shared-pipe build of the firmware. */
+static bool shared_pipe(void)
+{
+    return m_opt.devices > PIPE_DEVICES;
+}
+
+
+static uint32_t first_controller(void)
+{
+    return shared_pipe() ? SHARED_FIRST_CONTROLLER : PIPE_FIRST_CONTROLLER;
+}
+
+
+static uint32_t percentile(uint32_t const * p_sorted, uint32_t count, uint32_t percent)
+{
+    uint32_t index = (uint32_t)(((uint64_t)count * percent + 99) / 100);
+
+    return p_sorted[index > 0 ? index - 1 : 0];
+}
+
+
+/**@brief Function for getting the time from a device edge to the nearest edge of the box. */
+static sim_time_t edge_error(device_stats_t const * p_box, sim_time_t t)
+{
+    uint32_t   lo    = 0;
+    uint32_t   hi    = p_box->edge_count;
+    sim_time_t error = SIM_TIME_NEVER;
+
+    while (lo < hi)
+    {
+        uint32_t mid = (lo + hi) / 2;
+
+        if (p_box->p_edges[mid] < t)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    if (lo < p_box->edge_count)
+    {
+        error = p_box->p_edges[lo] - t;
+    }
+    if (lo > 0 && t - p_box->p_edges[lo - 1] < error)
+    {
+        error = t - p_box->p_edges[lo - 1];
+    }
+    return error;
+}
+
+
+static void sync_report(run_stats_t * p_stats)
+{
+    device_stats_t const * p_box    = &p_stats->devices[BOX_NODE];
+    uint32_t             * p_errors = NULL;
+    uint32_t               count    = 0;
+    uint32_t               max;
+
+    for (uint32_t d = 1; d <= m_opt.devices; d++)
+    {
+        count += p_stats->devices[d].edge_count;
+    }
+    if (count > 0 && p_box->edge_count > 0)
+    {
+        p_errors = malloc(count * sizeof(uint32_t));
+        if (p_errors == NULL)
+        {
+            fatal("malloc");
+        }
+    }
+    if (p_errors == NULL)
+    {
+        printf("  sync pulse: no edges\n");
+        m_failed |= m_opt.max_sync_error_us > 0;
+        return;
+    }
+
+    count = 0;
+    for (uint32_t d = 1; d <= m_opt.devices; d++)
+    {
+        for (uint32_t i = 0; i < p_stats->devices[d].edge_count; i++)
+        {
+            p_errors[count++] = (uint32_t)edge_error(p_box, p_stats->devices[d].p_edges[i]);
+        }
+    }
+    qsort(p_errors, count, sizeof(uint32_t), compare_u32);
+    max = p_errors[count - 1];
+
+    printf("  sync pulse error over %u edges: p50 %.2f, p99 %.2f, max %.2f us\n",
+           count, us(percentile(p_errors, count, 50)), us(percentile(p_errors, count, 99)), us(max));
+    if (m_opt.max_sync_error_us > 0 && max > SIM_US(m_opt.max_sync_error_us))
+    {
+        printf("  sync error above %u us\n", m_opt.max_sync_error_us);
+        m_failed = true;
+    }
+    free(p_errors);
+}
+
+
+static void beacon_wait_report(char const * p_after, sample_list_t * p_list)
+{
+    if (p_list->count == 0)
+    {
+        return;
+    }
+
+    qsort(p_list->p_items, p_list->count, sizeof(uint32_t), compare_u32);
+    printf("  first beacon %s, over %u waits: p50 %.1f, max %.1f ms\n",
+           p_after, p_list->count, percentile(p_list->p_items, p_list->count, 50) / 1000.0,
+           p_list->p_items[p_list->count - 1] / 1000.0);
+}
+
+
+/**@brief Function for reporting how long the devices took from boot to normal mode. */
+static void pairing_report(run_stats_t const * p_stats)
+{
+    uint32_t pair_ms[MAX_DEVICES];
+    uint32_t count = 0;
+
+    for (uint32_t d = 1; d <= m_opt.devices; d++)
+    {
+        sim_time_t boot = m_nodes[d].config.boot_time;
+
+        // LED_1 is also high from boot until pairing starts
+        if (p_stats->devices[d].normal_since > boot && (m_nodes[d].gpio_out & (1UL << PIN_LED_1)))
+        {
+            pair_ms[count++] = (uint32_t)(us(p_stats->devices[d].normal_since - boot) / 1000);
+        }
+    }
+    if (count == 0 || p_stats->beacons == 0)
+    {
+        m_failed |= m_opt.max_pair_ms > 0;
+        return;
+    }
+
+    qsort(pair_ms, count, sizeof(uint32_t), compare_u32);
+    printf("  boot to normal mode: %u devices, p50 %u, max %u ms; first beacon at %.1f ms\n",
+           count, percentile(pair_ms, count, 50), pair_ms[count - 1], us(p_stats->first_beacon) / 1000);
+    if (m_opt.max_pair_ms > 0 && (count < m_opt.devices || pair_ms[count - 1] > m_opt.max_pair_ms))
+    {
+        printf("  pairing took longer than %u ms\n", m_opt.max_pair_ms);
+        m_failed = true;
+    }
+}
+
+
+/**@brief Function for getting the share of the time from its first beacon a device kept the 16 MHz clock on, in percent. */
+static double hf_duty(device_stats_t const * p_dev)
+{
+    sim_time_t end = SIM_MS((uint64_t)m_opt.duration_s * 1000);
+
+    return p_dev->hf_from < end ? 100.0 * p_dev->hf_on / (end - p_dev->hf_from) : 0.0;
+}
+
+
+/**@brief Function for reporting how long the devices keep the 16 MHz clock on. The limit holds for each device. */
+static void hf_report(run_stats_t const * p_stats)
+{
+    double   sum   = 0.0;
+    double   max   = 0.0;
+    uint32_t worst = 0;
+    uint32_t count = 0;
+
+    for (uint32_t d = 1; d <= m_opt.devices; d++)
+    {
+        if (p_stats->devices[d].hf_from != SIM_TIME_NEVER)
+        {
+            double duty = hf_duty(&p_stats->devices[d]);
+
+            sum += duty;
+            count++;
+            if (duty >= max)
+            {
+                max   = duty;
+                worst = d;
+            }
+        }
+    }
+    if (count == 0)
+    {
+        m_failed |= m_opt.max_hf_duty > 0;
+        return;
+    }
+
+    printf("  16 MHz clock on after the first beacon: %.1f %% of the time on average, %.1f %% at most (device %u)\n",
+           sum / count, max, worst);
+    if (m_opt.max_hf_duty > 0 && max > m_opt.max_hf_duty)
+    {
+        printf("  device %u keeps the 16 MHz clock on more than %u %% of the time\n", worst, m_opt.max_hf_duty);
+        m_failed = true;
+    }
+}
+
+
+static void report(run_stats_t * p_stats)
+{
+    printf("\nScheme %u: %u beacons, %u frames, box resets %u, scheme switches %u, final scheme %u, "
+           "channel changes %u\n",
+           p_stats->scheme, p_stats->beacons, p_stats->frames, p_stats->box_resets,
+           p_stats->scheme_switches, p_stats->beacon_scheme, p_stats->channel_changes);
+    printf("  dev  type        sync[ms]  frames  delivered   hf on     lat min   avg   p50   p99   max [us]\n");
+
+    for (uint32_t d = 1; d <= m_opt.devices; d++)
+    {
+        device_stats_t * p_dev = &p_stats->devices[d];
+        char const     * p_type = d >= first_controller() ? "controller" : "display";
+
+        if (p_dev->first_delivery == SIM_TIME_NEVER)
+        {
+            printf("  %3u  %-10s  never synced\n", d, p_type);
+            continue;
+        }
+
+        printf("  %3u  %-10s  %8.1f  %6u  %8.2f %%  %5.1f %%",
+               d, p_type,
+               p_dev->first_delivery > p_dev->normal_since ?
+                   us(p_dev->first_delivery - p_dev->normal_since) / 1000 : 0.0,
+               p_dev->frames,
+               p_dev->frames ? 100.0 * p_dev->delivered / p_dev->frames : 0.0,
+               hf_duty(p_dev));
+
+        if (p_dev->latency_us.count > 0)
+        {
+            sample_list_t * p_lat = &p_dev->latency_us;
+            uint64_t        sum   = 0;
+
+            qsort(p_lat->p_items, p_lat->count, sizeof(uint32_t), compare_u32);
+            for (uint32_t i = 0; i < p_lat->count; i++)
+            {
+                sum += p_lat->p_items[i];
+            }
+            printf("  %6u %5u %5u %5u %5u",
+                   p_lat->p_items[0],
+                   (uint32_t)(sum / p_lat->count),
+                   percentile(p_lat->p_items, p_lat->count, 50),
+                   percentile(p_lat->p_items, p_lat->count, 99),
+                   p_lat->p_items[p_lat->count - 1]);
+        }
+        printf("\n");
+    }
+
+    if (m_opt.replace_dev > 0)
+    {
+        device_stats_t const * p_dev = &p_stats->devices[m_opt.replace_dev];
+
+        if (p_dev->first_delivery == SIM_TIME_NEVER)
+        {
+            printf("  device %u replaced at %u s: never delivered\n", m_opt.replace_dev, m_opt.replace_join_s);
+            m_failed = true;
+        }
+        else
+        {
+            printf("  device %u replaced at %u s: normal mode after %.1f ms, slot %u (was %u)\n",
+                   m_opt.replace_dev, m_opt.replace_join_s,
+                   us(p_dev->normal_since - SIM_MS((uint64_t)m_opt.replace_join_s * 1000)) / 1000,
+                   p_dev->dev_idx, p_stats->replaced_dev_idx);
+            if (p_dev->dev_idx != p_stats->replaced_dev_idx)
+            {
+                m_failed = true;
+            }
+        }
+    }
+
+    printf("  frames with all devices delivered: %u of %u (%.2f %%)\n",
+           p_stats->frames_complete, p_stats->frames_all_synced,
+           p_stats->frames_all_synced ? 100.0 * p_stats->frames_complete / p_stats->frames_all_synced : 0.0);
+    pairing_report(p_stats);
+    beacon_wait_report("after normal mode", &p_stats->acquire_us);
+    beacon_wait_report("after the noise ends", &p_stats->resync_us);
+    sync_report(p_stats);
+    hf_report(p_stats);
+}
+
+
+static void binary_path(char * p_buf, size_t size, char const * p_name)
+{
+    snprintf(p_buf, size, "%s/%s%s_sim", m_opt.p_bin_dir, p_name, shared_pipe() ? "32" : "");
+}
+
+
+/**@brief Function for drawing the clock deviation of a node from the seed, within the --clock-ppm range. */
+static int32_t clock_ppb(uint32_t id)
+{
+    uint64_t h     = (m_opt.seed + id + 1) * 0x9E3779B97F4A7C15ull;
+    uint32_t range = 2 * m_opt.clock_ppm * 1000 + 1;
+
+    h ^= h >> 31;
+    h *= 0xBF58476D1CE4E5B9ull;
+    h ^= h >> 29;
+    return (int32_t)(h % range) - (int32_t)(m_opt.clock_ppm * 1000);
+}
+
+
+static void run(uint32_t scheme, char const * p_flash_dir)
+{
+    char path[PATH_MAX];
+    char flash[PATH_MAX];
+
+    memset(&m_stats, 0, sizeof(m_stats));
+    m_stats.scheme = scheme;
+    for (uint32_t d = 0; d <= MAX_DEVICES; d++)
+    {
+        m_stats.devices[d].first_delivery = SIM_TIME_NEVER;
+        m_stats.devices[d].hf_from        = SIM_TIME_NEVER;
+        m_stats.devices[d].hf_since       = SIM_TIME_NEVER;
+    }
+
+    m_node_count = m_opt.devices + 1;
+    memset(m_nodes, 0, sizeof(m_nodes));
+
+    for (uint32_t i = 0; i < m_node_count; i++)
+    {
+        node_t * p_node = &m_nodes[i];
+
+        binary_path(path, sizeof(path), i == BOX_NODE ? "box" : "device");
+        snprintf(flash, sizeof(flash), "%s/node%u_s%u.flash", p_flash_dir, i, scheme);
+        node_spawn(i, path, flash);
+
+        p_node->config.node_id           = i;
+        p_node->config.device_id[0]      = (uint32_t)(m_opt.seed * 0x9E3779B1u) ^ (0x1000u + i);
+        p_node->config.device_id[1]      = (uint32_t)((m_opt.seed >> 32) + 0x5A5A0000u + 0x101u * (i + 1));
+        if (i == BOX_NODE)
+        {
+            // The same box image sets up scheme 1 while BUTTON_2 is held, scheme 2 otherwise
+            p_node->config.buttons_pressed = (scheme == 1) ? (1UL << PIN_BUTTON_2) : 0;
+            if (m_opt.replace_dev > 0)
+            {
+                // Take the new device when it boots
+                p_node->config.button_press_pins  = 1UL << PIN_BUTTON_3;
+                p_node->config.button_press_start = SIM_MS((uint64_t)m_opt.replace_join_s * 1000);
+                p_node->config.button_press_end   = p_node->config.button_press_start + SIM_MS(REPLACE_PRESS_MS);
+            }
+        }
+        else
+        {
+            p_node->config.buttons_pressed = (i >= first_controller()) ? (1UL << PIN_BUTTON_2) : 0;
+        }
+        p_node->config.seed              = m_opt.seed;
+        p_node->config.clock_ppb         = clock_ppb(i);
+        p_node->config.rx_dbm            = m_opt.rx_dbm;
+        p_node->config.noise_floor_dbm   = m_opt.noise_floor_dbm;
+        p_node->config.base_loss_percent = m_opt.base_loss_percent;
+        p_node->config.noise_band_count  = m_opt.noise_band_count;
+        memcpy(p_node->config.noise_bands, m_opt.noise_bands, sizeof(m_opt.noise_bands));
+
+        node_configure(i, i == BOX_NODE ? 0 :
+                       SIM_MS(m_opt.boot_delay_ms + (uint64_t)m_opt.stagger_ms * (i - 1)));
+    }
+
+    if (m_opt.replace_dev > 0)
+    {
+        // Swap the device for a new one with another chip ID and an empty flash, which has to join
+        uint32_t         id    = m_opt.replace_dev;
+        device_stats_t * p_dev = &m_stats.devices[id];
+
+        simulate(SIM_MS((uint64_t)m_opt.replace_remove_s * 1000));
+        node_remove(id);
+
+        simulate(SIM_MS((uint64_t)m_opt.replace_join_s * 1000));
+        m_stats.replaced_dev_idx = p_dev->dev_idx;
+        p_dev->first_delivery    = SIM_TIME_NEVER;
+        p_dev->normal_since      = 0;
+        p_dev->last_beacon       = SIM_TIME_NEVER;
+        p_dev->dev_idx           = 0;
+        p_dev->in_frame          = false;
+        p_dev->frames            = 0;
+        p_dev->delivered         = 0;
+        p_dev->hf_from           = SIM_TIME_NEVER;
+        p_dev->hf_since          = SIM_TIME_NEVER;
+        p_dev->hf_on             = 0;
+
+        binary_path(path, sizeof(path), "device");
+        snprintf(flash, sizeof(flash), "%s/node%u_s%u_new.flash", p_flash_dir, id, scheme);
+        (void)unlink(flash);
+        node_spawn(id, path, flash);
+        m_nodes[id].config.device_id[0] ^= 0x00FF0000u;
+        node_configure(id, SIM_MS((uint64_t)m_opt.replace_join_s * 1000));
+    }
+
+    simulate(SIM_MS((uint64_t)m_opt.duration_s * 1000));
+    frame_close();
+    for (uint32_t d = 1; d <= m_opt.devices; d++)
+    {
+        hf_close(&m_stats.devices[d], SIM_MS((uint64_t)m_opt.duration_s * 1000));
+    }
+    m_stats.box_resets = m_nodes[BOX_NODE].resets;
+
+    for (uint32_t i = 0; i < m_node_count; i++)
+    {
+        if (m_nodes[i].fd >= 0)
+        {
+            node_write(&m_nodes[i], SIM_MSG_END, NULL, 0);
+            close(m_nodes[i].fd);
+            waitpid(m_nodes[i].pid, NULL, 0);
+        }
+        free(m_nodes[i].notices.p_items);
+    }
+}
+
+
+static void usage(char const * p_name)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -n, --devices N          number of devices, 1-%u (default %u); devices %u and up are controllers,\n"
+            "                           above %u devices the shared-pipe build runs, with controllers from %u\n"
+            "  -t, --duration S         simulated seconds (default %u)\n"
+            "  -s, --seed N             random seed (default 1)\n"
+            "      --boot-delay MS      boot time of the first device (default %u)\n"
+            "      --stagger MS         boot delay between devices (default %u)\n"
+            "      --scheme 1|2|compare scheme the box sets up (default compare)\n"
+            "      --loss P             packet loss on every channel, percent\n"
+            "      --noise LO-HI:P[:DBM][@S[-E]] extra loss and RSSI level on channels LO..HI,\n"
+            "                           from S to E seconds if given (repeatable)\n"
+            "      --clock-ppm N        clock deviation of each node, drawn from -N..N ppm (default 0)\n"
+            "      --max-sync-error US  fail if a device sync pulse edge is further than US from the box\n"
+            "      --max-pair-ms MS     fail if a device is not in normal mode MS after its boot\n"
+            "      --max-hf-duty P      fail if a device keeps the 16 MHz clock on more than P percent of the time\n"
+            "                           from their first beacon, on average\n"
+            "      --replace D@S[-J]    power device D off at S seconds, and boot a new device with an empty flash\n"
+            "                           in its place at J seconds (default S+3), pressing BUTTON_3 of the box;\n"
+            "                           fail if it does not get the slot of device D\n"
+            "      --flash-dir DIR      keep node flash images in DIR (default: fresh temporary files)\n"
+            "      --bin-dir DIR        location of the node binaries (default: next to esb_sim)\n"
+            "      --csv FILE           write one line per frame\n"
+            "  -v, --verbose\n",
+            p_name, MAX_DEVICES, PIPE_DEVICES, PIPE_FIRST_CONTROLLER, PIPE_DEVICES, SHARED_FIRST_CONTROLLER,
+            DEFAULT_DURATION_S, DEFAULT_BOOT_DELAY_MS, DEFAULT_STAGGER_MS);
+    exit(EXIT_FAILURE);
+}
+
+
+static void noise_band_parse(char const * p_arg)
+{
+    unsigned     lo;
+    unsigned     hi;
+    unsigned     loss;
+    int          dbm     = m_opt.noise_floor_dbm;
+    int          n       = sscanf(p_arg, "%u-%u:%u:%d", &lo, &hi, &loss, &dbm);
+    double       start_s = 0.0;
+    double       end_s   = -1.0;
+    char const * p_time  = strchr(p_arg, '@');
+
+    // Optional active time, @START or @START-END in seconds
+    if (p_time != NULL && (sscanf(p_time, "@%lf-%lf", &start_s, &end_s) < 1 || start_s < 0.0 ||
+                           (end_s >= 0.0 && end_s <= start_s)))
+    {
+        n = 0;
+    }
+
+    if (n < 3 || lo > hi || hi > 125 || loss > 100 || dbm > 0 || dbm < -127 ||
+        m_opt.noise_band_count == SIM_MAX_NOISE_BANDS)
+    {
+        fprintf(stderr, "esb_sim: bad noise band '%s'\n", p_arg);
+        exit(EXIT_FAILURE);
+    }
+
+    m_opt.noise_bands[m_opt.noise_band_count++] = (sim_noise_band_t)
+    {
+        .lo_channel   = (uint8_t)lo,
+        .hi_channel   = (uint8_t)hi,
+        .loss_percent = (uint8_t)loss,
+        .dbm          = (int8_t)dbm,
+        .start        = SIM_US(start_s * 1e6),
+        .end          = end_s < 0.0 ? SIM_TIME_NEVER : SIM_US(end_s * 1e6),
+    };
+}
+
+
+static char * default_bin_dir(void)
+{
+    static char dir[PATH_MAX];
+    ssize_t     n = readlink("/proc/self/exe", dir, sizeof(dir) - 1);
+    char      * p_slash;
+
+    if (n < 0)
+    {
+        return ".";
+    }
+    dir[n]  = '\0';
+    p_slash = strrchr(dir, '/');
+    if (p_slash != NULL)
+    {
+        *p_slash = '\0';
+    }
+
+    return dir;
+}
+
+
+int main(int argc, char ** argv)
+{
+    enum { OPT_BOOT_DELAY = 256, OPT_STAGGER, OPT_SCHEME, OPT_LOSS, OPT_NOISE, OPT_CLOCK_PPM, OPT_MAX_SYNC_ERROR,
+           OPT_MAX_PAIR, OPT_MAX_HF_DUTY, OPT_REPLACE, OPT_FLASH_DIR, OPT_BIN_DIR, OPT_CSV };
+
+    static const struct option options[] =
+    {
+        {"devices",   required_argument, NULL, 'n'},
+        {"duration",  required_argument, NULL, 't'},
+        {"seed",      required_argument, NULL, 's'},
+        {"boot-delay", required_argument, NULL, OPT_BOOT_DELAY},
+        {"stagger",   required_argument, NULL, OPT_STAGGER},
+        {"scheme",    required_argument, NULL, OPT_SCHEME},
+        {"loss",      required_argument, NULL, OPT_LOSS},
+        {"noise",     required_argument, NULL, OPT_NOISE},
+        {"clock-ppm", required_argument, NULL, OPT_CLOCK_PPM},
+        {"max-sync-error", required_argument, NULL, OPT_MAX_SYNC_ERROR},
+        {"max-pair-ms", required_argument, NULL, OPT_MAX_PAIR},
+        {"max-hf-duty", required_argument, NULL, OPT_MAX_HF_DUTY},
+        {"replace",   required_argument, NULL, OPT_REPLACE},
+        {"flash-dir", required_argument, NULL, OPT_FLASH_DIR},
+        {"bin-dir",   required_argument, NULL, OPT_BIN_DIR},
+        {"csv",       required_argument, NULL, OPT_CSV},
+        {"verbose",   no_argument,       NULL, 'v'},
+        {"help",      no_argument,       NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+
+    char     tmp_dir[] = "/tmp/esb_sim.XXXXXX";
+    char const * p_flash_dir;
+    int      opt;
+
+    m_opt.devices         = PIPE_DEVICES;
+    m_opt.duration_s      = DEFAULT_DURATION_S;
+    m_opt.seed            = 1;
+    m_opt.boot_delay_ms   = DEFAULT_BOOT_DELAY_MS;
+    m_opt.stagger_ms      = DEFAULT_STAGGER_MS;
+    m_opt.rx_dbm          = DEFAULT_RX_DBM;
+    m_opt.noise_floor_dbm = DEFAULT_NOISE_FLOOR_DBM;
+    m_opt.compare         = true;
+    m_opt.p_bin_dir       = default_bin_dir();
+
+    while ((opt = getopt_long(argc, argv, "n:t:s:vh", options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+            case 'n':
+                m_opt.devices = strtoul(optarg, NULL, 0);
+                if (m_opt.devices < 1 || m_opt.devices > MAX_DEVICES)
+                {
+                    usage(argv[0]);
+                }
+                break;
+
+            case 't':
+                m_opt.duration_s = strtoul(optarg, NULL, 0);
+                break;
+
+            case 's':
+                m_opt.seed = strtoull(optarg, NULL, 0);
+                break;
+
+            case OPT_BOOT_DELAY:
+                m_opt.boot_delay_ms = strtoul(optarg, NULL, 0);
+                break;
+
+            case OPT_STAGGER:
+                m_opt.stagger_ms = strtoul(optarg, NULL, 0);
+                break;
+
+            case OPT_SCHEME:
+                if (strcmp(optarg, "compare") == 0)
+                {
+                    m_opt.compare = true;
+                }
+                else if (strcmp(optarg, "1") == 0 || strcmp(optarg, "2") == 0)
+                {
+                    m_opt.compare = false;
+                    m_opt.scheme  = optarg[0] - '0';
+                }
+                else
+                {
+                    usage(argv[0]);
+                }
+                break;
+
+            case OPT_LOSS:
+                m_opt.base_loss_percent = (uint8_t)strtoul(optarg, NULL, 0);
+                break;
+
+            case OPT_NOISE:
+                noise_band_parse(optarg);
+                break;
+
+            case OPT_CLOCK_PPM:
+                m_opt.clock_ppm = strtoul(optarg, NULL, 0);
+                if (m_opt.clock_ppm > 1000)
+                {
+                    usage(argv[0]);
+                }
+                break;
+
+            case OPT_MAX_SYNC_ERROR:
+                m_opt.max_sync_error_us = strtoul(optarg, NULL, 0);
+                break;
+
+            case OPT_MAX_PAIR:
+                m_opt.max_pair_ms = strtoul(optarg, NULL, 0);
+                break;
+
+            case OPT_MAX_HF_DUTY:
+                m_opt.max_hf_duty = strtoul(optarg, NULL, 0);
+                break;
+
+            case OPT_REPLACE:
+            {
+                int n = sscanf(optarg, "%u@%u-%u", &m_opt.replace_dev, &m_opt.replace_remove_s, &m_opt.replace_join_s);
+
+                if (n == 2)
+                {
+                    m_opt.replace_join_s = m_opt.replace_remove_s + 3;
+                }
+                if (n < 2 || m_opt.replace_dev < 1 || m_opt.replace_join_s <= m_opt.replace_remove_s)
+                {
+                    usage(argv[0]);
+                }
+                break;
+            }
+
+            case OPT_FLASH_DIR:
+                m_opt.p_flash_dir = optarg;
+                break;
+
+            case OPT_BIN_DIR:
+                m_opt.p_bin_dir = optarg;
+                break;
+
+            case OPT_CSV:
+                m_opt.p_csv = optarg;
+                break;
+
+            case 'v':
+                m_opt.verbose = true;
+                break;
+
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if (m_opt.replace_dev > m_opt.devices || m_opt.replace_join_s >= m_opt.duration_s)
+    {
+        usage(argv[0]);
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    if (m_opt.p_flash_dir != NULL)
+    {
+        p_flash_dir = m_opt.p_flash_dir;
+    }
+    else
+    {
+        if (mkdtemp(tmp_dir) == NULL)
+        {
+            fatal("mkdtemp");
+        }
+        p_flash_dir = tmp_dir;
+    }
+
+    if (m_opt.p_csv != NULL)
+    {
+        mp_csv = fopen(m_opt.p_csv, "w");
+        if (mp_csv == NULL)
+        {
+            fatal(m_opt.p_csv);
+        }
+        fprintf(mp_csv, "scheme,frame,start_us");
+        for (uint32_t d = 1; d <= m_opt.devices; d++)
+        {
+            fprintf(mp_csv, ",dev%u", d);
+        }
+        fputc('\n', mp_csv);
+    }
+
+    printf("esb_sim: %u devices, %u s, seed %" PRIu64 ", flash in %s\n",
+           m_opt.devices, m_opt.duration_s, m_opt.seed, p_flash_dir);
+
+    for (uint32_t scheme = 1; scheme <= 2; scheme++)
+    {
+        if (m_opt.compare || scheme == m_opt.scheme)
+        {
+            run(scheme, p_flash_dir);
+            report(&m_stats);
+            for (uint32_t d = 0; d <= MAX_DEVICES; d++)
+            {
+                free(m_stats.devices[d].latency_us.p_items);
+                free(m_stats.devices[d].p_edges);
+            }
+            free(m_stats.acquire_us.p_items);
+            free(m_stats.resync_us.p_items);
+        }
+    }
+
+    if (mp_csv != NULL)
+    {
+        fclose(mp_csv);
+    }
+
+    if (m_opt.p_flash_dir == NULL)
+    {
+        char flash[PATH_MAX];
+
+        for (uint32_t scheme = 1; scheme <= 2; scheme++)
+        {
+            for (uint32_t i = 0; i <= MAX_DEVICES; i++)
+            {
+                snprintf(flash, sizeof(flash), "%s/node%u_s%u.flash", tmp_dir, i, scheme);
+                (void)unlink(flash);
+                snprintf(flash, sizeof(flash), "%s/node%u_s%u_new.flash", tmp_dir, i, scheme);
+                (void)unlink(flash);
+            }
+        }
+        (void)rmdir(tmp_dir);
+    }
+
+    return m_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,469 @@
+/* Copyright (c) 2016 Nordic Semiconductor. All Rights Reserved.
+ *
+ * The information contained herein is property of Nordic Semiconductor ASA.
+ * Terms and conditions of usage are described in detail in NORDIC
+ * SEMICONDUCTOR STANDARD SOFTWARE LICENSE AGREEMENT.
+ *
+ * Licensees are granted free, non-transferable use of the information. NO
+ * WARRANTY of ANY KIND is provided. This heading must NOT be removed from
+ * the file.
+ *
+ */
+
+/** @file
+ *
+ * @brief Host stress test of the ESB payload FIFO.
+ *
+ * @details A producer and a consumer thread pass payloads through one FIFO, in the same way
+ *          the radio interrupt and the application do. Every payload carries its sequence
+ *          number in all fields, so a lost, repeated, reordered or torn payload is detected by
+ *          the consumer.
+ *
+ *          By default the producer waits for room, and both sides move a varying number of
+ *          slots per position update, as the batch read and write functions do, without any
+ *          lock. With an overflow policy, the producer pushes one payload at a time and never
+ *          waits, as the radio interrupt does: @c newest drops the new payload, @c oldest
+ *          discards the oldest committed slot and fills it. The producer then holds a lock for
+ *          each push, and the consumer only for its release, in place of the disabled radio
+ *          interrupt. The consumer reads the slots in place or copies them meanwhile, so the
+ *          producer may overwrite a slot while it is read. A slot must only be reported as valid
+ *          if it was not discarded, and no slot may be released twice.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "nordic_common.h"
+#include "nrf_esb_fifo.h"
+
+#define DEFAULT_COUNT       5000000UL       /**< Number of payloads passed through the FIFO. */
+#define MAX_BATCH           6               /**< Largest number of slots moved per position update. */
+#define SEQ_LENGTH          4               /**< Bytes of the sequence number at the start of the data. */
+
+static nrf_esb_payload_t    m_slots[NRF_ESB_RX_FIFO_SIZE];
+static nrf_esb_fifo_t       m_fifo;
+static uint32_t             m_count = DEFAULT_COUNT;
+static bool                 m_overflow;         /**< Whether the producer applies m_policy instead of waiting. */
+static nrf_esb_rx_overflow_t m_policy;
+static pthread_mutex_t      m_irq_lock = PTHREAD_MUTEX_INITIALIZER;     /**< Stands for the radio interrupt being disabled. */
+static volatile bool        m_producer_done;
+static uint32_t             m_producer_full;    /**< Number of times the producer found the FIFO full. */
+static uint32_t             m_consumer_empty;   /**< Number of times the consumer found the FIFO empty. */
+static uint32_t             m_dropped;          /**< Payloads dropped or discarded by the producer. */
+static uint32_t             m_delivered;        /**< Payloads the consumer took as valid. */
+static uint32_t             m_discarded_read;   /**< Slots the producer discarded while the consumer read them. */
+
+
+static void payload_fill(nrf_esb_payload_t * p_payload, uint32_t seq)
+{
+    p_payload->length    = SEQ_LENGTH + seq % (NRF_ESB_MAX_PAYLOAD_LENGTH - SEQ_LENGTH + 1);
+    p_payload->pipe      = seq & 0x07;
+    p_payload->pid       = seq & 0x03;
+    p_payload->hop_index = (uint8_t)(seq >> 8);
+    p_payload->timestamp = (uint16_t)seq;
+
+    memcpy(p_payload->data, &seq, SEQ_LENGTH);
+    for (uint32_t i = SEQ_LENGTH; i < p_payload->length; i++)
+    {
+        p_payload->data[i] = (uint8_t)(seq + i);
+    }
+}
+
+
+static uint32_t payload_seq(nrf_esb_payload_t const * p_payload)
+{
+    uint32_t seq;
+
+    memcpy(&seq, p_payload->data, SEQ_LENGTH);
+
+    return seq;
+}
+
+
+static bool payload_check(nrf_esb_payload_t const * p_payload, uint32_t seq)
+{
+    nrf_esb_payload_t expected;
+
+    payload_fill(&expected, seq);
+
+    return p_payload->length    == expected.length    &&
+           p_payload->pipe      == expected.pipe      &&
+           p_payload->pid       == expected.pid       &&
+           p_payload->hop_index == expected.hop_index &&
+           p_payload->timestamp == expected.timestamp &&
+           memcmp(p_payload->data, expected.data, expected.length) == 0;
+}
+
+
+/**@brief Producer that waits for room, as the application does on the TX FIFO. */
+static void * producer(void * p_arg)
+{
+    (void)p_arg;
+
+    uint32_t seq = 0;
+    uint32_t batch;
+
+    while (seq < m_count)
+    {
+        while ((batch = nrf_esb_fifo_space(&m_fifo)) == 0)
+        {
+            m_producer_full++;
+            sched_yield();
+        }
+
+        batch = MIN(batch, 1 + seq % MAX_BATCH);
+        batch = MIN(batch, m_count - seq);
+
+        for (uint32_t i = 0; i < batch; i++)
+        {
+            payload_fill(nrf_esb_fifo_write_slot(&m_fifo, i), seq + i);
+        }
+        nrf_esb_fifo_commit(&m_fifo, batch);
+        seq += batch;
+    }
+
+    return NULL;
+}
+
+
+/**@brief Producer that never waits, as the radio interrupt does on the RX FIFO. */
+static void * producer_overflow(void * p_arg)
+{
+    (void)p_arg;
+
+    uint32_t burst = 0;
+    bool     push;
+
+    for (uint32_t seq = 0; seq < m_count; seq++)
+    {
+        pthread_mutex_lock(&m_irq_lock);
+
+        push = true;
+        if (nrf_esb_fifo_is_full(&m_fifo))
+        {
+            m_producer_full++;
+            m_dropped++;
+
+            if (m_policy == NRF_ESB_RX_OVERFLOW_DROP_OLDEST)
+            {
+                nrf_esb_fifo_discard_oldest(&m_fifo);
+            }
+            else
+            {
+                push = false;
+            }
+        }
+
+        if (push)
+        {
+            payload_fill(nrf_esb_fifo_write_slot(&m_fifo, 0), seq);
+            nrf_esb_fifo_commit(&m_fifo, 1);
+        }
+
+        pthread_mutex_unlock(&m_irq_lock);
+
+        // Hand over to the consumer after bursts of up to twice the FIFO size, so that the FIFO
+        // is sometimes full and sometimes not
+        if (burst == 0)
+        {
+            burst = 1 + (seq * 2654435761UL >> 16) % (2 * NRF_ESB_RX_FIFO_SIZE);
+            sched_yield();
+        }
+        burst--;
+    }
+
+    m_producer_done = true;
+
+    return NULL;
+}
+
+
+/**@brief Consumer of the waiting producer. Every payload must arrive, in order. */
+static void * consumer(void * p_arg)
+{
+    uint32_t seq = 0;
+    uint32_t length;
+
+    while (seq < m_count)
+    {
+        while ((length = nrf_esb_fifo_length(&m_fifo)) == 0)
+        {
+            m_consumer_empty++;
+            sched_yield();
+        }
+
+        if (length > NRF_ESB_RX_FIFO_SIZE)
+        {
+            fprintf(stderr, "payload %u: FIFO length %u\n", seq, length);
+            *(bool *)p_arg = false;
+            return NULL;
+        }
+
+        length = MIN(length, MAX_BATCH - seq % MAX_BATCH);
+
+        for (uint32_t i = 0; i < length; i++)
+        {
+            if (!payload_check(nrf_esb_fifo_read_slot(&m_fifo, i), seq + i))
+            {
+                fprintf(stderr, "payload %u: wrong contents\n", seq + i);
+                *(bool *)p_arg = false;
+                return NULL;
+            }
+        }
+
+        nrf_esb_fifo_release(&m_fifo, length);
+        seq += length;
+    }
+
+    m_delivered = seq;
+
+    return NULL;
+}
+
+
+/**@brief Function for releasing slots as rx_fifo_release of the driver does.
+ *
+ * @return  Number of the slots from @p pos that the producer discarded, or UINT32_MAX if the
+ *          release is inconsistent.
+ */
+static uint32_t consumer_release(uint32_t pos, uint32_t count)
+{
+    uint32_t before;
+    uint32_t discarded;
+
+    pthread_mutex_lock(&m_irq_lock);
+
+    before    = nrf_esb_fifo_read_pos(&m_fifo);
+    discarded = nrf_esb_fifo_release_from(&m_fifo, pos, count);
+
+    // The position only moves past the slots read, and never back over a discarded one
+    if (discarded != before - pos ||
+        nrf_esb_fifo_read_pos(&m_fifo) != MAX(before, pos + count) ||
+        (m_policy != NRF_ESB_RX_OVERFLOW_DROP_OLDEST && discarded != 0))
+    {
+        discarded = UINT32_MAX;
+    }
+
+    pthread_mutex_unlock(&m_irq_lock);
+
+    return discarded;
+}
+
+
+/**@brief Function for taking one payload as valid. Sequence numbers must only increase. */
+static bool consumer_deliver(nrf_esb_payload_t const * p_payload, uint32_t * p_last_seq)
+{
+    uint32_t seq = payload_seq(p_payload);
+
+    if (!payload_check(p_payload, seq))
+    {
+        fprintf(stderr, "payload %u: torn slot reported as valid\n", seq);
+        return false;
+    }
+
+    if (m_delivered > 0 && seq <= *p_last_seq)
+    {
+        fprintf(stderr, "payload %u: after payload %u\n", seq, *p_last_seq);
+        return false;
+    }
+
+    *p_last_seq = seq;
+    m_delivered++;
+
+    return true;
+}
+
+
+/**@brief Function for letting the producer run in the middle of a read, now and then. On a single
+ *        CPU, the producer would otherwise hardly ever run while the consumer reads.
+ */
+static void consumer_preempt(uint32_t round)
+{
+    if (round % 3 == 0)
+    {
+        sched_yield();
+    }
+}
+
+
+/**@brief Consumer of the producer that never waits. Alternates between copying a batch, as
+ *        nrf_esb_read_rx_payloads does, and reading one slot in place, as
+ *        nrf_esb_borrow_rx_payload does.
+ */
+static void * consumer_overflow(void * p_arg)
+{
+    nrf_esb_payload_t copies[MAX_BATCH];
+    uint32_t          last_seq = 0;
+    uint32_t          round    = 0;
+    uint32_t          pos;
+    uint32_t          length;
+    uint32_t          discarded;
+    bool              done;
+
+    for (;; round++)
+    {
+        done   = m_producer_done;
+        length = nrf_esb_fifo_length(&m_fifo);
+
+        if (length == 0)
+        {
+            if (done)
+            {
+                break;
+            }
+            m_consumer_empty++;
+            sched_yield();
+            continue;
+        }
+
+        if (length > NRF_ESB_RX_FIFO_SIZE)
+        {
+            fprintf(stderr, "FIFO length %u\n", length);
+            *(bool *)p_arg = false;
+            return NULL;
+        }
+
+        pos = nrf_esb_fifo_read_pos(&m_fifo);
+
+        if (round % 2 == 0)
+        {
+            nrf_esb_payload_t const * p_slot = nrf_esb_fifo_slot_at(&m_fifo, pos);
+            nrf_esb_payload_t         copy;
+
+            // Let the producer in while the slot is held, as the radio interrupt may be
+            consumer_preempt(round);
+            copy = *p_slot;
+
+            // The slot is only valid if the producer did not discard it before the release
+            discarded = consumer_release(pos, 1);
+            if (discarded == UINT32_MAX)
+            {
+                fprintf(stderr, "release of slot %u inconsistent\n", pos);
+                *(bool *)p_arg = false;
+                return NULL;
+            }
+            if (discarded > 0)
+            {
+                m_discarded_read++;
+                continue;
+            }
+            if (!consumer_deliver(&copy, &last_seq))
+            {
+                *(bool *)p_arg = false;
+                return NULL;
+            }
+            continue;
+        }
+
+        length = MIN(length, 1 + round % MAX_BATCH);
+        for (uint32_t i = 0; i < length; i++)
+        {
+            copies[i] = *nrf_esb_fifo_slot_at(&m_fifo, pos + i);
+            consumer_preempt(round + i);
+        }
+
+        discarded = consumer_release(pos, length);
+        if (discarded == UINT32_MAX)
+        {
+            fprintf(stderr, "release of slots %u to %u inconsistent\n", pos, pos + length - 1);
+            *(bool *)p_arg = false;
+            return NULL;
+        }
+
+        m_discarded_read += MIN(discarded, length);
+        for (uint32_t i = discarded; i < length; i++)
+        {
+            if (!consumer_deliver(&copies[i], &last_seq))
+            {
+                *(bool *)p_arg = false;
+                return NULL;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+
+int main(int argc, char ** argv)
+{
+    pthread_t producer_thread;
+    pthread_t consumer_thread;
+    bool      ok = true;
+
+    if (argc > 1)
+    {
+        m_count = strtoul(argv[1], NULL, 0);
+    }
+
+    if (argc > 2)
+    {
+        m_overflow = true;
+        if (strcmp(argv[2], "newest") == 0)
+        {
+            m_policy = NRF_ESB_RX_OVERFLOW_DROP_NEWEST;
+        }
+        else if (strcmp(argv[2], "oldest") == 0)
+        {
+            m_policy = NRF_ESB_RX_OVERFLOW_DROP_OLDEST;
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s [count [newest|oldest]]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    nrf_esb_fifo_init(&m_fifo, m_slots, NRF_ESB_RX_FIFO_SIZE);
+
+    if (pthread_create(&consumer_thread, NULL, m_overflow ? consumer_overflow : consumer, &ok) != 0 ||
+        pthread_create(&producer_thread, NULL, m_overflow ? producer_overflow : producer, NULL) != 0)
+    {
+        perror("pthread_create");
+        return EXIT_FAILURE;
+    }
+
+    // A failing consumer stops early and would leave the waiting producer on a full FIFO
+    pthread_join(consumer_thread, NULL);
+    if (!ok)
+    {
+        return EXIT_FAILURE;
+    }
+    pthread_join(producer_thread, NULL);
+
+    if (nrf_esb_fifo_length(&m_fifo) != 0)
+    {
+        fprintf(stderr, "FIFO not empty at the end\n");
+        return EXIT_FAILURE;
+    }
+
+    // A slot released twice would take a payload with it that was neither delivered nor dropped
+    if (m_delivered + m_dropped != m_count)
+    {
+        fprintf(stderr, "%u payloads delivered and %u dropped, of %u\n", m_delivered, m_dropped, m_count);
+        return EXIT_FAILURE;
+    }
+
+    if (m_overflow && m_policy == NRF_ESB_RX_OVERFLOW_DROP_OLDEST && m_discarded_read == 0)
+    {
+        fprintf(stderr, "no slot was discarded while read\n");
+        return EXIT_FAILURE;
+    }
+
+    if (!m_overflow)
+    {
+        printf("fifo_stress: %u payloads passed, producer saw full %u times, consumer saw empty %u times\n",
+               m_count, m_producer_full, m_consumer_empty);
+    }
+    else
+    {
+        printf("fifo_stress %s: %u payloads, %u delivered, %u dropped, %u discarded while read\n",
+               argv[2], m_count, m_delivered, m_dropped, m_discarded_read);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,31 @@
+/* Copyright (c) 2016 Nordic Semiconductor. All Rights Reserved.
+ *
+ * The information contained herein is property of Nordic Semiconductor ASA.
+ * Terms and conditions of usage are described in detail in NORDIC
+ * SEMICONDUCTOR STANDARD SOFTWARE LICENSE AGREEMENT.
+ *
+ * Licensees are granted free, non-transferable use of the information. NO
+ * WARRANTY of ANY KIND is provided. This heading must NOT be removed from
+ * the file.
+ *
+ */
+
+/** @file
+ *
+ * @brief Host wrapper of the SDK scheduler header.
+ *
+ * @details The firmware images built for the simulator include this file before
+ *          components/libraries/scheduler/app_scheduler.h, which it includes in turn. The SDK sizes
+ *          the event header for 32-bit pointers. On the 64-bit host it holds two pointers of 8 bytes,
+ *          so the scheduler buffer is sized for that here, and the SDK header stays as shipped.
+ */
+
+#ifndef SIM_APP_SCHEDULER_H__
+#define SIM_APP_SCHEDULER_H__
+
+#include_next "app_scheduler.h"
+
+#undef  APP_SCHED_EVENT_HEADER_SIZE
+#define APP_SCHED_EVENT_HEADER_SIZE (2 * sizeof(void *))    /**< Size of app_scheduler.event_header_t on the host. */
+
+#endif // SIM_APP_SCHEDULER_H__
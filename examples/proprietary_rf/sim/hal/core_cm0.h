@@ -0,0 +1,175 @@
+/* Copyright (c) 2016 Nordic Semiconductor. All Rights Reserved.
+ *
+ * The information contained herein is property of Nordic Semiconductor ASA.
+ * Terms and conditions of usage are described in detail in NORDIC
+ * SEMICONDUCTOR STANDARD SOFTWARE LICENSE AGREEMENT.
+ *
+ * Licensees are granted free, non-transferable use of the information. NO
+ * WARRANTY of ANY KIND is provided. This heading must NOT be removed from
+ * the file.
+ *
+ */
+
+/** @file
+ *
+ * @brief Host replacement for the CMSIS Cortex-M0 core header.
+ *
+ * @details The firmware images built for the simulator include this file instead of
+ *          components/toolchain/cmsis/include/core_cm0.h. Core intrinsics, the NVIC and the
+ *          sleep instructions are routed to the simulated CPU in sim_node.c, so that interrupt
+ *          priorities, PRIMASK and WFE behave as on the nRF51.
+ */
+
+#ifndef SIM_CORE_CM0_H__
+#define SIM_CORE_CM0_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define __CM0_CMSIS_VERSION_MAIN  (0x04U)
+#define __CM0_CMSIS_VERSION_SUB   (0x1EU)
+#define __CM0_CMSIS_VERSION       ((__CM0_CMSIS_VERSION_MAIN << 16U) | __CM0_CMSIS_VERSION_SUB)
+
+#define __CORTEX_M                (0x00U)
+#define __FPU_USED                0U
+
+#define __ASM            __asm
+#define __INLINE         inline
+#define __STATIC_INLINE  static inline
+
+#define   __I     volatile const
+#define   __O     volatile
+#define   __IO    volatile
+#define   __IM    volatile const
+#define   __OM    volatile
+#define   __IOM   volatile
+
+#define IPSR_ISR_Pos                        0U
+#define IPSR_ISR_Msk                       (0x1FFUL /*<< IPSR_ISR_Pos*/)
+
+#define CONTROL_nPRIV_Pos                   0U
+#define CONTROL_nPRIV_Msk                  (1UL /*<< CONTROL_nPRIV_Pos*/)
+
+
+/** @brief System Control Block (SCB). Only the registers used by the SDK are meaningful. */
+typedef struct
+{
+  __IM  uint32_t CPUID;
+  __IOM uint32_t ICSR;
+        uint32_t RESERVED0;
+  __IOM uint32_t AIRCR;
+  __IOM uint32_t SCR;
+  __IOM uint32_t CCR;
+        uint32_t RESERVED1;
+  __IOM uint32_t SHP[2U];
+  __IOM uint32_t SHCSR;
+} SCB_Type;
+
+#define SCB_SCR_SEVONPEND_Pos               4U
+#define SCB_SCR_SEVONPEND_Msk              (1UL << SCB_SCR_SEVONPEND_Pos)
+
+#define SCB_SCR_SLEEPDEEP_Pos               2U
+#define SCB_SCR_SLEEPDEEP_Msk              (1UL << SCB_SCR_SLEEPDEEP_Pos)
+
+#define SCB_SCR_SLEEPONEXIT_Pos             1U
+#define SCB_SCR_SLEEPONEXIT_Msk            (1UL << SCB_SCR_SLEEPONEXIT_Pos)
+
+#define SCS_BASE            (0xE000E000UL)
+#define SCB_BASE            (SCS_BASE +  0x0D00UL)
+
+#define SCB                 ((SCB_Type *) sim_periph_access(SCB_BASE))
+
+
+/* Simulated CPU, implemented in sim_node.c. */
+void *   sim_periph_access(uint32_t base_address);
+void     sim_cpu_irq_enable(void);
+void     sim_cpu_irq_disable(void);
+uint32_t sim_cpu_primask_get(void);
+uint32_t sim_cpu_ipsr_get(void);
+void     sim_cpu_wfe(void);
+void     sim_cpu_sev(void);
+void     sim_cpu_system_reset(void);
+void     sim_nvic_enable(int32_t irqn);
+void     sim_nvic_disable(int32_t irqn);
+uint32_t sim_nvic_pending_get(int32_t irqn);
+void     sim_nvic_pending_set(int32_t irqn);
+void     sim_nvic_pending_clear(int32_t irqn);
+void     sim_nvic_priority_set(int32_t irqn, uint32_t priority);
+uint32_t sim_nvic_priority_get(int32_t irqn);
+
+
+__STATIC_INLINE void __enable_irq(void)                 { sim_cpu_irq_enable(); }
+__STATIC_INLINE void __disable_irq(void)                { sim_cpu_irq_disable(); }
+__STATIC_INLINE uint32_t __get_PRIMASK(void)            { return sim_cpu_primask_get(); }
+__STATIC_INLINE uint32_t __get_IPSR(void)               { return sim_cpu_ipsr_get(); }
+__STATIC_INLINE uint32_t __get_CONTROL(void)            { return 0; }
+
+__STATIC_INLINE void __set_PRIMASK(uint32_t primask)
+{
+    if (primask & 1)
+    {
+        sim_cpu_irq_disable();
+    }
+    else
+    {
+        sim_cpu_irq_enable();
+    }
+}
+
+__STATIC_INLINE void __NOP(void)                        { }
+__STATIC_INLINE void __WFI(void)                        { sim_cpu_wfe(); }
+__STATIC_INLINE void __WFE(void)                        { sim_cpu_wfe(); }
+__STATIC_INLINE void __SEV(void)                        { sim_cpu_sev(); }
+__STATIC_INLINE void __ISB(void)                        { }
+__STATIC_INLINE void __DSB(void)                        { __asm volatile ("" ::: "memory"); }
+__STATIC_INLINE void __DMB(void)                        { __asm volatile ("" ::: "memory"); }
+
+__STATIC_INLINE uint32_t __REV(uint32_t value)          { return __builtin_bswap32(value); }
+
+__STATIC_INLINE uint32_t __REV16(uint32_t value)
+{
+    return ((value & 0xFF00FF00UL) >> 8) | ((value & 0x00FF00FFUL) << 8);
+}
+
+__STATIC_INLINE int32_t __REVSH(int32_t value)
+{
+    return (int16_t)(((value & 0xFF00) >> 8) | ((value & 0x00FF) << 8));
+}
+
+__STATIC_INLINE uint32_t __ROR(uint32_t op1, uint32_t op2)
+{
+    return (op1 >> (op2 & 31)) | (op1 << ((32 - op2) & 31));
+}
+
+#define __BKPT(value)                                   __builtin_trap()
+
+
+__STATIC_INLINE void NVIC_EnableIRQ(IRQn_Type IRQn)         { sim_nvic_enable(IRQn); }
+__STATIC_INLINE void NVIC_DisableIRQ(IRQn_Type IRQn)        { sim_nvic_disable(IRQn); }
+__STATIC_INLINE uint32_t NVIC_GetPendingIRQ(IRQn_Type IRQn) { return sim_nvic_pending_get(IRQn); }
+__STATIC_INLINE void NVIC_SetPendingIRQ(IRQn_Type IRQn)     { sim_nvic_pending_set(IRQn); }
+__STATIC_INLINE void NVIC_ClearPendingIRQ(IRQn_Type IRQn)   { sim_nvic_pending_clear(IRQn); }
+
+__STATIC_INLINE void NVIC_SetPriority(IRQn_Type IRQn, uint32_t priority)
+{
+    sim_nvic_priority_set(IRQn, priority);
+}
+
+__STATIC_INLINE uint32_t NVIC_GetPriority(IRQn_Type IRQn)
+{
+    return sim_nvic_priority_get(IRQn);
+}
+
+__STATIC_INLINE void NVIC_SystemReset(void)
+{
+    sim_cpu_system_reset();
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SIM_CORE_CM0_H__
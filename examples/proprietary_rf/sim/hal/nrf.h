@@ -0,0 +1,116 @@
+/* Copyright (c) 2016 Nordic Semiconductor. All Rights Reserved.
+ *
+ * The information contained herein is property of Nordic Semiconductor ASA.
+ * Terms and conditions of usage are described in detail in NORDIC
+ * SEMICONDUCTOR STANDARD SOFTWARE LICENSE AGREEMENT.
+ *
+ * Licensees are granted free, non-transferable use of the information. NO
+ * WARRANTY of ANY KIND is provided. This heading must NOT be removed from
+ * the file.
+ *
+ */
+
+/** @file
+ *
+ * @brief Host replacement for components/device/nrf.h.
+ *
+ * @details The nRF51 device headers are used unchanged, but every peripheral instance macro is
+ *          redirected through @ref sim_periph_access. The simulated peripherals live at their
+ *          real addresses, so the pointer returned is the one the firmware would have used; the
+ *          call gives the simulator a point at which it can apply earlier register writes,
+ *          advance the node clock and take interrupts.
+ */
+
+#ifndef NRF_H
+#define NRF_H
+
+/* MDK version */
+#define MDK_MAJOR_VERSION   8
+#define MDK_MINOR_VERSION   7
+#define MDK_MICRO_VERSION   1
+
+#if !defined(NRF51)
+    #error "The simulator only models the nRF51 family."
+#endif
+
+#include "nrf51.h"
+#include "nrf51_bitfields.h"
+#include "nrf51_deprecated.h"
+#include "compiler_abstraction.h"
+
+#define SIM_PERIPH(type, base)          ((type *) sim_periph_access(base))
+
+#undef  NRF_POWER
+#undef  NRF_CLOCK
+#undef  NRF_MPU
+#undef  NRF_RADIO
+#undef  NRF_UART0
+#undef  NRF_SPI0
+#undef  NRF_TWI0
+#undef  NRF_SPI1
+#undef  NRF_TWI1
+#undef  NRF_SPIS1
+#undef  NRF_GPIOTE
+#undef  NRF_ADC
+#undef  NRF_TIMER0
+#undef  NRF_TIMER1
+#undef  NRF_TIMER2
+#undef  NRF_RTC0
+#undef  NRF_TEMP
+#undef  NRF_RNG
+#undef  NRF_ECB
+#undef  NRF_AAR
+#undef  NRF_CCM
+#undef  NRF_WDT
+#undef  NRF_RTC1
+#undef  NRF_QDEC
+#undef  NRF_LPCOMP
+#undef  NRF_SWI
+#undef  NRF_NVMC
+#undef  NRF_PPI
+#undef  NRF_FICR
+#undef  NRF_UICR
+#undef  NRF_GPIO
+
+#define NRF_POWER                       SIM_PERIPH(NRF_POWER_Type,  NRF_POWER_BASE)
+#define NRF_CLOCK                       SIM_PERIPH(NRF_CLOCK_Type,  NRF_CLOCK_BASE)
+#define NRF_MPU                         SIM_PERIPH(NRF_MPU_Type,    NRF_MPU_BASE)
+#define NRF_RADIO                       SIM_PERIPH(NRF_RADIO_Type,  NRF_RADIO_BASE)
+#define NRF_UART0                       SIM_PERIPH(NRF_UART_Type,   NRF_UART0_BASE)
+#define NRF_SPI0                        SIM_PERIPH(NRF_SPI_Type,    NRF_SPI0_BASE)
+#define NRF_TWI0                        SIM_PERIPH(NRF_TWI_Type,    NRF_TWI0_BASE)
+#define NRF_SPI1                        SIM_PERIPH(NRF_SPI_Type,    NRF_SPI1_BASE)
+#define NRF_TWI1                        SIM_PERIPH(NRF_TWI_Type,    NRF_TWI1_BASE)
+#define NRF_SPIS1                       SIM_PERIPH(NRF_SPIS_Type,   NRF_SPIS1_BASE)
+#define NRF_GPIOTE                      SIM_PERIPH(NRF_GPIOTE_Type, NRF_GPIOTE_BASE)
+#define NRF_ADC                         SIM_PERIPH(NRF_ADC_Type,    NRF_ADC_BASE)
+#define NRF_TIMER0                      SIM_PERIPH(NRF_TIMER_Type,  NRF_TIMER0_BASE)
+#define NRF_TIMER1                      SIM_PERIPH(NRF_TIMER_Type,  NRF_TIMER1_BASE)
+#define NRF_TIMER2                      SIM_PERIPH(NRF_TIMER_Type,  NRF_TIMER2_BASE)
+#define NRF_RTC0                        SIM_PERIPH(NRF_RTC_Type,    NRF_RTC0_BASE)
+#define NRF_TEMP                        SIM_PERIPH(NRF_TEMP_Type,   NRF_TEMP_BASE)
+#define NRF_RNG                         SIM_PERIPH(NRF_RNG_Type,    NRF_RNG_BASE)
+#define NRF_ECB                         SIM_PERIPH(NRF_ECB_Type,    NRF_ECB_BASE)
+#define NRF_AAR                         SIM_PERIPH(NRF_AAR_Type,    NRF_AAR_BASE)
+#define NRF_CCM                         SIM_PERIPH(NRF_CCM_Type,    NRF_CCM_BASE)
+#define NRF_WDT                         SIM_PERIPH(NRF_WDT_Type,    NRF_WDT_BASE)
+#define NRF_RTC1                        SIM_PERIPH(NRF_RTC_Type,    NRF_RTC1_BASE)
+#define NRF_QDEC                        SIM_PERIPH(NRF_QDEC_Type,   NRF_QDEC_BASE)
+#define NRF_LPCOMP                      SIM_PERIPH(NRF_LPCOMP_Type, NRF_LPCOMP_BASE)
+#define NRF_SWI                         SIM_PERIPH(NRF_SWI_Type,    NRF_SWI_BASE)
+#define NRF_NVMC                        SIM_PERIPH(NRF_NVMC_Type,   NRF_NVMC_BASE)
+#define NRF_PPI                         SIM_PERIPH(NRF_PPI_Type,    NRF_PPI_BASE)
+#define NRF_FICR                        SIM_PERIPH(NRF_FICR_Type,   NRF_FICR_BASE)
+#define NRF_UICR                        SIM_PERIPH(NRF_UICR_Type,   NRF_UICR_BASE)
+#define NRF_GPIO                        SIM_PERIPH(NRF_GPIO_Type,   NRF_GPIO_BASE)
+
+/* Busy-wait delays advance the simulated clock instead of spinning, see nrf_delay.h. */
+void sim_cpu_delay_us(uint32_t number_of_us);
+
+#define CUSTOM_NRF_DELAY_US
+static inline void nrf_delay_us(uint32_t number_of_us)
+{
+    sim_cpu_delay_us(number_of_us);
+}
+
+#endif /* NRF_H */
@@ -0,0 +1,763 @@
+/* Copyright (c) 2016 Nordic Semiconductor. All Rights Reserved.
+ *
+ * The information contained herein is property of Nordic Semiconductor ASA.
+ * Terms and conditions of usage are described in detail in NORDIC
+ * SEMICONDUCTOR STANDARD SOFTWARE LICENSE AGREEMENT.
+ *
+ * Licensees are granted free, non-transferable use of the information. NO
+ * WARRANTY of ANY KIND is provided. This heading must NOT be removed from
+ * the file.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "sim_node.h"
+
+#define SIM_MAX_PERIPHS             16
+#define SIM_THREAD_PRIORITY         4           /**< Execution priority of thread mode. */
+
+#define SIM_ACCESS_COST             4           /**< Cost of a register access, in 16 MHz cycles. */
+#define SIM_IRQ_ENTRY_COST          16          /**< Interrupt latency of the Cortex-M0. */
+
+#define SIM_IRQ_COUNT               26
+
+typedef void (*sim_irq_handler_t)(void);
+
+/* Memory regions of the nRF51 that the firmware addresses directly. */
+typedef struct
+{
+    uint32_t address;
+    uint32_t size;
+} sim_region_t;
+
+static const sim_region_t m_regions[] =
+{
+    {0x10000000, 0x2000},       // FICR, UICR
+    {0x40000000, 0x20000},      // APB peripherals
+    {0x50000000, 0x1000},       // GPIO
+    {0xE000E000, 0x1000},       // System control space
+};
+
+extern char __data_start[];
+extern char _end[];
+
+sim_node_t                  m_sim_node;
+
+static char              ** mp_argv;
+static sim_periph_t       * mp_periphs[SIM_MAX_PERIPHS];
+static uint32_t             m_periph_count;
+static uint32_t             m_dirty_mask;
+
+static uint32_t             m_nvic_enabled;
+static uint32_t             m_nvic_pending;
+static uint8_t              m_nvic_priority[32];
+static uint32_t             m_primask;
+static uint32_t             m_ipsr;
+static uint32_t             m_exec_priority = SIM_THREAD_PRIORITY;
+static bool                 m_event_register;
+
+
+/* Default handlers. The firmware overrides the ones it uses. */
+static void default_irq_handler(void)
+{
+    fprintf(stderr, "node %u: unhandled interrupt %u\n",
+            m_sim_node.config.node_id, m_ipsr - 16);
+    exit(EXIT_FAILURE);
+}
+
+#define SIM_WEAK_HANDLER(name) void name(void) __attribute__((weak, alias("default_irq_handler")))
+
+SIM_WEAK_HANDLER(POWER_CLOCK_IRQHandler);
+SIM_WEAK_HANDLER(RADIO_IRQHandler);
+SIM_WEAK_HANDLER(UART0_IRQHandler);
+SIM_WEAK_HANDLER(SPI0_TWI0_IRQHandler);
+SIM_WEAK_HANDLER(SPI1_TWI1_IRQHandler);
+SIM_WEAK_HANDLER(GPIOTE_IRQHandler);
+SIM_WEAK_HANDLER(ADC_IRQHandler);
+SIM_WEAK_HANDLER(TIMER0_IRQHandler);
+SIM_WEAK_HANDLER(TIMER1_IRQHandler);
+SIM_WEAK_HANDLER(TIMER2_IRQHandler);
+SIM_WEAK_HANDLER(RTC0_IRQHandler);
+SIM_WEAK_HANDLER(TEMP_IRQHandler);
+SIM_WEAK_HANDLER(RNG_IRQHandler);
+SIM_WEAK_HANDLER(ECB_IRQHandler);
+SIM_WEAK_HANDLER(CCM_AAR_IRQHandler);
+SIM_WEAK_HANDLER(WDT_IRQHandler);
+SIM_WEAK_HANDLER(RTC1_IRQHandler);
+SIM_WEAK_HANDLER(QDEC_IRQHandler);
+SIM_WEAK_HANDLER(LPCOMP_IRQHandler);
+SIM_WEAK_HANDLER(SWI0_IRQHandler);
+SIM_WEAK_HANDLER(SWI1_IRQHandler);
+SIM_WEAK_HANDLER(SWI2_IRQHandler);
+SIM_WEAK_HANDLER(SWI3_IRQHandler);
+SIM_WEAK_HANDLER(SWI4_IRQHandler);
+SIM_WEAK_HANDLER(SWI5_IRQHandler);
+
+static const sim_irq_handler_t m_irq_handlers[SIM_IRQ_COUNT] =
+{
+    POWER_CLOCK_IRQHandler, RADIO_IRQHandler,     UART0_IRQHandler,  SPI0_TWI0_IRQHandler,
+    SPI1_TWI1_IRQHandler,   default_irq_handler,  GPIOTE_IRQHandler, ADC_IRQHandler,
+    TIMER0_IRQHandler,      TIMER1_IRQHandler,    TIMER2_IRQHandler, RTC0_IRQHandler,
+    TEMP_IRQHandler,        RNG_IRQHandler,       ECB_IRQHandler,    CCM_AAR_IRQHandler,
+    WDT_IRQHandler,         RTC1_IRQHandler,      QDEC_IRQHandler,   LPCOMP_IRQHandler,
+    SWI0_IRQHandler,        SWI1_IRQHandler,      SWI2_IRQHandler,   SWI3_IRQHandler,
+    SWI4_IRQHandler,        SWI5_IRQHandler,
+};
+
+/* Firmware entry point; main() of the application is renamed at compile time. */
+int sim_fw_main(void);
+
+
+static void fatal(char const * p_what)
+{
+    fprintf(stderr, "node %u: %s: %s\n", m_sim_node.config.node_id, p_what, strerror(errno));
+    exit(EXIT_FAILURE);
+}
+
+
+/**@brief Kernel link. */
+
+static void kernel_read(void * p_buf, size_t length)
+{
+    uint8_t * p = p_buf;
+
+    while (length > 0)
+    {
+        ssize_t n = read(SIM_NODE_FD, p, length);
+        if (n <= 0)
+        {
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            // The kernel went away; nothing left to simulate.
+            exit(EXIT_SUCCESS);
+        }
+        p      += n;
+        length -= n;
+    }
+}
+
+
+void sim_kernel_send(sim_msg_type_t type, void const * p_body, uint32_t length)
+{
+    uint8_t       buf[sizeof(sim_msg_hdr_t) + sizeof(sim_msg_tx_t)];
+    sim_msg_hdr_t hdr = {.type = type, .length = length};
+    size_t        total = sizeof(hdr) + length;
+    uint8_t     * p = buf;
+
+    memcpy(buf, &hdr, sizeof(hdr));
+    memcpy(buf + sizeof(hdr), p_body, length);
+
+    while (total > 0)
+    {
+        ssize_t n = write(SIM_NODE_FD, p, total);
+        if (n <= 0)
+        {
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            exit(EXIT_SUCCESS);
+        }
+        p     += n;
+        total -= n;
+    }
+}
+
+
+/**@brief Wait for the kernel to grant a new horizon, handling everything it sends meanwhile. */
+static void kernel_wait_run(void)
+{
+    for (;;)
+    {
+        sim_msg_hdr_t hdr;
+        union
+        {
+            sim_msg_config_t config;
+            sim_msg_run_t    run;
+            sim_msg_tx_t     tx;
+        } body;
+
+        kernel_read(&hdr, sizeof(hdr));
+        if (hdr.length > sizeof(body))
+        {
+            fprintf(stderr, "node: bad message length %u\n", hdr.length);
+            exit(EXIT_FAILURE);
+        }
+        kernel_read(&body, hdr.length);
+
+        switch (hdr.type)
+        {
+            case SIM_MSG_CONFIG:
+                m_sim_node.config    = body.config;
+                m_sim_node.now       = body.config.boot_time;
+                m_sim_node.rng_state = body.config.seed ^ (0x9E3779B97F4A7C15ULL * (body.config.node_id + 1));
+                break;
+
+            case SIM_MSG_RUN:
+                m_sim_node.horizon = body.run.horizon;
+                return;
+
+            case SIM_MSG_TX:
+                sim_radio_tx_notice(&body.tx);
+                break;
+
+            case SIM_MSG_END:
+                exit(EXIT_SUCCESS);
+
+            default:
+                fprintf(stderr, "node: unexpected message %u\n", hdr.type);
+                exit(EXIT_FAILURE);
+        }
+    }
+}
+
+
+static void kernel_yield(sim_time_t wake)
+{
+    sim_msg_yield_t yield = {.now = m_sim_node.now, .wake = wake};
+
+    sim_kernel_send(SIM_MSG_YIELD, &yield, sizeof(yield));
+    kernel_wait_run();
+}
+
+
+uint32_t sim_random(void)
+{
+    // xorshift64*
+    uint64_t x = m_sim_node.rng_state;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    m_sim_node.rng_state = x;
+
+    return (uint32_t)((x * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+
+void sim_trace(char const * p_format, ...)
+{
+    va_list args;
+
+    fprintf(stderr, "%12.3f us node %u: ", (double)m_sim_node.now / SIM_TICKS_PER_US, m_sim_node.config.node_id);
+    va_start(args, p_format);
+    vfprintf(stderr, p_format, args);
+    va_end(args);
+    fputc('\n', stderr);
+}
+
+
+bool sim_ram_valid(uint32_t address, uint32_t length)
+{
+    uintptr_t start = (uintptr_t)__data_start;
+    uintptr_t end   = (uintptr_t)_end;
+
+    return address >= start && (uintptr_t)address + length <= end;
+}
+
+
+/**@brief Peripheral bookkeeping. */
+
+void sim_periph_register(sim_periph_t * p_periph)
+{
+    if (m_periph_count < SIM_MAX_PERIPHS)
+    {
+        mp_periphs[m_periph_count++] = p_periph;
+    }
+}
+
+
+static int32_t periph_index(uint32_t address)
+{
+    uint32_t base = address & ~(SIM_PERIPH_SIZE - 1);
+
+    for (uint32_t i = 0; i < m_periph_count; i++)
+    {
+        if (mp_periphs[i]->base == base)
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+
+sim_periph_t * sim_periph_find(uint32_t address)
+{
+    int32_t i = periph_index(address);
+
+    return i < 0 ? NULL : mp_periphs[i];
+}
+
+
+void sim_irq_update(sim_periph_t * p_periph)
+{
+    if (p_periph->irqn < 0 || !p_periph->has_inten)
+    {
+        return;
+    }
+
+    for (uint32_t bit = 0; bit < 32; bit++)
+    {
+        if ((p_periph->inten & (1UL << bit)) &&
+            SIM_REG(p_periph->base, SIM_EVENTS_OFFSET + 4 * bit) != 0)
+        {
+            m_nvic_pending |= 1UL << p_periph->irqn;
+            return;
+        }
+    }
+}
+
+
+void sim_event_generate(sim_periph_t * p_periph, uint32_t offset, sim_time_t t)
+{
+    SIM_REG(p_periph->base, offset) = 1;
+    sim_ppi_event(p_periph->base + offset, t);
+    sim_irq_update(p_periph);
+}
+
+
+void sim_task_trigger(uint32_t address, sim_time_t t)
+{
+    sim_periph_t * p_periph = sim_periph_find(address);
+
+    if (p_periph != NULL && p_periph->task != NULL)
+    {
+        p_periph->task(address - p_periph->base, t);
+    }
+}
+
+
+/**@brief Apply the register writes done since the previous call into the runtime. */
+static void flush_writes(void)
+{
+    while (m_dirty_mask != 0)
+    {
+        uint32_t       i        = __builtin_ctz(m_dirty_mask);
+        sim_periph_t * p_periph = mp_periphs[i];
+
+        m_dirty_mask &= ~(1UL << i);
+
+        if (p_periph->task != NULL)
+        {
+            for (uint32_t offset = 0; offset < SIM_EVENTS_OFFSET; offset += 4)
+            {
+                if (SIM_REG(p_periph->base, offset) != 0)
+                {
+                    SIM_REG(p_periph->base, offset) = 0;
+                    p_periph->task(offset, m_sim_node.now);
+                }
+            }
+        }
+
+        if (p_periph->has_inten)
+        {
+            // Both registers are restored so that rewriting the current value is a no-op:
+            // INTENSET reads back the enabled set, INTENCLR its complement.
+            uint32_t set   = SIM_REG(p_periph->base, SIM_INTENSET_OFFSET);
+            uint32_t clr   = SIM_REG(p_periph->base, SIM_INTENCLR_OFFSET);
+            uint32_t inten = p_periph->inten;
+
+            if (set != inten)
+            {
+                p_periph->inten |= set;
+            }
+            if (clr != ~inten)
+            {
+                p_periph->inten &= ~clr;
+            }
+            SIM_REG(p_periph->base, SIM_INTENSET_OFFSET) = p_periph->inten;
+            SIM_REG(p_periph->base, SIM_INTENCLR_OFFSET) = ~p_periph->inten;
+        }
+
+        if (p_periph->written != NULL)
+        {
+            p_periph->written(m_sim_node.now);
+        }
+
+        sim_irq_update(p_periph);
+    }
+}
+
+
+/**@brief Time of the earliest pending peripheral event. */
+static sim_time_t next_event(sim_periph_t ** pp_periph)
+{
+    sim_time_t next = SIM_TIME_NEVER;
+
+    *pp_periph = NULL;
+    for (uint32_t i = 0; i < m_periph_count; i++)
+    {
+        if (mp_periphs[i]->next_event != NULL)
+        {
+            sim_time_t t = mp_periphs[i]->next_event();
+            if (t < next)
+            {
+                next       = t;
+                *pp_periph = mp_periphs[i];
+            }
+        }
+    }
+
+    return next;
+}
+
+
+/**@brief Highest priority interrupt that is pending and enabled, or -1. */
+static int32_t pending_irq(void)
+{
+    uint32_t active = m_nvic_pending & m_nvic_enabled;
+    int32_t  best   = -1;
+
+    while (active != 0)
+    {
+        int32_t irqn = __builtin_ctz(active);
+
+        active &= active - 1;
+        if (best < 0 || m_nvic_priority[irqn] < m_nvic_priority[best])
+        {
+            best = irqn;
+        }
+    }
+
+    return best;
+}
+
+
+static void take_interrupts(void)
+{
+    for (;;)
+    {
+        int32_t irqn = pending_irq();
+
+        if (irqn < 0 || m_primask != 0 || m_nvic_priority[irqn] >= m_exec_priority)
+        {
+            return;
+        }
+
+        uint32_t saved_priority = m_exec_priority;
+        uint32_t saved_ipsr     = m_ipsr;
+
+        m_nvic_pending &= ~(1UL << irqn);
+        m_exec_priority = m_nvic_priority[irqn];
+        m_ipsr          = 16 + irqn;
+        m_sim_node.now += SIM_IRQ_ENTRY_COST;
+
+        SIM_TRACE("irq %d", irqn);
+        m_irq_handlers[irqn]();
+
+        flush_writes();
+        SIM_TRACE("irq %d return", irqn);
+        m_exec_priority  = saved_priority;
+        m_ipsr           = saved_ipsr;
+        m_event_register = true;
+
+        // Interrupt lines are level sensitive: an event left set pends the interrupt again.
+        for (uint32_t i = 0; i < m_periph_count; i++)
+        {
+            if (mp_periphs[i]->irqn == irqn)
+            {
+                sim_irq_update(mp_periphs[i]);
+            }
+        }
+    }
+}
+
+
+/**@brief Process the next peripheral event if it is due no later than @p limit.
+ *
+ * @details Yields to the kernel when the event lies beyond the granted horizon.
+ *
+ * @return  true if an event was processed or the kernel was consulted, false if nothing is due.
+ */
+static bool step(sim_time_t limit)
+{
+    sim_periph_t * p_periph;
+    sim_time_t     t = next_event(&p_periph);
+    sim_time_t     until = t < limit ? t : limit;
+
+    if (until > m_sim_node.horizon)
+    {
+        kernel_yield(until);
+        return true;
+    }
+
+    if (p_periph == NULL || t > limit)
+    {
+        return false;
+    }
+
+    if (t > m_sim_node.now)
+    {
+        m_sim_node.now = t;
+    }
+    p_periph->run(t);
+
+    return true;
+}
+
+
+/**@brief Let the CPU run until @p target, servicing events and interrupts on the way. */
+static void advance(sim_time_t target)
+{
+    for (;;)
+    {
+        take_interrupts();
+        if (m_sim_node.now >= target)
+        {
+            return;
+        }
+        if (!step(target))
+        {
+            m_sim_node.now = target;
+        }
+    }
+}
+
+
+void * sim_periph_access(uint32_t base_address)
+{
+    int32_t i;
+
+    flush_writes();
+    advance(m_sim_node.now + SIM_ACCESS_COST);
+
+    i = periph_index(base_address);
+    if (i >= 0)
+    {
+        if (mp_periphs[i]->accessed != NULL)
+        {
+            mp_periphs[i]->accessed(m_sim_node.now);
+        }
+        m_dirty_mask |= 1UL << i;
+    }
+
+    return (void *)(uintptr_t)base_address;
+}
+
+
+void sim_cpu_delay_us(uint32_t number_of_us)
+{
+    flush_writes();
+    advance(m_sim_node.now + SIM_US(number_of_us));
+}
+
+
+void sim_cpu_irq_enable(void)
+{
+    flush_writes();
+    m_primask = 0;
+    take_interrupts();
+}
+
+
+void sim_cpu_irq_disable(void)
+{
+    flush_writes();
+    m_primask = 1;
+}
+
+
+uint32_t sim_cpu_primask_get(void)
+{
+    return m_primask;
+}
+
+
+uint32_t sim_cpu_ipsr_get(void)
+{
+    return m_ipsr;
+}
+
+
+void sim_cpu_sev(void)
+{
+    m_event_register = true;
+}
+
+
+void sim_cpu_wfe(void)
+{
+    flush_writes();
+
+    if (m_event_register)
+    {
+        m_event_register = false;
+        return;
+    }
+
+    for (;;)
+    {
+        int32_t irqn = pending_irq();
+
+        if (irqn >= 0 && m_nvic_priority[irqn] < m_exec_priority)
+        {
+            // An interrupt wakes the core; it is taken unless PRIMASK masks it.
+            take_interrupts();
+            return;
+        }
+
+        if (!step(SIM_TIME_NEVER))
+        {
+            kernel_yield(SIM_TIME_NEVER);
+        }
+    }
+}
+
+
+void sim_cpu_system_reset(void)
+{
+    sim_msg_reset_t reset = {.time = m_sim_node.now};
+
+    fflush(NULL);
+    sim_kernel_send(SIM_MSG_RESET, &reset, sizeof(reset));
+
+    // Start over in a fresh image; the kernel socket and the flash file survive.
+    execv("/proc/self/exe", mp_argv);
+    fatal("execv");
+}
+
+
+void sim_nvic_enable(int32_t irqn)
+{
+    flush_writes();
+    if (irqn >= 0)
+    {
+        m_nvic_enabled |= 1UL << irqn;
+        take_interrupts();
+    }
+}
+
+
+void sim_nvic_disable(int32_t irqn)
+{
+    flush_writes();
+    if (irqn >= 0)
+    {
+        m_nvic_enabled &= ~(1UL << irqn);
+    }
+}
+
+
+uint32_t sim_nvic_pending_get(int32_t irqn)
+{
+    return irqn >= 0 ? (m_nvic_pending >> irqn) & 1 : 0;
+}
+
+
+void sim_nvic_pending_set(int32_t irqn)
+{
+    flush_writes();
+    if (irqn >= 0)
+    {
+        m_nvic_pending |= 1UL << irqn;
+        take_interrupts();
+    }
+}
+
+
+void sim_nvic_pending_clear(int32_t irqn)
+{
+    flush_writes();
+    if (irqn >= 0)
+    {
+        m_nvic_pending &= ~(1UL << irqn);
+    }
+}
+
+
+void sim_nvic_priority_set(int32_t irqn, uint32_t priority)
+{
+    if (irqn >= 0)
+    {
+        m_nvic_priority[irqn] = priority & 0x03;
+    }
+}
+
+
+uint32_t sim_nvic_priority_get(int32_t irqn)
+{
+    // The NVIC implements the two most significant priority bits.
+    return irqn >= 0 ? (uint32_t)m_nvic_priority[irqn] << 6 : 0;
+}
+
+
+static void memory_map(void)
+{
+    for (uint32_t i = 0; i < sizeof(m_regions) / sizeof(m_regions[0]); i++)
+    {
+        void * p = mmap((void *)(uintptr_t)m_regions[i].address, m_regions[i].size,
+                        PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+
+        if (p != (void *)(uintptr_t)m_regions[i].address)
+        {
+            fatal("mmap peripheral region");
+        }
+    }
+}
+
+
+static void usage(char const * p_name)
+{
+    fprintf(stderr, "usage: %s --flash <file>\n"
+                    "Simulated nRF51 node; normally started by esb_sim.\n", p_name);
+    exit(EXIT_FAILURE);
+}
+
+
+int main(int argc, char ** argv)
+{
+    char const * p_flash = NULL;
+
+    mp_argv = argv;
+    m_sim_node.trace = getenv("ESB_SIM_TRACE") != NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--flash") == 0 && i + 1 < argc)
+        {
+            p_flash = argv[++i];
+        }
+        else
+        {
+            usage(argv[0]);
+        }
+    }
+    if (p_flash == NULL)
+    {
+        usage(argv[0]);
+    }
+
+    memory_map();
+
+    // Configuration first, then wait for the first time slot.
+    kernel_wait_run();
+
+    for (uint32_t i = 0; i < 32; i++)
+    {
+        m_nvic_priority[i] = 0;
+    }
+
+    sim_periph_init();
+    sim_radio_init();
+    sim_nvmc_init(p_flash);
+
+    (void)sim_fw_main();
+
+    for (;;)
+    {
+        sim_cpu_wfe();
+    }
+}
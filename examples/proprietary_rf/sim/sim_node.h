@@ -0,0 +1,98 @@
+/* Copyright (c) 2016 Nordic Semiconductor. All Rights Reserved.
+ *
+ * The information contained herein is property of Nordic Semiconductor ASA.
+ * Terms and conditions of usage are described in detail in NORDIC
+ * SEMICONDUCTOR STANDARD SOFTWARE LICENSE AGREEMENT.
+ *
+ * Licensees are granted free, non-transferable use of the information. NO
+ * WARRANTY of ANY KIND is provided. This heading must NOT be removed from
+ * the file.
+ *
+ */
+
+/** @file
+ *
+ * @brief Internal interface of the simulated nRF51 node.
+ *
+ * @details A node is one process running one firmware image. sim_node.c owns the CPU model
+ *          (clock, NVIC, PRIMASK, WFE), the register access hook and the link to the kernel.
+ *          Every peripheral model registers a @ref sim_periph_t describing how its tasks are
+ *          triggered and when its next event is due.
+ *
+ *          Register semantics that plain memory cannot provide are applied lazily: a write
+ *          only lands in memory, and the next call into the runtime (register access, delay,
+ *          WFE, interrupt return) inspects the peripherals written since the previous call.
+ *          Task registers found non-zero are triggered, write-one-to-set/clear registers are
+ *          folded into their shadow value, and the peripheral model is told to re-evaluate.
+ */
+
+#ifndef SIM_NODE_H__
+#define SIM_NODE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "nrf.h"
+#include "sim_proto.h"
+
+#define SIM_PERIPH_SIZE             0x1000
+#define SIM_REG(base, offset)       (*(volatile uint32_t *)(uintptr_t)((base) + (offset)))
+
+/**@brief Write a register that the firmware sees as read-only. */
+#define SIM_REG_SET(base, type, field, value) (SIM_REG(base, offsetof(type, field)) = (value))
+
+#define SIM_INTENSET_OFFSET         0x304
+#define SIM_INTENCLR_OFFSET         0x308
+#define SIM_EVENTS_OFFSET           0x100
+
+/**@brief Description of one simulated peripheral. */
+typedef struct
+{
+    uint32_t     base;                                  /**< Base address of the register block. */
+    int32_t      irqn;                                  /**< IRQ number, or -1 if none. */
+    bool         has_inten;                             /**< INTENSET/INTENCLR at the standard offsets. */
+    void      (* task)(uint32_t offset, sim_time_t t);  /**< Task register at offset triggered at t. */
+    void      (* written)(sim_time_t t);                /**< Registers of the peripheral were written. */
+    sim_time_t (* next_event)(void);                    /**< Time of the next internal event. */
+    void      (* accessed)(sim_time_t t);               /**< Registers of the peripheral are about to be read. */
+    void      (* run)(sim_time_t t);                    /**< Process the internal event due at t. */
+    uint32_t     inten;                                 /**< Interrupt enable shadow. */
+} sim_periph_t;
+
+/**@brief Node-wide configuration and link state. */
+typedef struct
+{
+    sim_msg_config_t config;
+    sim_time_t       now;                   /**< Time of the CPU. */
+    sim_time_t       horizon;               /**< The node may not process events beyond this. */
+    uint64_t         rng_state;
+    bool             trace;
+} sim_node_t;
+
+extern sim_node_t m_sim_node;
+
+/**@brief Print a trace line with the node time when ESB_SIM_TRACE is set in the environment. */
+#define SIM_TRACE(...)  do { if (m_sim_node.trace) sim_trace(__VA_ARGS__); } while (0)
+
+/* Runtime, sim_node.c. */
+void         sim_periph_register(sim_periph_t * p_periph);
+sim_periph_t * sim_periph_find(uint32_t address);
+void         sim_event_generate(sim_periph_t * p_periph, uint32_t offset, sim_time_t t);
+void         sim_task_trigger(uint32_t address, sim_time_t t);
+void         sim_irq_update(sim_periph_t * p_periph);
+void         sim_kernel_send(sim_msg_type_t type, void const * p_body, uint32_t length);
+uint32_t     sim_random(void);
+void         sim_trace(char const * p_format, ...) __attribute__((format(printf, 1, 2)));
+bool         sim_ram_valid(uint32_t address, uint32_t length);
+
+/* Peripherals, sim_periph.c. */
+void         sim_periph_init(void);
+void         sim_ppi_event(uint32_t event_address, sim_time_t t);
+void         sim_nvmc_init(char const * p_flash_path);
+bool         sim_clock_hfxo_running(void);
+
+/* Radio, sim_radio.c. */
+void         sim_radio_init(void);
+void         sim_radio_tx_notice(sim_msg_tx_t const * p_tx);
+
+#endif // SIM_NODE_H__
@@ -0,0 +1,1131 @@
+/* Copyright (c) 2016 Nordic Semiconductor. All Rights Reserved.
+ *
+ * The information contained herein is property of Nordic Semiconductor ASA.
+ * Terms and conditions of usage are described in detail in NORDIC
+ * SEMICONDUCTOR STANDARD SOFTWARE LICENSE AGREEMENT.
+ *
+ * Licensees are granted free, non-transferable use of the information. NO
+ * WARRANTY of ANY KIND is provided. This heading must NOT be removed from
+ * the file.
+ *
+ */
+
+/** @file
+ *
+ * @brief Simulated CLOCK, TIMER, RTC, PPI, GPIO, NVMC and FICR of the nRF51.
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "sim_node.h"
+
+#define CLOCK_HFCLK_STARTUP         SIM_US(400)         /**< 16 MHz crystal start-up time. */
+#define CLOCK_LFCLK_STARTUP         SIM_US(600)         /**< 32 kHz RC oscillator start-up time. */
+
+#define NVMC_ERASE_TIME             SIM_US(22300)       /**< Page erase time. */
+#define NVMC_WRITE_TIME             SIM_US(46)          /**< Word write time. */
+
+#define FLASH_CODE_PAGE_SIZE        1024
+#define FLASH_CODE_PAGES            256
+#define FLASH_SIZE                  (FLASH_CODE_PAGE_SIZE * FLASH_CODE_PAGES)
+#define FLASH_MAP_START             0x1000              /**< Page zero cannot be mapped on the host. */
+
+#define PPI_CHANNELS                16
+#define TIMER_COUNT                 3
+#define RTC_COUNT                   2
+#define RTC_TICK_PERIOD             15625               /**< One 32.768 kHz period, in 1/32 sim ticks. */
+#define RTC_COUNTER_MASK            0xFFFFFF
+#define RTC_EVTEN_OFFSET            0x340
+#define RTC_EVTENSET_OFFSET         0x344
+#define RTC_EVTENCLR_OFFSET         0x348
+
+#define GPIO_PIN_CNF_DIR_MASK       (GPIO_PIN_CNF_DIR_Msk)
+#define GPIO_PIN_CNF_PULL_MASK      (GPIO_PIN_CNF_PULL_Msk)
+
+#define M_CLOCK                     ((NRF_CLOCK_Type *) NRF_CLOCK_BASE)
+#define M_PPI                       ((NRF_PPI_Type *) NRF_PPI_BASE)
+#define M_GPIO                      ((NRF_GPIO_Type *) NRF_GPIO_BASE)
+#define M_NVMC                      ((NRF_NVMC_Type *) NRF_NVMC_BASE)
+#define M_FICR                      ((NRF_FICR_Type *) NRF_FICR_BASE)
+#define M_UICR                      ((NRF_UICR_Type *) NRF_UICR_BASE)
+
+
+/**@brief CLOCK. */
+
+static sim_time_t m_hfclk_started = SIM_TIME_NEVER;
+static sim_time_t m_lfclk_started = SIM_TIME_NEVER;
+static bool       m_hfclk_on;
+
+static void hfclk_report(sim_time_t t);
+static void clock_task(uint32_t offset, sim_time_t t);
+static sim_time_t clock_next(void);
+static void clock_run(sim_time_t t);
+
+static sim_periph_t m_clock =
+{
+    .base       = NRF_CLOCK_BASE,
+    .irqn       = POWER_CLOCK_IRQn,
+    .has_inten  = true,
+    .task       = clock_task,
+    .next_event = clock_next,
+    .run        = clock_run,
+};
+
+
+static void clock_task(uint32_t offset, sim_time_t t)
+{
+    switch (offset)
+    {
+        case offsetof(NRF_CLOCK_Type, TASKS_HFCLKSTART):
+            if ((M_CLOCK->HFCLKSTAT & CLOCK_HFCLKSTAT_SRC_Msk) == 0 && m_hfclk_started == SIM_TIME_NEVER)
+            {
+                m_hfclk_started = t + CLOCK_HFCLK_STARTUP;
+            }
+            break;
+
+        case offsetof(NRF_CLOCK_Type, TASKS_HFCLKSTOP):
+            m_hfclk_started  = SIM_TIME_NEVER;
+            SIM_REG_SET(NRF_CLOCK_BASE, NRF_CLOCK_Type, HFCLKSTAT, 0);
+            break;
+
+        case offsetof(NRF_CLOCK_Type, TASKS_LFCLKSTART):
+            if (m_lfclk_started == SIM_TIME_NEVER && (M_CLOCK->LFCLKSTAT & CLOCK_LFCLKSTAT_STATE_Msk) == 0)
+            {
+                m_lfclk_started = t + CLOCK_LFCLK_STARTUP;
+            }
+            break;
+
+        case offsetof(NRF_CLOCK_Type, TASKS_LFCLKSTOP):
+            m_lfclk_started  = SIM_TIME_NEVER;
+            SIM_REG_SET(NRF_CLOCK_BASE, NRF_CLOCK_Type, LFCLKSTAT, 0);
+            break;
+
+        default:
+            break;
+    }
+
+    hfclk_report(t);
+}
+
+
+static sim_time_t clock_next(void)
+{
+    return m_hfclk_started < m_lfclk_started ? m_hfclk_started : m_lfclk_started;
+}
+
+
+static void clock_run(sim_time_t t)
+{
+    if (m_hfclk_started <= t)
+    {
+        m_hfclk_started    = SIM_TIME_NEVER;
+        SIM_REG_SET(NRF_CLOCK_BASE, NRF_CLOCK_Type, HFCLKSTAT,
+                    (CLOCK_HFCLKSTAT_SRC_Xtal << CLOCK_HFCLKSTAT_SRC_Pos) |
+                    (CLOCK_HFCLKSTAT_STATE_Running << CLOCK_HFCLKSTAT_STATE_Pos));
+        sim_event_generate(&m_clock, offsetof(NRF_CLOCK_Type, EVENTS_HFCLKSTARTED), t);
+    }
+    if (m_lfclk_started <= t)
+    {
+        m_lfclk_started    = SIM_TIME_NEVER;
+        SIM_REG_SET(NRF_CLOCK_BASE, NRF_CLOCK_Type, LFCLKSTAT,
+                    (M_CLOCK->LFCLKSRC & CLOCK_LFCLKSTAT_SRC_Msk) |
+                    (CLOCK_LFCLKSTAT_STATE_Running << CLOCK_LFCLKSTAT_STATE_Pos));
+        sim_event_generate(&m_clock, offsetof(NRF_CLOCK_Type, EVENTS_LFCLKSTARTED), t);
+    }
+
+    hfclk_report(t);
+}
+
+
+bool sim_clock_hfxo_running(void)
+{
+    return (M_CLOCK->HFCLKSTAT & CLOCK_HFCLKSTAT_SRC_Msk) != 0;
+}
+
+
+/**@brief TIMER.
+ *
+ * The counter is kept as a value at an anchor time; it is brought up to date whenever the
+ * timer is touched, and the next compare match is computed from it. The anchor is in the local
+ * time of the node, which runs off the simulated time by @c clock_ppb of the configuration.
+ */
+
+typedef struct
+{
+    sim_periph_t periph;
+    bool         running;
+    uint32_t     counter;
+    sim_time_t   anchor;
+    uint32_t     prescaler;
+    uint32_t     mask;
+    uint32_t     cc[4];
+    sim_time_t   next;
+} sim_timer_t;
+
+static sim_timer_t m_timers[TIMER_COUNT];
+
+
+static sim_time_t clock_local(sim_time_t t)
+{
+    return t + (int64_t)t * m_sim_node.config.clock_ppb / 1000000000;
+}
+
+
+/**@brief Function for getting the first simulated time at which the local time reaches @p local. */
+static sim_time_t clock_global(sim_time_t local)
+{
+    sim_time_t t = local - (int64_t)local * m_sim_node.config.clock_ppb / 1000000000;
+
+    while (clock_local(t) < local)
+    {
+        t++;
+    }
+    while (t > 0 && clock_local(t - 1) >= local)
+    {
+        t--;
+    }
+    return t;
+}
+
+
+static NRF_TIMER_Type * timer_reg(sim_timer_t const * p_timer)
+{
+    return (NRF_TIMER_Type *)(uintptr_t)p_timer->periph.base;
+}
+
+
+static void timer_sync(sim_timer_t * p_timer, sim_time_t t)
+{
+    if (p_timer->running && t > p_timer->anchor)
+    {
+        sim_time_t ticks = (t - p_timer->anchor) >> p_timer->prescaler;
+
+        p_timer->counter  = (uint32_t)((p_timer->counter + ticks) & p_timer->mask);
+        p_timer->anchor  += ticks << p_timer->prescaler;
+    }
+    else if (!p_timer->running)
+    {
+        p_timer->anchor = t;
+    }
+}
+
+
+static void timer_schedule(sim_timer_t * p_timer)
+{
+    p_timer->next = SIM_TIME_NEVER;
+
+    if (!p_timer->running || timer_reg(p_timer)->MODE != TIMER_MODE_MODE_Timer)
+    {
+        return;
+    }
+
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        uint64_t   delta = (p_timer->cc[i] - p_timer->counter) & p_timer->mask;
+        sim_time_t t;
+
+        if (delta == 0)
+        {
+            delta = (uint64_t)p_timer->mask + 1;
+        }
+        t = clock_global(p_timer->anchor + (delta << p_timer->prescaler));
+        if (t < p_timer->next)
+        {
+            p_timer->next = t;
+        }
+    }
+}
+
+
+static void timer_apply_config(sim_timer_t * p_timer)
+{
+    static const uint32_t masks[] = {0xFFFF, 0xFF, 0xFFFFFF, 0xFFFFFFFF};
+    NRF_TIMER_Type      * p_reg   = timer_reg(p_timer);
+
+    p_timer->prescaler = p_reg->PRESCALER > 9 ? 9 : p_reg->PRESCALER;
+    p_timer->mask      = masks[p_reg->BITMODE & 3];
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        p_timer->cc[i] = p_reg->CC[i] & p_timer->mask;
+    }
+}
+
+
+static void timer_task(sim_timer_t * p_timer, uint32_t offset, sim_time_t now)
+{
+    NRF_TIMER_Type * p_reg = timer_reg(p_timer);
+    sim_time_t       t     = clock_local(now);
+
+    SIM_TRACE("timer %x task %03x", p_timer->periph.base, offset);
+    if (t < p_timer->anchor)
+    {
+        t = p_timer->anchor;
+    }
+    timer_sync(p_timer, t);
+
+    switch (offset)
+    {
+        case offsetof(NRF_TIMER_Type, TASKS_START):
+            if (!p_timer->running)
+            {
+                timer_apply_config(p_timer);
+                p_timer->running = true;
+                p_timer->anchor  = t;
+            }
+            break;
+
+        case offsetof(NRF_TIMER_Type, TASKS_STOP):
+        case offsetof(NRF_TIMER_Type, TASKS_SHUTDOWN):
+            p_timer->running = false;
+            break;
+
+        case offsetof(NRF_TIMER_Type, TASKS_COUNT):
+            if (p_reg->MODE != TIMER_MODE_MODE_Timer)
+            {
+                p_timer->counter = (p_timer->counter + 1) & p_timer->mask;
+            }
+            break;
+
+        case offsetof(NRF_TIMER_Type, TASKS_CLEAR):
+            p_timer->counter = 0;
+            p_timer->anchor  = t;
+            break;
+
+        default:
+            if (offset >= offsetof(NRF_TIMER_Type, TASKS_CAPTURE[0]) &&
+                offset <= offsetof(NRF_TIMER_Type, TASKS_CAPTURE[3]))
+            {
+                uint32_t i = (offset - offsetof(NRF_TIMER_Type, TASKS_CAPTURE[0])) / 4;
+
+                p_reg->CC[i]   = p_timer->counter;
+                p_timer->cc[i] = p_timer->counter;
+            }
+            break;
+    }
+
+    timer_schedule(p_timer);
+    hfclk_report(now);
+}
+
+
+static void timer_written(sim_timer_t * p_timer, sim_time_t now)
+{
+    sim_time_t t = clock_local(now);
+
+    timer_sync(p_timer, t < p_timer->anchor ? p_timer->anchor : t);
+    timer_apply_config(p_timer);
+    timer_schedule(p_timer);
+}
+
+
+static void timer_run(sim_timer_t * p_timer, sim_time_t t)
+{
+    NRF_TIMER_Type * p_reg  = timer_reg(p_timer);
+    uint32_t         shorts = p_reg->SHORTS;
+    bool             clear  = false;
+    bool             stop   = false;
+    sim_time_t       local  = clock_local(t);
+
+    timer_sync(p_timer, local);
+
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        if (p_timer->cc[i] == p_timer->counter)
+        {
+            sim_event_generate(&p_timer->periph, offsetof(NRF_TIMER_Type, EVENTS_COMPARE[i]), t);
+            clear |= (shorts & (TIMER_SHORTS_COMPARE0_CLEAR_Msk << i)) != 0;
+            stop  |= (shorts & (TIMER_SHORTS_COMPARE0_STOP_Msk << i)) != 0;
+        }
+    }
+
+    if (clear)
+    {
+        p_timer->counter = 0;
+        p_timer->anchor  = local;
+    }
+    if (stop)
+    {
+        p_timer->running = false;
+    }
+    if (!clear && p_timer->running)
+    {
+        // Step past the matching count so that the same compare is not reported twice.
+        p_timer->anchor = local;
+    }
+
+    timer_schedule(p_timer);
+    if (!clear && p_timer->next == t)
+    {
+        p_timer->next = SIM_TIME_NEVER;
+    }
+    hfclk_report(t);
+}
+
+#define SIM_TIMER_GLUE(n)                                                               \
+static void timer##n##_task(uint32_t offset, sim_time_t t) { timer_task(&m_timers[n], offset, t); } \
+static void timer##n##_written(sim_time_t t) { timer_written(&m_timers[n], t); }        \
+static sim_time_t timer##n##_next(void) { return m_timers[n].next; }                    \
+static void timer##n##_run(sim_time_t t) { timer_run(&m_timers[n], t); }
+
+SIM_TIMER_GLUE(0)
+SIM_TIMER_GLUE(1)
+SIM_TIMER_GLUE(2)
+
+#define SIM_TIMER_PERIPH(n)                                                             \
+{                                                                                       \
+    .base       = NRF_TIMER##n##_BASE,                                                  \
+    .irqn       = TIMER##n##_IRQn,                                                      \
+    .has_inten  = true,                                                                 \
+    .task       = timer##n##_task,                                                      \
+    .written    = timer##n##_written,                                                   \
+    .next_event = timer##n##_next,                                                      \
+    .run        = timer##n##_run,                                                       \
+}
+
+
+/**@brief Tell the kernel when the 16 MHz clock turns on or off.
+ *
+ * The crystal and the RC oscillator are not told apart: a running TIMER keeps the clock on
+ * just like the crystal. The CPU is not counted, as it sleeps in WFE most of the time.
+ */
+static void hfclk_report(sim_time_t t)
+{
+    bool on = sim_clock_hfxo_running() || m_hfclk_started != SIM_TIME_NEVER;
+
+    for (uint32_t i = 0; i < TIMER_COUNT; i++)
+    {
+        on |= m_timers[i].running;
+    }
+
+    if (on != m_hfclk_on)
+    {
+        sim_msg_clock_t msg = {.time = t, .hfclk_on = on};
+
+        m_hfclk_on = on;
+        sim_kernel_send(SIM_MSG_CLOCK, &msg, sizeof(msg));
+    }
+}
+
+
+/**@brief RTC.
+ *
+ * Counts like a TIMER, on the 32.768 kHz clock, which runs off the simulated time by the same
+ * @c clock_ppb as the 16 MHz clock. The anchor is kept in 1/32 of a simulated tick, so that a
+ * period of the 32.768 kHz clock is a whole number. Events are only generated when enabled in
+ * INTEN or EVTEN, and only reach PPI when enabled in EVTEN. The TICK event is not modelled.
+ */
+
+typedef struct
+{
+    sim_periph_t periph;
+    bool         running;
+    uint32_t     counter;
+    sim_time_t   anchor;
+    uint32_t     period;
+    uint32_t     evten;
+    uint32_t     cc[4];
+    sim_time_t   next;
+} sim_rtc_t;
+
+static sim_rtc_t m_rtcs[RTC_COUNT];
+
+
+static NRF_RTC_Type * rtc_reg(sim_rtc_t const * p_rtc)
+{
+    return (NRF_RTC_Type *)(uintptr_t)p_rtc->periph.base;
+}
+
+
+static void rtc_sync(sim_rtc_t * p_rtc, sim_time_t t)
+{
+    sim_time_t local = clock_local(t) * 32;
+
+    if (p_rtc->running && local > p_rtc->anchor)
+    {
+        sim_time_t ticks = (local - p_rtc->anchor) / p_rtc->period;
+
+        p_rtc->counter = (uint32_t)((p_rtc->counter + ticks) & RTC_COUNTER_MASK);
+        p_rtc->anchor += ticks * p_rtc->period;
+    }
+    else if (!p_rtc->running)
+    {
+        p_rtc->anchor = local;
+    }
+    SIM_REG_SET(p_rtc->periph.base, NRF_RTC_Type, COUNTER, p_rtc->counter);
+}
+
+
+/**@brief Function for getting the time at which the counter has moved on by @p delta. */
+static sim_time_t rtc_time_of(sim_rtc_t const * p_rtc, uint64_t delta)
+{
+    return clock_global((p_rtc->anchor + delta * p_rtc->period + 31) / 32);
+}
+
+
+static void rtc_schedule(sim_rtc_t * p_rtc)
+{
+    uint32_t enabled = p_rtc->periph.inten | p_rtc->evten;
+
+    p_rtc->next = SIM_TIME_NEVER;
+
+    if (!p_rtc->running)
+    {
+        return;
+    }
+
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        uint64_t   delta = (p_rtc->cc[i] - p_rtc->counter) & RTC_COUNTER_MASK;
+        sim_time_t t;
+
+        if ((enabled & (RTC_EVTEN_COMPARE0_Msk << i)) == 0)
+        {
+            continue;
+        }
+        if (delta == 0)
+        {
+            delta = RTC_COUNTER_MASK + 1;
+        }
+        t = rtc_time_of(p_rtc, delta);
+        if (t < p_rtc->next)
+        {
+            p_rtc->next = t;
+        }
+    }
+
+    if (enabled & RTC_EVTEN_OVRFLW_Msk)
+    {
+        sim_time_t t = rtc_time_of(p_rtc, (RTC_COUNTER_MASK + 1) - p_rtc->counter);
+
+        if (t < p_rtc->next)
+        {
+            p_rtc->next = t;
+        }
+    }
+}
+
+
+static void rtc_event(sim_rtc_t * p_rtc, uint32_t mask, uint32_t offset, sim_time_t t)
+{
+    if (p_rtc->evten & mask)
+    {
+        sim_event_generate(&p_rtc->periph, offset, t);
+    }
+    else if (p_rtc->periph.inten & mask)
+    {
+        SIM_REG(p_rtc->periph.base, offset) = 1;
+        sim_irq_update(&p_rtc->periph);
+    }
+}
+
+
+static void rtc_task(sim_rtc_t * p_rtc, uint32_t offset, sim_time_t t)
+{
+    SIM_TRACE("rtc %x task %03x", p_rtc->periph.base, offset);
+    rtc_sync(p_rtc, t);
+
+    switch (offset)
+    {
+        case offsetof(NRF_RTC_Type, TASKS_START):
+            if (!p_rtc->running)
+            {
+                p_rtc->period  = ((rtc_reg(p_rtc)->PRESCALER & 0xFFF) + 1) * RTC_TICK_PERIOD;
+                p_rtc->running = true;
+            }
+            break;
+
+        case offsetof(NRF_RTC_Type, TASKS_STOP):
+            p_rtc->running = false;
+            break;
+
+        case offsetof(NRF_RTC_Type, TASKS_CLEAR):
+            p_rtc->counter = 0;
+            p_rtc->anchor  = clock_local(t) * 32;
+            break;
+
+        case offsetof(NRF_RTC_Type, TASKS_TRIGOVRFLW):
+            p_rtc->counter = 0xFFFFF0;
+            break;
+
+        default:
+            break;
+    }
+
+    SIM_REG_SET(p_rtc->periph.base, NRF_RTC_Type, COUNTER, p_rtc->counter);
+    rtc_schedule(p_rtc);
+}
+
+
+static void rtc_written(sim_rtc_t * p_rtc, sim_time_t t)
+{
+    uint32_t set   = SIM_REG(p_rtc->periph.base, RTC_EVTENSET_OFFSET);
+    uint32_t clr   = SIM_REG(p_rtc->periph.base, RTC_EVTENCLR_OFFSET);
+    uint32_t evten = p_rtc->evten;
+
+    rtc_sync(p_rtc, t);
+
+    if (SIM_REG(p_rtc->periph.base, RTC_EVTEN_OFFSET) != evten)
+    {
+        p_rtc->evten = SIM_REG(p_rtc->periph.base, RTC_EVTEN_OFFSET);
+    }
+    if (set != evten)
+    {
+        p_rtc->evten |= set;
+    }
+    if (clr != ~evten)
+    {
+        p_rtc->evten &= ~clr;
+    }
+    SIM_REG(p_rtc->periph.base, RTC_EVTEN_OFFSET)    = p_rtc->evten;
+    SIM_REG(p_rtc->periph.base, RTC_EVTENSET_OFFSET) = p_rtc->evten;
+    SIM_REG(p_rtc->periph.base, RTC_EVTENCLR_OFFSET) = ~p_rtc->evten;
+
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        p_rtc->cc[i] = rtc_reg(p_rtc)->CC[i] & RTC_COUNTER_MASK;
+    }
+    rtc_schedule(p_rtc);
+}
+
+
+static void rtc_run(sim_rtc_t * p_rtc, sim_time_t t)
+{
+    rtc_sync(p_rtc, t);
+
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        if (p_rtc->cc[i] == p_rtc->counter)
+        {
+            rtc_event(p_rtc, RTC_EVTEN_COMPARE0_Msk << i, offsetof(NRF_RTC_Type, EVENTS_COMPARE[i]), t);
+        }
+    }
+    if (p_rtc->counter == 0)
+    {
+        rtc_event(p_rtc, RTC_EVTEN_OVRFLW_Msk, offsetof(NRF_RTC_Type, EVENTS_OVRFLW), t);
+    }
+
+    // The counter only moves on at the next period, so every match is one period away.
+    rtc_schedule(p_rtc);
+}
+
+#define SIM_RTC_GLUE(n)                                                                 \
+static void rtc##n##_task(uint32_t offset, sim_time_t t) { rtc_task(&m_rtcs[n], offset, t); } \
+static void rtc##n##_written(sim_time_t t) { rtc_written(&m_rtcs[n], t); }              \
+static sim_time_t rtc##n##_next(void) { return m_rtcs[n].next; }                        \
+static void rtc##n##_run(sim_time_t t) { rtc_run(&m_rtcs[n], t); }                      \
+static void rtc##n##_accessed(sim_time_t t) { rtc_sync(&m_rtcs[n], t); }
+
+SIM_RTC_GLUE(0)
+SIM_RTC_GLUE(1)
+
+#define SIM_RTC_PERIPH(n)                                                               \
+{                                                                                       \
+    .base       = NRF_RTC##n##_BASE,                                                    \
+    .irqn       = RTC##n##_IRQn,                                                        \
+    .has_inten  = true,                                                                 \
+    .task       = rtc##n##_task,                                                        \
+    .written    = rtc##n##_written,                                                     \
+    .next_event = rtc##n##_next,                                                        \
+    .accessed   = rtc##n##_accessed,                                                    \
+    .run        = rtc##n##_run,                                                         \
+}
+
+
+/**@brief PPI. */
+
+static uint32_t m_ppi_chen;
+
+/* Pre-programmed channels 20 to 31. */
+static const uint32_t m_ppi_fixed[12][2] =
+{
+    {NRF_TIMER0_BASE + offsetof(NRF_TIMER_Type, EVENTS_COMPARE[0]), NRF_RADIO_BASE + offsetof(NRF_RADIO_Type, TASKS_TXEN)},
+    {NRF_TIMER0_BASE + offsetof(NRF_TIMER_Type, EVENTS_COMPARE[0]), NRF_RADIO_BASE + offsetof(NRF_RADIO_Type, TASKS_RXEN)},
+    {NRF_TIMER0_BASE + offsetof(NRF_TIMER_Type, EVENTS_COMPARE[1]), NRF_RADIO_BASE + offsetof(NRF_RADIO_Type, TASKS_DISABLE)},
+    {0, 0},
+    {0, 0},
+    {0, 0},
+    {NRF_RADIO_BASE + offsetof(NRF_RADIO_Type, EVENTS_ADDRESS), NRF_TIMER0_BASE + offsetof(NRF_TIMER_Type, TASKS_CAPTURE[1])},
+    {NRF_RADIO_BASE + offsetof(NRF_RADIO_Type, EVENTS_END),     NRF_TIMER0_BASE + offsetof(NRF_TIMER_Type, TASKS_CAPTURE[2])},
+    {NRF_RTC0_BASE + offsetof(NRF_RTC_Type, EVENTS_COMPARE[0]),  NRF_RADIO_BASE + offsetof(NRF_RADIO_Type, TASKS_TXEN)},
+    {NRF_RTC0_BASE + offsetof(NRF_RTC_Type, EVENTS_COMPARE[0]),  NRF_RADIO_BASE + offsetof(NRF_RADIO_Type, TASKS_RXEN)},
+    {NRF_RTC0_BASE + offsetof(NRF_RTC_Type, EVENTS_COMPARE[0]),  NRF_TIMER0_BASE + offsetof(NRF_TIMER_Type, TASKS_CLEAR)},
+    {NRF_RTC0_BASE + offsetof(NRF_RTC_Type, EVENTS_COMPARE[0]),  NRF_TIMER0_BASE + offsetof(NRF_TIMER_Type, TASKS_START)},
+};
+
+static void ppi_written(sim_time_t t);
+
+static sim_periph_t m_ppi =
+{
+    .base    = NRF_PPI_BASE,
+    .irqn    = -1,
+    .written = ppi_written,
+};
+
+
+static void ppi_written(sim_time_t t)
+{
+    uint32_t set  = M_PPI->CHENSET;
+    uint32_t clr  = M_PPI->CHENCLR;
+    uint32_t chen = m_ppi_chen;
+
+    (void)t;
+
+    if (M_PPI->CHEN != chen)
+    {
+        m_ppi_chen = M_PPI->CHEN;
+    }
+    if (set != chen)
+    {
+        m_ppi_chen |= set;
+    }
+    if (clr != ~chen)
+    {
+        m_ppi_chen &= ~clr;
+    }
+
+    if (m_ppi_chen != chen)
+    {
+        SIM_TRACE("ppi chen %08x", m_ppi_chen);
+    }
+    M_PPI->CHEN    = m_ppi_chen;
+    M_PPI->CHENSET = m_ppi_chen;
+    M_PPI->CHENCLR = ~m_ppi_chen;
+}
+
+
+void sim_ppi_event(uint32_t event_address, sim_time_t t)
+{
+    uint32_t chen = m_ppi_chen;
+
+    while (chen != 0)
+    {
+        uint32_t ch = __builtin_ctz(chen);
+
+        chen &= chen - 1;
+        if (ch < PPI_CHANNELS)
+        {
+            if (M_PPI->CH[ch].EEP == event_address)
+            {
+                sim_task_trigger(M_PPI->CH[ch].TEP, t);
+            }
+        }
+        else if (ch >= 20 && m_ppi_fixed[ch - 20][0] == event_address)
+        {
+            sim_task_trigger(m_ppi_fixed[ch - 20][1], t);
+        }
+    }
+}
+
+
+/**@brief GPIO. */
+
+static uint32_t m_gpio_out;
+static uint32_t m_gpio_dir;
+static uint32_t m_gpio_pin_cnf[32];
+
+static sim_time_t m_gpio_press_next;
+
+static void gpio_written(sim_time_t t);
+static sim_time_t gpio_next(void);
+static void gpio_run(sim_time_t t);
+
+static sim_periph_t m_gpio =
+{
+    .base       = NRF_GPIO_BASE,
+    .irqn       = -1,
+    .written    = gpio_written,
+    .next_event = gpio_next,
+    .run        = gpio_run,
+};
+
+
+static void gpio_update_in(sim_time_t t)
+{
+    uint32_t in      = 0;
+    uint32_t pressed = m_sim_node.config.buttons_pressed;
+
+    if (t >= m_sim_node.config.button_press_start && t < m_sim_node.config.button_press_end)
+    {
+        pressed |= m_sim_node.config.button_press_pins;
+    }
+
+    for (uint32_t pin = 0; pin < 32; pin++)
+    {
+        uint32_t pull  = (m_gpio_pin_cnf[pin] & GPIO_PIN_CNF_PULL_MASK) >> GPIO_PIN_CNF_PULL_Pos;
+        bool     level;
+
+        if (m_gpio_dir & (1UL << pin))
+        {
+            level = (m_gpio_out >> pin) & 1;
+        }
+        else if (pressed & (1UL << pin))
+        {
+            level = false;
+        }
+        else
+        {
+            level = pull != GPIO_PIN_CNF_PULL_Pulldown;
+        }
+
+        in |= (uint32_t)level << pin;
+    }
+
+    SIM_REG_SET(NRF_GPIO_BASE, NRF_GPIO_Type, IN, in);
+}
+
+
+/**@brief The timed button press changes the inputs when it starts and when it ends. */
+static sim_time_t gpio_next(void)
+{
+    return m_gpio_press_next;
+}
+
+
+static void gpio_run(sim_time_t t)
+{
+    if (m_sim_node.config.button_press_pins != 0 && t < m_sim_node.config.button_press_start)
+    {
+        m_gpio_press_next = m_sim_node.config.button_press_start;
+    }
+    else if (m_sim_node.config.button_press_pins != 0 && t < m_sim_node.config.button_press_end)
+    {
+        m_gpio_press_next = m_sim_node.config.button_press_end;
+    }
+    else
+    {
+        m_gpio_press_next = SIM_TIME_NEVER;
+    }
+
+    gpio_update_in(t);
+}
+
+
+static void gpio_written(sim_time_t t)
+{
+    uint32_t        out = m_gpio_out;
+    uint32_t        dir = m_gpio_dir;
+
+    if (M_GPIO->OUT != m_gpio_out)
+    {
+        out = M_GPIO->OUT;
+    }
+    if (M_GPIO->OUTSET != m_gpio_out)
+    {
+        out |= M_GPIO->OUTSET;
+    }
+    if (M_GPIO->OUTCLR != ~m_gpio_out)
+    {
+        out &= ~M_GPIO->OUTCLR;
+    }
+
+    if (M_GPIO->DIR != dir)
+    {
+        m_gpio_dir = M_GPIO->DIR;
+    }
+    if (M_GPIO->DIRSET != dir)
+    {
+        m_gpio_dir |= M_GPIO->DIRSET;
+    }
+    if (M_GPIO->DIRCLR != ~dir)
+    {
+        m_gpio_dir &= ~M_GPIO->DIRCLR;
+    }
+
+    for (uint32_t pin = 0; pin < 32; pin++)
+    {
+        if (M_GPIO->PIN_CNF[pin] != m_gpio_pin_cnf[pin])
+        {
+            m_gpio_pin_cnf[pin] = M_GPIO->PIN_CNF[pin];
+            if (m_gpio_pin_cnf[pin] & GPIO_PIN_CNF_DIR_MASK)
+            {
+                m_gpio_dir |= 1UL << pin;
+            }
+            else
+            {
+                m_gpio_dir &= ~(1UL << pin);
+            }
+        }
+        // PIN_CNF.DIR and DIR are the same bit.
+        if (m_gpio_dir & (1UL << pin))
+        {
+            m_gpio_pin_cnf[pin] |= GPIO_PIN_CNF_DIR_MASK;
+        }
+        else
+        {
+            m_gpio_pin_cnf[pin] &= ~GPIO_PIN_CNF_DIR_MASK;
+        }
+        M_GPIO->PIN_CNF[pin] = m_gpio_pin_cnf[pin];
+    }
+
+    M_GPIO->DIR    = m_gpio_dir;
+    M_GPIO->DIRSET = m_gpio_dir;
+    M_GPIO->DIRCLR = ~m_gpio_dir;
+
+    if (out != m_gpio_out)
+    {
+        sim_msg_gpio_t msg = {.time = t, .out = out};
+
+        m_gpio_out = out;
+        sim_kernel_send(SIM_MSG_GPIO, &msg, sizeof(msg));
+    }
+
+    M_GPIO->OUT    = m_gpio_out;
+    M_GPIO->OUTSET = m_gpio_out;
+    M_GPIO->OUTCLR = ~m_gpio_out;
+
+    gpio_update_in(t);
+}
+
+
+/**@brief NVMC and the flash it programs.
+ *
+ * The code area is backed by a file, so that data written by the firmware survives resets and
+ * can be kept between runs. Writes are detected by comparing the flash with a shadow copy while
+ * writing is enabled, and are applied with flash semantics (bits can only be cleared).
+ */
+
+static uint8_t  * mp_flash_shadow;
+static sim_time_t m_nvmc_busy_until;
+
+static void nvmc_written(sim_time_t t);
+static sim_time_t nvmc_next(void);
+static void nvmc_run(sim_time_t t);
+
+static sim_periph_t m_nvmc =
+{
+    .base       = NRF_NVMC_BASE,
+    .irqn       = -1,
+    .written    = nvmc_written,
+    .next_event = nvmc_next,
+    .run        = nvmc_run,
+};
+
+
+static uint8_t * flash_ptr(uint32_t address)
+{
+    return (uint8_t *)(uintptr_t)address;
+}
+
+
+static void nvmc_busy(sim_time_t t, sim_time_t duration)
+{
+    if (m_nvmc_busy_until == SIM_TIME_NEVER || m_nvmc_busy_until < t)
+    {
+        m_nvmc_busy_until = t;
+    }
+    m_nvmc_busy_until += duration;
+    SIM_REG_SET(NRF_NVMC_BASE, NRF_NVMC_Type, READY, NVMC_READY_READY_Busy);
+}
+
+
+static void nvmc_erase(uint32_t address, uint32_t size)
+{
+    if (address < FLASH_MAP_START)
+    {
+        return;
+    }
+    memset(flash_ptr(address), 0xFF, size);
+    memset(mp_flash_shadow + address, 0xFF, size);
+}
+
+
+static void nvmc_written(sim_time_t t)
+{
+    uint32_t config = M_NVMC->CONFIG & NVMC_CONFIG_WEN_Msk;
+
+    if (M_NVMC->ERASEPAGE != 0)
+    {
+        uint32_t address = M_NVMC->ERASEPAGE & ~(FLASH_CODE_PAGE_SIZE - 1);
+
+        M_NVMC->ERASEPAGE = 0;
+        if (config == NVMC_CONFIG_WEN_Een && address < FLASH_SIZE)
+        {
+            nvmc_erase(address, FLASH_CODE_PAGE_SIZE);
+            nvmc_busy(t, NVMC_ERASE_TIME);
+        }
+    }
+
+    if (M_NVMC->ERASEALL != 0)
+    {
+        M_NVMC->ERASEALL = 0;
+        if (config == NVMC_CONFIG_WEN_Een)
+        {
+            nvmc_erase(FLASH_MAP_START, FLASH_SIZE - FLASH_MAP_START);
+            nvmc_busy(t, NVMC_ERASE_TIME);
+        }
+    }
+
+    if (M_NVMC->READY == NVMC_READY_READY_Ready)
+    {
+        uint32_t * p_flash  = (uint32_t *)(uintptr_t)FLASH_MAP_START;
+        uint32_t * p_shadow = (uint32_t *)(mp_flash_shadow + FLASH_MAP_START);
+        uint32_t   words    = (FLASH_SIZE - FLASH_MAP_START) / 4;
+        uint32_t   written  = 0;
+
+        if (memcmp(p_flash, p_shadow, words * 4) == 0)
+        {
+            return;
+        }
+
+        for (uint32_t i = 0; i < words; i++)
+        {
+            if (p_flash[i] != p_shadow[i])
+            {
+                if (config == NVMC_CONFIG_WEN_Wen)
+                {
+                    p_shadow[i] &= p_flash[i];
+                    written++;
+                }
+                p_flash[i] = p_shadow[i];
+            }
+        }
+
+        if (written > 0)
+        {
+            nvmc_busy(t, NVMC_WRITE_TIME * written);
+        }
+    }
+}
+
+
+static sim_time_t nvmc_next(void)
+{
+    return m_nvmc_busy_until;
+}
+
+
+static void nvmc_run(sim_time_t t)
+{
+    (void)t;
+    m_nvmc_busy_until = SIM_TIME_NEVER;
+    SIM_REG_SET(NRF_NVMC_BASE, NRF_NVMC_Type, READY, NVMC_READY_READY_Ready);
+}
+
+
+void sim_nvmc_init(char const * p_flash_path)
+{
+    struct stat st;
+    int         fd = open(p_flash_path, O_RDWR | O_CREAT, 0644);
+
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        perror(p_flash_path);
+        exit(EXIT_FAILURE);
+    }
+
+    if (st.st_size < FLASH_SIZE)
+    {
+        static uint8_t erased[FLASH_CODE_PAGE_SIZE];
+
+        memset(erased, 0xFF, sizeof(erased));
+        for (off_t pos = st.st_size; pos < FLASH_SIZE; pos += sizeof(erased))
+        {
+            size_t n = FLASH_SIZE - pos < (off_t)sizeof(erased) ? FLASH_SIZE - pos : sizeof(erased);
+            if (pwrite(fd, erased, n, pos) != (ssize_t)n)
+            {
+                perror(p_flash_path);
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+
+    if (mmap((void *)FLASH_MAP_START, FLASH_SIZE - FLASH_MAP_START, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_FIXED_NOREPLACE, fd, FLASH_MAP_START) != (void *)FLASH_MAP_START)
+    {
+        perror("mmap flash");
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+
+    mp_flash_shadow = malloc(FLASH_SIZE);
+    if (mp_flash_shadow == NULL)
+    {
+        exit(EXIT_FAILURE);
+    }
+    memset(mp_flash_shadow, 0xFF, FLASH_MAP_START);
+    memcpy(mp_flash_shadow + FLASH_MAP_START, (void *)FLASH_MAP_START, FLASH_SIZE - FLASH_MAP_START);
+
+    m_nvmc_busy_until = SIM_TIME_NEVER;
+    SIM_REG_SET(NRF_NVMC_BASE, NRF_NVMC_Type, READY, NVMC_READY_READY_Ready);
+    sim_periph_register(&m_nvmc);
+}
+
+
+#define FICR_SET(field, value)  SIM_REG_SET(NRF_FICR_BASE, NRF_FICR_Type, field, value)
+
+static void ficr_init(void)
+{
+    memset((void *)NRF_UICR_BASE, 0xFF, SIM_PERIPH_SIZE);
+
+    FICR_SET(CODEPAGESIZE, FLASH_CODE_PAGE_SIZE);
+    FICR_SET(CODESIZE, FLASH_CODE_PAGES);
+    FICR_SET(CLENR0, 0xFFFFFFFF);
+    FICR_SET(PPFC, 0xFFFFFFFF);
+    FICR_SET(NUMRAMBLOCK, 4);
+    FICR_SET(SIZERAMBLOCKS, 0x2000);
+    FICR_SET(CONFIGID, 0x00400000);
+    FICR_SET(DEVICEID[0], m_sim_node.config.device_id[0]);
+    FICR_SET(DEVICEID[1], m_sim_node.config.device_id[1]);
+    FICR_SET(DEVICEADDRTYPE, 1);
+    FICR_SET(DEVICEADDR[0], m_sim_node.config.device_id[0] ^ 0x5A5A5A5A);
+    FICR_SET(DEVICEADDR[1], (m_sim_node.config.device_id[1] & 0xFFFF) | 0xC000);
+}
+
+
+static sim_periph_t m_timer_periphs[TIMER_COUNT] =
+{
+    SIM_TIMER_PERIPH(0),
+    SIM_TIMER_PERIPH(1),
+    SIM_TIMER_PERIPH(2),
+};
+
+static sim_periph_t m_rtc_periphs[RTC_COUNT] =
+{
+    SIM_RTC_PERIPH(0),
+    SIM_RTC_PERIPH(1),
+};
+
+
+void sim_periph_init(void)
+{
+    ficr_init();
+
+    sim_periph_register(&m_clock);
+
+    for (uint32_t i = 0; i < TIMER_COUNT; i++)
+    {
+        m_timers[i].periph = m_timer_periphs[i];
+        m_timers[i].next   = SIM_TIME_NEVER;
+        m_timers[i].mask   = 0xFFFF;
+        sim_periph_register(&m_timers[i].periph);
+    }
+
+    for (uint32_t i = 0; i < RTC_COUNT; i++)
+    {
+        m_rtcs[i].periph = m_rtc_periphs[i];
+        m_rtcs[i].next   = SIM_TIME_NEVER;
+        m_rtcs[i].period = RTC_TICK_PERIOD;
+        SIM_REG(m_rtcs[i].periph.base, RTC_EVTENCLR_OFFSET) = 0xFFFFFFFF;
+        sim_periph_register(&m_rtcs[i].periph);
+    }
+
+    sim_periph_register(&m_ppi);
+    ppi_written(0);
+
+    sim_periph_register(&m_gpio);
+    for (uint32_t pin = 0; pin < 32; pin++)
+    {
+        // Reset value: input, input buffer disconnected, no pull.
+        m_gpio_pin_cnf[pin]  = GPIO_PIN_CNF_INPUT_Msk;
+        M_GPIO->PIN_CNF[pin] = m_gpio_pin_cnf[pin];
+    }
+    M_GPIO->DIRCLR = 0xFFFFFFFF;
+    M_GPIO->OUTCLR = 0xFFFFFFFF;
+    gpio_run(m_sim_node.now);
+}
@@ -0,0 +1,162 @@
+/* Copyright (c) 2016 Nordic Semiconductor. All Rights Reserved.
+ *
+ * The information contained herein is property of Nordic Semiconductor ASA.
+ * Terms and conditions of usage are described in detail in NORDIC
+ * SEMICONDUCTOR STANDARD SOFTWARE LICENSE AGREEMENT.
+ *
+ * Licensees are granted free, non-transferable use of the information. NO
+ * WARRANTY of ANY KIND is provided. This heading must NOT be removed from
+ * the file.
+ *
+ */
+
+/** @file
+ *
+ * @brief Messages exchanged between the medium kernel (esb_sim) and the simulated nodes.
+ *
+ * @details Every node is a separate process running one firmware image. The kernel always
+ *          resumes the node with the earliest pending activity and grants it a horizon it may
+ *          run up to; the node answers with the messages it produced and a final
+ *          @ref SIM_MSG_YIELD carrying the time of its next local event. Transmissions are
+ *          forwarded to all other nodes, which decide locally whether they receive them.
+ */
+
+#ifndef SIM_PROTO_H__
+#define SIM_PROTO_H__
+
+#include <stdint.h>
+
+/** @brief Simulated time, in units of one 16 MHz clock cycle (62.5 ns). */
+typedef uint64_t sim_time_t;
+
+#define SIM_TICKS_PER_US            16
+#define SIM_US(us)                  ((sim_time_t)(us) * SIM_TICKS_PER_US)
+#define SIM_MS(ms)                  (SIM_US(ms) * 1000)
+#define SIM_TIME_NEVER              UINT64_MAX
+
+/** @brief Smallest time from the start of a transmission until it can affect another node
+ *         (preamble and shortest address at 2 Mbps). Used as the kernel lookahead. */
+#define SIM_LOOKAHEAD               SIM_US(16)
+
+#define SIM_MAX_NODES               33      /**< The box and up to 32 devices. */
+#define SIM_MAX_NOISE_BANDS         8
+#define SIM_MAX_PDU_LENGTH          258
+
+#define SIM_NODE_FD                 3       /**< File descriptor of the kernel socket in a node. */
+
+typedef enum
+{
+    SIM_MSG_CONFIG = 1,     /**< Kernel to node: node configuration, sent once. */
+    SIM_MSG_RUN,            /**< Kernel to node: run up to the given horizon. */
+    SIM_MSG_TX,             /**< Both directions: a transmission started. */
+    SIM_MSG_END,            /**< Kernel to node: simulation finished. */
+    SIM_MSG_YIELD,          /**< Node to kernel: horizon reached or idle. */
+    SIM_MSG_RX,             /**< Node to kernel: a packet was received with a valid CRC. */
+    SIM_MSG_GPIO,           /**< Node to kernel: GPIO output register changed. */
+    SIM_MSG_RESET,          /**< Node to kernel: the firmware requested a system reset. */
+    SIM_MSG_CLOCK,          /**< Node to kernel: the 16 MHz clock was turned on or off. */
+} sim_msg_type_t;
+
+typedef struct
+{
+    uint32_t type;
+    uint32_t length;        /**< Length of the body following the header. */
+} sim_msg_hdr_t;
+
+typedef struct
+{
+    uint8_t  lo_channel;
+    uint8_t  hi_channel;
+    uint8_t  loss_percent;  /**< Probability that a packet on these channels is corrupted. */
+    int8_t   dbm;           /**< Noise level reported by RSSI sampling on these channels. */
+    sim_time_t start;       /**< The band is active from this time... */
+    sim_time_t end;         /**< ...until this time. @ref SIM_TIME_NEVER for the whole run. */
+} sim_noise_band_t;
+
+typedef struct
+{
+    uint32_t         node_id;
+    uint32_t         device_id[2];          /**< Value of NRF_FICR->DEVICEID. */
+    uint32_t         buttons_pressed;       /**< GPIO pins held low by the test setup. */
+    uint32_t         button_press_pins;     /**< GPIO pins held low from button_press_start... */
+    sim_time_t       button_press_start;
+    sim_time_t       button_press_end;      /**< ...until this time. */
+    sim_time_t       boot_time;
+    int32_t          clock_ppb;             /**< Deviation of the HFCLK of this node, in parts per billion. */
+    uint64_t         seed;
+    int8_t           rx_dbm;                /**< Level at which this node hears other nodes. */
+    int8_t           noise_floor_dbm;
+    uint8_t          base_loss_percent;
+    uint8_t          noise_band_count;
+    sim_noise_band_t noise_bands[SIM_MAX_NOISE_BANDS];
+} sim_msg_config_t;
+
+typedef struct
+{
+    sim_time_t horizon;
+} sim_msg_run_t;
+
+typedef struct
+{
+    sim_time_t now;
+    sim_time_t wake;        /**< Time of the next local event, or SIM_TIME_NEVER. */
+} sim_msg_yield_t;
+
+/**@brief A transmission on the shared medium.
+ *
+ * @details The address is the logical address as seen on air: the prefix in bits 32-39 and
+ *          the used base address bytes below it. The PDU is stored in the RAM layout of the
+ *          transmitter (S0, LENGTH and S1 fields, then the payload), together with the
+ *          field sizes, so that the receiver can unpack it with its own packet configuration.
+ */
+typedef struct
+{
+    uint32_t   src_node;
+    sim_time_t t_start;     /**< Start of the preamble. */
+    sim_time_t t_address;   /**< End of the address (ADDRESS event). */
+    sim_time_t t_payload;   /**< End of the payload (PAYLOAD event). */
+    sim_time_t t_end;       /**< End of the CRC (END event). */
+    uint64_t   address;
+    uint32_t   crc;
+    uint8_t    channel;     /**< RADIO->FREQUENCY. */
+    uint8_t    mode;        /**< RADIO->MODE. */
+    uint8_t    balen;
+    uint8_t    crc_length;
+    uint8_t    s0_length;   /**< In bytes. */
+    uint8_t    length_bits;
+    uint8_t    s1_bits;
+    uint8_t    payload_length;
+    uint16_t   pdu_length;  /**< Bytes used in pdu[]. */
+    uint8_t    pdu[SIM_MAX_PDU_LENGTH];
+} sim_msg_tx_t;
+
+typedef struct
+{
+    uint32_t   src_node;
+    sim_time_t t_start;     /**< Start of the received transmission. */
+    sim_time_t t_end;
+    uint8_t    channel;
+    uint8_t    pipe;        /**< RADIO->RXMATCH. */
+    uint8_t    payload_length;
+    uint8_t    payload[32];
+} sim_msg_rx_t;
+
+typedef struct
+{
+    sim_time_t time;
+    uint32_t   out;
+} sim_msg_gpio_t;
+
+typedef struct
+{
+    sim_time_t time;
+} sim_msg_reset_t;
+
+/**@brief The 16 MHz clock is on while the crystal runs or starts up, or a TIMER runs. */
+typedef struct
+{
+    sim_time_t time;
+    uint32_t   hfclk_on;
+} sim_msg_clock_t;
+
+#endif // SIM_PROTO_H__
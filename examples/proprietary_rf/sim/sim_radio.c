@@ -0,0 +1,736 @@
+/* Copyright (c) 2016 Nordic Semiconductor. All Rights Reserved.
+ *
+ * The information contained herein is property of Nordic Semiconductor ASA.
+ * Terms and conditions of usage are described in detail in NORDIC
+ * SEMICONDUCTOR STANDARD SOFTWARE LICENSE AGREEMENT.
+ *
+ * Licensees are granted free, non-transferable use of the information. NO
+ * WARRANTY of ANY KIND is provided. This heading must NOT be removed from
+ * the file.
+ *
+ */
+
+/** @file
+ *
+ * @brief Simulated nRF51 RADIO.
+ *
+ * @details Models the radio state machine with its ramp-up and disable times, the shortcuts,
+ *          packet assembly from PACKETPTR according to PCNF0/PCNF1, address matching against
+ *          the enabled logical addresses, CRC generation and checking, and RSSI sampling.
+ *
+ *          Transmissions are announced to the kernel when they start. Transmissions of other
+ *          nodes arrive as notices; a notice is received if, when its address has been sent,
+ *          this radio has been listening on the same frequency and data rate since before the
+ *          address started and one of the enabled logical addresses matches. The packet is
+ *          corrupted if any other transmission on the frequency overlaps it, or by the random
+ *          loss configured for the frequency.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim_node.h"
+
+#define RADIO_RAMP_UP_TIME          SIM_US(130)
+#define RADIO_TX_DISABLE_TIME       SIM_US(4)
+#define RADIO_RX_DISABLE_TIME       SIM_US(1)
+#define RADIO_RSSI_TIME             4                   /**< 0.25 us. */
+#define RADIO_PREAMBLE_BITS         8
+#define RADIO_NOTICE_COUNT          32
+
+#define M_RADIO                     ((NRF_RADIO_Type *) NRF_RADIO_BASE)
+#define RADIO_REG_SET(reg, value)   SIM_REG_SET(NRF_RADIO_BASE, NRF_RADIO_Type, reg, value)
+
+typedef enum
+{
+    RADIO_EVT_READY,
+    RADIO_EVT_ADDRESS,
+    RADIO_EVT_PAYLOAD,
+    RADIO_EVT_END,
+    RADIO_EVT_DISABLED,
+    RADIO_EVT_RSSIEND,
+    RADIO_EVT_COUNT
+} radio_evt_t;
+
+static const uint32_t m_evt_offset[RADIO_EVT_COUNT] =
+{
+    offsetof(NRF_RADIO_Type, EVENTS_READY),
+    offsetof(NRF_RADIO_Type, EVENTS_ADDRESS),
+    offsetof(NRF_RADIO_Type, EVENTS_PAYLOAD),
+    offsetof(NRF_RADIO_Type, EVENTS_END),
+    offsetof(NRF_RADIO_Type, EVENTS_DISABLED),
+    offsetof(NRF_RADIO_Type, EVENTS_RSSIEND),
+};
+
+typedef struct
+{
+    sim_msg_tx_t tx;
+    bool         checked;       /**< Address match has been evaluated. */
+} radio_notice_t;
+
+static uint32_t       m_state;
+static uint32_t       m_channel;          /**< FREQUENCY, sampled at ramp-up. */
+static sim_time_t     m_evt_time[RADIO_EVT_COUNT];
+static sim_time_t     m_listen_since;
+static bool           m_transmitting;
+static bool           m_receiving;
+static sim_msg_tx_t   m_rx;
+static radio_notice_t m_notices[RADIO_NOTICE_COUNT];
+static uint32_t       m_notice_next;
+
+static void radio_task(uint32_t offset, sim_time_t t);
+static sim_time_t radio_next(void);
+static void radio_run(sim_time_t t);
+
+static sim_periph_t m_radio =
+{
+    .base       = NRF_RADIO_BASE,
+    .irqn       = RADIO_IRQn,
+    .has_inten  = true,
+    .task       = radio_task,
+    .next_event = radio_next,
+    .run        = radio_run,
+};
+
+
+static void state_set(uint32_t state)
+{
+    m_state = state;
+    RADIO_REG_SET(STATE, state);
+}
+
+
+static sim_time_t bit_time(uint32_t mode)
+{
+    switch (mode & RADIO_MODE_MODE_Msk)
+    {
+        case RADIO_MODE_MODE_Nrf_2Mbit:
+            return SIM_TICKS_PER_US / 2;
+
+        case RADIO_MODE_MODE_Nrf_250Kbit:
+            return SIM_TICKS_PER_US * 4;
+
+        default:
+            return SIM_TICKS_PER_US;
+    }
+}
+
+
+static uint32_t balen(void)
+{
+    return (M_RADIO->PCNF1 & RADIO_PCNF1_BALEN_Msk) >> RADIO_PCNF1_BALEN_Pos;
+}
+
+
+/**@brief On-air logical address @p index: prefix in bits 32-39, used base bytes below. */
+static uint64_t logical_address(uint32_t index)
+{
+    uint32_t base   = index == 0 ? M_RADIO->BASE0 : M_RADIO->BASE1;
+    uint32_t prefix = index < 4 ? M_RADIO->PREFIX0 >> (8 * index) : M_RADIO->PREFIX1 >> (8 * (index - 4));
+    uint32_t bytes  = balen();
+    uint32_t mask   = bytes >= 4 ? 0xFFFFFFFF : ~(0xFFFFFFFFUL >> (8 * bytes));
+
+    return ((uint64_t)(prefix & 0xFF) << 32) | (base & mask);
+}
+
+
+static uint32_t crc_length(void)
+{
+    return (M_RADIO->CRCCNF & RADIO_CRCCNF_LEN_Msk) >> RADIO_CRCCNF_LEN_Pos;
+}
+
+
+static void crc_bits(uint32_t * p_crc, uint32_t value, uint32_t bits, uint32_t length)
+{
+    uint32_t width = 8 * length;
+    uint32_t top   = 1UL << (width - 1);
+    uint32_t mask  = width >= 32 ? 0xFFFFFFFF : (1UL << width) - 1;
+    uint32_t poly  = M_RADIO->CRCPOLY & mask;
+
+    while (bits-- > 0)
+    {
+        uint32_t in  = (value >> bits) & 1;
+        uint32_t msb = (*p_crc & top) ? 1 : 0;
+
+        *p_crc = (*p_crc << 1) & mask;
+        if (msb ^ in)
+        {
+            *p_crc ^= poly;
+        }
+    }
+}
+
+
+/**@brief CRC of a packet, computed with the local CRC configuration over the on-air fields. */
+static uint32_t crc_compute(sim_msg_tx_t const * p_tx)
+{
+    uint32_t length = crc_length();
+    uint32_t crc;
+    uint32_t pos    = 0;
+
+    if (length == 0)
+    {
+        return 0;
+    }
+
+    crc = M_RADIO->CRCINIT & ((1ULL << (8 * length)) - 1);
+
+    if ((M_RADIO->CRCCNF & RADIO_CRCCNF_SKIPADDR_Msk) == 0)
+    {
+        crc_bits(&crc, (uint32_t)(p_tx->address >> 32), 8, length);
+        crc_bits(&crc, (uint32_t)p_tx->address >> (8 * (4 - p_tx->balen)), 8 * p_tx->balen, length);
+    }
+
+    if (p_tx->s0_length)
+    {
+        crc_bits(&crc, p_tx->pdu[pos++], 8, length);
+    }
+    if (p_tx->length_bits)
+    {
+        crc_bits(&crc, p_tx->pdu[pos++], p_tx->length_bits, length);
+    }
+    if (p_tx->s1_bits)
+    {
+        crc_bits(&crc, p_tx->pdu[pos++], p_tx->s1_bits, length);
+    }
+    for (uint32_t i = 0; i < p_tx->payload_length; i++)
+    {
+        crc_bits(&crc, p_tx->pdu[pos + i], 8, length);
+    }
+
+    return crc;
+}
+
+
+static void evt_schedule(radio_evt_t evt, sim_time_t t)
+{
+    m_evt_time[evt] = t;
+}
+
+
+static void evt_cancel_packet(void)
+{
+    m_evt_time[RADIO_EVT_ADDRESS] = SIM_TIME_NEVER;
+    m_evt_time[RADIO_EVT_PAYLOAD] = SIM_TIME_NEVER;
+    m_evt_time[RADIO_EVT_END]     = SIM_TIME_NEVER;
+    m_transmitting                = false;
+    m_receiving                   = false;
+}
+
+
+static void tx_start(sim_time_t t)
+{
+    sim_msg_tx_t tx;
+    uint32_t     pcnf0     = M_RADIO->PCNF0;
+    uint32_t     pcnf1     = M_RADIO->PCNF1;
+    uint32_t     maxlen    = (pcnf1 & RADIO_PCNF1_MAXLEN_Msk) >> RADIO_PCNF1_MAXLEN_Pos;
+    uint32_t     statlen   = (pcnf1 & RADIO_PCNF1_STATLEN_Msk) >> RADIO_PCNF1_STATLEN_Pos;
+    uint32_t     header;
+    uint32_t     length;
+    uint8_t      ram[3]    = {0};
+    sim_time_t   bt        = bit_time(M_RADIO->MODE);
+
+    memset(&tx, 0, sizeof(tx));
+    tx.src_node    = m_sim_node.config.node_id;
+    tx.channel     = m_channel;
+    tx.mode        = M_RADIO->MODE & RADIO_MODE_MODE_Msk;
+    tx.balen       = balen();
+    tx.crc_length  = crc_length();
+    tx.s0_length   = (pcnf0 & RADIO_PCNF0_S0LEN_Msk) >> RADIO_PCNF0_S0LEN_Pos;
+    tx.length_bits = (pcnf0 & RADIO_PCNF0_LFLEN_Msk) >> RADIO_PCNF0_LFLEN_Pos;
+    tx.s1_bits     = (pcnf0 & RADIO_PCNF0_S1LEN_Msk) >> RADIO_PCNF0_S1LEN_Pos;
+    tx.address     = logical_address(M_RADIO->TXADDRESS & 7);
+
+    header = tx.s0_length + (tx.length_bits ? 1 : 0) + (tx.s1_bits ? 1 : 0);
+    if (sim_ram_valid(M_RADIO->PACKETPTR, header))
+    {
+        memcpy(ram, (void *)(uintptr_t)M_RADIO->PACKETPTR, header);
+    }
+
+    length = statlen;
+    if (tx.length_bits)
+    {
+        length += ram[tx.s0_length] & ((1U << tx.length_bits) - 1);
+    }
+    if (length > maxlen)
+    {
+        length = maxlen;
+    }
+    if (header + length > SIM_MAX_PDU_LENGTH)
+    {
+        length = SIM_MAX_PDU_LENGTH - header;
+    }
+
+    tx.payload_length = length;
+    tx.pdu_length     = header + length;
+    if (sim_ram_valid(M_RADIO->PACKETPTR, tx.pdu_length))
+    {
+        memcpy(tx.pdu, (void *)(uintptr_t)M_RADIO->PACKETPTR, tx.pdu_length);
+    }
+    tx.crc = crc_compute(&tx);
+
+    tx.t_start   = t;
+    tx.t_address = t + bt * (RADIO_PREAMBLE_BITS + 8 * (tx.balen + 1));
+    tx.t_payload = tx.t_address + bt * (8 * tx.s0_length + tx.length_bits + tx.s1_bits + 8 * length);
+    tx.t_end     = tx.t_payload + bt * 8 * tx.crc_length;
+
+    m_transmitting = true;
+    state_set(RADIO_STATE_STATE_Tx);
+    evt_schedule(RADIO_EVT_ADDRESS, tx.t_address);
+    evt_schedule(RADIO_EVT_PAYLOAD, tx.t_payload);
+    evt_schedule(RADIO_EVT_END, tx.t_end);
+
+    sim_kernel_send(SIM_MSG_TX, &tx, sizeof(tx));
+
+    // Hand control back so that the other nodes learn about the transmission in time.
+    m_sim_node.horizon = t;
+}
+
+
+static int8_t noise_dbm(uint32_t channel, uint32_t * p_loss_percent)
+{
+    sim_msg_config_t const * p_cfg = &m_sim_node.config;
+    int8_t                   dbm   = p_cfg->noise_floor_dbm;
+
+    *p_loss_percent = p_cfg->base_loss_percent;
+
+    for (uint32_t i = 0; i < p_cfg->noise_band_count; i++)
+    {
+        sim_noise_band_t const * p_band = &p_cfg->noise_bands[i];
+
+        if (m_sim_node.now < p_band->start || m_sim_node.now >= p_band->end)
+        {
+            continue;
+        }
+
+        if (channel >= p_band->lo_channel && channel <= p_band->hi_channel)
+        {
+            if (p_band->dbm > dbm)
+            {
+                dbm = p_band->dbm;
+            }
+            if (p_band->loss_percent > *p_loss_percent)
+            {
+                *p_loss_percent = p_band->loss_percent;
+            }
+        }
+    }
+
+    return dbm;
+}
+
+
+static void rssi_sample(sim_time_t t)
+{
+    uint32_t channel = m_channel;
+    uint32_t loss;
+    int32_t  dbm     = noise_dbm(channel, &loss);
+
+    for (uint32_t i = 0; i < RADIO_NOTICE_COUNT; i++)
+    {
+        sim_msg_tx_t const * p_tx = &m_notices[i].tx;
+
+        if (p_tx->t_end != 0 && p_tx->channel == channel &&
+            p_tx->t_start <= t && t < p_tx->t_end && m_sim_node.config.rx_dbm > dbm)
+        {
+            dbm = m_sim_node.config.rx_dbm;
+        }
+    }
+
+    // A couple of dB of measurement spread.
+    dbm += (int32_t)(sim_random() % 5) - 2;
+    if (dbm > 0)
+    {
+        dbm = 0;
+    }
+    if (dbm < -127)
+    {
+        dbm = -127;
+    }
+
+    RADIO_REG_SET(RSSISAMPLE, (uint32_t)(-dbm));
+}
+
+
+static void radio_disable(sim_time_t t)
+{
+    switch (m_state)
+    {
+        case RADIO_STATE_STATE_TxRu:
+        case RADIO_STATE_STATE_TxIdle:
+        case RADIO_STATE_STATE_Tx:
+            state_set(RADIO_STATE_STATE_TxDisable);
+            m_evt_time[RADIO_EVT_READY] = SIM_TIME_NEVER;
+            evt_cancel_packet();
+            evt_schedule(RADIO_EVT_DISABLED, t + RADIO_TX_DISABLE_TIME);
+            break;
+
+        case RADIO_STATE_STATE_RxRu:
+        case RADIO_STATE_STATE_RxIdle:
+        case RADIO_STATE_STATE_Rx:
+            state_set(RADIO_STATE_STATE_RxDisable);
+            m_evt_time[RADIO_EVT_READY]   = SIM_TIME_NEVER;
+            m_evt_time[RADIO_EVT_RSSIEND] = SIM_TIME_NEVER;
+            evt_cancel_packet();
+            evt_schedule(RADIO_EVT_DISABLED, t + RADIO_RX_DISABLE_TIME);
+            break;
+
+        case RADIO_STATE_STATE_Disabled:
+            // DISABLE in the DISABLED state still produces the event.
+            evt_schedule(RADIO_EVT_DISABLED, t);
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+static void radio_task(uint32_t offset, sim_time_t t)
+{
+    SIM_TRACE("radio task %03x state %u", offset, m_state);
+
+    // The radio only works on the 16 MHz crystal. Catch firmware that stops it too long.
+    if ((offset == offsetof(NRF_RADIO_Type, TASKS_TXEN) || offset == offsetof(NRF_RADIO_Type, TASKS_RXEN)) &&
+        !sim_clock_hfxo_running())
+    {
+        fprintf(stderr, "node %u: radio enabled without the 16 MHz crystal\n", m_sim_node.config.node_id);
+        exit(EXIT_FAILURE);
+    }
+
+    switch (offset)
+    {
+        case offsetof(NRF_RADIO_Type, TASKS_TXEN):
+            if (m_state == RADIO_STATE_STATE_Disabled)
+            {
+                state_set(RADIO_STATE_STATE_TxRu);
+                m_channel = M_RADIO->FREQUENCY & 0x7F;
+                evt_schedule(RADIO_EVT_READY, t + RADIO_RAMP_UP_TIME);
+            }
+            break;
+
+        case offsetof(NRF_RADIO_Type, TASKS_RXEN):
+            if (m_state == RADIO_STATE_STATE_Disabled)
+            {
+                state_set(RADIO_STATE_STATE_RxRu);
+                m_channel = M_RADIO->FREQUENCY & 0x7F;
+                evt_schedule(RADIO_EVT_READY, t + RADIO_RAMP_UP_TIME);
+            }
+            break;
+
+        case offsetof(NRF_RADIO_Type, TASKS_START):
+            if (m_state == RADIO_STATE_STATE_TxIdle)
+            {
+                tx_start(t);
+            }
+            else if (m_state == RADIO_STATE_STATE_RxIdle)
+            {
+                state_set(RADIO_STATE_STATE_Rx);
+                m_listen_since = t;
+            }
+            break;
+
+        case offsetof(NRF_RADIO_Type, TASKS_STOP):
+            if (m_state == RADIO_STATE_STATE_Tx)
+            {
+                evt_cancel_packet();
+                state_set(RADIO_STATE_STATE_TxIdle);
+            }
+            else if (m_state == RADIO_STATE_STATE_Rx)
+            {
+                evt_cancel_packet();
+                state_set(RADIO_STATE_STATE_RxIdle);
+            }
+            break;
+
+        case offsetof(NRF_RADIO_Type, TASKS_DISABLE):
+            radio_disable(t);
+            break;
+
+        case offsetof(NRF_RADIO_Type, TASKS_RSSISTART):
+            if (m_state == RADIO_STATE_STATE_Rx)
+            {
+                evt_schedule(RADIO_EVT_RSSIEND, t + RADIO_RSSI_TIME);
+            }
+            break;
+
+        case offsetof(NRF_RADIO_Type, TASKS_RSSISTOP):
+            m_evt_time[RADIO_EVT_RSSIEND] = SIM_TIME_NEVER;
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+/**@brief Decide whether the notice, whose address ends now, is picked up by this radio. */
+static void rx_check(sim_msg_tx_t const * p_tx)
+{
+    sim_time_t bt = bit_time(p_tx->mode);
+
+    if (m_state != RADIO_STATE_STATE_Rx || m_receiving ||
+        m_channel != p_tx->channel ||
+        (M_RADIO->MODE & RADIO_MODE_MODE_Msk) != p_tx->mode ||
+        balen() != p_tx->balen ||
+        m_listen_since > p_tx->t_start + bt * RADIO_PREAMBLE_BITS)
+    {
+        return;
+    }
+
+    for (uint32_t i = 0; i < 8; i++)
+    {
+        if ((M_RADIO->RXADDRESSES & (1UL << i)) && logical_address(i) == p_tx->address)
+        {
+            m_rx        = *p_tx;
+            m_receiving = true;
+            RADIO_REG_SET(RXMATCH, i);
+            evt_schedule(RADIO_EVT_ADDRESS, p_tx->t_address);
+            evt_schedule(RADIO_EVT_PAYLOAD, p_tx->t_payload);
+            evt_schedule(RADIO_EVT_END, p_tx->t_end);
+            return;
+        }
+    }
+}
+
+
+/**@brief Complete a reception: store the packet at PACKETPTR and set the CRC status. */
+static void rx_end(void)
+{
+    uint32_t pcnf0   = M_RADIO->PCNF0;
+    uint32_t pcnf1   = M_RADIO->PCNF1;
+    uint32_t s0len   = (pcnf0 & RADIO_PCNF0_S0LEN_Msk) >> RADIO_PCNF0_S0LEN_Pos;
+    uint32_t lflen   = (pcnf0 & RADIO_PCNF0_LFLEN_Msk) >> RADIO_PCNF0_LFLEN_Pos;
+    uint32_t s1len   = (pcnf0 & RADIO_PCNF0_S1LEN_Msk) >> RADIO_PCNF0_S1LEN_Pos;
+    uint32_t maxlen  = (pcnf1 & RADIO_PCNF1_MAXLEN_Msk) >> RADIO_PCNF1_MAXLEN_Pos;
+    uint32_t loss;
+    uint32_t crc     = crc_compute(&m_rx);
+    bool     ok      = crc_length() == m_rx.crc_length && crc == m_rx.crc;
+    uint8_t  buf[SIM_MAX_PDU_LENGTH];
+    uint32_t pos     = 0;
+    uint32_t src     = 0;
+    uint32_t length  = m_rx.payload_length;
+
+    // Same frame format is required to decode the header the way it was sent.
+    if (s0len != m_rx.s0_length || lflen != m_rx.length_bits || s1len != m_rx.s1_bits || length > maxlen)
+    {
+        ok = false;
+    }
+    if (length > maxlen)
+    {
+        length = maxlen;
+    }
+
+    for (uint32_t i = 0; i < RADIO_NOTICE_COUNT && ok; i++)
+    {
+        sim_msg_tx_t const * p_tx = &m_notices[i].tx;
+
+        if (p_tx->t_end != 0 && p_tx->channel == m_rx.channel &&
+            !(p_tx->src_node == m_rx.src_node && p_tx->t_start == m_rx.t_start) &&
+            p_tx->t_start < m_rx.t_end && m_rx.t_start < p_tx->t_end)
+        {
+            ok = false;
+        }
+    }
+
+    (void)noise_dbm(m_rx.channel, &loss);
+    if (ok && loss > 0 && sim_random() % 100 < loss)
+    {
+        ok = false;
+    }
+
+    if (m_rx.s0_length)
+    {
+        buf[pos++] = m_rx.pdu[src++];
+    }
+    if (m_rx.length_bits)
+    {
+        buf[pos++] = m_rx.pdu[src++];
+    }
+    if (m_rx.s1_bits)
+    {
+        buf[pos++] = m_rx.pdu[src++];
+    }
+    memcpy(&buf[pos], &m_rx.pdu[src], length);
+    pos += length;
+
+    if (sim_ram_valid(M_RADIO->PACKETPTR, pos))
+    {
+        memcpy((void *)(uintptr_t)M_RADIO->PACKETPTR, buf, pos);
+    }
+
+    RADIO_REG_SET(RXCRC, crc);
+    RADIO_REG_SET(CRCSTATUS, ok ? 1 : 0);
+
+    if (ok)
+    {
+        sim_msg_rx_t msg;
+
+        memset(&msg, 0, sizeof(msg));
+        msg.src_node       = m_rx.src_node;
+        msg.t_start        = m_rx.t_start;
+        msg.t_end          = m_rx.t_end;
+        msg.channel        = m_rx.channel;
+        msg.pipe           = M_RADIO->RXMATCH;
+        msg.payload_length = length;
+        memcpy(msg.payload, &m_rx.pdu[src], length < sizeof(msg.payload) ? length : sizeof(msg.payload));
+        sim_kernel_send(SIM_MSG_RX, &msg, sizeof(msg));
+    }
+}
+
+
+static sim_time_t radio_next(void)
+{
+    sim_time_t next = SIM_TIME_NEVER;
+
+    for (uint32_t i = 0; i < RADIO_EVT_COUNT; i++)
+    {
+        if (m_evt_time[i] < next)
+        {
+            next = m_evt_time[i];
+        }
+    }
+
+    for (uint32_t i = 0; i < RADIO_NOTICE_COUNT; i++)
+    {
+        if (!m_notices[i].checked && m_notices[i].tx.t_address < next)
+        {
+            next = m_notices[i].tx.t_address;
+        }
+    }
+
+    return next;
+}
+
+
+static void radio_event(radio_evt_t evt, sim_time_t t)
+{
+    uint32_t shorts = M_RADIO->SHORTS;
+
+    m_evt_time[evt] = SIM_TIME_NEVER;
+    SIM_TRACE("radio event %03x state %u", m_evt_offset[evt], m_state);
+
+    switch (evt)
+    {
+        case RADIO_EVT_READY:
+            state_set(m_state == RADIO_STATE_STATE_TxRu ? RADIO_STATE_STATE_TxIdle : RADIO_STATE_STATE_RxIdle);
+            sim_event_generate(&m_radio, m_evt_offset[evt], t);
+            if (shorts & RADIO_SHORTS_READY_START_Msk)
+            {
+                radio_task(offsetof(NRF_RADIO_Type, TASKS_START), t);
+            }
+            break;
+
+        case RADIO_EVT_ADDRESS:
+            sim_event_generate(&m_radio, m_evt_offset[evt], t);
+            if ((shorts & RADIO_SHORTS_ADDRESS_RSSISTART_Msk) && m_state == RADIO_STATE_STATE_Rx)
+            {
+                radio_task(offsetof(NRF_RADIO_Type, TASKS_RSSISTART), t);
+            }
+            break;
+
+        case RADIO_EVT_PAYLOAD:
+            sim_event_generate(&m_radio, m_evt_offset[evt], t);
+            break;
+
+        case RADIO_EVT_END:
+            if (m_receiving)
+            {
+                rx_end();
+                m_receiving = false;
+                state_set(RADIO_STATE_STATE_RxIdle);
+            }
+            else
+            {
+                m_transmitting = false;
+                state_set(RADIO_STATE_STATE_TxIdle);
+            }
+            sim_event_generate(&m_radio, m_evt_offset[evt], t);
+            if (shorts & RADIO_SHORTS_END_DISABLE_Msk)
+            {
+                radio_task(offsetof(NRF_RADIO_Type, TASKS_DISABLE), t);
+            }
+            else if (shorts & RADIO_SHORTS_END_START_Msk)
+            {
+                radio_task(offsetof(NRF_RADIO_Type, TASKS_START), t);
+            }
+            break;
+
+        case RADIO_EVT_DISABLED:
+            state_set(RADIO_STATE_STATE_Disabled);
+            sim_event_generate(&m_radio, m_evt_offset[evt], t);
+            if (shorts & RADIO_SHORTS_DISABLED_TXEN_Msk)
+            {
+                radio_task(offsetof(NRF_RADIO_Type, TASKS_TXEN), t);
+            }
+            else if (shorts & RADIO_SHORTS_DISABLED_RXEN_Msk)
+            {
+                radio_task(offsetof(NRF_RADIO_Type, TASKS_RXEN), t);
+            }
+            if (shorts & RADIO_SHORTS_DISABLED_RSSISTOP_Msk)
+            {
+                radio_task(offsetof(NRF_RADIO_Type, TASKS_RSSISTOP), t);
+            }
+            break;
+
+        case RADIO_EVT_RSSIEND:
+            rssi_sample(t);
+            sim_event_generate(&m_radio, m_evt_offset[evt], t);
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+static void radio_run(sim_time_t t)
+{
+    for (uint32_t i = 0; i < RADIO_NOTICE_COUNT; i++)
+    {
+        if (!m_notices[i].checked && m_notices[i].tx.t_address <= t)
+        {
+            m_notices[i].checked = true;
+            rx_check(&m_notices[i].tx);
+        }
+    }
+
+    for (uint32_t i = 0; i < RADIO_EVT_COUNT; i++)
+    {
+        if (m_evt_time[i] <= t)
+        {
+            radio_event((radio_evt_t)i, t);
+        }
+    }
+}
+
+
+void sim_radio_tx_notice(sim_msg_tx_t const * p_tx)
+{
+    radio_notice_t * p_notice = &m_notices[m_notice_next];
+
+    m_notice_next = (m_notice_next + 1) % RADIO_NOTICE_COUNT;
+
+    p_notice->tx      = *p_tx;
+    p_notice->checked = false;
+}
+
+
+void sim_radio_init(void)
+{
+    for (uint32_t i = 0; i < RADIO_EVT_COUNT; i++)
+    {
+        m_evt_time[i] = SIM_TIME_NEVER;
+    }
+
+    state_set(RADIO_STATE_STATE_Disabled);
+    RADIO_REG_SET(INTENCLR, 0xFFFFFFFF);
+
+    // Notices that arrived before the node booted cannot be received any more.
+    for (uint32_t i = 0; i < RADIO_NOTICE_COUNT; i++)
+    {
+        m_notices[i].checked = true;
+    }
+
+    sim_periph_register(&m_radio);
+}
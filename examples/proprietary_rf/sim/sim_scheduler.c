@@ -0,0 +1,22 @@
+/* Copyright (c) 2016 Nordic Semiconductor. All Rights Reserved.
+ *
+ * The information contained herein is property of Nordic Semiconductor ASA.
+ * Terms and conditions of usage are described in detail in NORDIC
+ * SEMICONDUCTOR STANDARD SOFTWARE LICENSE AGREEMENT.
+ *
+ * Licensees are granted free, non-transferable use of the information. NO
+ * WARRANTY of ANY KIND is provided. This heading must NOT be removed from
+ * the file.
+ *
+ */
+
+/** @file
+ *
+ * @brief Host build of the SDK scheduler.
+ *
+ * @details app_scheduler.c includes its header from its own directory. Including hal/app_scheduler.h
+ *          first sizes the event header for the host pointers there too.
+ */
+
+#include "app_scheduler.h"
+#include "app_scheduler.c"
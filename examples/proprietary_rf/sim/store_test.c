@@ -0,0 +1,375 @@
+/* Copyright (c) 2016 Nordic Semiconductor. All Rights Reserved.
+ *
+ * The information contained herein is property of Nordic Semiconductor ASA.
+ * Terms and conditions of usage are described in detail in NORDIC
+ * SEMICONDUCTOR STANDARD SOFTWARE LICENSE AGREEMENT.
+ *
+ * Licensees are granted free, non-transferable use of the information. NO
+ * WARRANTY of ANY KIND is provided. This heading must NOT be removed from
+ * the file.
+ *
+ */
+
+/** @file
+ *
+ * @brief Host unit test of the configuration store.
+ *
+ * @details Runs app_store on flash pages mapped at their nRF51 address, with a stub NVMC that is
+ *          always ready. Every step of a write is checked to program at most one erased word,
+ *          and resets are simulated by starting the store over at any point of a write.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "nrf.h"
+#include "nrf_error.h"
+#include "app_store.h"
+
+#define PAGE_SIZE               1024
+#define STORE_ADDRESS           (APP_STORE_FIRST_PAGE * PAGE_SIZE)
+#define STORE_SIZE              (APP_STORE_PAGES * PAGE_SIZE)
+#define STORE_WORDS             (STORE_SIZE / sizeof(uint32_t))
+#define MAX_WORDS               (APP_STORE_MAX_LENGTH / sizeof(uint32_t))
+
+static uint32_t m_failures;
+
+#define CHECK(cond)                                                             \
+do                                                                              \
+{                                                                               \
+    if (!(cond))                                                                \
+    {                                                                           \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        m_failures++;                                                           \
+    }                                                                           \
+} while (0)
+
+
+// Peripheral stubs
+static NRF_FICR_Type    m_ficr;
+static NRF_NVMC_Type    m_nvmc;
+static uint32_t       * mp_flash;
+static uint32_t         m_shadow[STORE_WORDS];  /**< Flash as programmed, to check the writes against. */
+static uint32_t         m_erases;
+
+void * sim_periph_access(uint32_t base_address)
+{
+    // A page erase takes effect on the next access, as the NVMC would finish it.
+    if (m_nvmc.ERASEPAGE != 0)
+    {
+        uint32_t address = m_nvmc.ERASEPAGE;
+
+        m_nvmc.ERASEPAGE = 0;
+        CHECK((m_nvmc.CONFIG & NVMC_CONFIG_WEN_Msk) == NVMC_CONFIG_WEN_Een);
+        CHECK(address >= STORE_ADDRESS && address < STORE_ADDRESS + STORE_SIZE && address % PAGE_SIZE == 0);
+        if (address >= STORE_ADDRESS && address < STORE_ADDRESS + STORE_SIZE)
+        {
+            memset((uint8_t *)mp_flash + (address - STORE_ADDRESS), 0xFF, PAGE_SIZE);
+            memset((uint8_t *)m_shadow + (address - STORE_ADDRESS), 0xFF, PAGE_SIZE);
+        }
+        m_erases++;
+    }
+
+    switch (base_address)
+    {
+        case NRF_FICR_BASE:
+            return &m_ficr;
+        case NRF_NVMC_BASE:
+            return &m_nvmc;
+        default:
+            fprintf(stderr, "store_test: unexpected peripheral 0x%08x\n", base_address);
+            exit(EXIT_FAILURE);
+    }
+}
+
+void sim_cpu_irq_enable(void)
+{
+}
+
+void sim_cpu_irq_disable(void)
+{
+}
+
+
+/**@brief Function for checking that the flash changed by at most one word, with flash semantics. */
+static uint32_t flash_commit(void)
+{
+    uint32_t written = 0;
+
+    for (uint32_t i = 0; i < STORE_WORDS; i++)
+    {
+        if (mp_flash[i] != m_shadow[i])
+        {
+            CHECK((m_nvmc.CONFIG & NVMC_CONFIG_WEN_Msk) == NVMC_CONFIG_WEN_Wen);
+            CHECK(m_shadow[i] == 0xFFFFFFFF);
+            m_shadow[i] = mp_flash[i];
+            written++;
+        }
+    }
+    CHECK(written <= 1);
+    return written;
+}
+
+
+/**@brief Function for running the store until the write is done. */
+static uint32_t store_flush(void)
+{
+    uint32_t written = 0;
+    uint32_t steps   = 0;
+
+    while (app_store_is_busy() && steps++ < 2 * STORE_WORDS)
+    {
+        app_store_process();
+        written += flash_commit();
+    }
+    app_store_process();
+    CHECK(!app_store_is_busy());
+    CHECK((m_nvmc.CONFIG & NVMC_CONFIG_WEN_Msk) == NVMC_CONFIG_WEN_Ren);
+    return written;
+}
+
+
+/**@brief Function for starting the store over, as after a reset. */
+static void store_reset(void)
+{
+    m_nvmc.CONFIG = (NVMC_CONFIG_WEN_Ren << NVMC_CONFIG_WEN_Pos);
+    app_store_init();
+    flash_commit();
+    CHECK((m_nvmc.CONFIG & NVMC_CONFIG_WEN_Msk) == NVMC_CONFIG_WEN_Ren);
+}
+
+
+static void record_fill(uint32_t * p_data, uint32_t words, uint32_t seed)
+{
+    for (uint32_t i = 0; i < words; i++)
+    {
+        p_data[i] = seed * 0x9E3779B9UL + i;
+    }
+}
+
+
+static bool record_matches(uint32_t words, uint32_t seed)
+{
+    uint32_t expected[MAX_WORDS];
+    uint32_t data[MAX_WORDS];
+
+    record_fill(expected, words, seed);
+    return app_store_read(data, words * sizeof(uint32_t)) == NRF_SUCCESS &&
+           memcmp(data, expected, words * sizeof(uint32_t)) == 0;
+}
+
+
+static void flash_clear(void)
+{
+    memset(mp_flash, 0xFF, STORE_SIZE);
+    memset(m_shadow, 0xFF, STORE_SIZE);
+    store_reset();
+}
+
+
+static void test_arguments(void)
+{
+    uint32_t data[MAX_WORDS + 1] = {0};
+
+    flash_clear();
+    CHECK(app_store_read(data, 4) == NRF_ERROR_NOT_FOUND);
+    CHECK(app_store_read(NULL, 4) == NRF_ERROR_NULL);
+    CHECK(app_store_write(NULL, 4) == NRF_ERROR_NULL);
+    CHECK(app_store_write(data, 0) == NRF_ERROR_INVALID_LENGTH);
+    CHECK(app_store_write(data, 6) == NRF_ERROR_INVALID_LENGTH);
+    CHECK(app_store_write(data, APP_STORE_MAX_LENGTH + 4) == NRF_ERROR_INVALID_LENGTH);
+    CHECK(!app_store_is_busy());
+
+    CHECK(app_store_write(data, 8) == NRF_SUCCESS);
+    CHECK(app_store_read(data, 12) == NRF_ERROR_INVALID_LENGTH);
+    CHECK(app_store_read(data, 8) == NRF_SUCCESS);
+}
+
+
+static void test_write_read(void)
+{
+    uint32_t data[MAX_WORDS];
+    uint32_t written;
+
+    flash_clear();
+    record_fill(data, 17, 1);
+    CHECK(app_store_write(data, 17 * sizeof(uint32_t)) == NRF_SUCCESS);
+
+    // Nothing is programmed until the main loop runs the store, but the record reads back.
+    CHECK(flash_commit() == 0);
+    CHECK(app_store_is_busy());
+    CHECK(record_matches(17, 1));
+
+    // Page header, record header, data and check word.
+    written = store_flush();
+    CHECK(written == 2 + 1 + 17 + 1);
+
+    store_reset();
+    CHECK(record_matches(17, 1));
+}
+
+
+static void test_coalesce(void)
+{
+    uint32_t data[MAX_WORDS];
+
+    flash_clear();
+    record_fill(data, 4, 2);
+    app_store_write(data, 4 * sizeof(uint32_t));
+    record_fill(data, 4, 3);
+    app_store_write(data, 4 * sizeof(uint32_t));
+
+    // Only the newest data is written.
+    CHECK(store_flush() == 2 + 1 + 4 + 1);
+
+    // Data written during a write follows it.
+    record_fill(data, 4, 4);
+    app_store_write(data, 4 * sizeof(uint32_t));
+    app_store_process();
+    flash_commit();
+    record_fill(data, 4, 5);
+    app_store_write(data, 4 * sizeof(uint32_t));
+    CHECK(record_matches(4, 5));
+    store_flush();
+
+    store_reset();
+    CHECK(record_matches(4, 5));
+}
+
+
+static void test_rollover(void)
+{
+    uint32_t data[MAX_WORDS];
+    uint32_t seed;
+
+    // Across many power cycles, with one write each, the pages are used in turn and the only
+    // erases are the ones at boot.
+    flash_clear();
+    for (seed = 10; seed < 200; seed++)
+    {
+        uint32_t words = 1 + seed % MAX_WORDS;
+
+        record_fill(data, words, seed);
+        app_store_write(data, words * sizeof(uint32_t));
+        m_erases = 0;
+        store_flush();
+        CHECK(m_erases == 0);
+
+        store_reset();
+        CHECK(record_matches(words, seed));
+    }
+
+    // Within one power cycle, a write beyond the erased pages erases the oldest one.
+    for (seed = 200; seed < 260; seed++)
+    {
+        uint32_t words = MAX_WORDS;
+
+        record_fill(data, words, seed);
+        app_store_write(data, words * sizeof(uint32_t));
+        store_flush();
+        CHECK(record_matches(words, seed));
+    }
+    store_reset();
+    CHECK(record_matches(MAX_WORDS, seed - 1));
+}
+
+
+static void test_reset_during_write(void)
+{
+    uint32_t data[MAX_WORDS];
+    uint32_t words = 60;
+
+    // Stop at every step of a write of the record that opens a page, and of the one after it.
+    for (uint32_t record = 0; record < 2; record++)
+    {
+        for (uint32_t steps = 0; steps <= 2 + words + 2; steps++)
+        {
+            bool complete;
+
+            // Four records fill the first page.
+            flash_clear();
+            for (uint32_t seed = 1; seed <= 4 + record; seed++)
+            {
+                record_fill(data, words, seed);
+                app_store_write(data, words * sizeof(uint32_t));
+                store_flush();
+            }
+
+            record_fill(data, words, 100);
+            app_store_write(data, words * sizeof(uint32_t));
+            for (uint32_t i = 0; i < steps && app_store_is_busy(); i++)
+            {
+                app_store_process();
+                flash_commit();
+            }
+            complete = !app_store_is_busy();
+
+            // The check word is written last, so a torn record leaves the one before it in use.
+            store_reset();
+            CHECK(record_matches(words, complete ? 100 : 4 + record));
+
+            // The store keeps working after the reset.
+            record_fill(data, words, 101);
+            app_store_write(data, words * sizeof(uint32_t));
+            store_flush();
+            store_reset();
+            CHECK(record_matches(words, 101));
+        }
+    }
+}
+
+
+static void test_foreign_data(void)
+{
+    uint32_t data;
+
+    // Data of the raw store before, at the start of the last page, is not a record.
+    flash_clear();
+    mp_flash[STORE_WORDS - PAGE_SIZE / sizeof(uint32_t)]     = 0x1234567a;
+    mp_flash[STORE_WORDS - PAGE_SIZE / sizeof(uint32_t) + 1] = 0x00000001;
+    memcpy(m_shadow, mp_flash, STORE_SIZE);
+
+    m_erases = 0;
+    store_reset();
+    CHECK(m_erases == 1);
+    CHECK(app_store_read(&data, sizeof(data)) == NRF_ERROR_NOT_FOUND);
+    for (uint32_t i = 0; i < STORE_WORDS; i++)
+    {
+        CHECK(mp_flash[i] == 0xFFFFFFFF);
+    }
+}
+
+
+int main(void)
+{
+    mp_flash = mmap((void *)STORE_ADDRESS, STORE_SIZE, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (mp_flash != (void *)STORE_ADDRESS)
+    {
+        perror("mmap flash");
+        return EXIT_FAILURE;
+    }
+    // Read-only registers.
+    *(uint32_t *)&m_ficr.CODEPAGESIZE = PAGE_SIZE;
+    *(uint32_t *)&m_nvmc.READY        = NVMC_READY_READY_Ready;
+
+    test_arguments();
+    test_write_read();
+    test_coalesce();
+    test_rollover();
+    test_reset_during_write();
+    test_foreign_data();
+
+    if (m_failures > 0)
+    {
+        fprintf(stderr, "store_test: %u checks failed\n", m_failures);
+        return EXIT_FAILURE;
+    }
+
+    printf("store_test: %u pages of %u bytes, records of up to %u bytes\n",
+           APP_STORE_PAGES, PAGE_SIZE, APP_STORE_MAX_LENGTH);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,467 @@
+/* Copyright (c) 2016 Nordic Semiconductor. All Rights Reserved.
+ *
+ * The information contained herein is property of Nordic Semiconductor ASA.
+ * Terms and conditions of usage are described in detail in NORDIC
+ * SEMICONDUCTOR STANDARD SOFTWARE LICENSE AGREEMENT.
+ *
+ * Licensees are granted free, non-transferable use of the information. NO
+ * WARRANTY of ANY KIND is provided. This heading must NOT be removed from
+ * the file.
+ *
+ */
+
+/** @file
+ *
+ * @brief Host unit test of the TDMA slot scheduler.
+ *
+ * @details Checks the schedule arithmetic of app_tdma against the application schedule of both
+ *          schemes, and the hop sequencer and timed TX calls the scheduler makes.
+ *          The ESB functions are replaced by stubs that record their arguments.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "nrf_error.h"
+#include "nrf_esb.h"
+#include "app_config.h"
+#include "app_tdma.h"
+
+static uint32_t m_failures;
+
+#define CHECK(cond)                                                             \
+do                                                                              \
+{                                                                               \
+    if (!(cond))                                                                \
+    {                                                                           \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        m_failures++;                                                           \
+    }                                                                           \
+} while (0)
+
+
+// ESB stubs
+static struct
+{
+    uint32_t hop_starts;
+    uint16_t hop_period_us;
+    uint8_t  hop_count;
+    uint32_t hop_syncs;
+    uint8_t  sync_index;
+    uint16_t sync_ticks;
+    uint16_t tx_at_ticks;
+    uint32_t tx_at_result;
+    uint32_t tx_starts;
+    uint16_t tx_at_hop_ticks;
+    uint16_t tx_before_hop_ticks;
+    uint16_t hop_time_left;
+    uint32_t hop_time_left_result;
+    uint16_t deadline_ticks;
+} m_esb;
+
+uint32_t nrf_esb_hop_start(uint8_t const * p_channels, uint8_t count, uint16_t period_us)
+{
+    m_esb.hop_starts++;
+    m_esb.hop_count = count;
+    m_esb.hop_period_us = period_us;
+    m_esb.deadline_ticks = 0;
+    return NRF_SUCCESS;
+}
+
+uint32_t nrf_esb_hop_sync(uint8_t index, uint16_t ticks)
+{
+    m_esb.hop_syncs++;
+    m_esb.sync_index = index;
+    m_esb.sync_ticks = ticks;
+    return NRF_SUCCESS;
+}
+
+uint32_t nrf_esb_start_tx_at(uint16_t ticks)
+{
+    m_esb.tx_at_ticks = ticks;
+    return m_esb.tx_at_result;
+}
+
+uint32_t nrf_esb_start_tx(void)
+{
+    m_esb.tx_starts++;
+    return NRF_SUCCESS;
+}
+
+uint32_t nrf_esb_start_tx_at_hop(uint16_t ticks)
+{
+    m_esb.tx_at_hop_ticks = ticks;
+    return NRF_SUCCESS;
+}
+
+uint32_t nrf_esb_start_tx_before_hop(uint16_t ticks)
+{
+    m_esb.tx_before_hop_ticks = ticks;
+    return NRF_SUCCESS;
+}
+
+uint32_t nrf_esb_hop_time_left(uint16_t * p_ticks)
+{
+    *p_ticks = m_esb.hop_time_left;
+    return m_esb.hop_time_left_result;
+}
+
+uint32_t nrf_esb_hop_deadline_set(uint16_t ticks)
+{
+    m_esb.deadline_ticks = ticks;
+    return NRF_SUCCESS;
+}
+
+
+static const link_params_t       m_schemes[] = {SCHEME_1_LINK_PARAMS, SCHEME_2_LINK_PARAMS};
+static const uint8_t             m_channels[MAXIMUM_CHANNEL_LIST_SIZE] = DEFAULT_PAIRING_CHANNEL_LIST;
+static link_params_t             m_link;            /**< Link parameters of the scheme under test. */
+static app_tdma_schedule_t       m_app_schedule;
+
+
+static uint32_t gcd(uint32_t a, uint32_t b)
+{
+    while (b != 0)
+    {
+        uint32_t t = a % b;
+
+        a = b;
+        b = t;
+    }
+
+    return a;
+}
+
+
+static void test_airtime(void)
+{
+    // Preamble, 5-byte address, 9-bit PCF, payload and 16-bit CRC at 2 Mbps
+    CHECK(app_tdma_airtime_us(0) == 37);
+    CHECK(app_tdma_airtime_us(10) == 77);
+    CHECK(app_tdma_airtime_us(32) == 165);
+
+    // Response, box turnaround, acknowledgment and box turnaround back to RX
+    CHECK(app_tdma_slot_airtime_us(&m_app_schedule) == 165 + APP_TDMA_RAMP_UP_US + 37 + APP_TDMA_RAMP_UP_US);
+}
+
+
+static void test_app_schedule(void)
+{
+    app_tdma_schedule_t const * p = &m_app_schedule;
+    uint32_t                    slot_end;
+
+    CHECK(app_tdma_schedule_check(p) == NRF_SUCCESS);
+    CHECK(app_tdma_init(p) == NRF_SUCCESS);
+
+    // Every device asked in a cycle has a slot
+    CHECK(p->slot_count == APP_SLOTS_PER_FRAME);
+    CHECK(p->slot_count <= MAXIMUM_DEV);
+    CHECK(MAXIMUM_DEV <= MAXIMUM_PIPE_DEV || SHARED_PIPE_ADDRESSING);
+
+    // Slots follow each other without overlap
+    for (uint8_t slot = 1; slot < p->slot_count; slot++)
+    {
+        CHECK(app_tdma_slot_offset_us(slot) - app_tdma_slot_offset_us(slot - 1) >=
+              app_tdma_slot_airtime_us(p));
+    }
+
+    // The last acknowledgment ends before the devices retune for the next beacon
+    slot_end = APP_TDMA_RAMP_UP_US + app_tdma_airtime_us(p->beacon_length) +
+               app_tdma_slot_offset_us(p->slot_count - 1) + APP_TDMA_RAMP_UP_US +
+               app_tdma_slot_airtime_us(p);
+    CHECK(slot_end == app_tdma_frame_busy_us(p));
+    CHECK(slot_end + p->beacon_guard_us <= p->frame_period_us);
+
+    CHECK(m_link.chlist_size <= MAXIMUM_CHANNEL_LIST_SIZE);
+
+    // A scanning device meets the box: it holds a channel for a whole pass through the list, or
+    // moves against the box by a step that reaches every position of the list
+    CHECK(p->scan_frames >= m_link.chlist_size ||
+          gcd(p->scan_frames - 1, m_link.chlist_size) == 1);
+    CHECK(p->subframes == m_link.retry_count + 1);
+    CHECK(m_link.scheme == APP_SCHEME_2 || p->subframes == 1);
+}
+
+
+static void test_report_divisors(void)
+{
+    uint32_t cycles = DEV_REPORT_PERIOD;
+    uint32_t asked[MAXIMUM_DEV + 1] = {0};
+
+    // Devices of a type take turns, so no cycle asks more devices than the frame has slots
+    for (uint32_t cycle = 0; cycle < cycles; cycle++)
+    {
+        uint32_t count = 0;
+
+        for (uint8_t idx = 1; idx <= MAXIMUM_DEV; idx++)
+        {
+            if (cycle % DEV_REPORT_DIVISOR(idx) == DEV_REPORT_PHASE(idx))
+            {
+                asked[idx]++;
+                count++;
+            }
+        }
+        CHECK(count <= APP_SLOTS_PER_FRAME);
+    }
+
+    // Every device is asked once per divisor
+    for (uint8_t idx = 1; idx <= MAXIMUM_DEV; idx++)
+    {
+        CHECK(asked[idx] == cycles / DEV_REPORT_DIVISOR(idx));
+    }
+}
+
+
+static void test_schedule_limits(void)
+{
+    app_tdma_schedule_t s = m_app_schedule;
+
+    CHECK(app_tdma_schedule_check(NULL) == NRF_ERROR_NULL);
+
+    s = m_app_schedule;
+    s.slot_count = 0;
+    CHECK(app_tdma_schedule_check(&s) == NRF_ERROR_INVALID_PARAM);
+
+    s = m_app_schedule;
+    s.subframes = 0;
+    CHECK(app_tdma_schedule_check(&s) == NRF_ERROR_INVALID_PARAM);
+
+    // The flywheel ends before the sync does
+    s = m_app_schedule;
+    s.flywheel_frames = s.sync_timeout_frames;
+    CHECK(app_tdma_schedule_check(&s) == NRF_ERROR_INVALID_PARAM);
+    s.flywheel_frames--;
+    CHECK(app_tdma_schedule_check(&s) == NRF_SUCCESS);
+
+    // A slot shorter than a response and its acknowledgment
+    s = m_app_schedule;
+    s.slot_period_us = app_tdma_slot_airtime_us(&s) - 1;
+    CHECK(app_tdma_schedule_check(&s) == NRF_ERROR_INVALID_PARAM);
+    s.slot_period_us++;
+    CHECK(app_tdma_schedule_check(&s) == NRF_SUCCESS);
+
+    // The slots exactly fill the frame up to the guard time
+    s = m_app_schedule;
+    s.frame_period_us = app_tdma_frame_busy_us(&s) + s.beacon_guard_us;
+    CHECK(app_tdma_schedule_check(&s) == NRF_SUCCESS);
+    s.frame_period_us--;
+    CHECK(app_tdma_schedule_check(&s) == NRF_ERROR_INVALID_PARAM);
+
+    // The scan period must fit the 16-bit hop timer
+    s = m_app_schedule;
+    s.scan_frames = UINT16_MAX / s.frame_period_us + 1;
+    CHECK(app_tdma_schedule_check(&s) == NRF_ERROR_INVALID_PARAM);
+
+    // The 300 Hz stretch goal leaves room for four slots
+    s = m_app_schedule;
+    s.frame_period_us = 1000000 / 300;
+    CHECK(app_tdma_schedule_check(&s) == NRF_ERROR_INVALID_PARAM);
+    s.slot_count = 4;
+    CHECK(app_tdma_schedule_check(&s) == NRF_SUCCESS);
+}
+
+
+static void test_master(void)
+{
+    CHECK(app_tdma_init(&m_app_schedule) == NRF_SUCCESS);
+
+    m_esb.hop_starts = 0;
+    CHECK(app_tdma_master_start(m_channels, m_link.chlist_size) == NRF_SUCCESS);
+    CHECK(m_esb.hop_starts == 1);
+    CHECK(m_esb.hop_period_us == m_app_schedule.frame_period_us);
+    CHECK(m_esb.hop_count == m_link.chlist_size);
+
+    // The first frame opens a cycle, also when the cycle does not divide the channel list
+    for (uint8_t frame = 0; frame < 2 * MAXIMUM_CHANNEL_LIST_SIZE; frame++)
+    {
+        CHECK(app_tdma_master_on_hop() == frame % m_app_schedule.subframes);
+    }
+
+    // A new cycle length starts with the current frame, without touching the hop sequencer
+    m_esb.hop_starts = 0;
+    m_esb.hop_syncs  = 0;
+    CHECK(app_tdma_subframes_set(0) == NRF_ERROR_INVALID_PARAM);
+    CHECK(app_tdma_subframes_set(3) == NRF_SUCCESS);
+    CHECK(app_tdma_master_on_hop() == 1);
+    CHECK(app_tdma_master_on_hop() == 2);
+    CHECK(app_tdma_master_on_hop() == 0);
+    CHECK(app_tdma_subframes_set(1) == NRF_SUCCESS);
+    CHECK(app_tdma_master_on_hop() == 0);
+    CHECK(m_esb.hop_starts == 0 && m_esb.hop_syncs == 0);
+}
+
+
+static void test_device(void)
+{
+    uint16_t scan_period_us = m_app_schedule.frame_period_us * m_app_schedule.scan_frames;
+
+    CHECK(app_tdma_init(&m_app_schedule) == NRF_SUCCESS);
+    memset(&m_esb, 0, sizeof(m_esb));
+
+    // Scanning holds each channel, starting with the first one right away
+    CHECK(app_tdma_scan_start(m_channels, m_link.chlist_size) == NRF_SUCCESS);
+    CHECK(m_esb.hop_period_us == scan_period_us);
+    CHECK(m_esb.hop_syncs == 1 && m_esb.sync_index == 0 && m_esb.sync_ticks == scan_period_us);
+    CHECK(!app_tdma_is_synced());
+    CHECK(!app_tdma_on_hop());
+
+    // The first beacon switches to the frame period, and the next hop comes the guard time early
+    CHECK(app_tdma_beacon_received(1) == NRF_SUCCESS);
+    CHECK(m_esb.hop_starts == 2);
+    CHECK(m_esb.hop_period_us == m_app_schedule.frame_period_us);
+    CHECK(m_esb.sync_index == 1);
+    CHECK(m_esb.sync_ticks == m_app_schedule.frame_period_us - m_app_schedule.beacon_guard_us);
+    CHECK(m_esb.deadline_ticks == m_app_schedule.beacon_guard_us + APP_TDMA_BEACON_WINDOW_US);
+    CHECK(app_tdma_is_synced());
+
+    // Later beacons only realign
+    CHECK(app_tdma_beacon_received(2) == NRF_SUCCESS);
+    CHECK(m_esb.hop_starts == 2 && m_esb.hop_syncs == 3 && m_esb.sync_index == 2);
+
+    // Device N answers in slot N-1
+    m_esb.tx_at_result = NRF_SUCCESS;
+    for (uint8_t slot = 0; slot < m_app_schedule.slot_count; slot++)
+    {
+        CHECK(app_tdma_respond(slot) == NRF_SUCCESS);
+        CHECK(m_esb.tx_at_ticks == m_app_schedule.slot_offset_us + slot * m_app_schedule.slot_period_us);
+    }
+    CHECK(m_esb.tx_starts == 0);
+
+    // A slot that has passed is not sent at all, as it would run into the next one
+    m_esb.tx_at_result = NRF_ERROR_TIMEOUT;
+    CHECK(app_tdma_respond(0) == NRF_ERROR_TIMEOUT);
+    CHECK(m_esb.tx_starts == 0);
+
+    // After a sleep, the slots are timed to the next hop, which the beacon aligned. Here the
+    // beacon ended 100 us ago.
+    m_esb.hop_time_left = m_app_schedule.frame_period_us - m_app_schedule.beacon_guard_us - 100;
+    for (uint8_t slot = 0; slot < m_app_schedule.slot_count; slot++)
+    {
+        uint32_t time_us;
+
+        CHECK(app_tdma_slot_time_left(slot, &time_us) == NRF_SUCCESS);
+        CHECK(time_us == (app_tdma_slot_offset_us(slot) > 100 ? app_tdma_slot_offset_us(slot) - 100 : 0));
+
+        CHECK(app_tdma_respond_before_hop(slot) == NRF_SUCCESS);
+        CHECK(m_esb.tx_before_hop_ticks + app_tdma_slot_offset_us(slot) ==
+              m_app_schedule.frame_period_us - m_app_schedule.beacon_guard_us);
+    }
+    {
+        uint32_t time_us;
+
+        CHECK(app_tdma_slot_time_left(0, NULL) == NRF_ERROR_NULL);
+        m_esb.hop_time_left_result = NRF_ERROR_INVALID_STATE;
+        CHECK(app_tdma_slot_time_left(0, &time_us) == NRF_ERROR_INVALID_STATE);
+        m_esb.hop_time_left_result = NRF_SUCCESS;
+    }
+
+    // Without missed beacons there is nothing to predict
+    CHECK(app_tdma_beacons_missed() == 0);
+    CHECK(app_tdma_respond_predicted(0) == NRF_ERROR_INVALID_STATE);
+
+    // Missing beacons end the sync after the timeout, and the device scans again. Until then, it
+    // answers in its slot, timed from the hop, for the first missed beacons.
+    for (uint8_t frame = 1; frame < m_app_schedule.sync_timeout_frames; frame++)
+    {
+        uint8_t slot = frame % m_app_schedule.slot_count;
+
+        CHECK(!app_tdma_on_hop());
+        CHECK(app_tdma_is_synced());
+        CHECK(app_tdma_beacons_missed() == frame);
+
+        m_esb.tx_at_hop_ticks = 0;
+        if (frame <= m_app_schedule.flywheel_frames)
+        {
+            CHECK(app_tdma_respond_predicted(slot) == NRF_SUCCESS);
+            CHECK(m_esb.tx_at_hop_ticks == m_app_schedule.beacon_guard_us + app_tdma_slot_offset_us(slot));
+        }
+        else
+        {
+            CHECK(app_tdma_respond_predicted(slot) == NRF_ERROR_INVALID_STATE);
+            CHECK(m_esb.tx_at_hop_ticks == 0);
+        }
+    }
+    CHECK(app_tdma_on_hop());
+    CHECK(!app_tdma_is_synced());
+    CHECK(app_tdma_beacons_missed() == 0);
+
+    // The device coasts on the hop sequence of the box, listening through every frame
+    CHECK(app_tdma_is_coasting());
+    CHECK(m_esb.hop_starts == 2 && m_esb.deadline_ticks == 0);
+
+    // A beacon while coasting brings the sync back at once
+    CHECK(app_tdma_beacon_received(3) == NRF_SUCCESS);
+    CHECK(app_tdma_is_synced() && !app_tdma_is_coasting());
+    CHECK(m_esb.hop_starts == 3 && m_esb.hop_period_us == m_app_schedule.frame_period_us);
+    CHECK(m_esb.sync_index == 3);
+    CHECK(m_esb.deadline_ticks == m_app_schedule.beacon_guard_us + APP_TDMA_BEACON_WINDOW_US);
+
+    // Without one, the device scans after coasting
+    for (uint8_t frame = 0; frame < m_app_schedule.sync_timeout_frames; frame++)
+    {
+        (void)app_tdma_on_hop();
+    }
+    CHECK(!app_tdma_is_synced());
+    for (uint16_t frame = 1; frame < m_app_schedule.coast_frames; frame++)
+    {
+        CHECK(!app_tdma_on_hop());
+        CHECK(app_tdma_is_coasting());
+    }
+    CHECK(m_esb.hop_starts == 3);
+    CHECK(!app_tdma_on_hop());
+    CHECK(!app_tdma_is_coasting() && !app_tdma_is_synced());
+    CHECK(m_esb.hop_starts == 4 && m_esb.hop_period_us == scan_period_us);
+    CHECK(!app_tdma_on_hop());
+    CHECK(m_esb.hop_starts == 4);
+
+    // A schedule without coasting scans right away
+    {
+        app_tdma_schedule_t s = m_app_schedule;
+
+        s.coast_frames = 0;
+        CHECK(app_tdma_init(&s) == NRF_SUCCESS);
+        CHECK(app_tdma_scan_start(m_channels, m_link.chlist_size) == NRF_SUCCESS);
+        CHECK(app_tdma_beacon_received(0) == NRF_SUCCESS);
+        m_esb.hop_starts = 0;
+        for (uint8_t frame = 1; frame < s.sync_timeout_frames; frame++)
+        {
+            CHECK(!app_tdma_on_hop());
+        }
+        CHECK(app_tdma_on_hop());
+        CHECK(!app_tdma_is_coasting());
+        CHECK(m_esb.hop_starts == 1 && m_esb.hop_period_us == scan_period_us);
+    }
+}
+
+
+int main(void)
+{
+    for (uint32_t i = 0; i < sizeof(m_schemes) / sizeof(m_schemes[0]); i++)
+    {
+        app_tdma_schedule_t schedule = APP_TDMA_SCHEDULE(m_schemes[i]);
+
+        m_link         = m_schemes[i];
+        m_app_schedule = schedule;
+
+        test_airtime();
+        test_app_schedule();
+        test_report_divisors();
+        test_schedule_limits();
+        test_master();
+        test_device();
+
+        if (m_failures > 0)
+        {
+            fprintf(stderr, "tdma_test: scheme %u: %u checks failed\n", m_link.scheme, m_failures);
+            return EXIT_FAILURE;
+        }
+
+        printf("tdma_test: scheme %u schedule of %u us with %u slots on %u channels, %u us busy\n",
+               m_link.scheme, (unsigned)m_app_schedule.frame_period_us, m_app_schedule.slot_count,
+               m_link.chlist_size, app_tdma_frame_busy_us(&m_app_schedule));
+    }
+
+    return EXIT_SUCCESS;
+}